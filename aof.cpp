@@ -0,0 +1,318 @@
+#include "aof.hpp"
+
+//c
+#include <errno.h>
+#include <fcntl.h> //open()
+#include <string.h> //strerror()
+#include <sys/stat.h> //fstat()
+#include <unistd.h> //write(), read(), fdatasync(), ftruncate()
+
+//c++
+#include <chrono>
+#include <cstring> //memcpy
+#include <iostream>
+
+//custom
+#include "clock.hpp"
+#include "io_shared_library.hpp" //HEADER_SIZE
+#include "protocol.hpp" //RequestParser, encode_request()
+#include "snapshot.hpp" //SNAPSHOT_MAGIC
+
+static AppendOnlyError io_error(const std::string &what) {
+	return AppendOnlyError(what + ": " + strerror(errno));
+}
+
+//writes all of data, returns the number of bytes written before an error
+static size_t write_all(int fd, const char *data, size_t len) {
+	size_t done = 0;
+	while (done < len) {
+		ssize_t rv = ::write(fd, data + done, len - done);
+		if (rv < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		done += rv;
+	}
+
+	return done;
+}
+
+AppendOnlyFile::AppendOnlyFile(bool enabled, const std::string &path, FsyncPolicy policy)
+			: enabled(enabled), path(path), policy(policy) {
+	if (!enabled)
+		return;
+
+	fd = open(path.c_str(), O_RDWR | O_APPEND | O_CREAT, 0644);
+	if (fd < 0)
+		throw io_error("open(" + path + ")");
+
+	if (policy == FSYNC_EVERYSEC)
+		syncer = std::thread(&AppendOnlyFile::_sync_loop, this);
+}
+
+AppendOnlyFile::~AppendOnlyFile() {
+	if (!enabled)
+		return;
+
+	if (syncer.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			stop = true;
+		}
+
+		cv.notify_one();
+		syncer.join();
+	}
+
+	_write();
+	if (policy != FSYNC_NO)
+		fdatasync(fd);
+
+	close(fd);
+}
+
+void AppendOnlyFile::_sync_loop() {
+	std::unique_lock<std::mutex> lock(mtx);
+	while (true) {
+		cv.wait_for(lock, std::chrono::milliseconds(AOF_FSYNC_PERIOD_MS), [this] { return stop; });
+		if (stop)
+			return; //the destructor syncs the rest
+
+		if (!unsynced.exchange(false))
+			continue;
+
+		//the loop keeps appending while the file is synced,
+		//a duplicate stays valid even if a rewrite replaces the log meanwhile
+		int sync_fd = dup(fd);
+		if (sync_fd < 0)
+			continue;
+
+		syncing = true;
+		lock.unlock();
+		fdatasync(sync_fd);
+		close(sync_fd);
+		stats.fsyncs.fetch_add(1, std::memory_order_relaxed);
+		syncing = false;
+		lock.lock();
+	}
+}
+
+void AppendOnlyFile::_write() {
+	size_t done = write_all(fd, buf.data(), buf.size());
+	if (done < buf.size()) {
+		//e.g. the disk is full, the rest is retried in the next iteration
+		if (stats.last_write_ok)
+			perror("append only file write()");
+		stats.last_write_ok = false;
+	}
+
+	buf.erase(0, done);
+	stats.current_size += done;
+	if (buf.empty())
+		stats.last_write_ok = true;
+}
+
+bool AppendOnlyFile::is_enabled() const {
+	return enabled;
+}
+
+size_t AppendOnlyFile::load(const std::function<void(const std::vector<std::string> &)> &apply,
+							const std::function<size_t(int, size_t)> &load_preamble) {
+	if (!enabled)
+		return 0;
+
+	int64_t start = Clock::precise_us();
+	loading = true;
+
+	RequestParser parser;
+	std::vector<uint8_t> data; //the unparsed tail of what was read
+	std::vector<uint8_t> chunk(AOF_READ_CHUNK);
+	size_t valid = 0; //file offset after the last complete command
+	size_t commands = 0;
+
+	int rfd = open(path.c_str(), O_RDONLY);
+	if (rfd < 0)
+		throw io_error("open(" + path + ")");
+
+	try {
+		struct stat st;
+		if (fstat(rfd, &st) != 0)
+			throw io_error("fstat(" + path + ")");
+
+		//a rewritten log starts with a snapshot of the keyspace
+		char magic[sizeof(SNAPSHOT_MAGIC)];
+		if (pread(rfd, magic, sizeof(magic), 0) == sizeof(magic) 
+						&& memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) == 0) {
+			valid = load_preamble(rfd, st.st_size);
+			if (lseek(rfd, valid, SEEK_SET) < 0)
+				throw io_error("lseek(" + path + ")");
+		}
+
+		while (true) {
+			ssize_t rv = read(rfd, chunk.data(), chunk.size());
+			if (rv < 0) {
+				if (errno == EINTR)
+					continue;
+				throw io_error("read(" + path + ")");
+			}
+
+			if (rv == 0)
+				break;
+
+			data.insert(data.end(), chunk.begin(), chunk.begin() + rv);
+
+			size_t pos = 0;
+			while (data.size() - pos >= HEADER_SIZE) {
+				uint32_t len = 0;
+				memcpy(&len, data.data() + pos, HEADER_SIZE);
+				if (data.size() - pos - HEADER_SIZE < len)
+					break; //the rest is in the next chunk
+
+				std::vector<uint8_t> payload(data.begin() + pos + HEADER_SIZE,
+							data.begin() + pos + HEADER_SIZE + len);
+				auto result = parser.parse(payload, len);
+				if (!result.success)
+					throw AppendOnlyError("bad command at offset " + std::to_string(valid)
+								+ " of " + path + ": " + result.error_msg);
+
+				apply(result.cmd);
+				commands++;
+				pos += HEADER_SIZE + len;
+				valid += HEADER_SIZE + len;
+			}
+
+			data.erase(data.begin(), data.begin() + pos);
+		}
+	}
+	catch (...) {
+		close(rfd);
+		loading = false;
+		throw;
+	}
+
+	close(rfd);
+	loading = false;
+
+	if (!data.empty()) {
+		std::cout << "append only file ends with an incomplete command, "
+			<< data.size() << " bytes are truncated\n";
+		if (ftruncate(fd, valid) != 0)
+			throw io_error("ftruncate(" + path + ")");
+	}
+
+	stats.current_size = valid;
+	stats.base_size = valid;
+	std::cout << "replayed " << commands << " commands from " << path << " in "
+		<< (Clock::precise_us() - start) / 1000 << " ms\n";
+
+	return commands;
+}
+
+void AppendOnlyFile::feed(const std::vector<std::string> &cmd) {
+	if (!enabled || loading)
+		return;
+
+	size_t start = buf.size();
+	encode_request(cmd, buf);
+
+	//the child's snapshot doesn't have it
+	if (rewriting)
+		rewrite_buf.append(buf, start, std::string::npos);
+}
+
+void AppendOnlyFile::flush() {
+	if (!enabled || buf.empty())
+		return;
+
+	if (policy == FSYNC_EVERYSEC && syncing) {
+		//wait for the fsync instead of blocking the loop in write()
+		int64_t now = Clock::now_ms();
+		if (postponed_since < 0)
+			postponed_since = now;
+
+		if (now - postponed_since < AOF_MAX_POSTPONE_MS)
+			return;
+
+		stats.delayed_writes++; //the disk is too slow, the write may block
+	}
+
+	postponed_since = -1;
+	_write();
+
+	if (policy == FSYNC_ALWAYS) {
+		fdatasync(fd);
+		stats.fsyncs.fetch_add(1, std::memory_order_relaxed);
+	}
+	else if (policy == FSYNC_EVERYSEC)
+		unsynced = true;
+}
+
+int AppendOnlyFile::get_next_timeout() const {
+	return buf.empty() ? -1 : AOF_RETRY_MS;
+}
+
+std::string AppendOnlyFile::rewrite_path(pid_t child) const {
+	return path + ".rewrite-" + std::to_string(child);
+}
+
+void AppendOnlyFile::start_rewrite() {
+	rewriting = true;
+	rewrite_buf.clear();
+}
+
+void AppendOnlyFile::finish_rewrite(pid_t child) {
+	std::string new_path = rewrite_path(child);
+	int new_fd = open(new_path.c_str(), O_RDWR | O_APPEND);
+	if (new_fd < 0) {
+		AppendOnlyError err = io_error("open(" + new_path + ")");
+		cancel_rewrite(child);
+		throw err;
+	}
+
+	//the new file must be complete on the disk before it replaces the log
+	struct stat st;
+	bool ok = write_all(new_fd, rewrite_buf.data(), rewrite_buf.size()) == rewrite_buf.size()
+					&& fdatasync(new_fd) == 0 && fstat(new_fd, &st) == 0
+					&& rename(new_path.c_str(), path.c_str()) == 0;
+	if (!ok) {
+		AppendOnlyError err = io_error("rewrite of " + path);
+		close(new_fd);
+		cancel_rewrite(child);
+		throw err;
+	}
+
+	int old_fd = new_fd;
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		std::swap(fd, old_fd);
+	}
+	close(old_fd);
+
+	//the pending writes are in the rewrite buffer too
+	buf.clear();
+	postponed_since = -1;
+	rewriting = false;
+	rewrite_buf.clear();
+	rewrite_buf.shrink_to_fit();
+
+	stats.current_size = st.st_size;
+	stats.base_size = st.st_size;
+	stats.rewrites++;
+}
+
+void AppendOnlyFile::cancel_rewrite(pid_t child) {
+	unlink(rewrite_path(child).c_str());
+	rewriting = false;
+	rewrite_buf.clear();
+	rewrite_buf.shrink_to_fit();
+}
+
+bool AppendOnlyFile::rewrite_in_progress() const {
+	return rewriting;
+}
+
+const AOFStats &AppendOnlyFile::get_stats() const {
+	return stats;
+}
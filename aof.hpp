@@ -0,0 +1,134 @@
+#ifndef __AOF_HPP__
+#define __AOF_HPP__
+
+/* =====================================================================
+ * AppendOnlyFile logs every write command, so the keyspace is rebuilt
+ * on restart by replaying the log, losing at most the writes which
+ * haven't reached the disk yet(see FsyncPolicy).
+ *
+ * Group commit: commands are appended to a buffer while the event loop
+ * processes an iteration, and the whole buffer goes to the file with
+ * a single write() right before the loop waits again. The replies of
+ * the iteration are sent only after that write, so with FSYNC_ALWAYS
+ * a client never gets a reply to a write which isn't on the disk.
+ *
+ * Commands are logged in the request format of the protocol
+ * (length | nstr | len1 | str1 | ...), and relative ttls are logged
+ * as absolute unix deadlines(set ... pxat, pexpireat), so a replay
+ * at any later time gives the same keyspace.
+ *
+ * Rewrite: the log of a long history is replaced by a minimal one.
+ * A forked child writes the keyspace as a snapshot to a new file
+ * (the preamble), while the commands fed meanwhile are kept
+ * in a rewrite buffer. Once the child is done, the buffer is appended
+ * to the new file, which atomically replaces the log(rename), so replaying
+ * it takes the time of loading the dataset, not of its write history.
+ * =====================================================================*/
+
+//c
+#include <sys/types.h> //pid_t
+
+//c++
+#include <atomic>
+#include <condition_variable>
+#include <cstddef> //size_t
+#include <cstdint> //int64_t
+#include <functional> //std::function
+#include <mutex>
+#include <stdexcept> //runtime_error
+#include <string>
+#include <thread>
+#include <vector>
+
+//how often the log is flushed to the disk
+enum FsyncPolicy {
+	FSYNC_ALWAYS, //after every write(), the slowest and the safest
+	FSYNC_EVERYSEC, //once a second on a background thread, up to ~2s of writes may be lost
+	FSYNC_NO, //whenever the kernel decides
+};
+
+constexpr int64_t AOF_FSYNC_PERIOD_MS = 1000;
+//a write waits at most this long for the background fsync to finish,
+//since a write() to a file being synced blocks on most file systems
+constexpr int64_t AOF_MAX_POSTPONE_MS = 2000;
+constexpr int AOF_RETRY_MS = 10; //how soon a postponed or failed write is retried
+constexpr size_t AOF_READ_CHUNK = 64 * 1024;
+
+//an I/O error or a malformed log
+class AppendOnlyError : public std::runtime_error {
+public:
+	AppendOnlyError(const std::string &msg) : std::runtime_error(msg) {}
+};
+
+struct AOFStats {
+	size_t current_size = 0; //bytes of the log
+	bool last_write_ok = true;
+	size_t delayed_writes = 0; //written while the background fsync was still running
+	std::atomic<size_t> fsyncs{0};
+	size_t base_size = 0; //the size after the last rewrite or on startup
+	size_t rewrites = 0;
+};
+
+class AppendOnlyFile {
+private:
+	bool enabled;
+	std::string path;
+	FsyncPolicy policy;
+	int fd = -1;
+	std::string buf; //commands of the current event loop iteration
+	bool loading = false; //replayed commands aren't logged again
+	int64_t postponed_since = -1; //monotonic ms, when the pending write had to wait
+	bool rewriting = false;
+	std::string rewrite_buf; //commands fed since the rewrite started
+	AOFStats stats;
+
+	//the background fsync of FSYNC_EVERYSEC
+	std::mutex mtx; //guards stop and fd, which is replaced by a rewrite
+	std::condition_variable cv;
+	bool stop = false;
+	std::atomic<bool> unsynced{false}; //written since the last fsync
+	std::atomic<bool> syncing{false};
+	std::thread syncer;
+
+	void _sync_loop();
+	//writes the buffer, the part which failed to be written is kept
+	void _write();
+
+public:
+	//opens the log for appending if it's enabled, throws AppendOnlyError
+	AppendOnlyFile(bool enabled, const std::string &path, FsyncPolicy policy);
+	//writes and syncs the rest of the buffer
+	~AppendOnlyFile();
+	AppendOnlyFile(const AppendOnlyFile &) = delete;
+	AppendOnlyFile &operator=(const AppendOnlyFile &) = delete;
+
+	bool is_enabled() const;
+	/* passes every logged command to apply, in order. A snapshot preamble
+	 * is passed to load_preamble(fd, size) first, which returns its size.
+	 * An incomplete command at the end(a crash in the middle of a write)
+	 * is cut off the file, returns the number of commands, throws AppendOnlyError */
+	size_t load(const std::function<void(const std::vector<std::string> &)> &apply,
+				const std::function<size_t(int, size_t)> &load_preamble);
+	//appends the command to the buffer of the current iteration
+	void feed(const std::vector<std::string> &cmd);
+	//writes the buffer with a single write(), once per event loop iteration
+	void flush();
+	//returns ms till flush() has to be retried, -1 if nothing is pending
+	int get_next_timeout() const;
+
+	//the file the child of the rewrite writes to
+	std::string rewrite_path(pid_t child) const;
+	//starts keeping the fed commands for the rewritten log, right after the fork
+	void start_rewrite();
+	/* appends the commands fed since start_rewrite() to the file written
+	 * by the child and replaces the log with it. Throws AppendOnlyError,
+	 * the current log is kept then */
+	void finish_rewrite(pid_t child);
+	//drops the rewrite buffer and the child's file
+	void cancel_rewrite(pid_t child);
+	bool rewrite_in_progress() const;
+
+	const AOFStats &get_stats() const;
+};
+
+#endif
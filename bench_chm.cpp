@@ -0,0 +1,145 @@
+/* =====================================================================
+ * Scaling benchmark of ConcurrentHashMap vs one global mutex around
+ * HashMap: 4M operations over 200k keys(half of them preloaded) are
+ * split between 1..32 threads, with 90/10 and 50/50 read/write mixes,
+ * a write is an insert or an erase with equal chances.
+ * usage: ./bench_chm [<threads> ...], 1 2 4 8 16 32 by default
+ * =====================================================================*/
+
+//c++
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib> //strtoul
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//custom
+#include "concurrent_hashmap.hpp"
+#include "hashmap.hpp"
+
+//every member is compiled, not only the ones the benchmark calls
+template class ConcurrentHashMap<std::string, std::string>;
+
+constexpr size_t BENCH_KEYS = 200000;
+constexpr size_t BENCH_OPS = 4000000;
+constexpr size_t BENCH_BUCKETS = 1024;
+
+//the baseline: the whole map behind one lock
+class GlobalLockMap {
+private:
+	std::mutex mtx;
+	HashMap<std::string, std::string> map;
+
+public:
+	GlobalLockMap() : map(BENCH_BUCKETS) {}
+
+	bool search(const std::string &key, std::string &val) {
+		std::lock_guard<std::mutex> lock(mtx);
+		auto it = map.search(key);
+		if (it == map.end())
+			return false;
+
+		val = it.second();
+		return true;
+	}
+
+	void insert(const std::string &key, const std::string &val) {
+		std::lock_guard<std::mutex> lock(mtx);
+		map.insert(key, val);
+	}
+
+	void erase(const std::string &key) {
+		std::lock_guard<std::mutex> lock(mtx);
+		map.erase(key);
+	}
+};
+
+class StripedMap {
+private:
+	ConcurrentHashMap<std::string, std::string> map;
+
+public:
+	StripedMap() : map(BENCH_BUCKETS) {}
+
+	bool search(const std::string &key, std::string &val) {
+		return map.search(key, val);
+	}
+
+	void insert(const std::string &key, const std::string &val) {
+		map.insert(key, val);
+	}
+
+	void erase(const std::string &key) {
+		map.erase(key);
+	}
+};
+
+//returns millions of operations per second
+template <typename Map>
+static double run(size_t threads, int read_pct) {
+	Map map;
+	std::vector<std::string> keys;
+	keys.reserve(BENCH_KEYS);
+	for (size_t i = 0; i < BENCH_KEYS; i++)
+		keys.push_back("key:" + std::to_string(i));
+
+	for (size_t i = 0; i < BENCH_KEYS; i += 2)
+		map.insert(keys[i], "value");
+
+	std::atomic<size_t> hits(0); //so the searches aren't optimized away
+	auto start = std::chrono::steady_clock::now();
+	std::vector<std::thread> workers;
+	for (size_t t = 0; t < threads; t++) {
+		workers.emplace_back([&, t] {
+			uint64_t x = 88172645463325252ull + t * 7919; //xorshift
+			std::string val;
+			size_t found = 0;
+			for (size_t i = 0; i < BENCH_OPS / threads; i++) {
+				x ^= x << 13;
+				x ^= x >> 7;
+				x ^= x << 17;
+				const std::string &key = keys[x % BENCH_KEYS];
+				if (int((x >> 32) % 100) < read_pct)
+					found += map.search(key, val);
+				else if ((x >> 40) & 1)
+					map.insert(key, "value");
+				else
+					map.erase(key);
+			}
+
+			hits += found;
+		});
+	}
+
+	for (std::thread &worker : workers)
+		worker.join();
+
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	return BENCH_OPS / elapsed.count() / 1e6;
+}
+
+int main(int argc, char **argv) {
+	std::vector<size_t> threads;
+	for (int i = 1; i < argc; i++)
+		threads.push_back(strtoul(argv[i], nullptr, 10));
+
+	if (threads.empty())
+		threads = {1, 2, 4, 8, 16, 32};
+
+	printf("hardware threads: %u\n", std::thread::hardware_concurrency());
+	for (int read_pct : {90, 50}) {
+		for (size_t n : threads) {
+			if (n == 0)
+				continue;
+
+			printf("%d/%d threads %2zu: global mutex %5.2f Mops/s, striped %5.2f Mops/s\n",
+					read_pct, 100 - read_pct, n, run<GlobalLockMap>(n, read_pct),
+					run<StripedMap>(n, read_pct));
+		}
+	}
+
+	return 0;
+}
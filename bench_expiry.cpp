@@ -0,0 +1,101 @@
+/* =====================================================================
+ * Benchmark of the expiry indexes, TTLHeap vs TimingWheel, on a clock
+ * of simulated milliseconds:
+ *   - expire: every key gets a ttl of 1s..1h
+ *   - mixed: 60% expire(reschedule) and 30% persist(cancel) of random keys,
+ *     the clock ticks 1 ms every 10 operations and the due keys are popped
+ *   - drain: the clock runs in 100 ms steps until every key has expired
+ * usage: ./bench_expiry [<keys>], 10M keys by default
+ * =====================================================================*/
+
+//c++
+#include <chrono>
+#include <cstdio>
+#include <cstdlib> //strtoul
+#include <random> //mt19937
+#include <vector>
+
+//custom
+#include "custom_heap.hpp"
+#include "timing_wheel.hpp"
+
+constexpr int64_t MIN_TTL_MS = 1000;
+constexpr int64_t MAX_TTL_MS = 3600 * 1000;
+constexpr size_t OPS_PER_TICK = 10; //mixed operations per simulated ms
+constexpr int64_t DRAIN_STEP_MS = 100;
+
+typedef std::chrono::steady_clock Clock;
+
+//nanoseconds per operation since start
+static double ns_per_op(Clock::time_point start, size_t ops) {
+	auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+
+	return ops ? double(ns) / ops : 0;
+}
+
+//pops everything due by now, returns the number of the popped entries
+static size_t expire_due(ExpiryIndex &index, int64_t now) {
+	size_t popped = 0;
+	while (index.pop_expired(now))
+		popped++;
+
+	return popped;
+}
+
+static void bench(const char *name, ExpiryIndex &index, size_t keys) {
+	std::mt19937_64 rng(keys);
+	std::uniform_int_distribution<int64_t> ttl(MIN_TTL_MS, MAX_TTL_MS);
+	std::uniform_int_distribution<size_t> key(0, keys - 1);
+	std::uniform_int_distribution<int> op(0, 9);
+	std::vector<ExpiryEntry> entries(keys); //as if embedded into the keyspace nodes
+	int64_t now = 0;
+
+	auto start = Clock::now();
+	for (ExpiryEntry &entry : entries)
+		index.schedule(&entry, now + ttl(rng));
+	double expire = ns_per_op(start, keys);
+
+	size_t expired = 0;
+	start = Clock::now();
+	for (size_t i = 0; i < keys; i++) {
+		int kind = op(rng);
+		ExpiryEntry *entry = &entries[key(rng)];
+		if (kind < 6)
+			index.schedule(entry, now + ttl(rng));
+		else if (kind < 9)
+			index.cancel(entry);
+
+		if ((i + 1) % OPS_PER_TICK == 0)
+			expired += expire_due(index, ++now);
+	}
+	double mixed = ns_per_op(start, keys);
+
+	size_t left = index.size();
+	start = Clock::now();
+	while (!index.empty()) {
+		now += DRAIN_STEP_MS;
+		expire_due(index, now);
+	}
+	double drain = ns_per_op(start, left);
+
+	printf("%-11s %10zu keys  expire %6.0f ns  mixed %6.0f ns (%zu expired)  drain %6.0f ns/key\n",
+					name, keys, expire, mixed, expired, drain);
+}
+
+int main(int argc, char **argv) {
+	size_t keys = argc > 1 ? strtoul(argv[1], nullptr, 10) : 10000000;
+	if (keys == 0)
+		return 1;
+
+	{
+		TTLHeap heap;
+		bench("ttl-heap", heap, keys);
+	}
+
+	{
+		TimingWheel wheel(0);
+		bench("timing-wheel", wheel, keys);
+	}
+
+	return 0;
+}
@@ -0,0 +1,117 @@
+/* =====================================================================
+ * Benchmark of the keyspace map on the write path of the event loop:
+ *   - set: N new keys
+ *   - overwrite: a new value for every key
+ *   - get: a lookup of every key
+ *   - del: every key erased
+ * for a HashMap without concurrent reads, for KeyMap as it runs by default
+ * (no read threads) and for KeyMap once the read threads are enabled
+ * (boxed overwrites, release stores, retired nodes), the best of 3 runs.
+ * usage: ./bench_keymap [<keys>], 1M keys by default
+ * =====================================================================*/
+
+//c++
+#include <algorithm> //min
+#include <chrono>
+#include <cstdio>
+#include <cstdlib> //strtoul
+#include <string>
+#include <vector>
+
+//custom
+#include "epoch.hpp"
+#include "keyspace.hpp"
+
+constexpr size_t COLLECT_EVERY = 1024; //writes between the event loop's collects
+constexpr size_t ROUNDS = 3;
+
+typedef std::chrono::steady_clock BenchClock;
+typedef HashMap<std::string, KeyValue, KeyMeta> PlainKeyMap;
+
+//nanoseconds per operation since start
+static double ns_per_op(BenchClock::time_point start, size_t ops) {
+	auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(BenchClock::now() - start).count();
+
+	return double(ns) / ops;
+}
+
+//frees what the writes have retired, as the cron of the event loop does
+static void collect(size_t i) {
+	if (i % COLLECT_EVERY == 0)
+		Epoch::collect();
+}
+
+struct Timings {
+	double set, overwrite, get, del;
+};
+
+template <typename Map>
+static Timings run(const std::vector<std::string> &keys, size_t &checksum) {
+	Map map(hmap_base_capacity);
+	Timings t;
+
+	auto start = BenchClock::now();
+	for (size_t i = 0; i < keys.size(); i++) {
+		map.insert(keys[i], KeyValue("value"));
+		collect(i);
+	}
+	t.set = ns_per_op(start, keys.size());
+
+	start = BenchClock::now();
+	for (size_t i = 0; i < keys.size(); i++) {
+		map.insert(keys[i], KeyValue("new value"));
+		collect(i);
+	}
+	t.overwrite = ns_per_op(start, keys.size());
+
+	start = BenchClock::now();
+	for (const std::string &key : keys)
+		checksum += map.search(key).second().str.size();
+	t.get = ns_per_op(start, keys.size());
+
+	start = BenchClock::now();
+	for (size_t i = 0; i < keys.size(); i++) {
+		checksum += map.erase(keys[i]) != nullptr;
+		collect(i);
+	}
+	t.del = ns_per_op(start, keys.size());
+	Epoch::collect();
+
+	return t;
+}
+
+//prints the best of ROUNDS runs, so the first touch of the memory doesn't count
+template <typename Map>
+static void bench(const char *name, const std::vector<std::string> &keys) {
+	size_t checksum = 0; //so the lookups aren't optimized away
+	Timings best = run<Map>(keys, checksum);
+	for (size_t i = 1; i < ROUNDS; i++) {
+		Timings t = run<Map>(keys, checksum);
+		best.set = std::min(best.set, t.set);
+		best.overwrite = std::min(best.overwrite, t.overwrite);
+		best.get = std::min(best.get, t.get);
+		best.del = std::min(best.del, t.del);
+	}
+
+	printf("%-16s %8zu keys  set %5.0f ns  overwrite %5.0f ns  get %5.0f ns  del %5.0f ns  (%zu)\n",
+					name, keys.size(), best.set, best.overwrite, best.get, best.del, checksum);
+}
+
+int main(int argc, char **argv) {
+	size_t n = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1000000;
+	if (n == 0)
+		return 1;
+
+	std::vector<std::string> keys;
+	keys.reserve(n);
+	for (size_t i = 0; i < n; i++)
+		keys.push_back("key:" + std::to_string(i));
+
+	bench<PlainKeyMap>("plain hashmap", keys);
+	bench<KeyMap>("keymap", keys);
+	//there's no way back, so the concurrent mode goes last
+	Epoch::enable();
+	bench<KeyMap>("keymap, readers", keys);
+
+	return 0;
+}
@@ -0,0 +1,408 @@
+/* =====================================================================
+ * Benchmark of the sorted set backends, SkipList vs BPTree:
+ *   - zadd: N names with random scores added one by one
+ *   - zrange: a range of 100 names from a random score
+ *   - zrank: the rank of a random existing name
+ *   - zadd bulk: all the N names in one zadd(insert_many) into an empty set
+ * and, with "cutover", a zadd of B names into a set of S names done by
+ * insert_many against B single inserts, which is how insert_many
+ * picks between them.
+ * With "check" it runs the regression checks of the sorted set on both
+ * backends instead(make check), the exit code is 1 if any of them fails
+ * usage: ./bench_sset [<set size> ...], 1M and 10M names by default
+ *        ./bench_sset cutover
+ *        ./bench_sset check
+ * =====================================================================*/
+
+//c++
+#include <algorithm> //min, max, sort
+#include <chrono>
+#include <cmath> //INFINITY, isnan, fabs
+#include <cstdio>
+#include <cstdlib> //malloc, free, strtoul
+#include <map>
+#include <new> //bad_alloc
+#include <stdexcept> //invalid_argument
+#include <random> //mt19937
+#include <string>
+#include <vector>
+
+//custom
+#include "sortedset.hpp"
+
+constexpr size_t RANGE_COUNT = 100; //names per zrange
+constexpr size_t QUERIES = 1000000; //zrange/zrank calls per backend and size
+constexpr double MAX_SCORE = 1e9;
+constexpr size_t CUTOVER_NAMES = 1000000; //names per cutover case, sets included
+constexpr size_t CUTOVER_CHUNK_NAMES = 100000; //names of the sets alive at once
+constexpr size_t SENTINEL_ROUNDS = 1000;
+
+typedef std::chrono::steady_clock Clock;
+
+static size_t failed_checks = 0;
+static size_t live_allocations = 0; //by operator new, to tell a leak apart
+
+void *operator new(size_t size) {
+	void *ptr = malloc(size);
+	if (!ptr)
+		throw std::bad_alloc();
+
+	live_allocations++;
+	return ptr;
+}
+
+static void release(void *ptr) {
+	if (ptr)
+		live_allocations--;
+
+	free(ptr);
+}
+
+void operator delete(void *ptr) noexcept {
+	release(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+	release(ptr);
+}
+
+static const char *backend_name(SortBackend backend) {
+	return backend == BPTREE_BACKEND ? "bptree" : "skiplist";
+}
+
+//nanoseconds per operation since start
+static double ns_per_op(Clock::time_point start, size_t ops) {
+	auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+
+	return double(ns) / ops;
+}
+
+static void bench(SortBackend backend, size_t size) {
+	const char *name = backend_name(backend);
+	std::mt19937_64 rng(size);
+	std::uniform_real_distribution<double> score(0, MAX_SCORE);
+	std::uniform_int_distribution<size_t> member(0, size - 1);
+
+	std::vector<std::pair<std::string, double>> items;
+	items.reserve(size);
+	for (size_t i = 0; i < size; i++)
+		items.emplace_back("m" + std::to_string(i), score(rng));
+
+	SortSet zset(16, backend);
+	auto start = Clock::now();
+	for (const auto &item : items)
+		zset.insert(item.first, item.second);
+	double zadd = ns_per_op(start, size);
+
+	double zadd_bulk = 0;
+	{
+		SortSet bulk(16, backend);
+		start = Clock::now();
+		bulk.insert_many(items);
+		zadd_bulk = ns_per_op(start, size);
+	}
+
+	//the results are summed up so the calls aren't optimized away
+	size_t checksum = 0;
+	start = Clock::now();
+	for (size_t i = 0; i < QUERIES; i++)
+		checksum += zset.range(score(rng), RANGE_COUNT).size();
+	double zrange = ns_per_op(start, QUERIES);
+
+	std::vector<std::string> names;
+	names.reserve(QUERIES);
+	for (size_t i = 0; i < QUERIES; i++)
+		names.push_back("m" + std::to_string(member(rng)));
+
+	start = Clock::now();
+	for (const std::string &name : names)
+		checksum += zset.rank(name);
+	double zrank = ns_per_op(start, QUERIES);
+
+	printf("%-8s %10zu  zadd %6.0f ns  zadd bulk %6.0f ns  zrange(100) %6.0f ns  zrank %6.0f ns  (%zu)\n",
+					name, size, zadd, zadd_bulk, zrange, zrank, checksum);
+}
+
+//ns per name of a zadd of batch names into a set of size names, insert_many or one by one
+static double zadd_batch(SortBackend backend, size_t size, size_t batch, bool bulk) {
+	std::mt19937_64 rng(size + batch);
+	std::uniform_real_distribution<double> score(0, MAX_SCORE);
+	//the batch is repeated on fresh sets, so a small one is measurable,
+	//the sets are made and timed a chunk at a time, so they fit into memory
+	size_t rounds = std::max<size_t>(1, CUTOVER_NAMES / (size + batch));
+	size_t chunk = std::max<size_t>(1, CUTOVER_CHUNK_NAMES / (size + batch));
+
+	double ns = 0;
+	for (size_t done = 0; done < rounds; done += chunk) {
+		size_t n = std::min(chunk, rounds - done);
+		std::vector<SortSet *> sets;
+		std::vector<std::vector<std::pair<std::string, double>>> batches(n);
+		for (size_t r = 0; r < n; r++) {
+			sets.push_back(new SortSet(16, backend));
+			for (size_t i = 0; i < size; i++)
+				sets.back()->insert("m" + std::to_string(i), score(rng));
+
+			for (size_t i = 0; i < batch; i++)
+				batches[r].emplace_back("n" + std::to_string(i), score(rng));
+		}
+
+		auto start = Clock::now();
+		for (size_t r = 0; r < n; r++) {
+			if (bulk)
+				sets[r]->insert_many(batches[r]);
+			else {
+				for (const auto &item : batches[r])
+					sets[r]->insert(item.first, item.second);
+			}
+		}
+		ns += ns_per_op(start, 1);
+
+		for (SortSet *set : sets)
+			delete set;
+	}
+
+	return ns / (rounds * batch);
+}
+
+static void cutover(SortBackend backend) {
+	const char *name = backend_name(backend);
+	for (size_t size : {0, 16, 256, 4096, 65536}) {
+		for (size_t batch : {1, 4, 16, 64, 256, 1024, 4096, 16384, 65536}) {
+			printf("%-8s set %6zu  batch %6zu  insert_many %6.0f ns  one by one %6.0f ns\n",
+					name, size, batch, zadd_batch(backend, size, batch, true),
+					zadd_batch(backend, size, batch, false));
+		}
+	}
+}
+
+//reports a failed check and goes on with the others
+static void fail(const char *backend, const char *what) {
+	failed_checks++;
+	printf("FAILED %-8s %s\n", backend, what);
+}
+
+static void check(bool ok, SortBackend backend, const char *what) {
+	if (!ok)
+		fail(backend_name(backend), what);
+}
+
+//a check of both backends at once
+static void check(bool ok, const char *what) {
+	if (!ok)
+		fail("", what);
+}
+
+//the names of the set ordered by (score, name)
+static std::vector<std::string> names_of(SortSet &zset) {
+	std::vector<std::string> names;
+	zset.for_each([&names](const std::string &name, double) { names.push_back(name); });
+
+	return names;
+}
+
+//pairs at the keys of the skiplist sentinels(-inf, +inf) and the empty name
+static void sentinels_round(SortBackend backend) {
+	SortSet zset(16, backend);
+	zset.insert("", -INFINITY);
+	zset.insert("m", 0);
+	zset.insert("y", INFINITY);
+	zset.insert("x", INFINITY);
+	check(zset.size() == 4, backend, "sentinels: size");
+	check(names_of(zset) == std::vector<std::string>({"", "m", "x", "y"}), backend, "sentinels: order");
+	check(zset.rank("") == 0 && zset.rank("x") == 2 && zset.rank("y") == 3, backend, "sentinels: rank");
+	check(zset.range(-INFINITY, 10).size() == 4, backend, "sentinels: range from -inf");
+	check(zset.range(INFINITY, 10) == std::vector<std::string>({"x", "y"}), backend, "sentinels: range from +inf");
+
+	zset.incrby("m", -INFINITY);
+	check(zset.search("m") == -INFINITY && zset.rank("m") == 1, backend, "sentinels: update to -inf");
+
+	check(zset.erase("") == 1 && zset.erase("y") == 1, backend, "sentinels: erase");
+	check(names_of(zset) == std::vector<std::string>({"m", "x"}), backend, "sentinels: order after erase");
+
+	zset.clear();
+	check(zset.size() == 0 && names_of(zset).empty(), backend, "sentinels: clear");
+	zset.insert("", INFINITY);
+	check(zset.rank("") == 0 && zset.range(INFINITY, 10).size() == 1, backend, "sentinels: insert after clear");
+}
+
+//the levels of the skiplist are random, so it takes many rounds to promote
+//an infinite pair alone to the top, a node lost on the way shows as a leak
+static void check_sentinels(SortBackend backend) {
+	sentinels_round(backend); //the first one may set up statics
+	size_t before = live_allocations;
+	for (size_t i = 0; i < SENTINEL_ROUNDS; i++)
+		sentinels_round(backend);
+
+	check(live_allocations == before, backend, "sentinels: no node leaks");
+}
+
+//lexicographic queries over names at +inf, where "+" can't step to the next score
+static void check_lex(SortBackend backend) {
+	typedef std::vector<std::string> Names;
+	LexBound min = LexBound::parse("-"), max = LexBound::parse("+");
+	SortSet zset(16, backend);
+	check(zset.lex_count(min, max) == 0, backend, "lex: count of an empty set");
+
+	zset.insert("b", INFINITY);
+	zset.insert("a", INFINITY);
+	check(zset.lex_count(min, max) == 2, backend, "lex: count of +inf names");
+	check(zset.lex_count(LexBound::parse("(a"), max) == 1, backend, "lex: count from (a to +");
+	check(zset.lex_count(LexBound::parse("[a"), LexBound::parse("[b")) == 2, backend, "lex: count from [a to [b");
+	check(zset.range_by_lex(min, max, 0, 10) == Names({"a", "b"}), backend, "lex: range of +inf names");
+	check(zset.range_by_lex(min, max, 0, 10, true) == Names({"b", "a"}), backend, "lex: reverse range of +inf names");
+	check(zset.range_by_lex(LexBound::parse("(a"), max, 0, 10) == Names({"b"}), backend, "lex: range from (a to +");
+
+	//only the names with the lowest score are queried
+	zset.insert("c", 0);
+	check(zset.lex_count(min, max) == 1, backend, "lex: count at the lowest score");
+	check(zset.range_by_lex(min, max, 0, 10) == Names({"c"}), backend, "lex: range at the lowest score");
+}
+
+static ScoreAggregate aggregate(SortSet &zset, const char *min, const char *max) {
+	return zset.aggregate(ScoreBound::parse(min), ScoreBound::parse(max));
+}
+
+//score windows(zsum, zavg, zminmax) around infinite and huge scores
+static void check_aggregate(SortBackend backend) {
+	SortSet zset(16, backend);
+	zset.insert("x", -INFINITY);
+	zset.insert("a", 1);
+	zset.insert("b", 2);
+	ScoreAggregate agg = aggregate(zset, "1", "2");
+	check(agg.count == 2 && agg.sum == 3, backend, "aggregate: -inf below the window");
+	agg = aggregate(zset, "-inf", "+inf");
+	check(agg.count == 3 && agg.sum == -INFINITY && agg.min == -INFINITY && agg.max == 2,
+					backend, "aggregate: -inf in the window");
+
+	zset.clear();
+	zset.insert("p", INFINITY);
+	zset.insert("q", 1);
+	agg = aggregate(zset, "-inf", "+inf");
+	check(agg.count == 2 && agg.sum == INFINITY && agg.max == INFINITY, backend, "aggregate: [+inf bound");
+	check(aggregate(zset, "(inf", "+inf").count == 0, backend, "aggregate: (+inf bound");
+	agg = aggregate(zset, "-inf", "(inf");
+	check(agg.count == 1 && agg.sum == 1, backend, "aggregate: up to (+inf");
+
+	zset.insert("n", -INFINITY);
+	check(std::isnan(aggregate(zset, "-inf", "+inf").sum), backend, "aggregate: both infinities");
+	check(aggregate(zset, "(-inf", "(inf").sum == 1, backend, "aggregate: between the infinities");
+
+	//a huge score added and removed again mustn't leave its rounding error behind
+	zset.clear();
+	for (int i = 0; i < 20; i++)
+		zset.insert("m" + std::to_string(i), 0.1);
+	zset.incrby("big", -1e20);
+	zset.erase("big");
+	check(std::fabs(aggregate(zset, "-inf", "+inf").sum - 2) < 1e-9, backend, "aggregate: no drift");
+}
+
+//a score that doesn't parse, as a whole, into a number mustn't be taken
+static void check_parse_score() {
+	for (const char *bad : {"1abc", "2 junk", " ", "", "nan", "(1", "inf1"}) {
+		try {
+			parse_score(bad);
+			check(false, "parse score: a malformed score is taken");
+		}
+		catch(const std::invalid_argument &e) {
+		}
+	}
+
+	check(parse_score("1.5") == 1.5 && parse_score("-3e2") == -300, "parse score: numbers");
+	check(parse_score("-inf") == -INFINITY && parse_score("+inf") == INFINITY, "parse score: infinities");
+
+	ScoreBound bound = ScoreBound::parse("(1.5");
+	check(bound.exclusive && bound.score == 1.5, "parse score: exclusive bound");
+	try {
+		ScoreBound::parse("(1abc");
+		check(false, "parse score: a malformed bound is taken");
+	}
+	catch(const std::invalid_argument &e) {
+	}
+}
+
+//a zadd of the batch into a set of size names against a model of it,
+//repeated names in the batch get their last score
+static void zadd_round(SortBackend backend, size_t size, size_t batch, std::mt19937_64 &rng) {
+	std::uniform_int_distribution<size_t> member(0, size + batch / 2);
+	std::uniform_int_distribution<int> score(0, 100); //repeated scores are ordered by name
+	std::map<std::string, double> model;
+	SortSet zset(16, backend);
+	for (size_t i = 0; i < size; i++) {
+		std::string name = "m" + std::to_string(i);
+		model[name] = score(rng);
+		zset.insert(name, model[name]);
+	}
+
+	std::vector<std::pair<std::string, double>> items;
+	for (size_t i = 0; i < batch; i++)
+		items.emplace_back("m" + std::to_string(member(rng)), score(rng));
+
+	size_t added = 0;
+	for (const auto &item : items) {
+		added += model.count(item.first) == 0;
+		model[item.first] = item.second;
+	}
+
+	std::vector<std::pair<double, std::string>> order;
+	for (const auto &pair : model)
+		order.emplace_back(pair.second, pair.first);
+	std::sort(order.begin(), order.end());
+
+	check(zset.insert_many(items) == added, backend, "insert many: added names");
+	check(zset.size() == model.size(), backend, "insert many: size");
+	std::vector<std::string> names = names_of(zset);
+	bool ok = names.size() == order.size();
+	for (size_t i = 0; ok && i < order.size(); i++)
+		ok = names[i] == order[i].second && zset.search(order[i].second) == order[i].first
+					&& zset.rank(order[i].second) == long(i);
+	check(ok, backend, "insert many: names, scores and ranks");
+}
+
+//both ways of insert_many: single inserts and the bottom-up rebuild
+static void check_insert_many(SortBackend backend) {
+	std::mt19937_64 rng(backend);
+	for (size_t size : {size_t(0), size_t(10), size_t(100), size_t(1000)})
+		for (size_t batch : {size_t(2), BULK_MIN_BATCH - 1, BULK_MIN_BATCH, size_t(500), size_t(2000)})
+			zadd_round(backend, size, batch, rng);
+}
+
+static int run_checks() {
+	check_parse_score();
+	for (SortBackend backend : {SKIPLIST_BACKEND, BPTREE_BACKEND}) {
+		check_sentinels(backend);
+		check_lex(backend);
+		check_aggregate(backend);
+		check_insert_many(backend);
+	}
+
+	printf("%zu checks failed\n", failed_checks);
+	return failed_checks ? 1 : 0;
+}
+
+int main(int argc, char **argv) {
+	if (argc == 2 && std::string(argv[1]) == "check")
+		return run_checks();
+
+	if (argc == 2 && std::string(argv[1]) == "cutover") {
+		cutover(SKIPLIST_BACKEND);
+		cutover(BPTREE_BACKEND);
+		return 0;
+	}
+
+	std::vector<size_t> sizes;
+	for (int i = 1; i < argc; i++)
+		sizes.push_back(strtoul(argv[i], nullptr, 10));
+
+	if (sizes.empty())
+		sizes = {1000000, 10000000};
+
+	for (size_t size : sizes) {
+		if (size == 0)
+			continue;
+
+		bench(SKIPLIST_BACKEND, size);
+		bench(BPTREE_BACKEND, size);
+	}
+
+	return 0;
+}
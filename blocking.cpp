@@ -0,0 +1,92 @@
+#include "blocking.hpp"
+
+//c++
+#include <climits> //INT_MAX
+
+//custom
+#include "clock.hpp"
+
+void BlockedClients::block(const BlockedWaiter &waiter) {
+	uint64_t id = waiter.client->id;
+	Entry &entry = waiters[id];
+	entry.waiter = waiter;
+
+	for (const std::string &key : waiter.keys) {
+		Queue &queue = queues[key];
+		if (queue.empty() || queue.back() != id)
+			entry.positions.emplace_back(key, queue.insert(queue.end(), id));
+	}
+
+	entry.deadline_pos = deadlines.end();
+	if (waiter.deadline > 0)
+		entry.deadline_pos = deadlines.emplace(waiter.deadline, id).first;
+}
+
+BlockedWaiter BlockedClients::unblock(uint64_t client) {
+	auto it = waiters.find(client);
+	if (it == waiters.end())
+		return BlockedWaiter();
+
+	Entry &entry = it->second;
+	for (const auto &position : entry.positions) {
+		auto queue = queues.find(position.first);
+		queue->second.erase(position.second);
+		if (queue->second.empty())
+			queues.erase(queue);
+	}
+
+	if (entry.deadline_pos != deadlines.end())
+		deadlines.erase(entry.deadline_pos);
+
+	BlockedWaiter waiter = std::move(entry.waiter);
+	waiters.erase(it);
+
+	return waiter;
+}
+
+bool BlockedClients::is_blocked(uint64_t client) const {
+	return waiters.count(client) > 0;
+}
+
+void BlockedClients::signal(const std::string &key) {
+	if (queues.count(key))
+		signaled.push_back(key);
+}
+
+std::vector<std::string> BlockedClients::take_signaled() {
+	std::vector<std::string> keys;
+	keys.swap(signaled);
+
+	return keys;
+}
+
+const BlockedWaiter *BlockedClients::first(const std::string &key) const {
+	auto queue = queues.find(key);
+	if (queue == queues.end())
+		return nullptr;
+
+	return &waiters.at(queue->second.front()).waiter;
+}
+
+std::vector<BlockedWaiter> BlockedClients::take_expired(int64_t now_ms) {
+	std::vector<BlockedWaiter> expired;
+	while (!deadlines.empty() && deadlines.begin()->first <= now_ms)
+		expired.push_back(unblock(deadlines.begin()->second));
+
+	return expired;
+}
+
+int BlockedClients::get_next_timeout() const {
+	if (deadlines.empty())
+		return -1;
+
+	int64_t timeout = deadlines.begin()->first - Clock::now_ms();
+	if (timeout <= 0)
+		return 0;
+
+	return timeout > INT_MAX ? INT_MAX : int(timeout);
+}
+
+size_t BlockedClients::size() const {
+	return waiters.size();
+}
@@ -0,0 +1,78 @@
+#ifndef __BLOCKING_HPP__
+#define __BLOCKING_HPP__
+
+/* =====================================================================
+ * BlockedClients keeps the clients parked by the blocking pops
+ * (blpop/brpop) till one of their keys gets an element or their timeout comes.
+ *
+ * A parked client costs nothing while it waits:
+ *   - its reply is a deferred one, the connection stops taking its requests
+ *     and keeps only polling for the peer closing it
+ *   - nobody polls the keys, a push signals its key if the key has waiters,
+ *     and the waiters are served right after the command which has pushed
+ *   - the event loop sleeps till the closest deadline of the waiters
+ *     (get_next_timeout()), like it does for the ttls of the keys
+ * The waiters of a key are served in the order they've blocked,
+ * and every pushed element wakes exactly one of them.
+ * =====================================================================*/
+
+//c++
+#include <cstddef> //size_t
+#include <cstdint> //uint64_t, int64_t
+#include <list>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <utility> //std::pair
+#include <vector>
+
+//custom
+#include "request_handler.hpp" //Client
+
+struct BlockedWaiter {
+	Client *client = nullptr; //valid till the handler forgets the client
+	uint64_t seq = 0; //the slot of its deferred reply
+	std::vector<std::string> keys;
+	bool front = true; //blpop, brpop pops the tail
+	int64_t deadline = 0; //monotonic ms, 0 - waits for good
+};
+
+class BlockedClients {
+private:
+	typedef std::list<uint64_t> Queue; //client ids in the order they've blocked
+	typedef std::set<std::pair<int64_t, uint64_t>> Deadlines; //(deadline, client id)
+
+	struct Entry {
+		BlockedWaiter waiter;
+		//in the queue of every key, a key listed twice is queued once
+		std::vector<std::pair<std::string, Queue::iterator>> positions;
+		Deadlines::iterator deadline_pos; //deadlines.end() if none
+	};
+
+	std::unordered_map<uint64_t, Entry> waiters; //by client id
+	std::unordered_map<std::string, Queue> queues; //by key
+	Deadlines deadlines;
+	std::vector<std::string> signaled; //keys pushed to while they had waiters
+
+public:
+	//parks the client, its reply has to be reserved already
+	void block(const BlockedWaiter &waiter);
+	//removes the waiter from the queues of all its keys
+	BlockedWaiter unblock(uint64_t client);
+	bool is_blocked(uint64_t client) const;
+
+	//an element is pushed to the key, ignored if the key has no waiters
+	void signal(const std::string &key);
+	//the keys signaled since the last call
+	std::vector<std::string> take_signaled();
+	//the waiter to serve first by the key, nullptr if none
+	const BlockedWaiter *first(const std::string &key) const;
+
+	//unblocks and returns the waiters whose deadlines have come
+	std::vector<BlockedWaiter> take_expired(int64_t now_ms);
+	//ms till the closest deadline, -1 if nobody waits with a timeout
+	int get_next_timeout() const;
+	size_t size() const;
+};
+
+#endif
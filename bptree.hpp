@@ -0,0 +1,747 @@
+#ifndef __BPTREE_HPP__
+#define __BPTREE_HPP__
+
+/* =====================================================================
+ * This is B+tree data structure which stores pairs of (key, value),
+ * whereas the key(e.g. int/float) gives order but not necessarily unique
+ * and the value(e.g. strings) is unique. Pairs are sorted by keys
+ * and pairs with equal keys are sorted by values using Compare.
+ * All the pairs are stored in the leaves, keys and values in separate
+ * contiguous arrays, and leaves are chained to each other,
+ * so a range query is a sequential scan of few cache lines
+ * instead of a cache miss per element as in SkipList.
+ * Inner nodes store the lowest pair of every child as a separator,
+ * the number of pairs in every child's subtree and the sum of their keys,
+ * which makes it an order-statistic tree(rank and sum of a range in O(logN)).
+ * A subtree's sum is recomputed from its children whenever it changes
+ * instead of being adjusted by the difference, so it never drifts.
+ * Node sizes are chosen by cache lines: leaf keys take LEAF_LINES lines
+ * and inner keys take INNER_LINES lines.
+ * //BPTree//
+ * Main goal: range queries over big sets.
+ * Complexity: O(logN) for every action
+ *
+ * Ex. of BPTree(max 4 children/pairs per node):
+ *
+ *                    +---------------------+
+ *                    | 1:(4) | 5:(3)       |               inner: separator:(count)
+ *                    +---------------------+
+ *                     /                 \
+ *          +---------------+  <-->  +-----------+
+ *          | 1 | 2 | 3 | 4 |        | 5 | 6 | 7 |          leaves
+ *          +---------------+        +-----------+
+ *
+ * =====================================================================*/
+
+#include <algorithm> //std::move, std::move_backward
+#include <cstdint>
+#include <functional> //std::less
+#include <utility> //std::pair
+#include <vector>
+
+//custom
+#include "ordered_index.hpp"
+
+constexpr size_t CACHE_LINE_SIZE = 64;
+constexpr size_t LEAF_LINES = 4;
+constexpr size_t INNER_LINES = 2;
+
+template <typename T, typename P, typename Compare = std::less<P>>
+class BPTree : public OrderedIndex<T, P> {
+private:
+	static constexpr size_t LEAF_MAX = LEAF_LINES * CACHE_LINE_SIZE / sizeof(T);
+	static constexpr size_t INNER_MAX = INNER_LINES * CACHE_LINE_SIZE / sizeof(T);
+	static constexpr size_t LEAF_MIN = LEAF_MAX / 2;
+	static constexpr size_t INNER_MIN = INNER_MAX / 2;
+
+	static_assert(INNER_MAX >= 4 && LEAF_MAX >= 4, "BPTree: the key type is too big");
+
+	struct Node {
+		bool is_leaf;
+		uint16_t n; //number of pairs in a leaf or number of children in an inner node
+
+		Node(bool is_leaf) : is_leaf(is_leaf), n(0) {}
+	};
+
+	struct Leaf : Node {
+		T keys[LEAF_MAX];
+		P values[LEAF_MAX];
+		Leaf *prev = nullptr;
+		Leaf *next = nullptr;
+
+		Leaf() : Node(true) {}
+	};
+
+	struct Inner : Node {
+		//keys[i], values[i] - separator, the lowest pair of children[i]'s subtree,
+		//the separator of the first child isn't used for searching
+		T keys[INNER_MAX];
+		P values[INNER_MAX];
+		Node *children[INNER_MAX];
+		size_t counts[INNER_MAX]; //number of pairs in children[i]'s subtree
+		KeySum<T> sums[INNER_MAX]; //sum of the keys in children[i]'s subtree
+
+		Inner() : Node(false) {}
+	};
+
+	Node *root;
+	size_t length; //overall number of pairs
+
+	static bool _less(const T &lkey, const P &lvalue, const T &rkey, const P &rvalue) {
+		if (lkey != rkey)
+			return lkey < rkey;
+
+		return Compare()(lvalue, rvalue);
+	}
+	
+	//returns true if (lkey, lvalue) < (rkey, rvalue), or <= if inclusive
+	static bool _goes_before(const T &lkey, const P &lvalue, 
+							const T &rkey, const P &rvalue, bool inclusive) {
+		if (inclusive)
+			return !_less(rkey, rvalue, lkey, lvalue);
+		
+		return _less(lkey, lvalue, rkey, rvalue);
+	}
+
+	//returns the index of the first pair >= (key, value) in the leaf
+	static size_t _leaf_pos(const Leaf *leaf, const T &key, const P &value) {
+		size_t i = 0;
+		for (; i < leaf->n && _less(leaf->keys[i], leaf->values[i], key, value); i++);
+
+		return i;
+	}
+
+	//returns the index of the child whose subtree may hold (key, value)
+	static size_t _child_pos(const Inner *inner, const T &key, const P &value) {
+		size_t i = 1;
+		for (; i < inner->n && !_less(key, value, inner->keys[i], inner->values[i]); i++);
+
+		return i - 1;
+	}
+
+	static size_t _count(const Node *node) {
+		if (node->is_leaf)
+			return node->n;
+
+		const Inner *inner = static_cast<const Inner *>(node);
+		size_t count = 0;
+		for (size_t i = 0; i < inner->n; i++)
+			count += inner->counts[i];
+
+		return count;
+	}
+
+	static KeySum<T> _leaf_sum(const Leaf *leaf) {
+		KeySum<T> sum;
+		for (size_t i = 0; i < leaf->n; i++)
+			sum += leaf->keys[i];
+
+		return sum;
+	}
+
+	static KeySum<T> _inner_sum(const Inner *inner) {
+		KeySum<T> sum;
+		for (size_t i = 0; i < inner->n; i++)
+			sum += inner->sums[i];
+
+		return sum;
+	}
+
+	//a node is cast only after checking is_leaf, so a leaf is never read as an inner node
+	static KeySum<T> _sum(const Node *node) {
+		if (node->is_leaf)
+			return _leaf_sum(static_cast<const Leaf *>(node));
+
+		return _inner_sum(static_cast<const Inner *>(node));
+	}
+
+	static void _destroy(Node *node) {
+		if (!node->is_leaf) {
+			Inner *inner = static_cast<Inner *>(node);
+			for (size_t i = 0; i < inner->n; i++)
+				_destroy(inner->children[i]);
+
+			delete inner;
+		}
+		else
+			delete static_cast<Leaf *>(node);
+	}
+
+	//inserts a child with its separator, count and sum at position i of an inner node
+	static void _inner_insert_at(Inner *inner, size_t i, const T &key, const P &value,
+											Node *child, size_t count, const KeySum<T> &sum) {
+		std::move_backward(inner->keys + i, inner->keys + inner->n, inner->keys + inner->n + 1);
+		std::move_backward(inner->values + i, inner->values + inner->n, inner->values + inner->n + 1);
+		std::move_backward(inner->children + i, inner->children + inner->n, inner->children + inner->n + 1);
+		std::move_backward(inner->counts + i, inner->counts + inner->n, inner->counts + inner->n + 1);
+		std::move_backward(inner->sums + i, inner->sums + inner->n, inner->sums + inner->n + 1);
+		inner->keys[i] = key;
+		inner->values[i] = value;
+		inner->children[i] = child;
+		inner->counts[i] = count;
+		inner->sums[i] = sum;
+		inner->n++;
+	}
+
+	static void _inner_remove_at(Inner *inner, size_t i) {
+		std::move(inner->keys + i + 1, inner->keys + inner->n, inner->keys + i);
+		std::move(inner->values + i + 1, inner->values + inner->n, inner->values + i);
+		std::move(inner->children + i + 1, inner->children + inner->n, inner->children + i);
+		std::move(inner->counts + i + 1, inner->counts + inner->n, inner->counts + i);
+		std::move(inner->sums + i + 1, inner->sums + inner->n, inner->sums + i);
+		inner->n--;
+		inner->values[inner->n] = P(); //release the moved-from separator
+	}
+
+	/* moves the upper half of a full node to a new right sibling
+	 * and returns the sibling */
+	static Leaf *_split(Leaf *leaf) {
+		Leaf *right = new Leaf();
+		size_t half = leaf->n / 2;
+		right->n = leaf->n - half;
+		std::move(leaf->keys + half, leaf->keys + leaf->n, right->keys);
+		std::move(leaf->values + half, leaf->values + leaf->n, right->values);
+		leaf->n = half;
+
+		right->next = leaf->next;
+		right->prev = leaf;
+		if (leaf->next)
+			leaf->next->prev = right;
+		leaf->next = right;
+
+		return right;
+	}
+
+	static Inner *_split(Inner *inner) {
+		Inner *right = new Inner();
+		size_t half = inner->n / 2;
+		right->n = inner->n - half;
+		std::move(inner->keys + half, inner->keys + inner->n, right->keys);
+		std::move(inner->values + half, inner->values + inner->n, right->values);
+		std::move(inner->children + half, inner->children + inner->n, right->children);
+		std::move(inner->counts + half, inner->counts + inner->n, right->counts);
+		std::move(inner->sums + half, inner->sums + inner->n, right->sums);
+		inner->n = half;
+
+		return right;
+	}
+
+	/* inserts the pair into the node's subtree,
+	 * if the node had to be split returns its new right sibling */
+	Node *_insert(Node *node, const T &key, const P &value) {
+		if (node->is_leaf) {
+			Leaf *leaf = static_cast<Leaf *>(node);
+			Leaf *right = nullptr;
+			size_t i = _leaf_pos(leaf, key, value);
+
+			if (leaf->n == LEAF_MAX) {
+				right = _split(leaf);
+				if (i > leaf->n) {
+					i -= leaf->n;
+					leaf = right;
+				}
+			}
+
+			std::move_backward(leaf->keys + i, leaf->keys + leaf->n, leaf->keys + leaf->n + 1);
+			std::move_backward(leaf->values + i, leaf->values + leaf->n, leaf->values + leaf->n + 1);
+			leaf->keys[i] = key;
+			leaf->values[i] = value;
+			leaf->n++;
+
+			return right;
+		}
+
+		Inner *inner = static_cast<Inner *>(node);
+		size_t i = _child_pos(inner, key, value);
+		Node *split = _insert(inner->children[i], key, value);
+		inner->counts[i]++;
+		inner->sums[i] = _sum(inner->children[i]);
+		if (!split)
+			return nullptr;
+
+		size_t split_count = _count(split);
+		KeySum<T> split_sum = _sum(split);
+		inner->counts[i] -= split_count;
+
+		const T &split_key = split->is_leaf ? static_cast<Leaf *>(split)->keys[0]
+											: static_cast<Inner *>(split)->keys[0];
+		const P &split_value = split->is_leaf ? static_cast<Leaf *>(split)->values[0]
+											: static_cast<Inner *>(split)->values[0];
+
+		Inner *right = nullptr;
+		if (inner->n == INNER_MAX) {
+			right = _split(inner);
+			if (i + 1 > inner->n) {
+				_inner_insert_at(right, i + 1 - inner->n, split_key, split_value,
+												split, split_count, split_sum);
+				return right;
+			}
+		}
+
+		_inner_insert_at(inner, i + 1, split_key, split_value, split, split_count, split_sum);
+
+		return right;
+	}
+
+	//merges children i and i + 1 of the parent or moves pairs between them
+	//so that none of them is underfull
+	void _rebalance(Inner *parent, size_t i) {
+		Node *left = parent->children[i];
+		Node *right = parent->children[i + 1];
+
+		if (left->is_leaf) {
+			Leaf *l = static_cast<Leaf *>(left);
+			Leaf *r = static_cast<Leaf *>(right);
+
+			if (l->n + r->n <= LEAF_MAX) { //merge r into l
+				std::move(r->keys, r->keys + r->n, l->keys + l->n);
+				std::move(r->values, r->values + r->n, l->values + l->n);
+				l->n += r->n;
+				l->next = r->next;
+				if (r->next)
+					r->next->prev = l;
+
+				parent->counts[i] += parent->counts[i + 1];
+				parent->sums[i] = _sum(l);
+				_inner_remove_at(parent, i + 1);
+				delete r;
+				return;
+			}
+
+			size_t total = l->n + r->n;
+			size_t half = total / 2;
+			if (l->n > half) { //move the tail of l to the head of r
+				size_t moved = l->n - half;
+				std::move_backward(r->keys, r->keys + r->n, r->keys + r->n + moved);
+				std::move_backward(r->values, r->values + r->n, r->values + r->n + moved);
+				std::move(l->keys + half, l->keys + l->n, r->keys);
+				std::move(l->values + half, l->values + l->n, r->values);
+				for (size_t k = half; k < l->n; k++)
+					l->values[k] = P();
+			}
+			else { //move the head of r to the tail of l
+				size_t moved = half - l->n;
+				std::move(r->keys, r->keys + moved, l->keys + l->n);
+				std::move(r->values, r->values + moved, l->values + l->n);
+				std::move(r->keys + moved, r->keys + r->n, r->keys);
+				std::move(r->values + moved, r->values + r->n, r->values);
+				for (size_t k = r->n - moved; k < r->n; k++)
+					r->values[k] = P();
+			}
+
+			r->n = total - half;
+			l->n = half;
+			parent->counts[i] = l->n;
+			parent->counts[i + 1] = r->n;
+			parent->sums[i] = _sum(l);
+			parent->sums[i + 1] = _sum(r);
+			parent->keys[i + 1] = r->keys[0];
+			parent->values[i + 1] = r->values[0];
+
+			return;
+		}
+
+		Inner *l = static_cast<Inner *>(left);
+		Inner *r = static_cast<Inner *>(right);
+		//the first separator of r isn't kept exact, the parent's one is
+		r->keys[0] = parent->keys[i + 1];
+		r->values[0] = parent->values[i + 1];
+
+		if (l->n + r->n <= INNER_MAX) { //merge r into l
+			for (size_t k = 0; k < r->n; k++) {
+				_inner_insert_at(l, l->n, r->keys[k], r->values[k],
+											r->children[k], r->counts[k], r->sums[k]);
+			}
+
+			parent->counts[i] += parent->counts[i + 1];
+			parent->sums[i] = _sum(l);
+			_inner_remove_at(parent, i + 1);
+			r->n = 0;
+			delete r;
+			return;
+		}
+
+		size_t total = l->n + r->n;
+		size_t half = total / 2;
+		while (l->n > half) { //move the tail of l to the head of r
+			size_t k = l->n - 1;
+			_inner_insert_at(r, 0, l->keys[k], l->values[k], 
+									l->children[k], l->counts[k], l->sums[k]);
+			_inner_remove_at(l, k);
+		}
+
+		while (l->n < half) { //move the head of r to the tail of l
+			_inner_insert_at(l, l->n, r->keys[0], r->values[0], 
+									r->children[0], r->counts[0], r->sums[0]);
+			_inner_remove_at(r, 0);
+		}
+
+		parent->counts[i] = _count(l);
+		parent->counts[i + 1] = _count(r);
+		parent->sums[i] = _sum(l);
+		parent->sums[i + 1] = _sum(r);
+		parent->keys[i + 1] = r->keys[0];
+		parent->values[i + 1] = r->values[0];
+	}
+
+	//removes the pair from the node's subtree, returns false if it wasn't found
+	bool _erase(Node *node, const T &key, const P &value) {
+		if (node->is_leaf) {
+			Leaf *leaf = static_cast<Leaf *>(node);
+			size_t i = _leaf_pos(leaf, key, value);
+			if (i == leaf->n || leaf->keys[i] != key || leaf->values[i] != value)
+				return false;
+
+			std::move(leaf->keys + i + 1, leaf->keys + leaf->n, leaf->keys + i);
+			std::move(leaf->values + i + 1, leaf->values + leaf->n, leaf->values + i);
+			leaf->n--;
+			leaf->values[leaf->n] = P(); //release the moved-from value
+
+			return true;
+		}
+
+		Inner *inner = static_cast<Inner *>(node);
+		size_t i = _child_pos(inner, key, value);
+		Node *child = inner->children[i];
+		if (!_erase(child, key, value))
+			return false;
+
+		inner->counts[i]--;
+		inner->sums[i] = _sum(child);
+
+		size_t min = child->is_leaf ? LEAF_MIN : INNER_MIN;
+		if (child->n < min && inner->n > 1)
+			_rebalance(inner, (i > 0) ? i - 1 : i);
+
+		return true;
+	}
+
+	//returns the leaf and the position of the first pair with the key >= from
+	Leaf *_lower_bound(const T &from, size_t *pos) const {
+		Node *node = root;
+		while (!node->is_leaf) {
+			Inner *inner = static_cast<Inner *>(node);
+			size_t i = 1;
+			for (; i < inner->n && inner->keys[i] < from; i++);
+			node = inner->children[i - 1];
+		}
+
+		Leaf *leaf = static_cast<Leaf *>(node);
+		size_t i = 0;
+		for (; i < leaf->n && leaf->keys[i] < from; i++);
+
+		//all the pairs of the leaf are lower, the next leaf starts with a greater one
+		if (i == leaf->n && leaf->next) {
+			leaf = leaf->next;
+			i = 0;
+		}
+
+		*pos = i;
+		return leaf;
+	}
+
+public:
+	BPTree() : root(new Leaf()), length(0) {}
+
+	BPTree(const BPTree &) = delete;
+	BPTree &operator=(const BPTree &) = delete;
+
+	~BPTree() override {
+		_destroy(root);
+	}
+
+	void insert(const T &key, const P &value) override {
+		Node *split = _insert(root, key, value);
+		length++;
+
+		if (!split)
+			return;
+
+		//the root was split, grow the tree by one level
+		Inner *new_root = new Inner();
+		const T &split_key = split->is_leaf ? static_cast<Leaf *>(split)->keys[0]
+											: static_cast<Inner *>(split)->keys[0];
+		const P &split_value = split->is_leaf ? static_cast<Leaf *>(split)->values[0]
+											: static_cast<Inner *>(split)->values[0];
+		size_t split_count = _count(split);
+
+		_inner_insert_at(new_root, 0, split_key, split_value, 
+										root, length - split_count, _sum(root));
+		_inner_insert_at(new_root, 1, split_key, split_value, 
+										split, split_count, _sum(split));
+		root = new_root;
+	}
+
+	void erase(const T &key, const P &value) override {
+		if (!_erase(root, key, value))
+			return;
+
+		length--;
+
+		//the root has a single child left, shrink the tree by one level
+		while (!root->is_leaf && root->n == 1) {
+			Inner *old_root = static_cast<Inner *>(root);
+			root = old_root->children[0];
+			old_root->n = 0;
+			delete old_root;
+		}
+	}
+
+	/* moves the (old_key, value) pair to new_key.
+	 * if the pair keeps its place inside its leaf the key is rewritten in place,
+	 * otherwise the pair is removed and inserted again.
+	 * returns false if (old_key, value) wasn't found */
+	bool update(const T &old_key, const P &value, const T &new_key) override {
+		//the inner nodes and children on the way to the leaf to fix their sums
+		std::vector<std::pair<Inner *, size_t>> path;
+		Node *node = root;
+		while (!node->is_leaf) {
+			Inner *inner = static_cast<Inner *>(node);
+			size_t i = _child_pos(inner, old_key, value);
+			path.push_back({inner, i});
+			node = inner->children[i];
+		}
+
+		Leaf *leaf = static_cast<Leaf *>(node);
+		size_t i = _leaf_pos(leaf, old_key, value);
+		if (i == leaf->n || leaf->keys[i] != old_key || leaf->values[i] != value)
+			return false;
+
+		if (old_key == new_key)
+			return true;
+
+		/* the separators above the leaf stay valid as long as the pair
+		 * doesn't become the lowest one in its leaf or the greatest one,
+		 * since the next leaf's lower bound is unknown here */
+		bool after_prev = (i > 0) ? _less(leaf->keys[i - 1], leaf->values[i - 1], new_key, value)
+								: old_key < new_key;
+		bool before_next = (i + 1 < leaf->n)
+								&& _less(new_key, value, leaf->keys[i + 1], leaf->values[i + 1]);
+
+		if (after_prev && before_next) {
+			leaf->keys[i] = new_key;
+			for (size_t k = path.size(); k-- > 0;)
+				path[k].first->sums[path[k].second] = _sum(path[k].first->children[path[k].second]);
+				
+			return true;
+		}
+
+		erase(old_key, value);
+		insert(new_key, value);
+
+		return true;
+	}
+
+	//returns at most count values starting from the first key >= from
+	std::vector<P> range(const T &from, size_t count) override {
+		std::vector<P> v;
+		size_t i = 0;
+		for (Leaf *leaf = _lower_bound(from, &i); leaf && v.size() < count; leaf = leaf->next) {
+			for (; i < leaf->n && v.size() < count; i++)
+				v.push_back(leaf->values[i]);
+
+			i = 0;
+		}
+
+		return v;
+	}
+
+	//returns 0-based position of (key, value) or -1 if it wasn't found
+	long rank(const T &key, const P &value) override {
+		Node *node = root;
+		size_t rank = 0;
+		while (!node->is_leaf) {
+			Inner *inner = static_cast<Inner *>(node);
+			size_t i = _child_pos(inner, key, value);
+			for (size_t k = 0; k < i; k++)
+				rank += inner->counts[k];
+
+			node = inner->children[i];
+		}
+
+		Leaf *leaf = static_cast<Leaf *>(node);
+		size_t i = _leaf_pos(leaf, key, value);
+		if (i == leaf->n || leaf->keys[i] != key || leaf->values[i] != value)
+			return -1;
+
+		return rank + i;
+	}
+
+	//returns the number of pairs < (key, value), or <= (key, value) if inclusive
+	size_t count_before(const T &key, const P &value, bool inclusive) override {
+		Node *node = root;
+		size_t rank = 0;
+		while (!node->is_leaf) {
+			Inner *inner = static_cast<Inner *>(node);
+			size_t i = 1;
+			for (; i < inner->n 
+				&& _goes_before(inner->keys[i], inner->values[i], key, value, inclusive); i++)
+				rank += inner->counts[i - 1];
+			
+			node = inner->children[i - 1];
+		}
+		
+		Leaf *leaf = static_cast<Leaf *>(node);
+		size_t i = 0;
+		for (; i < leaf->n && _goes_before(leaf->keys[i], leaf->values[i], key, value, inclusive); i++);
+		
+		return rank + i;
+	}
+	
+	//sets count and sum to the number and the sum of keys of the pairs < (key, value),
+	//or <= (key, value) if inclusive
+	void aggregate_before(const T &key, const P &value, bool inclusive, 
+								size_t &count, KeySum<T> &sum) override {
+		Node *node = root;
+		count = 0;
+		sum = KeySum<T>();
+		while (!node->is_leaf) {
+			Inner *inner = static_cast<Inner *>(node);
+			size_t i = 1;
+			for (; i < inner->n 
+				&& _goes_before(inner->keys[i], inner->values[i], key, value, inclusive); i++) {
+				count += inner->counts[i - 1];
+				sum += inner->sums[i - 1];
+			}
+			
+			node = inner->children[i - 1];
+		}
+		
+		Leaf *leaf = static_cast<Leaf *>(node);
+		for (size_t i = 0; i < leaf->n 
+				&& _goes_before(leaf->keys[i], leaf->values[i], key, value, inclusive); i++) {
+			count++;
+			sum += leaf->keys[i];
+		}
+	}
+	
+	//returns at most count values starting from the 0-based position start,
+	//going to the lower positions if reverse
+	std::vector<P> range_by_rank(size_t start, size_t count, bool reverse) override {
+		std::vector<P> v;
+		if (start >= length)
+			return v;
+		
+		Node *node = root;
+		while (!node->is_leaf) {
+			Inner *inner = static_cast<Inner *>(node);
+			size_t i = 0;
+			for (; start >= inner->counts[i]; i++)
+				start -= inner->counts[i];
+			
+			node = inner->children[i];
+		}
+		
+		Leaf *leaf = static_cast<Leaf *>(node);
+		long i = start;
+		while (leaf && v.size() < count) {
+			v.push_back(leaf->values[i]);
+			i += reverse ? -1 : 1;
+			
+			if (i < 0 || i >= leaf->n) { //continue in the neighbouring leaf
+				leaf = reverse ? leaf->prev : leaf->next;
+				if (leaf)
+					i = reverse ? leaf->n - 1 : 0;
+			}
+		}
+		
+		return v;
+	}
+	
+	void for_each(const std::function<void(const T &, const P &)> &visit) override {
+		Node *node = root;
+		while (!node->is_leaf)
+			node = static_cast<Inner *>(node)->children[0];
+		
+		//the leaves are chained in order
+		for (Leaf *leaf = static_cast<Leaf *>(node); leaf; leaf = leaf->next) {
+			for (size_t i = 0; i < leaf->n; i++)
+				visit(leaf->keys[i], leaf->values[i]);
+		}
+	}
+	
+	/* bulk loading: the leaves are filled from left to right,
+	 * then every level of inner nodes is built on top of the previous one.
+	 * Nodes of a level share the pairs/children evenly,
+	 * so none of them is underfull */
+	void build(const std::vector<std::pair<T, P>> &pairs) override {
+		_destroy(root);
+		length = pairs.size();
+		if (pairs.empty()) {
+			root = new Leaf();
+			return;
+		}
+		
+		std::vector<Node *> level;
+		std::vector<size_t> counts;
+		std::vector<KeySum<T>> sums;
+		
+		size_t leaves = (length + LEAF_MAX - 1) / LEAF_MAX;
+		Leaf *prev = nullptr;
+		for (size_t i = 0, from = 0; i < leaves; i++) {
+			size_t to = length * (i + 1) / leaves;
+			Leaf *leaf = new Leaf();
+			for (size_t j = from; j < to; j++) {
+				leaf->keys[leaf->n] = pairs[j].first;
+				leaf->values[leaf->n] = pairs[j].second;
+				leaf->n++;
+			}
+			
+			leaf->prev = prev;
+			if (prev)
+				prev->next = leaf;
+			prev = leaf;
+			
+			level.push_back(leaf);
+			counts.push_back(to - from);
+			sums.push_back(_leaf_sum(leaf));
+			from = to;
+		}
+		
+		while (level.size() > 1) {
+			std::vector<Node *> upper;
+			std::vector<size_t> upper_counts;
+			std::vector<KeySum<T>> upper_sums;
+			
+			size_t inners = (level.size() + INNER_MAX - 1) / INNER_MAX;
+			for (size_t i = 0, from = 0; i < inners; i++) {
+				size_t to = level.size() * (i + 1) / inners;
+				Inner *inner = new Inner();
+				for (size_t j = from; j < to; j++) {
+					const T &key = level[j]->is_leaf ? static_cast<Leaf *>(level[j])->keys[0]
+													: static_cast<Inner *>(level[j])->keys[0];
+					const P &value = level[j]->is_leaf ? static_cast<Leaf *>(level[j])->values[0]
+													: static_cast<Inner *>(level[j])->values[0];
+					_inner_insert_at(inner, inner->n, key, value, level[j], counts[j], sums[j]);
+				}
+				
+				upper.push_back(inner);
+				upper_counts.push_back(_count(inner));
+				upper_sums.push_back(_inner_sum(inner));
+				from = to;
+			}
+			
+			level.swap(upper);
+			counts.swap(upper_counts);
+			sums.swap(upper_sums);
+		}
+		
+		root = level[0];
+	}
+	
+	void clear() override {
+		_destroy(root);
+		root = new Leaf();
+		length = 0;
+	}
+
+	KeySum<T> sum() override {
+		return _sum(root);
+	}
+
+	size_t size() const override {
+		return length;
+	}
+};
+
+#endif
@@ -86,9 +86,16 @@ public:
 	}
 	
 	size_t size() const {
+		if (is_full())
+			return capacity;
+		
 		return (head <= tail) ? tail - head : capacity - (head - tail);
 	}
 	
+	size_t free_space() const {
+		return capacity - size();
+	}
+	
 	void push_back(T element) {
 		if (is_full()) { //head == tail
 			throw std::out_of_range("buffer is full");
@@ -181,11 +188,25 @@ public:
 		}
 	}
 	
+	//removes the last len elements, e.g. the header reserved for a reply which is deferred
+	void erase_back(size_t len) {
+		if (size() < len)
+			throw std::out_of_range("RingBuffer::erase_back: erase length is larger than the buffer size");
+		
+		if (len == 0)
+			return;
+		
+		tail = (tail + capacity - len) % capacity;
+		if (head == tail)
+			is_empty = true;
+	}
+	
 	//transform circular buffer to vector and return a pointer to it
 	std::vector<T> to_vector() {		
 		std::vector<T> vector_buffer;
-		for (int id = head; id != tail; id = (id + 1) % capacity) {
-			vector_buffer.push_back(buffer[id]);
+		//a full buffer has head == tail as well, so the elements are counted
+		for (size_t i = 0, n = size(); i < n; i++) {
+			vector_buffer.push_back(buffer[(head + i) % capacity]);
 		}
 		
 		return vector_buffer;
@@ -194,8 +215,8 @@ public:
 	//"override" to the vector's method data()
 	T* data() {
 		buffer_uptr->clear();
-		for (int i = head; i != tail; i = (i + 1) % capacity) {
-			buffer_uptr->push_back(buffer[i]);
+		for (size_t i = 0, n = size(); i < n; i++) {
+			buffer_uptr->push_back(buffer[(head + i) % capacity]);
 		}
 		/*if (array_buffer.size() == 0 || tail < head) { //straighten the buffer to array
 			array_buffer.clear();
@@ -213,17 +234,15 @@ public:
 		return buffer_uptr->data();
 	}
 	
+	//overwrites len elements starting from start, which is relative to the head
 	void memcpy(size_t start, T *src, size_t len) {
 		if (!src)
 			throw std::invalid_argument("RingBuffer::memcpy: NULL passed");
 		
-		if (len > capacity - this->size())
-			throw std::out_of_range("RingBuffer::memcpy: passed arg is too big");
-		
-		if (start > this->size())
-			throw std::out_of_range("RingBuffer::memcpy: start idx is out of boundaries");
+		if (start > this->size() || len > this->size() - start)
+			throw std::out_of_range("RingBuffer::memcpy: passed arg is out of boundaries");
 			
-		auto it = iterator(*this, start);
+		auto it = iterator(*this, head + start);
 		
 		for (size_t i = 0; i < len; i++) {
 			*it = *src;
@@ -236,7 +255,7 @@ public:
 		this->push_back(TAG_NIL);
 	}
 	
-	void append_int(int32_t val) {
+	void append_int(int64_t val) {
 		this->push_back(TAG_INT);
 		append_helper(*this, val, sizeof(val));
 	}
@@ -272,8 +291,8 @@ public:
 			out << "\nbuffer is empty";
 		}
 		
-		for (int i = buffer.head; i != buffer.tail; i = (i + 1) % buffer.capacity) {
-			out << buffer[i] << " ";
+		for (size_t i = 0, n = buffer.size(); i < n; i++) {
+			out << buffer[(buffer.head + i) % buffer.capacity] << " ";
 		}
 		
 		out << "\n";
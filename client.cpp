@@ -5,7 +5,9 @@
 
 //c++
 #include <iostream>
+#include <sstream>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 //networking
@@ -14,7 +16,7 @@
 #include <arpa/inet.h> //inet_ntop
 
 //custom
-#include "io_shared_library.hpp" //PORT, HEADER_SIZE, MAX_MSG_LEN, Tag, get_in_addr
+#include "io_shared_library.hpp" //PORT, HEADER_SIZE, MAX_MSG_LEN, Tag, get_in_addr, key_hash_slot
 
 constexpr size_t TAG_SIZE = sizeof(Tag);
 
@@ -157,15 +159,15 @@ static int32_t print_resp(const uint8_t *data, size_t size) {
             return TAG_SIZE + HEADER_SIZE + len;
         }
     case TAG_INT:
-        if (size < TAG_SIZE + sizeof(int32_t)) {
+        if (size < TAG_SIZE + sizeof(int64_t)) {
             fprintf(stderr, "bad response: size %lu\n", size);
             return -1;
         }
         {
-            int32_t val = 0;
-            memcpy(&val, &data[TAG_SIZE], sizeof(int32_t));
-            printf("(int) %d\n", val);
-            return size;
+            int64_t val = 0;
+            memcpy(&val, &data[TAG_SIZE], sizeof(int64_t));
+            printf("(int) %lld\n", (long long)val);
+            return TAG_SIZE + sizeof(int64_t);
         }
     case TAG_DBL:
         if (size < TAG_SIZE + sizeof(double)) {
@@ -204,42 +206,47 @@ static int32_t print_resp(const uint8_t *data, size_t size) {
     }
 }
 
-static int32_t recv_resp(int sockfd) {
-	//get server's reply
-	uint8_t rbuf[HEADER_SIZE + MAX_MSG_LEN + 1];
+//reads a reply into reply, without its length
+static int32_t recv_reply(int sockfd, std::vector<uint8_t> &reply) {
 	//read exactly HEADER_SIZE bytes
+	uint8_t header[HEADER_SIZE];
 	int32_t rv;
-	if ((rv = read_all(sockfd, rbuf, HEADER_SIZE)))
+	if ((rv = read_all(sockfd, header, HEADER_SIZE)))
 		return rv; //failed to read exactly HEADER_SIZE bytes
 	
-	size_t msg_len = 0;
-	memmove(&msg_len, rbuf, HEADER_SIZE);
-	if (msg_len > MAX_MSG_LEN) {
-		fprintf(stderr, "response is too long, len: %lu, max_msg: %lu\n", msg_len, MAX_MSG_LEN);
+	uint32_t msg_len = 0;
+	memmove(&msg_len, header, HEADER_SIZE);
+	if (msg_len > MAX_RESP_LEN) {
+		fprintf(stderr, "response is too long, len: %u, max_resp: %lu\n", msg_len, MAX_RESP_LEN);
 		return -1;
 	}
 	
 	//reply's body
-	if ((rv = read_all(sockfd, &rbuf[HEADER_SIZE], msg_len)))
+	reply.resize(msg_len);
+	return read_all(sockfd, reply.data(), msg_len);
+}
+
+static int32_t recv_resp(int sockfd) {
+	//get server's reply
+	std::vector<uint8_t> reply;
+	int32_t rv;
+	if ((rv = recv_reply(sockfd, reply)))
 		return rv;
 	
 	//print response
-	rv = print_resp((uint8_t *)&rbuf[HEADER_SIZE], msg_len);
-	if (rv > 0 && (uint32_t)rv != msg_len) {
-		fprintf(stderr, "bad response: rv!=msg_len (%d, %lu)\n", rv, msg_len);
+	rv = print_resp(reply.data(), reply.size());
+	if (rv > 0 && (uint32_t)rv != reply.size()) {
+		fprintf(stderr, "bad response: rv!=msg_len (%d, %lu)\n", rv, reply.size());
 		rv = -1;
 	}
-	//uint32_t rc = 0;
-	//memmove(&rc, &rbuf[HEADER_SIZE], HEADER_SIZE);
-	//rbuf[HEADER_SIZE + msg_len] = '\0';
-	//printf("server says: [%u] %s\n", rc, &rbuf[2 * HEADER_SIZE]);
 	
-	return rv;
+	return rv < 0 ? rv : 0;
 }
 
-int main(int argc, char **argv) {
+//connects to host(NULL - this machine) and port, returns the socket or -1
+static int connect_to(const char *host, const char *port) {
 	struct addrinfo hints{}, *servinfo, *adi;
-	int sockfd, err;
+	int sockfd = -1, err;
 	char s[INET6_ADDRSTRLEN];
 	
 	memset(&hints, 0, sizeof(hints));
@@ -247,21 +254,22 @@ int main(int argc, char **argv) {
 	hints.ai_socktype = SOCK_STREAM;
 	hints.ai_flags = AI_PASSIVE;
 	
-	if ((err = getaddrinfo(NULL, PORT, &hints, &servinfo)) != 0) {
+	if ((err = getaddrinfo(host, port, &hints, &servinfo)) != 0) {
 		fprintf(stderr, "getaddrinfo(): %s\n", gai_strerror(err));
-		exit(1);
+		return -1;
 	}
 	
 	for (adi = servinfo; adi != NULL; adi = adi->ai_next) {
-		if ((sockfd = socket(servinfo->ai_family, servinfo->ai_socktype, 
-										servinfo->ai_protocol)) < 0) {
+		if ((sockfd = socket(adi->ai_family, adi->ai_socktype, 
+										adi->ai_protocol)) < 0) {
 			perror("client: socket()");
 			continue;
 		}
 	
-		if ((err = connect(sockfd, servinfo->ai_addr, 
-										servinfo->ai_addrlen)) != 0) {
+		if ((err = connect(sockfd, adi->ai_addr, 
+										adi->ai_addrlen)) != 0) {
 			perror("client: connect()");
+			close(sockfd);
 			continue;
 		}
 		
@@ -270,20 +278,305 @@ int main(int argc, char **argv) {
 	
 	if (adi == NULL) {
 		fprintf(stderr, "client: failed to connect\n");
-		exit(1);
+		freeaddrinfo(servinfo);
+		return -1;
 	}
 	
 	//convert IPv4 and IPv6 addresses from binary to text form
 	inet_ntop(adi->ai_family, get_in_addr((struct sockaddr *)adi->ai_addr),
             s, sizeof(s));
-    printf("client: connecting to %s\n", s);
-    
+	printf("client: connecting to %s:%s\n", s, port);
+	
 	freeaddrinfo(servinfo);
+	return sockfd;
+}
+
+//the fields of a reply, each returns false if the reply doesn't have one at pos
+static bool read_arr(const std::vector<uint8_t> &reply, size_t &pos, uint32_t &n) {
+	if (pos + TAG_SIZE + HEADER_SIZE > reply.size() || reply[pos] != TAG_ARR)
+		return false;
+	
+	memcpy(&n, &reply[pos + TAG_SIZE], HEADER_SIZE);
+	pos += TAG_SIZE + HEADER_SIZE;
+	return true;
+}
+
+static bool read_int(const std::vector<uint8_t> &reply, size_t &pos, int64_t &val) {
+	if (pos + TAG_SIZE + sizeof(val) > reply.size() || reply[pos] != TAG_INT)
+		return false;
+	
+	memcpy(&val, &reply[pos + TAG_SIZE], sizeof(val));
+	pos += TAG_SIZE + sizeof(val);
+	return true;
+}
+
+static bool read_str(const std::vector<uint8_t> &reply, size_t &pos, std::string &val) {
+	uint32_t len = 0;
+	if (pos + TAG_SIZE + HEADER_SIZE > reply.size() || reply[pos] != TAG_STR)
+		return false;
 	
-	std::vector<std::string> cmd(argv + 1, argv + argc);	
-	if (send_req(sockfd, cmd) || recv_resp(sockfd)) {
-		close(sockfd);
+	memcpy(&len, &reply[pos + TAG_SIZE], HEADER_SIZE);
+	if (pos + TAG_SIZE + HEADER_SIZE + len > reply.size())
+		return false;
+	
+	val.assign((const char *)&reply[pos + TAG_SIZE + HEADER_SIZE], len);
+	pos += TAG_SIZE + HEADER_SIZE + len;
+	return true;
+}
+
+//the code and the message of an error reply, false if it isn't one
+static bool read_err(const std::vector<uint8_t> &reply, int32_t &code, std::string &msg) {
+	uint32_t len = 0;
+	if (reply.size() < TAG_SIZE + 2 * HEADER_SIZE || reply[0] != TAG_ERR)
+		return false;
+	
+	memcpy(&code, &reply[TAG_SIZE], HEADER_SIZE);
+	memcpy(&len, &reply[TAG_SIZE + HEADER_SIZE], HEADER_SIZE);
+	if (TAG_SIZE + 2 * HEADER_SIZE + len > reply.size())
+		return false;
+	
+	msg.assign((const char *)&reply[TAG_SIZE + 2 * HEADER_SIZE], len);
+	return true;
+}
+
+constexpr int MAX_REDIRECTS = 16;
+constexpr useconds_t TRYAGAIN_DELAY_US = 10 * 1000;
+
+/* ClusterClient
+ * sends every command right to the node which serves the slot of its key(cmd[1]).
+ * The slot map is fetched by "cluster slots" and cached: a MOVED redirect
+ * updates the slot and fetches the map again from the new owner, an ASK
+ * redirect sends "asking" and the command to the other node only this once,
+ * TRYAGAIN(a key being migrated) is retried after a while.
+ * The connections to the nodes stay open for the next commands */
+class ClusterClient {
+private:
+	std::string seed; //the node given on the command line, it gets the commands without a key
+	std::vector<std::string> slots; //the node of every slot, "" if unknown
+	std::unordered_map<std::string, int> conns; //node -> socket
+	
+	//returns the socket of the node, connects to it if needed, -1 upon an error
+	int _conn(const std::string &node) {
+		auto it = conns.find(node);
+		if (it != conns.end())
+			return it->second;
+		
+		size_t colon = node.rfind(':');
+		if (colon == std::string::npos) {
+			fprintf(stderr, "bad node address: %s\n", node.c_str());
+			return -1;
+		}
+		
+		std::string host = node.substr(0, colon);
+		int fd = connect_to(host.c_str(), node.substr(colon + 1).c_str());
+		if (fd >= 0)
+			conns[node] = fd;
+		
+		return fd;
+	}
+	
+	void _drop_conn(const std::string &node) {
+		auto it = conns.find(node);
+		if (it != conns.end()) {
+			close(it->second);
+			conns.erase(it);
+		}
+	}
+	
+	//sends the command to the node and reads the reply
+	int32_t _call(const std::string &node, const std::vector<std::string> &cmd, 
+										std::vector<uint8_t> &reply) {
+		int fd = _conn(node);
+		if (fd < 0)
+			return -1;
+		
+		if (send_req(fd, cmd) || recv_reply(fd, reply)) {
+			_drop_conn(node);
+			return -1;
+		}
+		
+		return 0;
+	}
+	
+	//caches the slot map of the node, [[from, to, "host:port"], ...]
+	void _fetch_slots(const std::string &node) {
+		std::vector<uint8_t> reply;
+		if (_call(node, {"cluster", "slots"}, reply))
+			return;
+		
+		size_t pos = 0;
+		uint32_t n = 0;
+		if (!read_arr(reply, pos, n))
+			return; //e.g. the cluster mode is disabled
+		
+		std::vector<std::string> fetched(CLUSTER_SLOTS);
+		for (uint32_t i = 0; i < n; i++) {
+			uint32_t fields = 0;
+			int64_t from = 0, to = 0;
+			std::string owner;
+			if (!read_arr(reply, pos, fields) || fields != 3 || !read_int(reply, pos, from)
+						|| !read_int(reply, pos, to) || !read_str(reply, pos, owner)
+						|| from < 0 || to >= (int64_t)CLUSTER_SLOTS || from > to)
+				return;
+			
+			for (int64_t slot = from; slot <= to; slot++)
+				fetched[slot] = owner;
+		}
+		
+		slots.swap(fetched);
+	}
+	
+	//splits "<slot> <host>:<port>" of a redirect
+	static bool parse_redirect(const std::string &msg, size_t &slot, std::string &node) {
+		size_t space = msg.find(' ');
+		if (space == std::string::npos || space == 0)
+			return false;
+		
+		slot = std::stoul(msg.substr(0, space));
+		node = msg.substr(space + 1);
+		return slot < CLUSTER_SLOTS && !node.empty();
+	}
+	
+	static bool has_key(const std::vector<std::string> &cmd) {
+		static const char *keyless[] = {"info", "save", "bgsave", "bgrewriteaof", "flushall", 
+								"cluster", "replicaof", "psync", "asking", 
+								"subscribe", "psubscribe", "unsubscribe", "punsubscribe", "publish"};
+		if (cmd.size() < 2)
+			return false;
+		
+		for (const char *name : keyless) {
+			if (cmd[0] == name)
+				return false;
+		}
+		
+		return true;
+	}
+	
+public:
+	ClusterClient(const std::string &seed) : seed(seed), slots(CLUSTER_SLOTS) {
+		_fetch_slots(seed);
+	}
+	
+	~ClusterClient() {
+		for (const auto &pair : conns)
+			close(pair.second);
+	}
+	
+	//sends the command to its node following the redirects and prints the reply
+	int32_t execute(const std::vector<std::string> &cmd) {
+		std::string node = seed;
+		if (has_key(cmd) && !slots[key_hash_slot(cmd[1])].empty())
+			node = slots[key_hash_slot(cmd[1])];
+		
+		bool asking = false;
+		std::vector<uint8_t> reply;
+		for (int redirects = 0; redirects < MAX_REDIRECTS; redirects++) {
+			if (asking && _call(node, {"asking"}, reply))
+				return -1;
+			
+			if (_call(node, cmd, reply))
+				return -1;
+			
+			int32_t code = 0;
+			std::string msg;
+			size_t slot = 0;
+			asking = false;
+			if (!read_err(reply, code, msg) || (code != RES_MOVED && code != RES_ASK 
+											&& code != RES_TRYAGAIN))
+				break;
+			
+			if (code == RES_TRYAGAIN) {
+				usleep(TRYAGAIN_DELAY_US); //the key is on its way, the same node is asked again
+				continue;
+			}
+			
+			if (!parse_redirect(msg, slot, node))
+				break;
+			
+			if (code == RES_ASK) {
+				asking = true;
+				continue;
+			}
+			
+			//the map has changed, probably not only for this slot
+			slots[slot] = node;
+			_fetch_slots(node);
+		}
+		
+		int32_t rv = print_resp(reply.data(), reply.size());
+		return rv < 0 ? rv : 0;
+	}
+};
+
+//splits a line of the standard input into the strings of a command
+static std::vector<std::string> split_line(const std::string &line) {
+	std::vector<std::string> cmd;
+	std::istringstream in(line);
+	std::string str;
+	while (in >> str)
+		cmd.push_back(str);
+	
+	return cmd;
+}
+
+int main(int argc, char **argv) {
+	/* ./client [-p <port>] [-c] [<command>]
+	 * -p: e.g. to query a replica or a node of a cluster
+	 * -c: the commands go to the nodes serving their keys
+	 * without a command, the commands are read from the standard input, one per line */
+	const char *port = PORT;
+	bool cluster = false;
+	int first_arg = 1;
+	while (first_arg < argc) {
+		if (strcmp(argv[first_arg], "-p") == 0 && first_arg + 1 < argc) {
+			port = argv[first_arg + 1];
+			first_arg += 2;
+		}
+		else if (strcmp(argv[first_arg], "-c") == 0) {
+			cluster = true;
+			first_arg++;
+		}
+		else
+			break;
+	}
+	
+	std::vector<std::vector<std::string>> cmds;
+	if (first_arg < argc)
+		cmds.emplace_back(argv + first_arg, argv + argc);
+	else {
+		std::string line;
+		while (std::getline(std::cin, line)) {
+			std::vector<std::string> cmd = split_line(line);
+			if (!cmd.empty())
+				cmds.push_back(std::move(cmd));
+		}
+	}
+	
+	if (cluster) {
+		ClusterClient client(std::string("127.0.0.1:") + port);
+		for (const auto &cmd : cmds) {
+			if (client.execute(cmd))
+				exit(1);
+		}
+		
+		return 0;
+	}
+	
+	int sockfd = connect_to(NULL, port);
+	if (sockfd < 0)
 		exit(1);
+	
+	for (const auto &cmd : cmds) {
+		if (send_req(sockfd, cmd) || recv_resp(sockfd)) {
+			close(sockfd);
+			exit(1);
+		}
+	}
+	
+	//a subscriber prints the messages till the server closes the connection
+	const std::string &last = cmds.empty() ? "" : cmds.back()[0];
+	if (last == "subscribe" || last == "psubscribe") {
+		while (!recv_resp(sockfd)) {}
 	}
 	
 	close(sockfd);
@@ -0,0 +1,41 @@
+#include "clock.hpp"
+
+//c
+#include <time.h> //clock_gettime() for better performance and poll() compatibility
+
+static int64_t to_ms(const struct timespec &tv) {
+	return int64_t(tv.tv_sec) * 1000 + tv.tv_nsec / 1000000;
+}
+
+static int64_t sample_ms(clockid_t clock) {
+	struct timespec tv = {0, 0};
+	clock_gettime(clock, &tv);
+	return to_ms(tv);
+}
+
+//sampled once a thread starts, so the cache is valid before its event loop runs
+thread_local int64_t Clock::mono_ms = sample_ms(CLOCK_MONOTONIC);
+thread_local int64_t Clock::unix_ms = sample_ms(CLOCK_REALTIME);
+
+void Clock::update() {
+	mono_ms = sample_ms(CLOCK_MONOTONIC);
+	unix_ms = sample_ms(CLOCK_REALTIME);
+}
+
+int64_t Clock::now_ms() {
+	return mono_ms;
+}
+
+int64_t Clock::from_unix_ms(int64_t unix_time_ms) {
+	return mono_ms + (unix_time_ms - unix_ms);
+}
+
+int64_t Clock::to_unix_ms(int64_t mono_time_ms) {
+	return unix_ms + (mono_time_ms - mono_ms);
+}
+
+int64_t Clock::precise_us() {
+	struct timespec tv = {0, 0};
+	clock_gettime(CLOCK_MONOTONIC, &tv);
+	return int64_t(tv.tv_sec) * 1000000 + tv.tv_nsec / 1000;
+}
@@ -0,0 +1,33 @@
+#ifndef __CLOCK_HPP__
+#define __CLOCK_HPP__
+
+//c++
+#include <cstdint> //int64_t
+
+/* Clock is the only time source of the server.
+ * The event loop samples the clock once per iteration(update()),
+ * so every timer, ttl and deadline of the iteration reads the same cached
+ * 64-bit millisecond value instead of calling clock_gettime() each time.
+ * The cache is per thread, so every thread with an event loop of its own
+ * (the read threads) samples its own clock and nothing is shared.
+ * Monotonic time is used for deadlines, since it never goes back,
+ * and the wall-clock is kept alongside to convert absolute unix timestamps */
+class Clock {
+private:
+	static thread_local int64_t mono_ms; //CLOCK_MONOTONIC
+	static thread_local int64_t unix_ms; //CLOCK_REALTIME, sampled together with mono_ms
+	
+public:
+	//samples both clocks into the cache
+	static void update();
+	//the cached monotonic time
+	static int64_t now_ms();
+	//converts a unix timestamp to the monotonic time base
+	static int64_t from_unix_ms(int64_t unix_time_ms);
+	//converts a monotonic time to a unix timestamp, e.g. to persist a deadline
+	static int64_t to_unix_ms(int64_t mono_time_ms);
+	//not cached, for measuring short intervals like a time budget
+	static int64_t precise_us();
+};
+
+#endif
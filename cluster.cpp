@@ -0,0 +1,573 @@
+#include "cluster.hpp"
+
+//c
+#include <errno.h>
+#include <fcntl.h> //fcntl()
+#include <netdb.h> //getaddrinfo()
+#include <netinet/in.h> //IPPROTO_TCP
+#include <netinet/tcp.h> //TCP_NODELAY
+#include <stdio.h> //rename(), snprintf()
+#include <string.h> //strerror()
+#include <sys/socket.h> //send(), recv(), connect()
+#include <unistd.h> //close()
+
+//c++
+#include <algorithm> //min, max
+#include <climits> //INT_MAX
+#include <cstring> //memcpy
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept> //invalid_argument, runtime_error
+
+//custom
+#include "clock.hpp"
+#include "protocol.hpp" //encode_request()
+
+//EAGAIN and EINTR only mean the socket isn't ready
+static bool would_block() {
+	return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+}
+
+//the score is sent as text, 17 digits restore the same double
+static std::string format_score(double score) {
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%.17g", score);
+	return buf;
+}
+
+Cluster::Cluster(bool enabled, const std::string &myself, const std::string &config_path,
+			KeyMap &hmap, TTLManager &ttl_manager, std::function<void(const std::string &)> drop)
+		: enabled(enabled), config_path(config_path), hmap(hmap), ttl_manager(ttl_manager),
+		drop(std::move(drop)), nodes{myself}, slots(CLUSTER_SLOTS, -1), importing(CLUSTER_SLOTS, -1) {
+	if (enabled)
+		_load_config();
+}
+
+Cluster::~Cluster() {
+	_close_migration_link();
+}
+
+bool Cluster::is_enabled() const {
+	return enabled;
+}
+
+int Cluster::_node_index(const std::string &node) {
+	for (size_t i = 0; i < nodes.size(); i++) {
+		if (nodes[i] == node)
+			return i;
+	}
+
+	nodes.push_back(node);
+	return nodes.size() - 1;
+}
+
+bool Cluster::_is_migrating(uint16_t slot) const {
+	return migration.state != MIGRATION_NONE && slot >= migration.from && slot <= migration.to;
+}
+
+bool Cluster::route(const std::string &key, bool write, bool asking, RingBuffer<uint8_t> &buffer) {
+	uint16_t slot = key_hash_slot(key);
+	int owner = slots[slot];
+
+	if (owner == 0) {
+		if (!_is_migrating(slot))
+			return true;
+
+		//the target may have a copy already, so the key mustn't change till it's dropped
+		if (migration.in_flight.count(key)) {
+			if (!write)
+				return true;
+
+			stats.tryagain_replies++;
+			buffer.append_err(RES_TRYAGAIN, std::to_string(slot) + " " + migration.target);
+			return false;
+		}
+
+		//a missing key either has moved or is new, the target has it from now on
+		if (ttl_manager.lookup(key) != hmap.end())
+			return true;
+
+		stats.ask_redirects++;
+		buffer.append_err(RES_ASK, std::to_string(slot) + " " + migration.target);
+		return false;
+	}
+
+	if (asking && importing[slot] >= 0)
+		return true;
+
+	if (owner < 0) {
+		buffer.append_err(RES_CLUSTERDOWN, "slot " + std::to_string(slot) + " isn't served");
+		return false;
+	}
+
+	stats.moved_redirects++;
+	buffer.append_err(RES_MOVED, std::to_string(slot) + " " + nodes[owner]);
+	return false;
+}
+
+void Cluster::assign(uint16_t from, uint16_t to, const std::string &node) {
+	//the slots are handed over by hand, e.g. a failed migration is given up
+	if (migration.state != MIGRATION_NONE && from <= migration.to && to >= migration.from) {
+		std::cout << "the migration of slots " << migration.from << "-" << migration.to
+			<< " is cancelled\n";
+		_close_migration_link();
+		migration = Migration();
+	}
+
+	int idx = _node_index(node);
+	for (size_t slot = from; slot <= to; slot++) {
+		slots[slot] = idx;
+		importing[slot] = -1;
+	}
+
+	_save_config();
+}
+
+void Cluster::import(uint16_t from, uint16_t to, const std::string &node) {
+	int idx = _node_index(node);
+	for (size_t slot = from; slot <= to; slot++)
+		importing[slot] = idx;
+}
+
+void Cluster::migrate(uint16_t from, uint16_t to, const std::string &node) {
+	if (node == nodes[0])
+		throw std::invalid_argument("the slots can't be migrated to this node");
+
+	bool resumed = migration.state == MIGRATION_FAILED && migration.from == from
+						&& migration.to == to && migration.target == node;
+	if (migration.state != MIGRATION_NONE && !resumed)
+		throw std::invalid_argument("slots " + std::to_string(migration.from) + "-"
+			+ std::to_string(migration.to) + " are being migrated to " + migration.target);
+
+	for (size_t slot = from; slot <= to; slot++) {
+		if (slots[slot] != 0)
+			throw std::invalid_argument("slot " + std::to_string(slot) + " isn't served by this node");
+	}
+
+	migration = Migration();
+	migration.from = from;
+	migration.to = to;
+	migration.target = node;
+	migration.state = MIGRATION_DOWN;
+	migration.last_try_ms = Clock::now_ms() - CLUSTER_RETRY_MS; //right away
+	std::cout << "migrating slots " << from << "-" << to << " to " << node << "\n";
+}
+
+std::vector<SlotRange> Cluster::get_ranges() const {
+	std::vector<SlotRange> ranges;
+	for (size_t slot = 0; slot < CLUSTER_SLOTS; slot++) {
+		int owner = slots[slot];
+		if (owner < 0)
+			continue;
+
+		if (!ranges.empty() && ranges.back().to + 1u == slot && ranges.back().node == nodes[owner])
+			ranges.back().to = slot;
+		else
+			ranges.push_back({uint16_t(slot), uint16_t(slot), nodes[owner]});
+	}
+
+	return ranges;
+}
+
+const std::string &Cluster::get_myself() const {
+	return nodes[0];
+}
+
+size_t Cluster::slots_assigned() const {
+	size_t n = 0;
+	for (int owner : slots)
+		n += owner >= 0;
+
+	return n;
+}
+
+size_t Cluster::slots_owned() const {
+	size_t n = 0;
+	for (int owner : slots)
+		n += owner == 0;
+
+	return n;
+}
+
+std::string Cluster::migration_status() const {
+	static const char *states[] = {"none", "connecting", "connecting", "sending", "handover", "failed"};
+	if (migration.state == MIGRATION_NONE)
+		return "none";
+
+	std::string status = std::to_string(migration.from) + "-" + std::to_string(migration.to)
+			+ " to " + migration.target + ": " + states[migration.state];
+	if (migration.state == MIGRATION_FAILED)
+		status += ", " + migration.error;
+
+	return status;
+}
+
+const ClusterStats &Cluster::get_stats() const {
+	return stats;
+}
+
+//one "<from> <to> <host>:<port>" line per range
+void Cluster::_save_config() const {
+	std::string tmp = config_path + ".tmp";
+	{
+		std::ofstream out(tmp, std::ios::trunc);
+		for (const SlotRange &range : get_ranges())
+			out << range.from << " " << range.to << " " << range.node << "\n";
+
+		if (!out) {
+			std::cerr << "can't write the cluster config " << tmp << "\n";
+			return;
+		}
+	}
+
+	if (rename(tmp.c_str(), config_path.c_str()) != 0)
+		std::cerr << "can't replace the cluster config " << config_path << ": " << strerror(errno) << "\n";
+}
+
+void Cluster::_load_config() {
+	std::ifstream in(config_path);
+	if (!in)
+		return; //a new node serves nothing
+
+	std::string line;
+	while (std::getline(in, line)) {
+		size_t from = 0, to = 0;
+		std::string node;
+		std::istringstream fields(line);
+		if (!(fields >> from >> to >> node) || from > to || to >= CLUSTER_SLOTS)
+			throw std::runtime_error("bad line in the cluster config " + config_path + ": " + line);
+
+		int idx = _node_index(node);
+		for (size_t slot = from; slot <= to; slot++)
+			slots[slot] = idx;
+	}
+
+	std::cout << "serving " << slots_owned() << " of " << slots_assigned()
+		<< " assigned slots as " << nodes[0] << "\n";
+}
+
+void Cluster::_connect() {
+	migration.last_try_ms = Clock::now_ms();
+
+	size_t colon = migration.target.rfind(':');
+	std::string host = migration.target.substr(0, colon);
+	std::string port = migration.target.substr(colon + 1);
+
+	struct addrinfo hints{}, *res;
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	int err = getaddrinfo(host.c_str(), port.c_str(), &hints, &res);
+	if (err != 0) {
+		std::cerr << "can't resolve the migration target " << host << ": " << gai_strerror(err) << "\n";
+		return;
+	}
+
+	int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+	if (fd < 0) {
+		perror("socket()");
+		freeaddrinfo(res);
+		return;
+	}
+
+	//a batch is sent at once, it mustn't wait for the acks of the previous one
+	int yes = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+	int rv = connect(fd, res->ai_addr, res->ai_addrlen);
+	freeaddrinfo(res);
+	if (rv != 0 && errno != EINPROGRESS) {
+		perror("connect() to the migration target");
+		close(fd);
+		return;
+	}
+
+	//the event loop reports when it's connected
+	migration.fd = fd;
+	migration.state = MIGRATION_CONNECTING;
+}
+
+void Cluster::_close_migration_link() {
+	if (migration.fd >= 0) {
+		close(migration.fd);
+		migration.fd = -1;
+	}
+
+	migration.output.clear();
+	migration.input.clear();
+	migration.batches.clear();
+	migration.in_flight.clear();
+}
+
+void Cluster::_migration_down() {
+	std::cerr << "the link to the migration target " << migration.target << " is lost\n";
+	_close_migration_link();
+	migration.state = MIGRATION_DOWN;
+	migration.last_try_ms = Clock::now_ms();
+}
+
+void Cluster::_fail_migration(const std::string &error) {
+	std::cerr << "the migration of slots " << migration.from << "-" << migration.to
+		<< " has failed: " << error << "\n";
+	_close_migration_link();
+	migration.state = MIGRATION_FAILED;
+	migration.error = error;
+	stats.migration_errors++;
+}
+
+size_t Cluster::_encode_key(const std::string &key, std::string &out) {
+	auto it = ttl_manager.lookup(key);
+	if (it == hmap.end())
+		return 0; //has just expired
+
+	std::vector<std::vector<std::string>> cmds;
+	const KeyValue &val = it.second();
+	if (val.type == STRING_KEY)
+		cmds.push_back({"set", key, val.str});
+	else if (val.type == LIST_KEY) {
+		//the elements are appended, so a part from an interrupted attempt goes first
+		cmds.push_back({"del", key});
+		val.list->for_each([&](const std::string &elem) {
+			cmds.push_back({"rpush", key, elem});
+		});
+	}
+	else {
+		//a member may be there from an interrupted attempt
+		cmds.push_back({"del", key});
+		val.zset->for_each([&](const std::string &name, double score) {
+			cmds.push_back({"zincrby", key, name, format_score(score)});
+		});
+	}
+
+	if (ttl_manager.has_ttl(it))
+		cmds.push_back({"pexpireat", key, std::to_string(Clock::to_unix_ms(it.meta().expire_at))});
+
+	for (const auto &cmd : cmds) {
+		encode_request({"asking"}, out);
+		size_t start = out.size();
+		encode_request(cmd, out);
+		//the target would drop the connection
+		if (out.size() - start > HEADER_SIZE + MAX_MSG_LEN)
+			throw std::length_error("the key " + key + " is too long to be migrated");
+	}
+
+	return 2 * cmds.size(); //asking is replied as well
+}
+
+void Cluster::_send_batches() {
+	while (migration.batches.size() < CLUSTER_MIGRATE_WINDOW && !migration.scan_done) {
+		std::vector<std::string> keys;
+		size_t steps = 0;
+		do {
+			migration.cursor = hmap.scan(migration.cursor, [&](KeyMap::iterator it) {
+				const std::string &key = it->get_key();
+				uint16_t slot = key_hash_slot(key);
+				//a rehash may show a key twice
+				if (slot >= migration.from && slot <= migration.to && !migration.in_flight.count(key))
+					keys.push_back(key);
+			});
+			migration.scan_done = (migration.cursor == 0);
+		} while (!migration.scan_done && keys.size() < CLUSTER_MIGRATE_BATCH
+									&& ++steps < CLUSTER_SCAN_STEPS);
+
+		Batch batch;
+		try {
+			for (const std::string &key : keys) {
+				size_t replies = _encode_key(key, migration.output);
+				if (replies == 0)
+					continue;
+
+				batch.replies += replies;
+				batch.keys.push_back(key);
+				migration.in_flight.insert(key);
+			}
+		}
+		catch (const std::length_error &e) {
+			_fail_migration(e.what());
+			return;
+		}
+
+		if (batch.replies > 0)
+			migration.batches.push_back(std::move(batch));
+
+		//a sparse range is walked over several iterations
+		if (keys.empty())
+			break;
+	}
+
+	if (migration.scan_done && migration.batches.empty()) {
+		encode_request({"cluster", "setslot", std::to_string(migration.from),
+				std::to_string(migration.to), "node", migration.target}, migration.output);
+		Batch handover;
+		handover.replies = 1;
+		handover.handover = true;
+		migration.batches.push_back(std::move(handover));
+		migration.state = MIGRATION_HANDOVER;
+	}
+}
+
+void Cluster::_read_replies() {
+	std::string &input = migration.input;
+	size_t pos = 0;
+	while (input.size() - pos >= HEADER_SIZE) {
+		uint32_t len = 0;
+		std::memcpy(&len, input.data() + pos, HEADER_SIZE);
+		if (input.size() - pos - HEADER_SIZE < len)
+			break; //the rest hasn't come yet
+
+		const char *reply = input.data() + pos + HEADER_SIZE;
+		pos += HEADER_SIZE + len;
+		if (migration.batches.empty()) {
+			_migration_down(); //a reply nobody has asked for
+			return;
+		}
+
+		//|TAG_ERR|code(4)|len(4)|msg|
+		if (len > 0 && reply[0] == TAG_ERR) {
+			std::string msg = "the target has replied with an error";
+			if (len >= 1 + 2 * HEADER_SIZE)
+				msg += ": " + std::string(reply + 1 + 2 * HEADER_SIZE, len - 1 - 2 * HEADER_SIZE);
+			_fail_migration(msg);
+			return;
+		}
+
+		Batch &batch = migration.batches.front();
+		if (--batch.replies > 0)
+			continue;
+
+		if (batch.handover) {
+			_finish_batch(batch);
+			return; //the link is closed
+		}
+
+		_finish_batch(batch);
+		migration.batches.pop_front();
+	}
+
+	input.erase(0, pos);
+}
+
+void Cluster::_finish_batch(Batch &batch) {
+	if (!batch.handover) {
+		//the target has every key of the batch
+		for (const std::string &key : batch.keys) {
+			migration.in_flight.erase(key);
+			drop(key);
+		}
+
+		stats.migrated_keys += batch.keys.size();
+		return;
+	}
+
+	std::cout << "slots " << migration.from << "-" << migration.to << " have moved to "
+		<< migration.target << "\n";
+	uint16_t from = migration.from, to = migration.to;
+	std::string target = migration.target;
+	_close_migration_link();
+	migration = Migration();
+	stats.migrations_done++;
+	assign(from, to, target);
+}
+
+std::vector<size_t> Cluster::get_fds() const {
+	std::vector<size_t> fds;
+	if (migration.fd >= 0)
+		fds.push_back(migration.fd);
+
+	return fds;
+}
+
+bool Cluster::owns(int fd) const {
+	return fd >= 0 && fd == migration.fd;
+}
+
+bool Cluster::is_readable(int fd) const {
+	return owns(fd) && migration.state >= MIGRATION_SENDING;
+}
+
+bool Cluster::is_writable(int fd) const {
+	return owns(fd) && (migration.state == MIGRATION_CONNECTING || !migration.output.empty());
+}
+
+bool Cluster::is_closing(int) const {
+	return false; //the link is closed right away
+}
+
+void Cluster::handle_read(int fd) {
+	if (!owns(fd))
+		return;
+
+	std::vector<char> chunk(CLUSTER_READ_CHUNK);
+	ssize_t rv = recv(fd, chunk.data(), chunk.size(), 0);
+	if (rv < 0 && would_block())
+		return;
+
+	if (rv <= 0) {
+		_migration_down();
+		return;
+	}
+
+	migration.input.append(chunk.data(), rv);
+	_read_replies();
+}
+
+void Cluster::handle_write(int fd) {
+	if (!owns(fd))
+		return;
+
+	if (migration.state == MIGRATION_CONNECTING) {
+		int err = 0;
+		socklen_t len = sizeof(err);
+		if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0 || err != 0) {
+			std::cerr << "can't connect to the migration target: " << strerror(err) << "\n";
+			_migration_down();
+			return;
+		}
+
+		//the keys left by the previous attempt are found by a new scan
+		migration.cursor = 0;
+		migration.scan_done = false;
+		migration.state = MIGRATION_SENDING;
+		encode_request({"cluster", "setslot", std::to_string(migration.from),
+				std::to_string(migration.to), "importing", nodes[0]}, migration.output);
+		Batch importing;
+		importing.replies = 1;
+		migration.batches.push_back(std::move(importing));
+	}
+
+	ssize_t rv = send(fd, migration.output.data(), migration.output.size(), MSG_NOSIGNAL);
+	if (rv < 0) {
+		if (!would_block())
+			_migration_down();
+		return;
+	}
+
+	migration.output.erase(0, rv);
+}
+
+void Cluster::close_link(int fd) {
+	if (owns(fd))
+		_migration_down();
+}
+
+void Cluster::run_cron() {
+	if (migration.state == MIGRATION_DOWN && Clock::now_ms() - migration.last_try_ms >= CLUSTER_RETRY_MS)
+		_connect();
+
+	if (migration.state == MIGRATION_SENDING)
+		_send_batches();
+}
+
+int Cluster::get_next_timeout() const {
+	if (migration.state == MIGRATION_DOWN) {
+		int64_t wait = migration.last_try_ms + CLUSTER_RETRY_MS - Clock::now_ms();
+		return int(std::max<int64_t>(std::min<int64_t>(wait, INT_MAX), 0));
+	}
+
+	//the next batch is sent by the next iteration, unless the window is full
+	if (migration.state == MIGRATION_SENDING && !migration.scan_done
+					&& migration.batches.size() < CLUSTER_MIGRATE_WINDOW)
+		return 0;
+
+	return -1;
+}
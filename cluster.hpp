@@ -0,0 +1,184 @@
+#ifndef __CLUSTER_HPP__
+#define __CLUSTER_HPP__
+
+/* =====================================================================
+ * Cluster mode splits the keyspace between several nodes.
+ *
+ * A key belongs to one of CLUSTER_SLOTS hash slots(CRC16 of the key or
+ * of its {hash tag} mod 16384) and every slot is served by one node.
+ * A node keeps the whole slot map and answers a key of a slot served
+ * elsewhere with a MOVED redirect "<slot> <host>:<port>", so a client
+ * caches the map and sends every command right to the node with its key.
+ * Nodes don't exchange the map by themselves: the slots are assigned by
+ * "cluster addslots"/"cluster setslot" on every node, a node which
+ * isn't told about a change redirects to the old owner, which redirects further.
+ *
+ * Live migration("cluster migrate <from> <to> <host>:<port>") moves the keys
+ * of a slot range to another node while both keep serving them:
+ *   - the source connects to the target and marks the slots there as importing
+ *   - it walks its keyspace with an incremental scan, a batch of keys per
+ *     event loop iteration, and sends each key as write commands
+ *     (set/zincrby, pexpireat) prefixed by "asking"
+ *   - a key is deleted by the source once the target has replied to
+ *     all of its commands, until then it's "in flight": it's still read
+ *     on the source, but a write to it gets TRYAGAIN, so no update is lost
+ *   - a key of a migrating slot which isn't on the source anymore(or never was)
+ *     gets an ASK redirect: the client sends "asking" and the command to the target,
+ *     which serves an importing slot only to such a command
+ *   - once the scan is over and every batch is acknowledged,
+ *     the target and then the source assign the slots to the target
+ * A lost link is reconnected and the scan starts over, the keys which have
+ * already moved aren't on the source anymore, so nothing is sent twice.
+ * =====================================================================*/
+
+//c++
+#include <cstddef> //size_t
+#include <cstdint> //uint16_t, int64_t
+#include <deque>
+#include <functional> //std::function
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+//custom
+#include "buffer.hpp" //RingBuffer
+#include "io_shared_library.hpp" //CLUSTER_SLOTS, key_hash_slot()
+#include "keyspace.hpp" //KeyMap
+#include "link_owner.hpp"
+#include "ttl_manager.hpp"
+
+constexpr size_t CLUSTER_MIGRATE_BATCH = 128; //keys sent per event loop iteration
+constexpr size_t CLUSTER_MIGRATE_WINDOW = 4; //batches sent before the target replies to the first one
+//cursor steps of the scan per batch, so a sparse slot range doesn't stall the loop
+constexpr size_t CLUSTER_SCAN_STEPS = 1024;
+constexpr int64_t CLUSTER_RETRY_MS = 1000; //a lost link to the target is reconnected after it
+constexpr size_t CLUSTER_READ_CHUNK = 64 * 1024;
+
+//a run of consecutive slots served by the same node
+struct SlotRange {
+	uint16_t from;
+	uint16_t to;
+	std::string node; //host:port
+};
+
+struct ClusterStats {
+	size_t moved_redirects = 0;
+	size_t ask_redirects = 0;
+	size_t tryagain_replies = 0;
+	size_t migrated_keys = 0;
+	size_t migrations_done = 0;
+	size_t migration_errors = 0;
+};
+
+class Cluster : public LinkOwner {
+private:
+	//the keys of a batch are dropped once the target has replied to all their commands
+	struct Batch {
+		std::vector<std::string> keys;
+		size_t replies = 0; //left
+		bool handover = false; //the target takes the slots over
+	};
+
+	enum MigrationState {
+		MIGRATION_NONE,
+		MIGRATION_DOWN, //waits to reconnect to the target
+		MIGRATION_CONNECTING,
+		MIGRATION_SENDING, //scans the slots and sends their keys
+		MIGRATION_HANDOVER, //every key is moved, the target takes the slots over
+		MIGRATION_FAILED, //stopped by an error of the target, the slots stay migrating
+	};
+
+	struct Migration {
+		MigrationState state = MIGRATION_NONE;
+		uint16_t from = 0;
+		uint16_t to = 0;
+		std::string target; //host:port
+		int fd = -1;
+		size_t cursor = 0; //of the keyspace scan
+		bool scan_done = false;
+		std::string output;
+		std::string input;
+		std::deque<Batch> batches; //sent, waiting for the replies
+		std::unordered_set<std::string> in_flight; //their keys
+		int64_t last_try_ms = 0;
+		std::string error; //why it failed
+	};
+
+	bool enabled;
+	std::string config_path;
+	KeyMap &hmap;
+	TTLManager &ttl_manager;
+	//deletes a key which has moved to the target and logs the deletion
+	std::function<void(const std::string &)> drop;
+
+	std::vector<std::string> nodes; //addresses, this node is the first one
+	std::vector<int> slots; //the index of the node serving the slot, -1 if none
+	std::vector<int> importing; //the node the slot is being imported from, -1 if none
+	Migration migration;
+	ClusterStats stats;
+
+	int _node_index(const std::string &node);
+	bool _is_migrating(uint16_t slot) const;
+	void _save_config() const;
+	void _load_config();
+
+	void _connect();
+	//closes the link, the keys in flight stay on this node
+	void _close_migration_link();
+	//the link is lost, it's reconnected after CLUSTER_RETRY_MS
+	void _migration_down();
+	//stops the migration upon an error which a retry won't fix
+	void _fail_migration(const std::string &error);
+	//sends batches until the window is full, then the handover
+	void _send_batches();
+	//appends the commands which recreate the key on the target, returns the number of commands
+	size_t _encode_key(const std::string &key, std::string &out);
+	void _read_replies();
+	void _finish_batch(Batch &batch);
+
+public:
+	Cluster(bool enabled, const std::string &myself, const std::string &config_path,
+			KeyMap &hmap, TTLManager &ttl_manager, std::function<void(const std::string &)> drop);
+	~Cluster();
+	Cluster(const Cluster &) = delete;
+	Cluster &operator=(const Cluster &) = delete;
+
+	bool is_enabled() const;
+	/* returns true if a command on the key is served by this node,
+	 * otherwise replies with a redirect(MOVED, ASK), TRYAGAIN for a write
+	 * to a key being migrated or CLUSTERDOWN for a slot nobody serves.
+	 * asking: the previous command of the client was "asking" */
+	bool route(const std::string &key, bool write, bool asking, RingBuffer<uint8_t> &buffer);
+
+	//the slots are served by the node from now on, the node may be this one
+	void assign(uint16_t from, uint16_t to, const std::string &node);
+	//the slots are being migrated from the node to this one
+	void import(uint16_t from, uint16_t to, const std::string &node);
+	//starts moving the keys of the slots to the node, throws invalid_argument
+	void migrate(uint16_t from, uint16_t to, const std::string &node);
+
+	//the slot map for the clients, one range per run of slots of the same node
+	std::vector<SlotRange> get_ranges() const;
+	const std::string &get_myself() const;
+	size_t slots_assigned() const;
+	size_t slots_owned() const;
+	//"none", or "<from>-<to> to <node>: <state>"
+	std::string migration_status() const;
+	const ClusterStats &get_stats() const;
+
+	std::vector<size_t> get_fds() const override;
+	bool owns(int fd) const override;
+	bool is_readable(int fd) const override;
+	bool is_writable(int fd) const override;
+	bool is_closing(int fd) const override;
+	void handle_read(int fd) override;
+	void handle_write(int fd) override;
+	void close_link(int fd) override;
+
+	//reconnects to the target and sends the next batches of a migration
+	void run_cron();
+	//returns ms till run_cron() is needed again, -1 if it isn't
+	int get_next_timeout() const;
+};
+
+#endif
@@ -1,15 +1,20 @@
 #include "commands.hpp"
 
+//c++
+#include <cmath> //isnan
+#include <iostream>
+
 /* GetCommand */
 void GetCommand::execute(const std::vector<std::string> &cmd, 
 			RingBuffer<uint8_t> &buffer, CommandContext &ctx) {
-	ctx.ttl_manager.process_expired();
-	
 	if (cmd.size() >= 2) {
-		auto it = ctx.hmap.search(cmd[1]);
+		auto it = ctx.ttl_manager.lookup(cmd[1]);
 		if (it != ctx.hmap.end()) {
-			auto val = it.second();
-			buffer.append_str(val);
+			const KeyValue &val = it.second();
+			if (val.type != STRING_KEY)
+				throw WrongTypeError();
+			
+			buffer.append_str(val.str);
 		}
 		else {
 			buffer.append_nil();
@@ -19,45 +24,187 @@ void GetCommand::execute(const std::vector<std::string> &cmd,
 		throw std::invalid_argument("usage: get <key>");
 }
 
+//converts a ttl or a unix timestamp to an absolute monotonic deadline in ms,
+//throws out_of_range if it doesn't fit into 64 bits
+static int64_t to_deadline(int64_t val, bool in_ms, bool absolute) {
+	constexpr int64_t max = std::numeric_limits<int64_t>::max();
+	constexpr int64_t min = std::numeric_limits<int64_t>::min();
+	
+	if (!in_ms) {
+		if (val > max / 1000 || val < min / 1000)
+			throw std::out_of_range("ttl");
+		val *= 1000;
+	}
+	
+	//both bases are ~now, so only the offset can overflow
+	int64_t base = absolute ? Clock::from_unix_ms(0) : Clock::now_ms();
+	if ((base > 0 && val > max - base) || (base < 0 && val < min - base))
+		throw std::out_of_range("ttl");
+	
+	return base + val;
+}
+
+//set's ttl arguments have to be positive numbers
+static int64_t parse_set_ttl(const std::string &arg) {
+	int64_t val = 0;
+	try {
+		val = std::stoll(arg);
+	}
+	catch(const std::invalid_argument &e) {
+		throw std::invalid_argument("invalid ttl");
+	}
+	
+	if (val <= 0)
+		throw std::invalid_argument("invalid ttl");
+	
+	return val;
+}
+
 /* SetCommand */
+void SetCommand::set_key(const std::string &key, const std::string &val,
+		const SetOptions &opts, RingBuffer<uint8_t> &buffer, CommandContext &ctx) {
+	//the only lookup, a due key counts as a missing one
+	auto it = ctx.ttl_manager.lookup(key);
+	bool exists = (it != ctx.hmap.end());
+	
+	std::string old_val;
+	if (opts.get && exists) {
+		//only a string can be returned, other types are left untouched
+		if (it.second().type != STRING_KEY)
+			throw WrongTypeError();
+		old_val = it.second().str;
+	}
+	
+	bool applied = !(opts.nx && exists) && !(opts.xx && !exists);
+	if (applied) {
+		if (exists) {
+			//the old value of any type is dropped, e.g. a whole sorted set,
+			//a big one is freed in the background
+			std::shared_ptr<void> heavy = LazyFree::heavy_part(it.second());
+			it.set_second(val);
+			ctx.lazy_free.release(std::move(heavy));
+			if (opts.ttl_mode == SetOptions::CLEAR_TTL)
+				ctx.ttl_manager.remove(it); //a new value starts without a ttl
+		}
+		else
+			it = ctx.hmap.insert_new(key, val);
+		
+		//the ttl is set before the reply, so no reader sees the key without it
+		if (opts.ttl_mode == SetOptions::NEW_TTL)
+			ctx.ttl_manager.set(it, opts.expire_at);
+	}
+	
+	if (opts.get) {
+		if (exists)
+			buffer.append_str(old_val);
+		else
+			buffer.append_nil();
+	}
+	else if (opts.nx || opts.xx)
+		buffer.append_int(applied);
+	else
+		buffer.append_nil();
+}
+
+void SetCommand::log_with_deadline(const std::string &key, const std::string &val, 
+										const SetOptions &opts) {
+	log_cmd = {"set", key, val, "pxat", std::to_string(Clock::to_unix_ms(opts.expire_at))};
+	if (opts.nx)
+		log_cmd.push_back("nx");
+	if (opts.xx)
+		log_cmd.push_back("xx");
+	if (opts.get)
+		log_cmd.push_back("get");
+}
+
 void SetCommand::execute(const std::vector<std::string> &cmd, 
 			RingBuffer<uint8_t> &buffer, CommandContext &ctx) {
-	ctx.ttl_manager.process_expired();
+	if (cmd.size() < 3)
+		throw std::invalid_argument("usage: set <key> <val> "
+					"[ex <s>|px <ms>|exat <s>|pxat <ms>|keepttl] [nx|xx] [get]");
 	
-	if (cmd.size() >= 3) {
-		//if a key already exists, its value will be overrided
-		ctx.hmap.insert(cmd[1], cmd[2]);
-		buffer.append_nil();
+	SetOptions opts;
+	try {
+		for (size_t i = 3; i < cmd.size(); i++) {
+			const std::string &opt = cmd[i];
+			bool no_ttl_yet = (opts.ttl_mode == SetOptions::CLEAR_TTL);
+			
+			if ((opt == "ex" || opt == "px" || opt == "exat" || opt == "pxat") 
+											&& no_ttl_yet && i + 1 < cmd.size()) {
+				int64_t arg = parse_set_ttl(cmd[++i]);
+				opts.ttl_mode = SetOptions::NEW_TTL;
+				opts.expire_at = to_deadline(arg, opt[0] == 'p', opt.size() == 4);
+			}
+			else if (opt == "keepttl" && no_ttl_yet)
+				opts.ttl_mode = SetOptions::KEEP_TTL;
+			else if (opt == "nx" && !opts.xx)
+				opts.nx = true;
+			else if (opt == "xx" && !opts.nx)
+				opts.xx = true;
+			else if (opt == "get")
+				opts.get = true;
+			else
+				throw std::invalid_argument("syntax error at " + opt);
+		}
+	}
+	catch(const std::invalid_argument &e) {
+		buffer.append_err(RES_INVALID, e.what());
+		return;
+	}
+	catch(const std::out_of_range &e) {
+		buffer.append_err(RES_TOOLONG, "ttl is too long");
+		return;
 	}
-	else 
-		throw std::invalid_argument("usage: set <key> <val>");
+	
+	if (opts.ttl_mode == SetOptions::NEW_TTL)
+		log_with_deadline(cmd[1], cmd[2], opts);
+	set_key(cmd[1], cmd[2], opts, buffer, ctx);
+}
+
+/* SetExCommand */
+void SetExCommand::execute(const std::vector<std::string> &cmd, 
+			RingBuffer<uint8_t> &buffer, CommandContext &ctx) {
+	if (cmd.size() != 4)
+		throw std::invalid_argument("usage: " + cmd[0] + " <key> <ttl> <val>");
+	
+	SetOptions opts;
+	try {
+		opts.ttl_mode = SetOptions::NEW_TTL;
+		opts.expire_at = to_deadline(parse_set_ttl(cmd[2]), in_ms, false);
+	}
+	catch(const std::invalid_argument &e) {
+		buffer.append_err(RES_INVALID, e.what());
+		return;
+	}
+	catch(const std::out_of_range &e) {
+		buffer.append_err(RES_TOOLONG, "ttl is too long");
+		return;
+	}
+	
+	log_with_deadline(cmd[1], cmd[3], opts);
+	set_key(cmd[1], cmd[3], opts, buffer, ctx);
 }
 
 /* DelCommand */
 void DelCommand::execute(const std::vector<std::string> &cmd, 
 			RingBuffer<uint8_t> &buffer, CommandContext &ctx) {
-	ctx.ttl_manager.process_expired();
-	
 	if (cmd.size() >= 2) {
-		auto val = ctx.hmap.erase(cmd[1]);
-		//check if succeed in key deletion
-		int rc = (val != nullptr);
-		buffer.append_int(rc);
+		//a due key counts as already deleted
+		buffer.append_int(ctx.ttl_manager.erase(cmd[1], lazy));
 	}
 	else
-		throw std::invalid_argument("usage: del <key>");
+		throw std::invalid_argument("usage: " + cmd[0] + " <key>");
 }
 
 /* ExpireCommand */
 void ExpireCommand::execute(const std::vector<std::string> &cmd, 
 			RingBuffer<uint8_t> &buffer, CommandContext &ctx) {
-	ctx.ttl_manager.process_expired();
-	
 	if (cmd.size() >= 3) {
-		try { //check that we received a valid number from stoi
-			int ttl = std::stoi(cmd[2]);
-			int32_t rc = ctx.ttl_manager.set(cmd[1], ttl);
-			buffer.append_int((int32_t)rc);
+		try { //check that we received a valid number from stoll
+			int64_t expire_at = to_deadline(std::stoll(cmd[2]), in_ms, absolute);
+			log_cmd = {"pexpireat", cmd[1], std::to_string(Clock::to_unix_ms(expire_at))};
+			TTLStatus rc = ctx.ttl_manager.set(cmd[1], expire_at);
+			buffer.append_int(rc);
 		}
 		catch(const std::invalid_argument &e) {
 			buffer.append_err(RES_INVALID, "invalid ttl");
@@ -67,14 +214,13 @@ void ExpireCommand::execute(const std::vector<std::string> &cmd,
 		}
 	}
 	else
-		throw std::invalid_argument("usage: expire <key> <ttl>");
+		throw std::invalid_argument("usage: " + cmd[0] 
+					+ (absolute ? " <key> <timestamp>" : " <key> <ttl>"));
 }
 
 /* PersistCommand */
 void PersistCommand::execute(const std::vector<std::string> &cmd, 
 			RingBuffer<uint8_t> &buffer, CommandContext &ctx) {
-	ctx.ttl_manager.process_expired();
-	
 	if (cmd.size() >= 2) {
 		TTLStatus rc = ctx.ttl_manager.remove(cmd[1]);
 		//if the key exists and hasn't expired yet: rc = OK
@@ -88,29 +234,424 @@ void PersistCommand::execute(const std::vector<std::string> &cmd,
 /* GetTTLCommand */
 void GetTTLCommand::execute(const std::vector<std::string> &cmd, 
 			RingBuffer<uint8_t> &buffer, CommandContext &ctx) {
-	ctx.ttl_manager.process_expired();
-	
 	if (cmd.size() >= 2) {
-		int rc = ctx.ttl_manager.get_ttl(cmd[1]);
-		//if the key exists and hasn't expired yet: rc = ttl
+		int64_t rc = ctx.ttl_manager.get_ttl(cmd[1]);
+		//if the key exists and hasn't expired yet: rc = ttl in ms
 		//if the has already expired or doesn't exist(which is somewhat equal): rc = EXPIRED
 		//if no ttl was set for the given key: rc = NOTTL
+		if (rc > 0 && !in_ms)
+			rc = (rc + 500) / 1000; //rounded to the closest second
 		buffer.append_int(rc);
 	}
 	else
-		throw std::invalid_argument("usage: ttl <key>");
+		throw std::invalid_argument("usage: " + cmd[0] + " <key>");
+}
+
+/* FlushAllCommand */
+void FlushAllCommand::execute(const std::vector<std::string> &cmd, 
+			RingBuffer<uint8_t> &buffer, CommandContext &ctx) {
+	if (cmd.size() == 1 || (cmd.size() == 2 && (cmd[1] == "sync" || cmd[1] == "async"))) {
+		//async detaches the keyspace in O(1) and frees it in the background
+		ctx.ttl_manager.clear(cmd.size() == 2 && cmd[1] == "async");
+		buffer.append_nil();
+	}
+	else
+		throw std::invalid_argument("usage: flushall [sync|async]");
+}
+
+/* InfoCommand */
+void InfoCommand::execute(const std::vector<std::string> &, 
+			RingBuffer<uint8_t> &buffer, CommandContext &ctx) {
+	const ExpiryStats &stats = ctx.ttl_manager.get_stats();
+	const EvictionStats &ev_stats = ctx.evictor.get_stats();
+	LazyFreeStats lf_stats = ctx.lazy_free.get_stats();
+	const PersistenceStats &rdb_stats = ctx.persistence.get_stats();
+	const AOFStats &aof_stats = ctx.aof.get_stats();
+	const ReplicationBacklog &backlog = ctx.replication.get_backlog();
+	const ReplicationStats &repl_stats = ctx.replication.get_stats();
+	EpochStats epoch_stats = Epoch::get_stats();
+	WorkerStats worker_stats = ctx.workers.get_stats();
+	const PubSubStats &pubsub_stats = ctx.pubsub.get_stats();
+	std::vector<std::string> lines = {
+		"used_memory:" + std::to_string(MemoryUsage::used()),
+		"maxmemory:" + std::to_string(ctx.evictor.get_maxmemory()),
+		"evicted_keys:" + std::to_string(ev_stats.evicted_keys),
+		"oom_rejections:" + std::to_string(ev_stats.oom_rejections),
+		"lazyfree_pending_objects:" + std::to_string(lf_stats.pending_objects),
+		"lazyfreed_objects:" + std::to_string(lf_stats.freed_objects),
+		"keys:" + std::to_string(ctx.hmap.size()),
+		"keys_with_ttl:" + std::to_string(ctx.ttl_manager.size()),
+		"expired_keys:" + std::to_string(stats.expired_keys),
+		"expire_cycles:" + std::to_string(stats.active_cycles),
+		"expire_cycles_timed_out:" + std::to_string(stats.timed_out_cycles),
+		"rdb_changes_since_last_save:" + std::to_string(rdb_stats.dirty),
+		"rdb_bgsave_in_progress:" + std::to_string(ctx.persistence.bgsave_in_progress()),
+		"rdb_last_save_time:" + std::to_string(rdb_stats.last_save_time / 1000),
+		"rdb_last_bgsave_status:" + std::string(rdb_stats.last_bgsave_ok ? "ok" : "err"),
+		"rdb_last_save_bytes:" + std::to_string(rdb_stats.last_save_bytes),
+		"rdb_last_save_us:" + std::to_string(rdb_stats.last_save_us),
+		"rdb_last_fork_us:" + std::to_string(rdb_stats.last_fork_us),
+		"rdb_last_cow_bytes:" + std::to_string(rdb_stats.last_cow_bytes),
+		"aof_enabled:" + std::to_string(ctx.aof.is_enabled()),
+		"aof_current_size:" + std::to_string(aof_stats.current_size),
+		"aof_last_write_status:" + std::string(aof_stats.last_write_ok ? "ok" : "err"),
+		"aof_delayed_writes:" + std::to_string(aof_stats.delayed_writes),
+		"aof_fsyncs:" + std::to_string(aof_stats.fsyncs.load(std::memory_order_relaxed)),
+		"aof_rewrite_in_progress:" + std::to_string(ctx.persistence.rewrite_in_progress()),
+		"aof_rewrites:" + std::to_string(aof_stats.rewrites),
+		"aof_base_size:" + std::to_string(aof_stats.base_size),
+		"aof_last_bgrewrite_status:" + std::string(rdb_stats.last_rewrite_ok ? "ok" : "err"),
+		"aof_last_rewrite_us:" + std::to_string(rdb_stats.last_rewrite_us),
+		"aof_last_cow_bytes:" + std::to_string(rdb_stats.last_rewrite_cow_bytes),
+		"role:" + std::string(ctx.replication.is_replica() ? "replica" : "master"),
+		"connected_replicas:" + std::to_string(ctx.replication.online_replicas()),
+		"master_replid:" + ctx.replication.get_replid(),
+		"master_repl_offset:" + std::to_string(ctx.replication.get_offset()),
+		"replicas_min_ack_offset:" + std::to_string(ctx.replication.min_ack_offset()),
+		"repl_backlog_active:" + std::to_string(backlog.is_active()),
+		"repl_backlog_size:" + std::to_string(backlog.get_capacity()),
+		"repl_backlog_histlen:" + std::to_string(backlog.size()),
+		"sync_full:" + std::to_string(repl_stats.sync_full),
+		"sync_partial_ok:" + std::to_string(repl_stats.sync_partial_ok),
+		"sync_partial_err:" + std::to_string(repl_stats.sync_partial_err),
+		"repl_output_limit_drops:" + std::to_string(repl_stats.output_limit_drops),
+		"cluster_enabled:" + std::to_string(ctx.cluster.is_enabled()),
+		"read_threads:" + std::to_string(ctx.read_threads.size()),
+		"read_lookups:" + std::to_string(ctx.read_threads.get_lookups()),
+		"epoch_retired_objects:" + std::to_string(epoch_stats.retired_objects),
+		"epoch_pending_objects:" + std::to_string(epoch_stats.pending_objects),
+		"worker_threads:" + std::to_string(worker_stats.threads),
+		"worker_jobs:" + std::to_string(worker_stats.jobs),
+		"worker_pending_jobs:" + std::to_string(worker_stats.pending_jobs),
+		"blocked_clients:" + std::to_string(ctx.blocked.size()),
+		"pubsub_channels:" + std::to_string(ctx.pubsub.channels_num()),
+		"pubsub_patterns:" + std::to_string(ctx.pubsub.patterns_num()),
+		"pubsub_messages:" + std::to_string(pubsub_stats.messages),
+		"pubsub_output_limit_drops:" + std::to_string(pubsub_stats.output_limit_drops),
+	};
+	
+	if (ctx.replication.is_replica()) {
+		lines.push_back("master_host:" + ctx.replication.get_master_host());
+		lines.push_back("master_port:" + ctx.replication.get_master_port());
+		lines.push_back("master_link_status:" + std::string(ctx.replication.link_is_up() ? "up" : "down"));
+		lines.push_back("master_sync_in_progress:" + std::to_string(ctx.replication.sync_in_progress()));
+		lines.push_back("master_full_syncs:" + std::to_string(repl_stats.full_syncs_done));
+		lines.push_back("master_partial_syncs:" + std::to_string(repl_stats.partial_syncs_done));
+	}
+	
+	buffer.append_arr(lines.size());
+	for (const auto &line : lines)
+		buffer.append_str(line);
+}
+
+/* SaveCommand */
+void SaveCommand::execute(const std::vector<std::string> &, 
+			RingBuffer<uint8_t> &buffer, CommandContext &ctx) {
+	if (ctx.persistence.bgsave_in_progress()) {
+		buffer.append_err(RES_BUSY, "a background save is in progress");
+		return;
+	}
+	
+	try {
+		ctx.persistence.save();
+		buffer.append_nil();
+	}
+	catch(const SnapshotError &e) {
+		buffer.append_err(RES_IOERR, e.what());
+	}
+}
+
+//only one child is forked at a time, returns true if the busy error was replied
+static bool reply_child_busy(RingBuffer<uint8_t> &buffer, CommandContext &ctx) {
+	if (ctx.persistence.bgsave_in_progress())
+		buffer.append_err(RES_BUSY, "a background save is in progress");
+	else if (ctx.persistence.rewrite_in_progress())
+		buffer.append_err(RES_BUSY, "a background append only file rewrite is in progress");
+	else
+		return false;
+	
+	return true;
+}
+
+/* BgSaveCommand */
+void BgSaveCommand::execute(const std::vector<std::string> &, 
+			RingBuffer<uint8_t> &buffer, CommandContext &ctx) {
+	if (reply_child_busy(buffer, ctx))
+		return;
+	
+	try {
+		ctx.persistence.bgsave();
+		buffer.append_str("background saving started");
+	}
+	catch(const SnapshotError &e) {
+		buffer.append_err(RES_IOERR, e.what());
+	}
+}
+
+/* BgRewriteAofCommand */
+void BgRewriteAofCommand::execute(const std::vector<std::string> &, 
+			RingBuffer<uint8_t> &buffer, CommandContext &ctx) {
+	if (!ctx.aof.is_enabled()) {
+		buffer.append_err(RES_INVALID, "append only file is disabled");
+		return;
+	}
+	
+	if (reply_child_busy(buffer, ctx))
+		return;
+	
+	try {
+		ctx.persistence.bgrewriteaof();
+		buffer.append_str("background append only file rewriting started");
+	}
+	catch(const SnapshotError &e) {
+		buffer.append_err(RES_IOERR, e.what());
+	}
+}
+
+/* a set shared with a job of the workers is being read by it,
+ * so a write goes to a copy of the set and the job keeps the old one.
+ * Only the event loop copies or drops the references, so the count is exact */
+static void unshare_zset(KeyMap::iterator &it, CommandContext &ctx) {
+	const std::shared_ptr<SortSet> &zset = it.second().zset;
+	if (zset.use_count() == 1)
+		return;
+	
+	std::vector<std::pair<std::string, double>> items;
+	items.reserve(zset->size());
+	zset->for_each([&items](const std::string &name, double score) {
+		items.emplace_back(name, score);
+	});
+	
+	auto copy = std::make_shared<SortSet>(zset_base_capacity, ctx.zset_backend);
+	copy->build_sorted(std::move(items));
+	it.set_second(KeyValue(copy));
+}
+
+//returns the sorted set stored at key or nullptr if there's no such key,
+//throws WrongTypeError if the key holds another type
+static std::shared_ptr<SortSet> share_zset(CommandContext &ctx, const std::string &key) {
+	auto it = ctx.ttl_manager.lookup(key);
+	if (it == ctx.hmap.end())
+		return nullptr;
+	
+	if (it.second().type != ZSET_KEY)
+		throw WrongTypeError();
+	
+	return it.second().zset;
+}
+
+//the same without a reference, write - the set is about to be changed
+static SortSet *find_zset(CommandContext &ctx, const std::string &key, bool write = false) {
+	auto it = ctx.ttl_manager.lookup(key);
+	if (it == ctx.hmap.end())
+		return nullptr;
+	
+	if (it.second().type != ZSET_KEY)
+		throw WrongTypeError();
+	
+	if (write)
+		unshare_zset(it, ctx);
+	
+	return it.second().zset.get();
+}
+
+//the same, but a missing set is created
+static SortSet *find_or_add_zset(CommandContext &ctx, const std::string &key) {
+	auto it = ctx.ttl_manager.lookup(key);
+	if (it == ctx.hmap.end()) {
+		auto zset = std::make_shared<SortSet>(zset_base_capacity, ctx.zset_backend);
+		it = ctx.hmap.insert_new(key, KeyValue(zset));
+	}
+	else if (it.second().type != ZSET_KEY)
+		throw WrongTypeError();
+	else
+		unshare_zset(it, ctx);
+	
+	return it.second().zset.get();
+}
+
+/* PsyncCommand */
+void PsyncCommand::execute(const std::vector<std::string> &cmd, 
+			RingBuffer<uint8_t> &buffer, CommandContext &ctx) {
+	if (cmd.size() != 3)
+		throw std::invalid_argument("usage: psync <replid> <offset>");
+	
+	if (ctx.client.fd < 0) {
+		buffer.append_err(RES_INVALID, "psync needs a connection");
+		return;
+	}
+	
+	try {
+		buffer.append_str(ctx.replication.add_replica(ctx.client.fd, cmd[1], cmd[2]));
+		//the rest of the link is the stream, not replies
+		ctx.client.replica = true;
+	}
+	catch(const std::invalid_argument &e) {
+		buffer.append_err(RES_INVALID, e.what());
+	}
+}
+
+/* ReplicaOfCommand */
+void ReplicaOfCommand::execute(const std::vector<std::string> &cmd, 
+			RingBuffer<uint8_t> &buffer, CommandContext &ctx) {
+	if (cmd.size() != 3)
+		throw std::invalid_argument("usage: replicaof <host> <port> | replicaof no one");
+	
+	if (cmd[1] == "no" && cmd[2] == "one") {
+		ctx.replication.promote();
+		buffer.append_nil();
+		return;
+	}
+	
+	if (cmd[2].empty() || cmd[2].size() > 5 || cmd[2].find_first_not_of("0123456789") != std::string::npos
+						|| std::stoul(cmd[2]) == 0 || std::stoul(cmd[2]) > 65535) {
+		buffer.append_err(RES_INVALID, "bad port: " + cmd[2]);
+		return;
+	}
+	
+	ctx.replication.replicaof(cmd[1], cmd[2]);
+	buffer.append_nil();
+}
+
+//a slot number of the cluster, throws invalid_argument
+static uint16_t parse_slot(const std::string &arg) {
+	if (arg.empty() || arg.size() > 5 || arg.find_first_not_of("0123456789") != std::string::npos
+											|| std::stoul(arg) >= CLUSTER_SLOTS)
+		throw std::invalid_argument("bad slot: " + arg);
+	
+	return std::stoul(arg);
+}
+
+//a node is addressed by <host>:<port>, throws invalid_argument
+static const std::string &check_node(const std::string &node) {
+	size_t colon = node.rfind(':');
+	std::string port = colon == std::string::npos ? "" : node.substr(colon + 1);
+	if (colon == 0 || port.empty() || port.size() > 5 
+					|| port.find_first_not_of("0123456789") != std::string::npos
+					|| std::stoul(port) == 0 || std::stoul(port) > 65535)
+		throw std::invalid_argument("a node is <host>:<port>: " + node);
+	
+	return node;
+}
+
+static void reply_cluster_info(RingBuffer<uint8_t> &buffer, const Cluster &cluster) {
+	const ClusterStats &stats = cluster.get_stats();
+	std::vector<std::string> lines = {
+		"cluster_enabled:" + std::to_string(cluster.is_enabled()),
+		"cluster_state:" + std::string(cluster.slots_assigned() == CLUSTER_SLOTS ? "ok" : "fail"),
+		"cluster_myself:" + cluster.get_myself(),
+		"cluster_slots_assigned:" + std::to_string(cluster.slots_assigned()),
+		"cluster_slots_owned:" + std::to_string(cluster.slots_owned()),
+		"cluster_migration:" + cluster.migration_status(),
+		"cluster_migrated_keys:" + std::to_string(stats.migrated_keys),
+		"cluster_migrations_done:" + std::to_string(stats.migrations_done),
+		"cluster_migration_errors:" + std::to_string(stats.migration_errors),
+		"cluster_moved_redirects:" + std::to_string(stats.moved_redirects),
+		"cluster_ask_redirects:" + std::to_string(stats.ask_redirects),
+		"cluster_tryagain_replies:" + std::to_string(stats.tryagain_replies),
+	};
+	
+	buffer.append_arr(lines.size());
+	for (const auto &line : lines)
+		buffer.append_str(line);
+}
+
+/* ClusterCommand */
+void ClusterCommand::execute(const std::vector<std::string> &cmd, 
+			RingBuffer<uint8_t> &buffer, CommandContext &ctx) {
+	const std::string sub = cmd.size() >= 2 ? cmd[1] : "";
+	bool known = (sub == "keyslot" && cmd.size() == 3) || (sub == "slots" && cmd.size() == 2)
+				|| (sub == "info" && cmd.size() == 2) || (sub == "addslots" && cmd.size() == 4)
+				|| (sub == "setslot" && cmd.size() == 6) || (sub == "migrate" && cmd.size() == 5);
+	if (!known)
+		throw std::invalid_argument("usage: cluster keyslot <key> | slots | info | addslots <from> <to> | "
+			"setslot <from> <to> node|importing <host>:<port> | migrate <from> <to> <host>:<port>");
+	
+	//the slot of a key is known without the cluster mode
+	if (sub == "keyslot") {
+		buffer.append_int(key_hash_slot(cmd[2]));
+		return;
+	}
+	
+	if (sub == "info") {
+		reply_cluster_info(buffer, ctx.cluster);
+		return;
+	}
+	
+	if (!ctx.cluster.is_enabled()) {
+		buffer.append_err(RES_INVALID, "cluster support is disabled");
+		return;
+	}
+	
+	if (sub == "slots") {
+		//[[from, to, "host:port"], ...]
+		std::vector<SlotRange> ranges = ctx.cluster.get_ranges();
+		buffer.append_arr(ranges.size());
+		for (const SlotRange &range : ranges) {
+			buffer.append_arr(3);
+			buffer.append_int(range.from);
+			buffer.append_int(range.to);
+			buffer.append_str(range.node);
+		}
+		return;
+	}
+	
+	try {
+		uint16_t from = parse_slot(cmd[2]);
+		uint16_t to = parse_slot(cmd[3]);
+		if (from > to)
+			throw std::invalid_argument("the range is empty");
+		
+		if (sub == "addslots")
+			ctx.cluster.assign(from, to, ctx.cluster.get_myself());
+		else if (sub == "migrate")
+			ctx.cluster.migrate(from, to, check_node(cmd[4]));
+		else if (cmd[4] == "node")
+			ctx.cluster.assign(from, to, check_node(cmd[5]));
+		else if (cmd[4] == "importing")
+			ctx.cluster.import(from, to, check_node(cmd[5]));
+		else
+			throw std::invalid_argument("setslot is either node or importing: " + cmd[4]);
+		
+		buffer.append_nil();
+	}
+	catch(const std::invalid_argument &e) {
+		buffer.append_err(RES_INVALID, e.what());
+	}
+}
+
+/* AskingCommand */
+void AskingCommand::execute(const std::vector<std::string> &cmd, 
+			RingBuffer<uint8_t> &buffer, CommandContext &ctx) {
+	if (cmd.size() != 1)
+		throw std::invalid_argument("usage: asking");
+	
+	ctx.client.asking = true;
+	buffer.append_nil();
 }
 
 /* ZAddCommand */
 void ZAddCommand::execute(const std::vector<std::string> &cmd,
 			RingBuffer<uint8_t> &buffer, CommandContext &ctx) {
-	if (cmd.size() >= 3) {
-		try { //check that we received a valid number from stoi
-			int score = std::stoi(cmd[2]);
-			int rc = ctx.sset.insert(cmd[1], score);
-			//rc == 1: key was added
-			//rc == 0: key was updated
-			buffer.append_int(rc);
+	if (cmd.size() >= 4 && cmd.size() % 2 == 0) {
+		try { //check that we received valid numbers from parse_score
+			//all the scores are checked before anything is added
+			std::vector<std::pair<std::string, double>> items;
+			items.reserve(cmd.size() / 2 - 1);
+			for (size_t i = 2; i < cmd.size(); i += 2)
+				items.emplace_back(cmd[i], parse_score(cmd[i + 1]));
+			
+			SortSet *zset = find_or_add_zset(ctx, cmd[1]);
+			if (items.size() == 1) {
+				int rc = zset->insert(items[0].first, items[0].second);
+				//rc == 1: key was added
+				//rc == 0: key was updated
+				buffer.append_int(rc);
+				return;
+			}
+			
+			//bulk load
+			buffer.append_int(zset->insert_many(items)); //number of added keys
 		}
 		catch(const std::invalid_argument &e) {
 			buffer.append_err(RES_INVALID, "invalid score");
@@ -120,20 +661,64 @@ void ZAddCommand::execute(const std::vector<std::string> &cmd,
 		}
 	}
 	else
-		throw std::invalid_argument("usage: zadd <key> <score>");
+		throw std::invalid_argument("usage: zadd <set> <key> <score> [<key> <score> ...]");
+}
+
+/* ZIncrByCommand */
+void ZIncrByCommand::execute(const std::vector<std::string> &cmd,
+			RingBuffer<uint8_t> &buffer, CommandContext &ctx) {
+	if (cmd.size() == 4) {
+		try { //check that we received a valid number from parse_score
+			double increment = parse_score(cmd[3]);
+			SortSet *zset = find_or_add_zset(ctx, cmd[1]);
+			buffer.append_dbl(zset->incrby(cmd[2], increment));
+		}
+		catch(const std::domain_error &e) {
+			buffer.append_err(RES_INVALID, e.what());
+		}
+		catch(const std::invalid_argument &e) {
+			buffer.append_err(RES_INVALID, "invalid increment");
+		}
+		catch(const std::out_of_range &e) {
+			buffer.append_err(RES_TOOLONG, "increment is too long");
+		}
+	}
+	else
+		throw std::invalid_argument("usage: zincrby <set> <key> <increment>");
+}
+
+/* ZRankCommand */
+void ZRankCommand::execute(const std::vector<std::string> &cmd, 
+			RingBuffer<uint8_t> &buffer, CommandContext &ctx) {
+	if (cmd.size() >= 3) {
+		SortSet *zset = find_zset(ctx, cmd[1]);
+		long rank = zset ? zset->rank(cmd[2]) : -1;
+		if (rank < 0)
+			buffer.append_nil(); //no key was found
+		else
+			buffer.append_int(rank);
+	}
+	else
+		throw std::invalid_argument("usage: zrank <set> <key>");
 }
 
 /* ZRemCommand */
 void ZRemCommand::execute(const std::vector<std::string> &cmd, 
 			RingBuffer<uint8_t> &buffer, CommandContext &ctx) {
-	if (cmd.size() >= 2) {
-		int rc = ctx.sset.erase(cmd[1]);
+	if (cmd.size() >= 3) {
+		SortSet *zset = find_zset(ctx, cmd[1], true);
+		int rc = zset ? zset->erase(cmd[2]) : 0;
 		//rc == 1: key was removed
 		//rc == 0: no key was found
+		
+		//an empty set doesn't exist, so it mustn't keep the key or its ttl
+		if (zset && zset->size() == 0)
+			ctx.ttl_manager.erase(cmd[1]);
+		
 		buffer.append_int(rc);
 	}
 	else
-		throw std::invalid_argument("usage: zrem <key>");
+		throw std::invalid_argument("usage: zrem <set> <key>");
 }
 
 /* ZRangeCommand */
@@ -141,9 +726,16 @@ void ZRangeCommand::execute(const std::vector<std::string> &cmd,
 			RingBuffer<uint8_t> &buffer, CommandContext &ctx) {
 	//TODO add an option to pass only beginning of the range
 	//TODO add an option get all keys in order(one special key as arg)
-	if (cmd.size() >= 3) {
+	if (cmd.size() >= 4) {
 		try { //check that we received a valid number from stoi
-			auto v = ctx.sset.range(std::stoi(cmd[1]), std::stoi(cmd[2]));
+			int from = std::stoi(cmd[2]);
+			int offset = std::stoi(cmd[3]);
+			SortSet *zset = find_zset(ctx, cmd[1]);
+			
+			std::vector<std::string> v;
+			if (zset)
+				v = zset->range(from, offset);
+			
 			buffer.append_arr(v.size());
 			for (auto it : v) {
 				buffer.append_str(it);
@@ -157,22 +749,451 @@ void ZRangeCommand::execute(const std::vector<std::string> &cmd,
 		}
 	}
 	else
-		throw std::invalid_argument("usage: zrange <from> <to>");
+		throw std::invalid_argument("usage: zrange <set> <from> <offset>");
+}
+
+ReplyJob ZRangeCommand::offload(const std::vector<std::string> &cmd, CommandContext &ctx) {
+	if (cmd.size() < 4)
+		return nullptr;
+	
+	int from = 0, offset = 0;
+	try {
+		from = std::stoi(cmd[2]);
+		offset = std::stoi(cmd[3]);
+	}
+	catch(const std::exception &e) {
+		return nullptr; //execute() replies with the error
+	}
+	
+	std::shared_ptr<SortSet> zset = share_zset(ctx, cmd[1]);
+	if (!zset || std::min(size_t(offset), zset->size()) < OFFLOAD_MIN_RANGE)
+		return nullptr;
+	
+	return [zset, from, offset] { return arr_reply(zset->range(from, offset)); };
+}
+
+/* ZRangeByLexCommand */
+void ZRangeByLexCommand::execute(const std::vector<std::string> &cmd, 
+			RingBuffer<uint8_t> &buffer, CommandContext &ctx) {
+	if (cmd.size() == 4 || (cmd.size() == 7 && cmd[4] == "limit")) {
+		try { 
+			size_t offset = 0;
+			size_t count = std::numeric_limits<size_t>::max();
+			if (cmd.size() == 7) { //check that we received valid numbers from stoul
+				offset = std::stoul(cmd[5]);
+				count = std::stoul(cmd[6]);
+			}
+			
+			//the reversed range is given from max to min
+			LexBound min = LexBound::parse(reverse ? cmd[3] : cmd[2]);
+			LexBound max = LexBound::parse(reverse ? cmd[2] : cmd[3]);
+			SortSet *zset = find_zset(ctx, cmd[1]);
+			
+			std::vector<std::string> v;
+			if (zset)
+				v = zset->range_by_lex(min, max, offset, count, reverse);
+			
+			buffer.append_arr(v.size());
+			for (const auto &it : v) {
+				buffer.append_str(it);
+			}
+		}
+		catch(const std::invalid_argument &e) {
+			buffer.append_err(RES_INVALID, e.what());
+		}
+		catch(const std::out_of_range &e) {
+			buffer.append_err(RES_TOOLONG, "limit is too long");
+		}
+	}
+	else if (reverse)
+		throw std::invalid_argument("usage: zrevrangebylex <set> <max> <min> [limit <offset> <count>]");
+	else
+		throw std::invalid_argument("usage: zrangebylex <set> <min> <max> [limit <offset> <count>]");
+}
+
+ReplyJob ZRangeByLexCommand::offload(const std::vector<std::string> &cmd, CommandContext &ctx) {
+	if (cmd.size() != 4 && !(cmd.size() == 7 && cmd[4] == "limit"))
+		return nullptr;
+	
+	size_t offset = 0;
+	size_t count = std::numeric_limits<size_t>::max();
+	LexBound min = {LexBound::MIN, ""}, max = {LexBound::MAX, ""};
+	try {
+		if (cmd.size() == 7) {
+			offset = std::stoul(cmd[5]);
+			count = std::stoul(cmd[6]);
+		}
+		
+		min = LexBound::parse(reverse ? cmd[3] : cmd[2]);
+		max = LexBound::parse(reverse ? cmd[2] : cmd[3]);
+	}
+	catch(const std::exception &e) {
+		return nullptr; //execute() replies with the error
+	}
+	
+	//the bounds are found in O(logN), so only a long range is worth a worker
+	std::shared_ptr<SortSet> zset = share_zset(ctx, cmd[1]);
+	double score = 0;
+	if (!zset || !zset->lex_score(score))
+		return nullptr;
+	
+	size_t names = zset->lex_count(min, max);
+	if (names <= offset || std::min(count, names - offset) < OFFLOAD_MIN_RANGE)
+		return nullptr;
+	
+	bool reverse = this->reverse;
+	return [zset, score, min, max, offset, count, reverse] {
+		return arr_reply(zset->range_by_lex(score, min, max, offset, count, reverse));
+	};
+}
+
+/* ZLexCountCommand */
+void ZLexCountCommand::execute(const std::vector<std::string> &cmd, 
+			RingBuffer<uint8_t> &buffer, CommandContext &ctx) {
+	if (cmd.size() >= 4) {
+		try {
+			LexBound min = LexBound::parse(cmd[2]);
+			LexBound max = LexBound::parse(cmd[3]);
+			SortSet *zset = find_zset(ctx, cmd[1]);
+			buffer.append_int(zset ? zset->lex_count(min, max) : 0);
+		}
+		catch(const std::invalid_argument &e) {
+			buffer.append_err(RES_INVALID, e.what());
+		}
+	}
+	else
+		throw std::invalid_argument("usage: zlexcount <set> <min> <max>");
+}
+
+/* ZAggregateCommand */
+void ZAggregateCommand::execute(const std::vector<std::string> &cmd, 
+			RingBuffer<uint8_t> &buffer, CommandContext &ctx) {
+	if (cmd.size() >= 4) {
+		try {
+			ScoreBound min = ScoreBound::parse(cmd[2]);
+			ScoreBound max = ScoreBound::parse(cmd[3]);
+			SortSet *zset = find_zset(ctx, cmd[1]);
+			
+			ScoreAggregate agg = {0, 0, 0, 0}; //a missing set is an empty one
+			if (zset)
+				agg = zset->aggregate(min, max);
+			
+			switch (kind) {
+			case SUM:
+				buffer.append_dbl(agg.sum);
+				break;
+			case AVG:
+				if (agg.count == 0) 
+					buffer.append_nil(); //no keys in the range
+				else
+					buffer.append_dbl(agg.sum / agg.count);
+				break;
+			case MINMAX:
+				buffer.append_arr(agg.count ? 2 : 0);
+				if (agg.count) {
+					buffer.append_dbl(agg.min);
+					buffer.append_dbl(agg.max);
+				}
+				break;
+			}
+		}
+		catch(const std::invalid_argument &e) {
+			buffer.append_err(RES_INVALID, e.what());
+		}
+		catch(const std::out_of_range &e) {
+			buffer.append_err(RES_TOOLONG, "score is too long");
+		}
+	}
+	else
+		throw std::invalid_argument("usage: " + cmd[0] + " <set> <min> <max>");
+}
+
+//returns the list stored at key or nullptr if there's no such key,
+//throws WrongTypeError if the key holds another type
+static PackedList *find_list(CommandContext &ctx, const std::string &key) {
+	auto it = ctx.ttl_manager.lookup(key);
+	if (it == ctx.hmap.end())
+		return nullptr;
+	
+	if (it.second().type != LIST_KEY)
+		throw WrongTypeError();
+	
+	return it.second().list.get();
+}
+
+//the same, but a missing list is created
+static PackedList *find_or_add_list(CommandContext &ctx, const std::string &key) {
+	auto it = ctx.ttl_manager.lookup(key);
+	if (it == ctx.hmap.end())
+		it = ctx.hmap.insert_new(key, KeyValue(std::make_shared<PackedList>()));
+	else if (it.second().type != LIST_KEY)
+		throw WrongTypeError();
+	
+	return it.second().list.get();
+}
+
+//returns false if there's no such list
+static bool pop_list(CommandContext &ctx, const std::string &key, bool front, std::string &val) {
+	PackedList *list = find_list(ctx, key);
+	if (!list)
+		return false;
+	
+	if (front)
+		list->pop_front(val);
+	else
+		list->pop_back(val);
+	
+	//an empty list doesn't exist, so it mustn't keep the key or its ttl
+	if (list->size() == 0)
+		ctx.ttl_manager.erase(key);
+	
+	return true;
+}
+
+/* PushCommand */
+void PushCommand::execute(const std::vector<std::string> &cmd, 
+			RingBuffer<uint8_t> &buffer, CommandContext &ctx) {
+	if (cmd.size() >= 3) {
+		PackedList *list = find_or_add_list(ctx, cmd[1]);
+		for (size_t i = 2; i < cmd.size(); i++) {
+			if (front)
+				list->push_front(cmd[i]);
+			else
+				list->push_back(cmd[i]);
+		}
+		
+		//the reply is the length with the elements the blocked clients are about to take
+		buffer.append_int(list->size());
+		ctx.blocked.signal(cmd[1]);
+	}
+	else
+		throw std::invalid_argument("usage: " + cmd[0] + " <list> <val> [<val> ...]");
+}
+
+/* PopCommand */
+void PopCommand::execute(const std::vector<std::string> &cmd, 
+			RingBuffer<uint8_t> &buffer, CommandContext &ctx) {
+	if (cmd.size() >= 2) {
+		std::string val;
+		if (pop_list(ctx, cmd[1], front, val))
+			buffer.append_str(val);
+		else
+			buffer.append_nil();
+	}
+	else
+		throw std::invalid_argument("usage: " + cmd[0] + " <list>");
+}
+
+/* BlockingPopCommand */
+void BlockingPopCommand::execute(const std::vector<std::string> &cmd, 
+			RingBuffer<uint8_t> &buffer, CommandContext &ctx) {
+	if (cmd.size() < 3)
+		throw std::invalid_argument("usage: " + cmd[0] + " <list> [<list> ...] <timeout>");
+	
+	std::vector<std::string> keys(cmd.begin() + 1, cmd.end() - 1);
+	int64_t deadline = 0;
+	try { //check that we received a valid number from stod
+		double timeout = std::stod(cmd.back());
+		if (std::isnan(timeout))
+			throw std::invalid_argument("timeout");
+		
+		if (timeout < 0) {
+			buffer.append_err(RES_INVALID, "timeout is negative");
+			return;
+		}
+		
+		if (timeout * 1000 >= double(std::numeric_limits<int64_t>::max() - Clock::now_ms()))
+			throw std::out_of_range("timeout");
+		
+		if (timeout > 0)
+			deadline = Clock::now_ms() + std::max(int64_t(timeout * 1000), int64_t(1));
+	}
+	catch(const std::invalid_argument &e) {
+		buffer.append_err(RES_INVALID, "invalid timeout");
+		return;
+	}
+	catch(const std::out_of_range &e) {
+		buffer.append_err(RES_TOOLONG, "timeout is too long");
+		return;
+	}
+	
+	//the node has the slot of the first key only
+	if (ctx.cluster.is_enabled()) {
+		for (const std::string &key : keys) {
+			if (key_hash_slot(key) != key_hash_slot(keys[0])) {
+				buffer.append_err(RES_INVALID, "keys in request don't hash to the same slot");
+				return;
+			}
+		}
+	}
+	
+	//a key of another type is an error even if a list after it has elements
+	for (const std::string &key : keys)
+		find_list(ctx, key);
+	
+	for (const std::string &key : keys) {
+		std::string val;
+		if (pop_list(ctx, key, front, val)) {
+			log_cmd = {front ? "lpop" : "rpop", key};
+			buffer.append_arr(2);
+			buffer.append_str(key);
+			buffer.append_str(val);
+			return;
+		}
+	}
+	
+	//the replayed commands and the stream of the primary never wait
+	if (ctx.client.fd < 0 || ctx.client.master) {
+		buffer.append_nil();
+		return;
+	}
+	
+	BlockedWaiter waiter;
+	waiter.client = &ctx.client;
+	waiter.seq = ctx.deferred.reserve(ctx.client);
+	waiter.keys = std::move(keys);
+	waiter.front = front;
+	waiter.deadline = deadline;
+	ctx.blocked.block(waiter);
+	ctx.client.blocked = true;
+}
+
+/* LRangeCommand */
+void LRangeCommand::execute(const std::vector<std::string> &cmd, 
+			RingBuffer<uint8_t> &buffer, CommandContext &ctx) {
+	if (cmd.size() >= 4) {
+		try { //check that we received valid numbers from stol
+			long start = std::stol(cmd[2]);
+			long stop = std::stol(cmd[3]);
+			PackedList *list = find_list(ctx, cmd[1]);
+			
+			std::vector<std::string> v;
+			if (list)
+				v = list->range(start, stop);
+			
+			buffer.append_arr(v.size());
+			for (const auto &val : v)
+				buffer.append_str(val);
+		}
+		catch(const std::invalid_argument &e) {
+			buffer.append_err(RES_INVALID, "invalid index");
+		}
+		catch(const std::out_of_range &e) {
+			buffer.append_err(RES_TOOLONG, "index is too long");
+		}
+	}
+	else
+		throw std::invalid_argument("usage: lrange <list> <start> <stop>");
+}
+
+/* LLenCommand */
+void LLenCommand::execute(const std::vector<std::string> &cmd, 
+			RingBuffer<uint8_t> &buffer, CommandContext &ctx) {
+	if (cmd.size() >= 2) {
+		PackedList *list = find_list(ctx, cmd[1]);
+		buffer.append_int(list ? list->size() : 0);
+	}
+	else
+		throw std::invalid_argument("usage: llen <list>");
+}
+
+/* SubscribeCommand */
+void SubscribeCommand::execute(const std::vector<std::string> &cmd, 
+			RingBuffer<uint8_t> &buffer, CommandContext &ctx) {
+	if (cmd.size() < 2)
+		throw std::invalid_argument("usage: " + cmd[0] + (pattern ? " <pattern> [<pattern> ...]" 
+																	: " <channel> [<channel> ...]"));
+	
+	//the messages are sent by the connection, which the replayed commands don't have
+	if (ctx.client.fd < 0 || ctx.client.master) {
+		buffer.append_err(RES_INVALID, "only a connection can subscribe");
+		return;
+	}
+	
+	size_t subscriptions = 0;
+	for (size_t i = 1; i < cmd.size(); i++)
+		subscriptions = ctx.pubsub.subscribe(ctx.client, cmd[i], pattern);
+	
+	buffer.append_int(subscriptions);
+}
+
+/* UnsubscribeCommand */
+void UnsubscribeCommand::execute(const std::vector<std::string> &cmd, 
+			RingBuffer<uint8_t> &buffer, CommandContext &ctx) {
+	std::vector<std::string> names(cmd.begin() + 1, cmd.end());
+	if (names.empty())
+		names = ctx.pubsub.get_subscriptions(ctx.client, pattern);
+	
+	for (const std::string &name : names)
+		ctx.pubsub.unsubscribe(ctx.client, name, pattern);
+	
+	buffer.append_int(ctx.client.subscriptions);
+}
+
+/* PublishCommand */
+void PublishCommand::execute(const std::vector<std::string> &cmd, 
+			RingBuffer<uint8_t> &buffer, CommandContext &ctx) {
+	if (cmd.size() != 3)
+		throw std::invalid_argument("usage: publish <channel> <message>");
+	
+	buffer.append_int(ctx.pubsub.publish(cmd[1], cmd[2]));
 }
 
 /* CommandFactory */
 CommandFactory::CommandFactory() {
 	creators_dict["get"] = [] { return std::make_unique<GetCommand>(); };
 	creators_dict["set"] = [] { return std::make_unique<SetCommand>(); };
+	creators_dict["setex"] = [] { return std::make_unique<SetExCommand>(); };
+	creators_dict["psetex"] = [] { return std::make_unique<SetExCommand>(true); };
 	creators_dict["del"] = [] { return std::make_unique<DelCommand>(); };
+	creators_dict["unlink"] = [] { return std::make_unique<DelCommand>(true); };
+	creators_dict["flushall"] = [] { return std::make_unique<FlushAllCommand>(); };
 	
 	creators_dict["expire"] = [] { return std::make_unique<ExpireCommand>(); };
+	creators_dict["pexpire"] = [] { return std::make_unique<ExpireCommand>(true); };
+	creators_dict["expireat"] = [] { return std::make_unique<ExpireCommand>(false, true); };
+	creators_dict["pexpireat"] = [] { return std::make_unique<ExpireCommand>(true, true); };
 	creators_dict["persist"] = [] { return std::make_unique<PersistCommand>(); };
 	creators_dict["ttl"] = [] { return std::make_unique<GetTTLCommand>(); };
+	creators_dict["pttl"] = [] { return std::make_unique<GetTTLCommand>(true); };
 	
+	creators_dict["info"] = [] { return std::make_unique<InfoCommand>(); };
+	creators_dict["save"] = [] { return std::make_unique<SaveCommand>(); };
+	creators_dict["bgsave"] = [] { return std::make_unique<BgSaveCommand>(); };
+	creators_dict["bgrewriteaof"] = [] { return std::make_unique<BgRewriteAofCommand>(); };
+	creators_dict["psync"] = [] { return std::make_unique<PsyncCommand>(); };
+	creators_dict["replicaof"] = [] { return std::make_unique<ReplicaOfCommand>(); };
+	creators_dict["cluster"] = [] { return std::make_unique<ClusterCommand>(); };
+	creators_dict["asking"] = [] { return std::make_unique<AskingCommand>(); };
 	creators_dict["zadd"] = [] { return std::make_unique<ZAddCommand>(); };
+	creators_dict["zincrby"] = [] { return std::make_unique<ZIncrByCommand>(); };
+	creators_dict["zrank"] = [] { return std::make_unique<ZRankCommand>(); };
 	creators_dict["zrem"] = [] { return std::make_unique<ZRemCommand>(); };
 	creators_dict["zrange"] = [] { return std::make_unique<ZRangeCommand>(); };
+	creators_dict["zrangebylex"] = [] { return std::make_unique<ZRangeByLexCommand>(); };
+	creators_dict["zrevrangebylex"] = [] { return std::make_unique<ZRangeByLexCommand>(true); };
+	creators_dict["zlexcount"] = [] { return std::make_unique<ZLexCountCommand>(); };
+	creators_dict["zsum"] = [] { 
+		return std::make_unique<ZAggregateCommand>(ZAggregateCommand::SUM); };
+	creators_dict["zavg"] = [] { 
+		return std::make_unique<ZAggregateCommand>(ZAggregateCommand::AVG); };
+	creators_dict["zminmax"] = [] { 
+		return std::make_unique<ZAggregateCommand>(ZAggregateCommand::MINMAX); };
+	
+	creators_dict["lpush"] = [] { return std::make_unique<PushCommand>(true); };
+	creators_dict["rpush"] = [] { return std::make_unique<PushCommand>(false); };
+	creators_dict["lpop"] = [] { return std::make_unique<PopCommand>(true); };
+	creators_dict["rpop"] = [] { return std::make_unique<PopCommand>(false); };
+	creators_dict["blpop"] = [] { return std::make_unique<BlockingPopCommand>(true); };
+	creators_dict["brpop"] = [] { return std::make_unique<BlockingPopCommand>(false); };
+	creators_dict["lrange"] = [] { return std::make_unique<LRangeCommand>(); };
+	creators_dict["llen"] = [] { return std::make_unique<LLenCommand>(); };
+	
+	creators_dict["subscribe"] = [] { return std::make_unique<SubscribeCommand>(false); };
+	creators_dict["psubscribe"] = [] { return std::make_unique<SubscribeCommand>(true); };
+	creators_dict["unsubscribe"] = [] { return std::make_unique<UnsubscribeCommand>(false); };
+	creators_dict["punsubscribe"] = [] { return std::make_unique<UnsubscribeCommand>(true); };
+	creators_dict["publish"] = [] { return std::make_unique<PublishCommand>(); };
 }
 
 std::unique_ptr<Command> CommandFactory::create_command(const std::string &name) {
@@ -185,27 +1206,293 @@ std::unique_ptr<Command> CommandFactory::create_command(const std::string &name)
 }
 
 /* CommandExecutor */
-CommandExecutor::CommandExecutor() 
-	: hmap(HashMap<std::string, std::string>(hmap_base_capacity)),
-										ttl_manager(hmap),
-										sset(hmap_base_capacity) {}
+CommandExecutor::CommandExecutor(const Config &config) 
+	: hmap(hmap_base_capacity),
+										ttl_manager(hmap, lazy_free, config.expiry_backend, 
+												config.maxmemory_policy),
+										aof(config.appendonly, config.appendfilename, config.appendfsync),
+										persistence(hmap, ttl_manager, aof, config.dbfilename, 
+												config.save_points, config.aof_rewrite_percentage,
+												config.aof_rewrite_min_size),
+										replication(persistence, config.dbfilename, config.repl_backlog_size,
+												[this](const std::vector<std::string> &cmd) { _apply_stream(cmd); },
+												[this] { _load_full_resync(); }),
+										evictor(hmap, ttl_manager, lazy_free, aof, replication, 
+												config.maxmemory_policy, config.maxmemory, 
+												config.maxmemory_samples),
+										cluster(config.cluster_enabled, 
+												config.cluster_announce_ip + ":" + config.port,
+												config.cluster_config_file, hmap, ttl_manager,
+												[this](const std::string &key) { _drop_migrated(key); }),
+										pubsub(config.pubsub_output_limit),
+										zset_backend(config.zset_backend),
+										stream_reply(REPLAY_REPLY_CAPACITY) {
+	if (!config.replicaof_host.empty())
+		replication.replicaof(config.replicaof_host, config.replicaof_port);
+	
+	_load();
+	read_threads.start(config.read_threads, config.read_port, hmap);
+	workers.start(config.worker_threads);
+}
+
+void CommandExecutor::_load() {
+	if (!aof.is_enabled()) {
+		persistence.load(zset_backend);
+		return;
+	}
+	
+	//the log has every write, while the snapshot may be older
+	replaying = true;
+	Client client;
+	RingBuffer<uint8_t> reply(REPLAY_REPLY_CAPACITY);
+	aof.load([this, &reply, &client](const std::vector<std::string> &cmd) {
+		do_query(cmd, reply, client);
+		reply.erase_front(reply.size());
+	}, [this](int fd, size_t size) {
+		//a rewritten log starts with the keyspace at the time of the rewrite
+		size_t keys = 0;
+		size_t bytes = Snapshot::read(fd, size, hmap, ttl_manager, zset_backend, keys);
+		std::cout << "loaded " << keys << " keys from the preamble of the append only file\n";
+		return bytes;
+	});
+	replaying = false;
+}
+
+void CommandExecutor::_apply_stream(const std::vector<std::string> &cmd) {
+	Client primary;
+	primary.master = true;
+	do_query(cmd, stream_reply, primary);
+	stream_reply.erase_front(stream_reply.size());
+}
+
+void CommandExecutor::_load_full_resync() {
+	//the snapshot of the primary is at the path of the own one by now
+	ttl_manager.clear(true);
+	persistence.load(zset_backend);
+	
+	//the log has the old keyspace
+	if (!aof.is_enabled())
+		return;
+	
+	try {
+		persistence.bgrewriteaof();
+	}
+	catch(const SnapshotError &e) {
+		std::cerr << "the append only file isn't rewritten after the full resync: " << e.what() << "\n";
+	}
+}
+
+void CommandExecutor::_drop_migrated(const std::string &key) {
+	if (!ttl_manager.erase(key, true))
+		return; //has expired meanwhile
+	
+	//the target has logged and replicated the key, so the source forgets it the same way
+	persistence.add_dirty();
+	aof.feed({"del", key});
+	replication.feed({"del", key});
+}
+
+void CommandExecutor::_serve_blocked() {
+	for (const std::string &key : blocked.take_signaled()) {
+		//one element per waiter, in the order they've blocked
+		while (const BlockedWaiter *first = blocked.first(key)) {
+			CommandContext ctx(hmap, ttl_manager, evictor, lazy_free, persistence, aof, replication,
+							cluster, read_threads, workers, deferred, blocked, pubsub, 
+							*first->client, zset_backend);
+			std::string val;
+			if (!pop_list(ctx, key, first->front, val))
+				break; //every element is taken
+			
+			BlockedWaiter waiter = blocked.unblock(first->client->id);
+			waiter.client->blocked = false;
+			deferred.complete(waiter.client->id, waiter.seq, arr_reply({key, val}));
+			
+			//logged as if the client popped it right now
+			std::vector<std::string> pop = {waiter.front ? "lpop" : "rpop", key};
+			persistence.add_dirty();
+			aof.feed(pop);
+			replication.feed(pop);
+		}
+	}
+}
+
+void CommandExecutor::_expire_blocked() {
+	for (const BlockedWaiter &waiter : blocked.take_expired(Clock::now_ms())) {
+		waiter.client->blocked = false;
+		deferred.complete(waiter.client->id, waiter.seq, std::string(1, (char)TAG_NIL));
+	}
+}
+
+void CommandExecutor::adopt_link(int fd, const std::vector<uint8_t> &pending) {
+	replication.adopt(fd, pending);
+}
+
+std::vector<LinkOwner *> CommandExecutor::get_link_owners() {
+	return {&replication, &cluster, &workers};
+}
+
+void CommandExecutor::run_cron() {
+	//frees what the read threads have left since the last iteration
+	Epoch::collect();
+	ttl_manager.active_expire_cycle();
+	persistence.run_cron();
+	replication.run_cron();
+	cluster.run_cron();
+	_expire_blocked();
+}
+
+//-1 means there's nothing to wait for
+static int min_timeout(int left, int right) {
+	if (left < 0)
+		return right;
+	
+	if (right < 0)
+		return left;
+	
+	return std::min(left, right);
+}
+
+int CommandExecutor::get_next_timeout() {
+	int timeout = min_timeout(ttl_manager.get_next_timeout(), persistence.get_next_timeout());
+	timeout = min_timeout(timeout, replication.get_next_timeout());
+	timeout = min_timeout(timeout, cluster.get_next_timeout());
+	timeout = min_timeout(timeout, Epoch::get_next_timeout());
+	timeout = min_timeout(timeout, blocked.get_next_timeout());
+	return min_timeout(timeout, aof.get_next_timeout());
+}
+
+void CommandExecutor::before_reply() {
+	aof.flush();
+	replication.flush();
+}
+
+void CommandExecutor::_offload(ReplyJob job, Client &client) {
+	uint64_t seq = deferred.reserve(client);
+	uint64_t id = client.id;
+	workers.submit([job = std::move(job)] {
+		std::string reply = job();
+		//the connection frames it, so it has to fit as an inline reply does
+		if (reply.size() > MAX_RESP_LEN)
+			return error_reply(RES_TOOLONG, "response is too long");
+		
+		return reply;
+	}, [this, id, seq](const std::string &reply) {
+		deferred.complete(id, seq, reply);
+	});
+}
 
 void CommandExecutor::do_query(const std::vector<std::string> &cmd, 
-									RingBuffer<uint8_t> &buffer) {
+									RingBuffer<uint8_t> &buffer, Client &client) {
+	if (!deferred.is_waiting(client)) {
+		_execute(cmd, buffer, client);
+		return;
+	}
+	
+	//the command runs now, its reply waits for the ones before it
+	RingBuffer<uint8_t> reply(MAX_RESP_LEN);
+	size_t waiting = client.deferred;
+	std::string payload;
+	try {
+		_execute(cmd, reply, client);
+		std::vector<uint8_t> bytes = reply.to_vector();
+		payload.assign(bytes.begin(), bytes.end());
+	}
+	catch(const std::exception &e) {
+		payload = error_reply(RES_TOOLONG, "response is too long");
+	}
+	
+	//handed over to the workers, the job has deferred its reply itself
+	if (client.deferred > waiting)
+		return;
+	
+	deferred.complete(client.id, deferred.reserve(client), payload);
+}
+
+size_t CommandExecutor::take_replies(Client &client, RingBuffer<uint8_t> &buffer) {
+	return deferred.take(client, buffer);
+}
+
+std::vector<int> CommandExecutor::get_ready_clients() {
+	std::vector<int> fds = deferred.take_ready();
+	std::vector<int> subscribers = pubsub.take_ready();
+	fds.insert(fds.end(), subscribers.begin(), subscribers.end());
+	
+	return fds;
+}
+
+void CommandExecutor::forget_client(const Client &client) {
+	blocked.unblock(client.id);
+	pubsub.forget(client);
+	deferred.forget(client);
+}
+
+void CommandExecutor::_execute(const std::vector<std::string> &cmd, 
+									RingBuffer<uint8_t> &buffer, Client &client) {
 	if (cmd.empty()) {
 		buffer.append_err(RES_NOCMD, "no input");
 		return;
 	}
 	
+	//asking is valid for the command right after it
+	bool asking = client.asking;
+	client.asking = false;
+	
 	std::unique_ptr<Command> command 
 						= CommandFactory().create_command(cmd[0]);
 	try {
 		if (command) {
-			CommandContext ctx(hmap, ttl_manager, sset);
+			//a key of a slot served by another node is redirected there
+			if (cluster.is_enabled() && command->has_key() && cmd.size() >= 2 && !client.master 
+						&& !replaying && !cluster.route(cmd[1], command->is_write(), asking, buffer))
+				return;
+			
+			//a message could be taken for the reply of any other command
+			if (client.subscriptions > 0 && !command->runs_subscribed()) {
+				buffer.append_err(RES_INVALID, "only (p)subscribe and (p)unsubscribe are allowed while subscribed");
+				return;
+			}
+			
+			//only the stream of the primary writes to a replica
+			if (command->is_write() && replication.is_replica() && !client.master && !replaying) {
+				buffer.append_err(RES_READONLY, "can't write against a read only replica");
+				return;
+			}
+			
+			//keys are evicted before a write, so the limit is kept by the write itself,
+			//a replica gets the evictions of its primary instead
+			if (command->grows_memory() && !client.master && !evictor.free_memory()) {
+				buffer.append_err(RES_OOM, "command not allowed when used memory > maxmemory");
+				return;
+			}
+			
+			CommandContext ctx(hmap, ttl_manager, evictor, lazy_free, persistence, aof, 
+										replication, cluster, read_threads, workers, deferred, blocked,
+										pubsub, client, zset_backend);
+			//the replies of the primary's stream and of the log are dropped anyway
+			if (workers.is_enabled() && client.fd >= 0 && !client.master && !replaying) {
+				ReplyJob job = command->offload(cmd, ctx);
+				if (job) {
+					_offload(std::move(job), client);
+					return;
+				}
+			}
+			
 			command->execute(cmd, buffer, ctx);
+			if (command->is_write() && !replaying) {
+				persistence.add_dirty();
+				aof.feed(command->log_form(cmd));
+				//the stream of the primary is passed on by the replication as it came
+				if (!client.master)
+					replication.feed(command->log_form(cmd));
+				
+				_serve_blocked();
+			}
 		}
 		else buffer.append_err(RES_NOCMD, "command doesn't exist");
 	}
+	catch(const WrongTypeError &e) {
+		buffer.append_err(RES_WRONGTYPE, e.what());
+	}
 	catch(const std::exception &e) {
 		buffer.append_err(RES_NOCMD, e.what());
 	}
@@ -2,6 +2,9 @@
 #define __COMMANDS_HPP__
 
 //c++
+#include <algorithm> //min
+#include <functional> //std::function
+#include <limits> //numeric_limits
 #include <stdexcept> //invalid_argument
 #include <string>
 #include <memory> //unique_ptr
@@ -9,29 +12,100 @@
 #include <vector>
 
 //custom
+#include "aof.hpp"
+#include "blocking.hpp"
 #include "buffer.hpp"
-#include "hashmap.hpp"
+#include "cluster.hpp"
+#include "config.hpp"
+#include "deferred_replies.hpp"
+#include "epoch.hpp"
+#include "eviction.hpp"
+#include "keyspace.hpp"
+#include "lazy_free.hpp"
+#include "persistence.hpp"
+#include "pubsub.hpp"
+#include "read_threads.hpp"
+#include "replication.hpp"
+#include "request_handler.hpp" //Client
 #include "sortedset.hpp"
 #include "ttl_manager.hpp"
-
-constexpr int hmap_base_capacity = 128;
+#include "worker_pool.hpp"
 
 struct CommandContext {
-	HashMap<std::string, std::string> &hmap;
+	KeyMap &hmap;
 	TTLManager &ttl_manager;
-	SortSet &sset;
+	Evictor &evictor;
+	LazyFree &lazy_free;
+	Persistence &persistence;
+	AppendOnlyFile &aof;
+	Replication &replication;
+	Cluster &cluster;
+	ReadThreads &read_threads;
+	WorkerPool &workers;
+	DeferredReplies &deferred;
+	BlockedClients &blocked;
+	PubSub &pubsub;
+	Client &client;
+	SortBackend zset_backend; //the index of the newly created sets
 	
-	 CommandContext(HashMap<std::string, std::string>& h,
+	 CommandContext(KeyMap& h,
 											TTLManager& ttl,
-											SortSet& s)
-						: hmap(h), ttl_manager(ttl), sset(s) {}
+											Evictor& ev,
+											LazyFree& lf,
+											Persistence& p,
+											AppendOnlyFile& a,
+											Replication& r,
+											Cluster& cl,
+											ReadThreads& rt,
+											WorkerPool& w,
+											DeferredReplies& d,
+											BlockedClients& b,
+											PubSub& ps,
+											Client& c,
+											SortBackend backend)
+						: hmap(h), ttl_manager(ttl), evictor(ev), lazy_free(lf), 
+						persistence(p), aof(a), replication(r), cluster(cl), read_threads(rt),
+						workers(w), deferred(d), blocked(b), pubsub(ps), client(c), zset_backend(backend) {}
 };
 
+//replies of the replayed commands are dropped, they're small for writes
+constexpr size_t REPLAY_REPLY_CAPACITY = 4096;
+/* a sorted set range walking at least so many names runs on a worker thread if there are any.
+ * A reply can't exceed MAX_RESP_LEN, so a much longer range is refused as too long,
+ * but only after the walk, which then doesn't stall the event loop either */
+constexpr size_t OFFLOAD_MIN_RANGE = 256;
+
+//the work of a command handed over to a worker thread, returns the reply without its length
+typedef std::function<std::string()> ReplyJob;
+
 class Command {
+protected:
+	//the form of the command written to the append only file
+	//if it differs from the request, e.g. with an absolute deadline
+	std::vector<std::string> log_cmd;
+	
 public:
 	virtual ~Command() {}
 	virtual void execute(const std::vector<std::string> &cmd,
 						RingBuffer<uint8_t> &buffer, CommandContext &ctx) = 0;
+	//a command which may allocate memory is refused
+	//if the memory limit is reached and nothing can be evicted
+	virtual bool grows_memory() const { return false; }
+	//a write is counted towards the snapshot save points
+	virtual bool is_write() const { return grows_memory(); }
+	//the key is cmd[1], so a cluster node serves the command only if it has the key's slot
+	virtual bool has_key() const { return true; }
+	//a connection subscribed to pub/sub channels runs only the commands which change its subscriptions
+	virtual bool runs_subscribed() const { return false; }
+	/* an expensive read may return a job instead of being executed: the job
+	 * captures a snapshot of its input(e.g. the shared_ptr of a sorted set,
+	 * which the writes then copy instead of changing) and runs on a worker thread.
+	 * An empty job means execute() runs the command on the event loop as usual */
+	virtual ReplyJob offload(const std::vector<std::string> &, CommandContext &) { return nullptr; }
+	//what a write command logs, valid after execute()
+	const std::vector<std::string> &log_form(const std::vector<std::string> &cmd) const {
+		return log_cmd.empty() ? cmd : log_cmd;
+	}
 };
 
 class GetCommand : public Command {
@@ -40,46 +114,283 @@ public:
 				RingBuffer<uint8_t> &buffer, CommandContext &ctx) override;
 };
 
+//what a set does besides writing the value
+struct SetOptions {
+	enum TTLMode {CLEAR_TTL, NEW_TTL, KEEP_TTL};
+	
+	TTLMode ttl_mode = CLEAR_TTL;
+	int64_t expire_at = 0; //monotonic deadline for NEW_TTL
+	bool nx = false; //only if the key doesn't exist
+	bool xx = false; //only if the key exists
+	bool get = false; //reply with the old value
+};
+
 class SetCommand : public Command {
+protected:
+	//writes the value and the ttl with a single lookup of the key
+	static void set_key(const std::string &key, const std::string &val, 
+			const SetOptions &opts, RingBuffer<uint8_t> &buffer, CommandContext &ctx);
+	//logs a set with a new ttl as "set <key> <val> pxat <unix ms> ..."
+	void log_with_deadline(const std::string &key, const std::string &val, const SetOptions &opts);
+	
 public:
 	void execute(const std::vector<std::string> &cmd, 
 				RingBuffer<uint8_t> &buffer, CommandContext &ctx) override;
+	bool grows_memory() const override { return true; }
+};
+
+//set <key> <val> with a mandatory ttl, in seconds or in ms
+class SetExCommand : public SetCommand {
+private:
+	bool in_ms;
+	
+public:
+	SetExCommand(bool in_ms = false) : in_ms(in_ms) {}
+	void execute(const std::vector<std::string> &cmd, 
+				RingBuffer<uint8_t> &buffer, CommandContext &ctx) override;
 };
 
 class DelCommand : public Command {
+private:
+	bool lazy; //unlink: a big value is freed in the background
+	
 public:
+	DelCommand(bool lazy = false) : lazy(lazy) {}
 	void execute(const std::vector<std::string> &cmd, 
 				RingBuffer<uint8_t> &buffer, CommandContext &ctx) override;
+	bool is_write() const override { return true; }
 };
 
 class ExpireCommand : public Command {
+private:
+	bool in_ms; //the argument is in ms instead of seconds
+	bool absolute; //the argument is a unix timestamp instead of a ttl
+	
+public:
+	ExpireCommand(bool in_ms = false, bool absolute = false) 
+									: in_ms(in_ms), absolute(absolute) {}
 	void execute(const std::vector<std::string> &cmd, 
 				RingBuffer<uint8_t> &buffer, CommandContext &ctx) override;
+	bool is_write() const override { return true; }
 };
 
 class PersistCommand : public Command {
 	void execute(const std::vector<std::string> &cmd, 
 				RingBuffer<uint8_t> &buffer, CommandContext &ctx) override;
+	bool is_write() const override { return true; }
 };
 
 class GetTTLCommand : public Command {
+private:
+	bool in_ms;
+	
+public:
+	GetTTLCommand(bool in_ms = false) : in_ms(in_ms) {}
 	void execute(const std::vector<std::string> &cmd, 
 				RingBuffer<uint8_t> &buffer, CommandContext &ctx) override;
 };
 
+class FlushAllCommand : public Command {
+	void execute(const std::vector<std::string> &cmd, 
+				RingBuffer<uint8_t> &buffer, CommandContext &ctx) override;
+	bool is_write() const override { return true; }
+	bool has_key() const override { return false; }
+};
+
+class InfoCommand : public Command {
+	void execute(const std::vector<std::string> &cmd, 
+				RingBuffer<uint8_t> &buffer, CommandContext &ctx) override;
+	bool has_key() const override { return false; }
+};
+
+//writes the snapshot on the event loop, blocking every client
+class SaveCommand : public Command {
+	void execute(const std::vector<std::string> &cmd, 
+				RingBuffer<uint8_t> &buffer, CommandContext &ctx) override;
+	bool has_key() const override { return false; }
+};
+
+//writes the snapshot in a forked child
+class BgSaveCommand : public Command {
+	void execute(const std::vector<std::string> &cmd, 
+				RingBuffer<uint8_t> &buffer, CommandContext &ctx) override;
+	bool has_key() const override { return false; }
+};
+
+class BgRewriteAofCommand : public Command {
+	void execute(const std::vector<std::string> &cmd, 
+				RingBuffer<uint8_t> &buffer, CommandContext &ctx) override;
+	bool has_key() const override { return false; }
+};
+
+//psync <replid> <offset>, sent by a replica to turn its connection into a replication link
+class PsyncCommand : public Command {
+	void execute(const std::vector<std::string> &cmd, 
+				RingBuffer<uint8_t> &buffer, CommandContext &ctx) override;
+	bool has_key() const override { return false; }
+};
+
+//replicaof <host> <port> | replicaof no one
+class ReplicaOfCommand : public Command {
+	void execute(const std::vector<std::string> &cmd, 
+				RingBuffer<uint8_t> &buffer, CommandContext &ctx) override;
+	bool has_key() const override { return false; }
+};
+
+/* cluster keyslot <key> | cluster slots | cluster info
+ * cluster addslots <from> <to>
+ * cluster setslot <from> <to> node|importing <host>:<port>
+ * cluster migrate <from> <to> <host>:<port> */
+class ClusterCommand : public Command {
+	void execute(const std::vector<std::string> &cmd, 
+				RingBuffer<uint8_t> &buffer, CommandContext &ctx) override;
+	bool has_key() const override { return false; }
+};
+
+//the next command of the connection may use a slot being imported by this node
+class AskingCommand : public Command {
+	void execute(const std::vector<std::string> &cmd, 
+				RingBuffer<uint8_t> &buffer, CommandContext &ctx) override;
+	bool has_key() const override { return false; }
+};
+
 class ZAddCommand : public Command {
 	void execute(const std::vector<std::string> &cmd,
 				RingBuffer<uint8_t> &buffer, CommandContext &ctx) override;
+	bool grows_memory() const override { return true; }
+};
+
+class ZIncrByCommand : public Command {
+	void execute(const std::vector<std::string> &cmd,
+				RingBuffer<uint8_t> &buffer, CommandContext &ctx) override;
+	bool grows_memory() const override { return true; }
+};
+
+class ZRankCommand : public Command {
+	void execute(const std::vector<std::string> &cmd, 
+				RingBuffer<uint8_t> &buffer, CommandContext &ctx) override;
 };
 
 class ZRemCommand : public Command {
 	void execute(const std::vector<std::string> &cmd, 
 				RingBuffer<uint8_t> &buffer, CommandContext &ctx) override;
+	bool is_write() const override { return true; }
 };
 
 class ZRangeCommand : public Command {
 	void execute(const std::vector<std::string> &cmd, 
 				RingBuffer<uint8_t> &buffer, CommandContext &ctx) override;
+	ReplyJob offload(const std::vector<std::string> &cmd, CommandContext &ctx) override;
+};
+
+class ZRangeByLexCommand : public Command {
+private:
+	bool reverse;
+	
+public:
+	ZRangeByLexCommand(bool reverse = false) : reverse(reverse) {}
+	void execute(const std::vector<std::string> &cmd, 
+				RingBuffer<uint8_t> &buffer, CommandContext &ctx) override;
+	ReplyJob offload(const std::vector<std::string> &cmd, CommandContext &ctx) override;
+};
+
+class ZLexCountCommand : public Command {
+	void execute(const std::vector<std::string> &cmd, 
+				RingBuffer<uint8_t> &buffer, CommandContext &ctx) override;
+};
+
+class ZAggregateCommand : public Command {
+public:
+	enum Kind {SUM, AVG, MINMAX};
+	
+	ZAggregateCommand(Kind kind) : kind(kind) {}
+	void execute(const std::vector<std::string> &cmd, 
+				RingBuffer<uint8_t> &buffer, CommandContext &ctx) override;
+
+private:
+	Kind kind;
+};
+
+//lpush|rpush <list> <val> [<val> ...]
+class PushCommand : public Command {
+private:
+	bool front;
+	
+public:
+	PushCommand(bool front) : front(front) {}
+	void execute(const std::vector<std::string> &cmd, 
+				RingBuffer<uint8_t> &buffer, CommandContext &ctx) override;
+	bool grows_memory() const override { return true; }
+};
+
+//lpop|rpop <list>
+class PopCommand : public Command {
+private:
+	bool front;
+	
+public:
+	PopCommand(bool front) : front(front) {}
+	void execute(const std::vector<std::string> &cmd, 
+				RingBuffer<uint8_t> &buffer, CommandContext &ctx) override;
+	bool is_write() const override { return true; }
+};
+
+/* blpop|brpop <list> [<list> ...] <timeout>
+ * pops the first non-empty list, or parks the client till a push to one of
+ * the lists or the timeout(in seconds, 0 - none), which is replied with nil.
+ * The pop is logged as lpop|rpop, whenever it happens */
+class BlockingPopCommand : public Command {
+private:
+	bool front;
+	
+public:
+	BlockingPopCommand(bool front) : front(front) {}
+	void execute(const std::vector<std::string> &cmd, 
+				RingBuffer<uint8_t> &buffer, CommandContext &ctx) override;
+	bool is_write() const override { return true; }
+};
+
+class LRangeCommand : public Command {
+	void execute(const std::vector<std::string> &cmd, 
+				RingBuffer<uint8_t> &buffer, CommandContext &ctx) override;
+};
+
+class LLenCommand : public Command {
+	void execute(const std::vector<std::string> &cmd, 
+				RingBuffer<uint8_t> &buffer, CommandContext &ctx) override;
+};
+
+//subscribe <channel> [<channel> ...] | psubscribe <pattern> [<pattern> ...]
+class SubscribeCommand : public Command {
+private:
+	bool pattern;
+	
+public:
+	SubscribeCommand(bool pattern) : pattern(pattern) {}
+	void execute(const std::vector<std::string> &cmd, 
+				RingBuffer<uint8_t> &buffer, CommandContext &ctx) override;
+	bool has_key() const override { return false; }
+	bool runs_subscribed() const override { return true; }
+};
+
+//unsubscribe [<channel> ...] | punsubscribe [<pattern> ...], all of them without arguments
+class UnsubscribeCommand : public Command {
+private:
+	bool pattern;
+	
+public:
+	UnsubscribeCommand(bool pattern) : pattern(pattern) {}
+	void execute(const std::vector<std::string> &cmd, 
+				RingBuffer<uint8_t> &buffer, CommandContext &ctx) override;
+	bool has_key() const override { return false; }
+	bool runs_subscribed() const override { return true; }
+};
+
+//publish <channel> <message>, the subscribers of this node get it
+class PublishCommand : public Command {
+	void execute(const std::vector<std::string> &cmd, 
+				RingBuffer<uint8_t> &buffer, CommandContext &ctx) override;
+	bool has_key() const override { return false; }
 };
 
 typedef std::function<std::unique_ptr<Command>()> Creator;
@@ -91,20 +402,63 @@ public:
 	std::unique_ptr<Command> create_command(const std::string &name);
 };
 
-class CommandExecutor {
+class CommandExecutor : public RequestHandler {
 private:
-	HashMap<std::string, std::string> hmap;
+	LazyFree lazy_free; //the first one, so it outlives the values queued to it
+	KeyMap hmap;
 	TTLManager ttl_manager;
-	SortSet sset;
+	AppendOnlyFile aof;
+	Persistence persistence;
+	Replication replication;
+	Evictor evictor;
+	Cluster cluster;
+	ReadThreads read_threads; //started once the keyspace is loaded
+	WorkerPool workers;
+	//the replies of the jobs of the workers, of the blocked clients and the ones behind them
+	DeferredReplies deferred;
+	BlockedClients blocked;
+	PubSub pubsub;
+	SortBackend zset_backend;
+	bool replaying = false; //the commands come from the append only file
+	RingBuffer<uint8_t> stream_reply; //the replies to the stream of the primary are dropped
+	
+	//loads the keyspace from the append only file or the snapshot
+	void _load();
+	//runs the command, or hands it over to the workers
+	void _execute(const std::vector<std::string> &cmd, RingBuffer<uint8_t> &buffer, Client &client);
+	//the reply of the job is deferred, it's handed over to the connection in order
+	void _offload(ReplyJob job, Client &client);
+	//applies a command of the primary's stream
+	void _apply_stream(const std::vector<std::string> &cmd);
+	//replaces the keyspace with the snapshot of a full resync
+	void _load_full_resync();
+	//pops the lists pushed to by the last command for their blocked clients
+	void _serve_blocked();
+	//replies nil to the blocked clients whose timeouts have come
+	void _expire_blocked();
+	//deletes a key which has migrated to another cluster node
+	void _drop_migrated(const std::string &key);
 	
 public:
-	CommandExecutor();
+	CommandExecutor(const Config &config);
 	
 	CommandExecutor(const CommandExecutor &) = delete;
     CommandExecutor &operator=(const CommandExecutor &) = delete;
     
+	//a reply behind a deferred one of the connection is deferred as well
 	void do_query(const std::vector<std::string> &cmd, 
-										RingBuffer<uint8_t> &buffer);
+										RingBuffer<uint8_t> &buffer, Client &client) override;
+	size_t take_replies(Client &client, RingBuffer<uint8_t> &buffer) override;
+	std::vector<int> get_ready_clients() override;
+	void forget_client(const Client &client) override;
+	//hands the connection of a new replica over to the replication
+	void adopt_link(int fd, const std::vector<uint8_t> &pending) override;
+	std::vector<LinkOwner *> get_link_owners() override;
+	void run_cron() override;
+	int get_next_timeout() override;
+	//writes the commands of the iteration to the append only file
+	//and sends them to the replicas
+	void before_reply() override;
 };
 
 #endif
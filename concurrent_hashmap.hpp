@@ -0,0 +1,169 @@
+#ifndef __CONCURRENT_HASHMAP_HPP__
+#define __CONCURRENT_HASHMAP_HPP__
+
+/* =====================================================================
+ * ConcurrentHashMap is the HashMap for several writer threads at once,
+ * e.g. for an executor which runs commands on many threads.
+ *
+ * The buckets are split into groups(stripes) and every stripe has a lock
+ * of its own, so threads working on keys of different stripes never wait
+ * for each other:
+ *   - a stripe is a whole HashMap: its own two tables and gradual rehash,
+ *     so a stripe grows by itself, a few nodes per operation under its lock,
+ *     and there's no resize which stops every thread
+ *   - the stripe of a key is picked by the high bits of the key's hash
+ *     (Fibonacci hashing), while a stripe's buckets use the low bits,
+ *     so the keys of a stripe are still spread over all of its buckets
+ *   - the stripes are cache-line aligned, so the locks of neighbouring
+ *     stripes aren't on the same line
+ * The API mirrors HashMap, but nothing returns a node: another thread
+ * may erase it right after the lock is released, so values are copied out.
+ * =====================================================================*/
+
+//c++
+#include <cassert>
+#include <cstddef> //size_t
+#include <cstdint> //uint64_t
+#include <memory> //unique_ptr, shared_ptr
+#include <mutex>
+#include <string>
+#include <vector>
+
+//custom
+#include "hashmap.hpp"
+
+constexpr size_t CONCURRENT_STRIPES = 64;
+constexpr size_t CONCURRENT_CACHE_LINE = 64;
+//2^64 / golden ratio, multiplying by it spreads any hash over the high bits
+constexpr uint64_t FIBONACCI_MULTIPLIER = 11400714819323198485ull;
+
+template <typename T, typename P>
+class ConcurrentHashMap {
+private:
+	struct alignas(CONCURRENT_CACHE_LINE) Stripe {
+		std::mutex mtx;
+		HashMap<T, P> map;
+
+		Stripe(size_t n) : map(n) {}
+	};
+
+	std::vector<std::unique_ptr<Stripe>> stripes;
+	size_t stripe_bits; //log2 of the number of stripes
+
+	//the same FNV hash as HashTable's, but all of its bits
+	static uint64_t _hash(const T &key) {
+		uint64_t hash = FNV_OFFSET_BASIS;
+		const uint8_t *arr = reinterpret_cast<const uint8_t *>(key.data());
+		for (size_t i = 0; i < key.size(); i++) {
+			hash = hash ^ arr[i];
+			hash *= FNV_PRIME;
+		}
+
+		return hash;
+	}
+
+	Stripe &_stripe_of(const T &key) {
+		if (stripe_bits == 0)
+			return *stripes[0];
+
+		return *stripes[(_hash(key) * FIBONACCI_MULTIPLIER) >> (64 - stripe_bits)];
+	}
+
+public:
+	//n - the buckets of the whole map, stripes - a power of 2
+	ConcurrentHashMap(size_t n, size_t stripes_num = CONCURRENT_STRIPES) : stripe_bits(0) {
+		assert(stripes_num > 0 && ((stripes_num - 1) & stripes_num) == 0);
+
+		while ((size_t(1) << stripe_bits) < stripes_num)
+			stripe_bits++;
+
+		//every stripe gets its share of the buckets, a power of 2 as well
+		size_t share = 1;
+		while (share * stripes_num < n)
+			share *= 2;
+
+		stripes.reserve(stripes_num);
+		for (size_t i = 0; i < stripes_num; i++)
+			stripes.push_back(std::make_unique<Stripe>(share));
+	}
+
+	ConcurrentHashMap(const ConcurrentHashMap &) = delete;
+	ConcurrentHashMap &operator=(const ConcurrentHashMap &) = delete;
+
+	//copies the value of the key into val, returns false if there's no such key
+	bool search(const T &key, P &val) {
+		Stripe &stripe = _stripe_of(key);
+		std::lock_guard<std::mutex> lock(stripe.mtx);
+
+		auto it = stripe.map.search(key);
+		if (it == stripe.map.end())
+			return false;
+
+		val = it.second();
+		return true;
+	}
+
+	bool contains(const T &key) {
+		Stripe &stripe = _stripe_of(key);
+		std::lock_guard<std::mutex> lock(stripe.mtx);
+
+		return stripe.map.search(key) != stripe.map.end();
+	}
+
+	//inserts the key or overwrites its value
+	std::shared_ptr<T> insert(const T &key, const P &value) {
+		Stripe &stripe = _stripe_of(key);
+		std::lock_guard<std::mutex> lock(stripe.mtx);
+
+		return stripe.map.insert(key, value);
+	}
+
+	/* applies fn(P &) to the value of the key under the stripe's lock,
+	 * so a read-modify-write(e.g. an increment) isn't interleaved with
+	 * another thread's one, inserts init first if there's no such key */
+	template <typename Update>
+	void update(const T &key, const P &init, Update fn) {
+		Stripe &stripe = _stripe_of(key);
+		std::lock_guard<std::mutex> lock(stripe.mtx);
+
+		auto it = stripe.map.search(key);
+		if (it == stripe.map.end())
+			it = stripe.map.insert_new(key, init);
+
+		P val = it.second();
+		fn(val);
+		it.set_second(val);
+	}
+
+	std::unique_ptr<P> erase(const T &key) {
+		Stripe &stripe = _stripe_of(key);
+		std::lock_guard<std::mutex> lock(stripe.mtx);
+
+		return stripe.map.erase(key);
+	}
+
+	//the sum of the stripes, each one is locked in turn, so it's
+	//only a snapshot of the moment if other threads keep writing
+	size_t size() {
+		size_t sum = 0;
+		for (auto &stripe : stripes) {
+			std::lock_guard<std::mutex> lock(stripe->mtx);
+			sum += stripe->map.size();
+		}
+
+		return sum;
+	}
+
+	void clear() {
+		for (auto &stripe : stripes) {
+			std::lock_guard<std::mutex> lock(stripe->mtx);
+			stripe->map.clear();
+		}
+	}
+
+	size_t stripes_num() const {
+		return stripes.size();
+	}
+};
+
+#endif
@@ -0,0 +1,222 @@
+#include "config.hpp"
+
+//c++
+#include <stdexcept> //invalid_argument
+#include <vector>
+
+//parses a number of bytes with an optional kb/mb/gb suffix
+static size_t parse_bytes(const std::string &val) {
+	size_t pos = 0;
+	unsigned long long num = std::stoull(val, &pos);
+	
+	std::string unit = val.substr(pos);
+	if (unit == "kb")
+		num <<= 10;
+	else if (unit == "mb")
+		num <<= 20;
+	else if (unit == "gb")
+		num <<= 30;
+	else if (!unit.empty())
+		throw std::invalid_argument("unknown memory unit: " + unit);
+	
+	return num;
+}
+
+//parses "<seconds> <changes> [<seconds> <changes> ...]", "" disables the save points
+static std::vector<SavePoint> parse_save_points(const std::string &val) {
+	std::vector<std::string> nums;
+	size_t pos = 0;
+	while ((pos = val.find_first_not_of(' ', pos)) != std::string::npos) {
+		size_t end = val.find(' ', pos);
+		nums.push_back(val.substr(pos, end - pos));
+		pos = end;
+	}
+	
+	if (nums.size() % 2 != 0)
+		throw std::invalid_argument("save points are pairs of <seconds> <changes>");
+	
+	std::vector<SavePoint> points;
+	for (size_t i = 0; i < nums.size(); i += 2) {
+		SavePoint point = {std::stoll(nums[i]), std::stoul(nums[i + 1])};
+		if (point.seconds <= 0 || point.changes == 0)
+			throw std::invalid_argument("save points must be positive");
+		
+		points.push_back(point);
+	}
+	
+	return points;
+}
+
+//a port number is passed to getaddrinfo() as a string
+static std::string parse_port(const std::string &val) {
+	if (val.empty() || val.size() > 5 || val.find_first_not_of("0123456789") != std::string::npos
+						|| std::stoul(val) == 0 || std::stoul(val) > 65535)
+		throw std::invalid_argument("bad port: " + val);
+	
+	return val;
+}
+
+Config Config::from_args(int argc, char **argv) {
+	Config config;
+	std::vector<std::string> args(argv + 1, argv + argc);
+	
+	for (size_t i = 0; i < args.size(); i++) {
+		const std::string &opt = args[i];
+		if (i + 1 >= args.size())
+			throw std::invalid_argument("missing value for " + opt);
+			
+		const std::string &val = args[++i];
+		if (opt == "--port") {
+			config.port = parse_port(val);
+		}
+		else if (opt == "--zset-backend") {
+			if (val == "skiplist")
+				config.zset_backend = SKIPLIST_BACKEND;
+			else if (val == "bptree")
+				config.zset_backend = BPTREE_BACKEND;
+			else
+				throw std::invalid_argument("unknown zset backend: " + val);
+		}
+		else if (opt == "--expiry-index") {
+			if (val == "heap")
+				config.expiry_backend = HEAP_EXPIRY;
+			else if (val == "wheel")
+				config.expiry_backend = WHEEL_EXPIRY;
+			else
+				throw std::invalid_argument("unknown expiry index: " + val);
+		}
+		else if (opt == "--maxmemory") {
+			config.maxmemory = parse_bytes(val);
+		}
+		else if (opt == "--maxmemory-policy") {
+			if (val == "noeviction")
+				config.maxmemory_policy = NO_EVICTION;
+			else if (val == "allkeys-lru")
+				config.maxmemory_policy = ALLKEYS_LRU;
+			else if (val == "allkeys-lfu")
+				config.maxmemory_policy = ALLKEYS_LFU;
+			else if (val == "volatile-ttl")
+				config.maxmemory_policy = VOLATILE_TTL;
+			else
+				throw std::invalid_argument("unknown maxmemory policy: " + val);
+		}
+		else if (opt == "--maxmemory-samples") {
+			config.maxmemory_samples = std::stoul(val);
+			if (config.maxmemory_samples == 0)
+				throw std::invalid_argument("maxmemory samples must be positive");
+		}
+		else if (opt == "--dbfilename") {
+			if (val.empty())
+				throw std::invalid_argument("dbfilename can't be empty");
+			config.dbfilename = val;
+		}
+		else if (opt == "--save") {
+			config.save_points = parse_save_points(val);
+		}
+		else if (opt == "--appendonly") {
+			if (val == "yes")
+				config.appendonly = true;
+			else if (val == "no")
+				config.appendonly = false;
+			else
+				throw std::invalid_argument("appendonly is yes or no: " + val);
+		}
+		else if (opt == "--appendfilename") {
+			if (val.empty())
+				throw std::invalid_argument("appendfilename can't be empty");
+			config.appendfilename = val;
+		}
+		else if (opt == "--appendfsync") {
+			if (val == "always")
+				config.appendfsync = FSYNC_ALWAYS;
+			else if (val == "everysec")
+				config.appendfsync = FSYNC_EVERYSEC;
+			else if (val == "no")
+				config.appendfsync = FSYNC_NO;
+			else
+				throw std::invalid_argument("unknown appendfsync policy: " + val);
+		}
+		else if (opt == "--auto-aof-rewrite-percentage") {
+			config.aof_rewrite_percentage = std::stoul(val);
+		}
+		else if (opt == "--auto-aof-rewrite-min-size") {
+			config.aof_rewrite_min_size = parse_bytes(val);
+		}
+		else if (opt == "--replicaof") {
+			size_t colon = val.rfind(':');
+			if (colon == std::string::npos || colon == 0)
+				throw std::invalid_argument("replicaof is <host>:<port>: " + val);
+			config.replicaof_host = val.substr(0, colon);
+			config.replicaof_port = parse_port(val.substr(colon + 1));
+		}
+		else if (opt == "--repl-backlog-size") {
+			config.repl_backlog_size = parse_bytes(val);
+			if (config.repl_backlog_size == 0)
+				throw std::invalid_argument("repl backlog size must be positive");
+		}
+		else if (opt == "--cluster-enabled") {
+			if (val == "yes")
+				config.cluster_enabled = true;
+			else if (val == "no")
+				config.cluster_enabled = false;
+			else
+				throw std::invalid_argument("cluster-enabled is yes or no: " + val);
+		}
+		else if (opt == "--cluster-announce-ip") {
+			if (val.empty())
+				throw std::invalid_argument("cluster announce ip can't be empty");
+			config.cluster_announce_ip = val;
+		}
+		else if (opt == "--cluster-config-file") {
+			if (val.empty())
+				throw std::invalid_argument("cluster config file can't be empty");
+			config.cluster_config_file = val;
+		}
+		else if (opt == "--read-threads") {
+			config.read_threads = std::stoul(val);
+			if (config.read_threads > READ_MAX_THREADS)
+				throw std::invalid_argument("read threads must be at most " 
+											+ std::to_string(READ_MAX_THREADS));
+		}
+		else if (opt == "--read-port") {
+			config.read_port = parse_port(val);
+		}
+		else if (opt == "--worker-threads") {
+			config.worker_threads = std::stoul(val);
+			if (config.worker_threads > WORKER_MAX_THREADS)
+				throw std::invalid_argument("worker threads must be at most " 
+											+ std::to_string(WORKER_MAX_THREADS));
+		}
+		else if (opt == "--pubsub-output-limit") {
+			config.pubsub_output_limit = parse_bytes(val);
+		}
+		else
+			throw std::invalid_argument("unknown option: " + opt);
+	}
+	
+	if (config.read_threads > 0) {
+		if (config.read_port.empty() || config.read_port == config.port)
+			throw std::invalid_argument("read threads need a --read-port of their own");
+		//a key of another node would be read without a redirect
+		if (config.cluster_enabled)
+			throw std::invalid_argument("read threads don't serve a cluster node");
+	}
+	
+	return config;
+}
+
+std::string Config::usage() {
+	return "usage: ./main [--port <port>] [--zset-backend skiplist|bptree] [--expiry-index heap|wheel]\n"
+		"              [--maxmemory <bytes>[kb|mb|gb]] [--maxmemory-samples <n>]\n"
+		"              [--maxmemory-policy noeviction|allkeys-lru|allkeys-lfu|volatile-ttl]\n"
+		"              [--dbfilename <file>] [--save \"<seconds> <changes> ...\"]\n"
+		"              [--appendonly yes|no] [--appendfilename <file>]\n"
+		"              [--appendfsync always|everysec|no]\n"
+		"              [--auto-aof-rewrite-percentage <n>]\n"
+		"              [--auto-aof-rewrite-min-size <bytes>[kb|mb|gb]]\n"
+		"              [--replicaof <host>:<port>] [--repl-backlog-size <bytes>[kb|mb|gb]]\n"
+		"              [--cluster-enabled yes|no] [--cluster-announce-ip <ip>]\n"
+		"              [--cluster-config-file <file>]\n"
+		"              [--read-threads <n> --read-port <port>] [--worker-threads <n>]\n"
+		"              [--pubsub-output-limit <bytes>[kb|mb|gb]]";
+}
@@ -0,0 +1,52 @@
+#ifndef __CONFIG_HPP__
+#define __CONFIG_HPP__
+
+//c++
+#include <string>
+#include <vector>
+
+//custom
+#include "aof.hpp" //FsyncPolicy
+#include "io_shared_library.hpp" //PORT
+#include "keyspace.hpp" //EvictionPolicy
+#include "persistence.hpp" //SavePoint
+#include "pubsub.hpp" //PUBSUB_OUTPUT_LIMIT
+#include "read_threads.hpp" //READ_MAX_THREADS
+#include "sortedset.hpp" //SortBackend
+#include "ttl_manager.hpp" //ExpiryBackend
+#include "worker_pool.hpp" //WORKER_MAX_THREADS
+
+/* Config holds the server settings which can be changed 
+ * from the command line, e.g.:
+ * ./main --zset-backend bptree */
+struct Config {
+	std::string port = PORT;
+	SortBackend zset_backend = SKIPLIST_BACKEND;
+	ExpiryBackend expiry_backend = HEAP_EXPIRY;
+	size_t maxmemory = 0; //bytes, 0 - no limit
+	EvictionPolicy maxmemory_policy = NO_EVICTION;
+	size_t maxmemory_samples = 5; //keys sampled per eviction
+	std::string dbfilename = "dump.rdb"; //the snapshot file
+	std::vector<SavePoint> save_points; //none - only save/bgsave write snapshots
+	bool appendonly = false; //the log replaces the snapshot on startup
+	std::string appendfilename = "appendonly.aof";
+	FsyncPolicy appendfsync = FSYNC_EVERYSEC;
+	size_t aof_rewrite_percentage = 100; //growth since the last rewrite, 0 disables it
+	size_t aof_rewrite_min_size = 64 << 20; //bytes, a smaller log isn't rewritten
+	std::string replicaof_host; //empty - a primary
+	std::string replicaof_port;
+	size_t repl_backlog_size = 1 << 20; //bytes of the stream kept for partial resyncs
+	bool cluster_enabled = false; //the node serves only the hash slots assigned to it
+	std::string cluster_announce_ip = "127.0.0.1"; //with the port, the address of the node in redirects
+	std::string cluster_config_file = "nodes.conf"; //the slot map, kept across restarts
+	size_t read_threads = 0; //threads serving get/ttl/pttl on read_port, 0 - none
+	std::string read_port;
+	size_t worker_threads = 0; //threads running long sorted set ranges, 0 - the event loop runs them
+	size_t pubsub_output_limit = PUBSUB_OUTPUT_LIMIT; //bytes of unsent messages per subscriber, 0 - no limit
+	
+	//throws invalid_argument upon an unknown option or a bad value
+	static Config from_args(int argc, char **argv);
+	static std::string usage();
+};
+
+#endif
@@ -1,17 +1,13 @@
 #include "conn_manager.hpp"
 
 /* Timer */
-Timer::Timer(size_t fd) : conn_fd(fd) {
-	struct timespec tv = {0, 0};
-	clock_gettime(CLOCK_MONOTONIC, &tv);
-	time = int(tv.tv_sec) * 1000 + tv.tv_nsec / 1000 / 1000;
-}
+Timer::Timer(size_t fd) : time(Clock::now_ms()), conn_fd(fd) {}
 
-int Timer::get_time() {
+int64_t Timer::get_time() {
 	return time;
 }
 
-void Timer::set_time(int new_time) {
+void Timer::set_time(int64_t new_time) {
 	time = new_time;
 }
 
@@ -28,16 +24,10 @@ bool Timer::operator!=(const Timer &second) const {
 }
 
 /* TimerManager */
-int TimerManager::get_monotonic_ms() {
-	struct timespec tv = {0, 0};
-	clock_gettime(CLOCK_MONOTONIC, &tv);
-	return int(tv.tv_sec) * 1000 + tv.tv_nsec / 1000 / 1000;
-}
-	
 int TimerManager::get_next_timer() {
 	//Connections timers
-	int now_ms = get_monotonic_ms();
-	int next_timer_ms = -1;
+	int64_t now_ms = Clock::now_ms();
+	int64_t next_timer_ms = -1;
 	
 	if (!timers_q.empty())
 		next_timer_ms = timers_q.front().get_time() + CONN_TIMEOUT_MS;
@@ -51,51 +41,47 @@ int TimerManager::get_next_timer() {
 		return 0; 
 	}
 		
-	return next_timer_ms - now_ms;
+	return int(next_timer_ms - now_ms);
 }
 
-//removes all expired timers 
-//and returns all related expired connections to remove
+//returns the expired connections, the timers are ordered by time
 std::vector<size_t> TimerManager::process_timers() {
 	std::vector<size_t> expired_conns;
-	int now_ms = get_monotonic_ms();
+	int64_t now_ms = Clock::now_ms();
 	
-	auto it = timers_q.begin();
-	while (it != timers_q.end()) {
-		int next_timer_ms = it->get_time() + CONN_TIMEOUT_MS;
+	for (Timer &timer : timers_q) {
+		int64_t next_timer_ms = timer.get_time() + CONN_TIMEOUT_MS;
 		if (next_timer_ms >= now_ms)
 			break; //the rest of the timers are still active
 		
-		expired_conns.push_back(it->get_connection_fd());
-		
-		//erase its timer from the queue
-		it = timers_q.erase(it);
-		if (it != timers_q.end())
-			it++;
-			
-		//TODO remove from map	
+		expired_conns.push_back(timer.get_connection_fd());
 	}
 	
 	return expired_conns;
 }
 
-Timer *TimerManager::add_timer(size_t conn_fd) {
+TimerManager::Handle TimerManager::add_timer(size_t conn_fd) {
 	//start timer and add it to the queue
 	timers_q.push_back(Timer(conn_fd));
 	
-	return &timers_q.back();
+	return std::prev(timers_q.end());
 }
 
-void TimerManager::remove_timer(Timer *timer) {
-	auto it = std::find(timers_q.begin(), timers_q.end(), *timer);
-	if (it != timers_q.end()) {
-		timers_q.erase(it);
-	}
+void TimerManager::reset_timer(Handle timer) {
+	timer->set_time(Clock::now_ms());
+	timers_q.splice(timers_q.end(), timers_q, timer);
+}
+
+void TimerManager::remove_timer(Handle timer) {
+	timers_q.erase(timer);
 }
 
 /* Conn */
-Conn::Conn(int fd) : socket_fd(fd), 
-		incoming(BUFF_CAPACITY), outgoing(BUFF_CAPACITY) {}
+Conn::Conn(int fd, uint64_t id) : socket_fd(fd), 
+		incoming(BUFF_CAPACITY), outgoing(OUT_BUFF_CAPACITY) {
+	client.id = id;
+	client.fd = fd;
+}
 
 //Getters
 int Conn::get_fd() const {
@@ -114,10 +100,26 @@ bool Conn::is_closing() const {
 	return want_close;
 }
 
-Timer *Conn::get_timer() const {
+bool Conn::is_replica() const {
+	return client.replica;
+}
+
+bool Conn::has_backlog() const {
+	return !incoming.empty() || client.deferred > 0;
+}
+
+bool Conn::is_waiting() const {
+	return client.deferred > 0 || client.subscriptions > 0;
+}
+
+TimerManager::Handle Conn::get_timer() const {
 	return timer;
 }
 
+const Client &Conn::get_client() const {
+	return client;
+}
+
 //Setters
 void Conn::set_want_read(bool isRead) {
 	want_read = isRead;
@@ -131,14 +133,10 @@ void Conn::mark_as_closing() {
 	want_close = true;
 }
 
-void Conn::set_timer(Timer *t) {
+void Conn::set_timer(TimerManager::Handle t) {
 	timer = t;
 }
 
-void Conn::append_to_outgoing(size_t len) {
-	outgoing.insert(incoming.begin(), incoming.begin() + len);
-}
-
 void Conn::append_to_incoming(std::vector<uint8_t>& buff, size_t len) {
 	incoming.insert(buff.begin(), buff.begin() + len);
 }
@@ -149,6 +147,14 @@ void Conn::consume_from_incoming(size_t len) {
 
 void Conn::consume_from_outgoing(size_t len) {
 	outgoing.erase_front(len);
+	out_sent += len;
+}
+
+std::vector<uint8_t> Conn::take_outgoing() {
+	std::vector<uint8_t> pending = outgoing.to_vector();
+	outgoing.erase_front(outgoing.size());
+	
+	return pending;
 }
 
 void Conn::prepare_for_response(size_t *header) {
@@ -165,7 +171,7 @@ void Conn::complete_response(size_t header) {
 	outgoing.memcpy(header, (uint8_t *)&resp_size, HEADER_SIZE);
 }
 
-bool Conn::handle_request(CommandExecutor &command_exec) {
+bool Conn::handle_request(RequestHandler &handler) {
 
 	if (incoming.size() < HEADER_SIZE)
 		return false; //not ready yet
@@ -197,45 +203,84 @@ bool Conn::handle_request(CommandExecutor &command_exec) {
 		return false;
 	}
 	
+	//the messages published before the request go before its reply
+	_take_pushed();
+	
 	//process the cmd by finding its arg in HashMap
 	//create a response, serialize it and add to outgoing buff
 	size_t header_pos = 0;
+	size_t deferred = client.deferred;
 	prepare_for_response(&header_pos);
 	try {
-		command_exec.do_query(result.cmd, outgoing); 
-	}//TODO clear already inserted parts from output in case of exception
+		handler.do_query(result.cmd, outgoing, client); 
+	}
 	catch (const std::exception &e) {
+		//the part of the reply which has fit is dropped
+		outgoing.erase_back(outgoing.size() - header_pos - HEADER_SIZE);
 		outgoing.append_err(RES_TOOLONG, "response is too long");
-		return false;
 	}
-	complete_response(header_pos);
 	
-	append_to_outgoing(packet_len);
+	//the reply comes later, it's framed by the handler
+	if (client.deferred > deferred)
+		outgoing.erase_back(HEADER_SIZE);
+	else
+		complete_response(header_pos);
+	
 	consume_from_incoming(packet_len);
 		
 	return true;	
 }
 
-void Conn::handle_write() {
-	assert(outgoing.size() > 0);
-	ssize_t rv = send(socket_fd, outgoing.data(), outgoing.size(), 0);
-	if (rv < 0) {
+ssize_t Conn::_send_next() {
+	if (!pushed.empty() && pushed.front().after == out_sent) {
+		const std::string &payload = *pushed.front().payload;
+		ssize_t rv = send(socket_fd, payload.data() + pushed_sent, 
+									payload.size() - pushed_sent, MSG_NOSIGNAL);
+		if (rv <= 0)
+			return rv;
 		
-		if (errno & EAGAIN)
-			return; //not ready yet
+		pushed_sent += rv;
+		client.pushed_bytes -= rv;
+		if (pushed_sent == payload.size()) {
+			pushed.pop_front(); //the last connection to send it frees the payload
+			pushed_sent = 0;
+		}
 		
-		mark_as_closing();
-		return; //error
-	}	
-	consume_from_outgoing((size_t)rv);
+		return rv;
+	}
+	
+	size_t len = pushed.empty() ? outgoing.size() : pushed.front().after - out_sent;
+	//a subscriber may have gone long before its messages are sent
+	ssize_t rv = send(socket_fd, outgoing.data(), len, MSG_NOSIGNAL);
+	if (rv > 0)
+		consume_from_outgoing((size_t)rv);
 	
-	if (outgoing.size() == 0) {
-		want_read = true;
-		want_write = false;
+	return rv;
+}
+
+void Conn::handle_write() {
+	assert(outgoing.size() > 0 || !pushed.empty());
+	//the replies and the messages in the order they were queued, till the socket is full
+	while (outgoing.size() > 0 || !pushed.empty()) {
+		ssize_t rv = _send_next();
+		if (rv < 0) {
+			
+			if (errno & EAGAIN)
+				return; //not ready yet
+			
+			mark_as_closing();
+			return; //error
+		}
+		
+		if (rv == 0)
+			return;
 	}
+	
+	want_read = true;
+	want_write = false;
 }
 
-void Conn::handle_read(CommandExecutor &command_exec) {
+void Conn::handle_read(RequestHandler &handler) {
 	std::vector<uint8_t> rbuf(HEADER_SIZE + MAX_MSG_LEN + 1);
 	ssize_t rv = recv(socket_fd, rbuf.data(), rbuf.size(), 0);
 	if (rv <= 0) {
@@ -253,18 +298,54 @@ void Conn::handle_read(CommandExecutor &command_exec) {
 	append_to_incoming(rbuf, (size_t)rv);
 	//incoming.insert(rbuf.begin(), rbuf.begin() + (size_t)rv);
 	
-	//for a pipeline
-	while (handle_request(command_exec)) {}
+	_handle_requests(handler);
+}
+
+void Conn::handle_replies(RequestHandler &handler) {
+	_take_pushed();
+	client.deferred -= handler.take_replies(client, outgoing);
 	
-	if (outgoing.size() > 0) {
+	//a reply which doesn't fit is taken once outgoing is sent
+	_handle_requests(handler);
+}
+
+void Conn::_handle_requests(RequestHandler &handler) {
+	//for a pipeline, nothing but the stream follows psync.
+	//A request is taken only while the longest reply still fits into outgoing,
+	//the rest of the pipeline waits till outgoing is sent
+	while (!client.replica && !client.blocked && client.deferred < MAX_DEFERRED 
+			&& outgoing.free_space() >= HEADER_SIZE + MAX_RESP_LEN && handle_request(handler)) {}
+	
+	//the reply is sent by the connection manager once the writes
+	//of the whole iteration are logged(group commit)
+	if (outgoing.size() > 0 || !pushed.empty()) {
 		want_read = false;
 		want_write = true;
-		
-		return handle_write();
 	}
+	else if (client.blocked)
+		//reads only to notice the peer closing the connection, while a read still fits
+		want_read = incoming.free_space() >= HEADER_SIZE + MAX_MSG_LEN + 1;
+	else
+		want_read = client.deferred < MAX_DEFERRED;
+}
+
+void Conn::_take_pushed() {
+	//a subscriber which can't keep up is dropped with whatever it has queued
+	if (client.cut_off) {
+		mark_as_closing();
+		return;
+	}
+	
+	for (auto &payload : client.pushed)
+		pushed.push_back({std::move(payload), out_sent + outgoing.size()});
+	
+	client.pushed.clear();
 }
 
 /* ConnectionManager */
+ConnectionManager::ConnectionManager(std::unique_ptr<RequestHandler> handler) 
+										: handler(std::move(handler)) {}
+
 int ConnectionManager::handle_accept(int listen_fd) {
 	char ip[INET6_ADDRSTRLEN];
 	struct sockaddr_storage client_addr;
@@ -286,9 +367,14 @@ int ConnectionManager::handle_accept(int listen_fd) {
 	//set read and write timeouts:
 	setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof tv);
 	setsockopt(client_fd, SOL_SOCKET, SO_SNDTIMEO, (const char*)&tv, sizeof tv);
+	
+	//the replies of a pipeline go out in several sends, Nagle's algorithm
+	//would hold each of them until the client's delayed ack of the previous one
+	int yes = 1;
+	setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
 
 	
-	auto new_conn = std::make_unique<Conn>(Conn(client_fd));
+	auto new_conn = std::make_unique<Conn>(Conn(client_fd, next_client_id++));
 	// want to read first request
 	new_conn->set_want_read(true);
 	new_conn->set_timer(tm.add_timer(client_fd));
@@ -305,9 +391,31 @@ void ConnectionManager::close_conn(size_t conn_fd) {
 		std::cout << "removing connection " << conn_fd << "\n";
 		const auto &conn_ptr = it->second;
 		tm.remove_timer(conn_ptr->get_timer());
+		handler->forget_client(conn_ptr->get_client());
 		while ((close(conn_fd) == -1) && (errno & (EINTR | EIO)));
-		fd2conn[conn_fd].reset(); //clean unique_ptr
+		fd2conn.erase(it);
+	}
+	else if (LinkOwner *owner = _link_owner(conn_fd))
+		owner->close_link(conn_fd);
+}
+
+LinkOwner *ConnectionManager::_link_owner(size_t conn_fd) {
+	for (LinkOwner *owner : handler->get_link_owners()) {
+		if (owner->owns(conn_fd))
+			return owner;
 	}
+	
+	return nullptr;
+}
+
+void ConnectionManager::_hand_over(size_t conn_fd) {
+	auto it = fd2conn.find(conn_fd);
+	Conn &conn = *it->second;
+	
+	//the link doesn't time out, and the reply to psync goes first
+	tm.remove_timer(conn.get_timer());
+	handler->adopt_link(conn_fd, conn.take_outgoing());
+	fd2conn.erase(it);
 }
 
 bool ConnectionManager::is_closing(size_t conn_fd) {
@@ -318,7 +426,9 @@ bool ConnectionManager::is_closing(size_t conn_fd) {
 		return conn_ptr->is_closing();
 	}
 	
-	return false; //if conn_fd is invalid there's nothing to close
+	//a link of a module or an invalid fd, which has nothing to close
+	LinkOwner *owner = _link_owner(conn_fd);
+	return owner && owner->is_closing(conn_fd);
 }
 
 bool ConnectionManager::is_readable(size_t conn_fd) {
@@ -329,7 +439,8 @@ bool ConnectionManager::is_readable(size_t conn_fd) {
 		return conn_ptr->is_readable();
 	}
 	
-	return false;
+	LinkOwner *owner = _link_owner(conn_fd);
+	return owner && owner->is_readable(conn_fd);
 }
 
 bool ConnectionManager::is_writable(size_t conn_fd) {
@@ -340,7 +451,8 @@ bool ConnectionManager::is_writable(size_t conn_fd) {
 		return conn_ptr->is_writable();
 	}
 	
-	return false;
+	LinkOwner *owner = _link_owner(conn_fd);
+	return owner && owner->is_writable(conn_fd);
 }
 
 std::vector<size_t> ConnectionManager::get_all_connections() {
@@ -353,6 +465,11 @@ std::vector<size_t> ConnectionManager::get_all_connections() {
 		}
 	}
 	
+	for (LinkOwner *owner : handler->get_link_owners()) {
+		for (size_t fd : owner->get_fds())
+			v.push_back(fd);
+	}
+	
 	return v;
 }
 
@@ -361,9 +478,16 @@ void ConnectionManager::handle_read(size_t conn_fd) {
 	auto it = fd2conn.find(conn_fd);
 	if (it != fd2conn.end()) {
 		const auto &conn_ptr = it->second;
-		if (conn_ptr->is_readable())
-			conn_ptr->handle_read(command_exec);
+		if (conn_ptr->is_readable()) {
+			conn_ptr->handle_read(*handler);
+			if (conn_ptr->is_replica())
+				_hand_over(conn_fd);
+			else if (conn_ptr->is_writable())
+				pending_replies.push_back(conn_fd);
+		}
 	}
+	else if (LinkOwner *owner = _link_owner(conn_fd))
+		owner->handle_read(conn_fd);
 }
 
 void ConnectionManager::handle_write(size_t conn_fd) {
@@ -373,28 +497,106 @@ void ConnectionManager::handle_write(size_t conn_fd) {
 		const auto &conn_ptr = it->second;
 		if (conn_ptr->is_writable())
 			conn_ptr->handle_write();
+		
+		//deferred replies and requests which didn't fit into outgoing
+		if (!conn_ptr->is_writable())
+			conn_ptr->handle_replies(*handler);
 	}
+	else if (LinkOwner *owner = _link_owner(conn_fd))
+		owner->handle_write(conn_fd);
 }
 
 void ConnectionManager::check_timers() {
 	auto conns_to_close = tm.process_timers();
 	
 	for (size_t fd : conns_to_close) {
-		close_conn(fd);
+		auto it = fd2conn.find(fd);
+		if (it != fd2conn.end() && it->second->is_waiting())
+			tm.reset_timer(it->second->get_timer());
+		else
+			close_conn(fd);
 	}
 }
 
 void ConnectionManager::update_timer(size_t conn_fd) {
 	auto it = fd2conn.find(conn_fd);
 	if (it == fd2conn.end())
-		return; //TODO throw exception
+		return; //a link of a module, it doesn't time out
 	
 	const auto &conn_ptr = it->second;
-	tm.remove_timer(conn_ptr->get_timer());
-	conn_ptr->set_timer(tm.add_timer(conn_fd));
+	tm.reset_timer(conn_ptr->get_timer());
 }
 
 int ConnectionManager::get_next_timer() {
-	return tm.get_next_timer();
+	if (!resumed.empty())
+		return 0;
+	
+	int conn_timeout = tm.get_next_timer();
+	int cron_timeout = handler->get_next_timeout();
+	
+	//-1 means there's nothing to wait for
+	if (conn_timeout < 0)
+		return cron_timeout;
+	
+	if (cron_timeout < 0)
+		return conn_timeout;
+	
+	return std::min(conn_timeout, cron_timeout);
+}
+
+void ConnectionManager::run_cron() {
+	handler->run_cron();
+}
+
+void ConnectionManager::send_replies() {
+	//before the writes are logged, so their replies wait for the log as well
+	for (size_t conn_fd : resumed) {
+		auto it = fd2conn.find(conn_fd);
+		if (it == fd2conn.end() || !it->second)
+			continue; //closed in the meantime
+		
+		const auto &conn_ptr = it->second;
+		if (!conn_ptr->is_writable()) {
+			conn_ptr->handle_replies(*handler);
+			if (conn_ptr->is_writable())
+				pending_replies.push_back(conn_fd);
+		}
+	}
+	
+	resumed.clear();
+	handler->before_reply();
+	
+	//the deferred replies which have come during the iteration
+	for (int conn_fd : handler->get_ready_clients()) {
+		auto it = fd2conn.find(conn_fd);
+		if (it == fd2conn.end() || !it->second)
+			continue; //closed in the meantime
+		
+		const auto &conn_ptr = it->second;
+		bool writable = conn_ptr->is_writable();
+		conn_ptr->handle_replies(*handler);
+		//a subscriber over the output limit is closed there as well
+		if ((!writable && conn_ptr->is_writable()) || conn_ptr->is_closing())
+			pending_replies.push_back(conn_fd);
+	}
+	
+	for (size_t conn_fd : pending_replies) {
+		auto it = fd2conn.find(conn_fd);
+		if (it == fd2conn.end() || !it->second)
+			continue; //closed in the meantime
+		
+		const auto &conn_ptr = it->second;
+		if (conn_ptr->is_writable()) {
+			conn_ptr->handle_write();
+			//sent at once, so there's no POLLOUT to take the rest of a pipeline
+			if (!conn_ptr->is_writable() && !conn_ptr->is_closing() && conn_ptr->has_backlog())
+				resumed.push_back(conn_fd);
+		}
+		
+		if (conn_ptr->is_closing())
+			close_conn(conn_fd);
+	}
+	
+	pending_replies.clear();
 }
 
@@ -5,60 +5,70 @@
 #include <algorithm> //std::find()
 #include <cassert> //assert()
 #include <cstring> //std::memcpy
+#include <deque>
 #include <iostream>
+#include <list>
 #include <memory> //unique_ptr
 #include <unordered_map>
 #include <vector>
 
 //networking
 #include <arpa/inet.h> //inet_ntop converts network address to string
+#include <netinet/tcp.h> //TCP_NODELAY
 
 //c
 #include <errno.h>
-#include <time.h> //clock_gettime() for better performance and poll() compatibility
 #include <unistd.h> //close()
 
 //custom
 #include "buffer.hpp" //RingBuffer
-#include "commands.hpp"
+#include "clock.hpp"
 #include "io_shared_library.hpp" //MAX_MSG_LEN, get_in_addr
 #include "protocol.hpp" //RequestParser
+#include "request_handler.hpp" //RequestHandler, Client
 
 constexpr size_t CONN_TIMEOUT_MS = 5000; //5000 ms
 constexpr size_t IO_TIMEOUT_MS = 500;
 constexpr size_t BUFF_CAPACITY = 2 * (HEADER_SIZE + MAX_MSG_LEN);
+constexpr size_t OUT_BUFF_CAPACITY = 2 * (HEADER_SIZE + MAX_RESP_LEN);
+//a connection stops reading requests while it waits for as many deferred replies
+constexpr size_t MAX_DEFERRED = 1024;
 
 class Timer {
 private:
-	int time;
+	int64_t time;
 	int conn_fd;
 
 public:
 	Timer(size_t fd);
-	int get_time();
-	void set_time(int new_time);
+	int64_t get_time();
+	void set_time(int64_t new_time);
 	int get_connection_fd();
 	bool operator==(const Timer &second) const;
 	bool operator!=(const Timer &second) const;
 };
 
 /* TimerManager
- * Handles timers for connections to detect expired ones */
+ * Handles timers for connections to detect expired ones.
+ * The timers are a list ordered by time: a new or an updated one
+ * goes to the back, so the oldest is always the first, and a handle
+ * stays valid until its own timer is removed */
 class TimerManager {
 private:
 	//connection timers' queue for checking timeouts
-	std::vector<Timer> timers_q;
-	
-	int get_monotonic_ms();
+	std::list<Timer> timers_q;
 	
 public:
+	typedef std::list<Timer>::iterator Handle;
+	
 	int get_next_timer();
 	
-	//removes all expired timers 
-	//and returns all related expired connections to remove
+	//returns the expired connections, their timers are removed when they're closed
 	std::vector<size_t> process_timers();
-	Timer *add_timer(size_t conn_fd);
-	void remove_timer(Timer *timer);
+	Handle add_timer(size_t conn_fd);
+	//restarts the timer upon activity of its connection, O(1)
+	void reset_timer(Handle timer);
+	void remove_timer(Handle timer);
 };
 
 class Conn {
@@ -74,53 +84,97 @@ private:
 	RingBuffer<uint8_t> outgoing; //response for the app
 	
 	//timer
-	Timer *timer = nullptr;
+	TimerManager::Handle timer;
 	
 	RequestParser parser; //parses clients requests
+	Client client; //what the commands know about the connection
+	
+	//pub/sub messages, their payloads are sent as they are instead of being copied to outgoing
+	struct Pushed {
+		std::shared_ptr<const std::string> payload;
+		uint64_t after; //sent once out_sent reaches it, i.e. after the replies queued before it
+	};
+	std::deque<Pushed> pushed;
+	size_t pushed_sent = 0; //bytes of pushed.front() which have been sent
+	uint64_t out_sent = 0; //bytes of outgoing sent since the connection was opened
+	
+	//runs the complete requests of incoming, unless too many replies are deferred
+	void _handle_requests(RequestHandler &handler);
+	//takes the messages of client.pushed, they go after the replies queued so far
+	void _take_pushed();
+	//sends the next part of the output: replies up to the next message or the message itself,
+	//returns the bytes sent, -1 upon an error
+	ssize_t _send_next();
 	
 public:
-	Conn(int fd);
+	Conn(int fd, uint64_t id);
 	
 	//Getters
 	int get_fd() const;
 	bool is_readable() const;
 	bool is_writable() const;
 	bool is_closing() const;
-	Timer *get_timer() const;
+	//psync made it a replication link, which is handed over to the replication
+	bool is_replica() const;
+	//requests or deferred replies wait for outgoing to be sent
+	bool has_backlog() const;
+	//waits for a deferred reply(e.g. a blocking pop) or for pub/sub messages, so it isn't idle
+	bool is_waiting() const;
+	TimerManager::Handle get_timer() const;
+	const Client &get_client() const;
 	
 	//Setters
 	void set_want_read(bool isRead);
 	void set_want_write(bool isWrite);
 	void mark_as_closing();
 	
-	void set_timer(Timer *t);
+	void set_timer(TimerManager::Handle t);
 	
-	void append_to_outgoing(size_t len);
 	void append_to_incoming(std::vector<uint8_t>& buff, size_t len);
 	void consume_from_incoming(size_t len);
 	void consume_from_outgoing(size_t len);
+	//removes and returns the bytes which haven't been sent yet
+	std::vector<uint8_t> take_outgoing();
 	
 	void prepare_for_response(size_t *header);
 	void complete_response(size_t header);
 	
-	bool handle_request(CommandExecutor &command_exec);
+	bool handle_request(RequestHandler &handler);
 	void handle_write();
-	void handle_read(CommandExecutor &command_exec);
+	void handle_read(RequestHandler &handler);
+	//takes the deferred replies which are ready and the requests which have waited for them
+	void handle_replies(RequestHandler &handler);
 };
 
 /* ConnectionManager
  * it's a connections interface to encapsulate them from server
  * it stores all active connections as a map(fd<->conn),
  * accepts new connections(clients) and do a cleanup afterwards,
- * tells the event loop when a conn is ready to read/write/close */
+ * tells the event loop when a conn is ready to read/write/close.
+ * The requests are run by the handler: the commands of the server or the
+ * forwarding of the proxy. The links of the modules(e.g. to the primary,
+ * to the replicas, to the target of a slot migration or to the backends
+ * of the proxy) are polled with the connections, but their modules own them */
 class ConnectionManager {
 private:
 	//map all client connection to fds, used as keys, to save the state for event loop
 	std::unordered_map<size_t, std::unique_ptr<Conn>> fd2conn;
 	TimerManager tm;
-	CommandExecutor command_exec;
+	std::unique_ptr<RequestHandler> handler;
+	uint64_t next_client_id = 1;
+	//connections with replies of the current iteration
+	std::vector<size_t> pending_replies;
+	//connections whose backlog is taken by the next iteration, once outgoing is sent
+	std::vector<size_t> resumed;
+	
+	//the module which owns a link, nullptr if the fd isn't a link
+	LinkOwner *_link_owner(size_t conn_fd);
+	//hands the connection which has turned into a link(a new replica) over to the handler
+	void _hand_over(size_t conn_fd);
 
 public:
+	ConnectionManager(std::unique_ptr<RequestHandler> handler);
+	
 	int handle_accept(int listen_fd);
 	void close_conn(size_t conn_fd);
 	
@@ -134,7 +188,11 @@ public:
 	
 	void check_timers();
 	void update_timer(size_t conn_fd);
+	//returns ms till the closest connection timer or background job, -1 if none
 	int get_next_timer();
+	void run_cron();
+	//logs the writes of the iteration and then sends their replies
+	void send_replies();
 };
 
 #endif
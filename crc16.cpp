@@ -0,0 +1,29 @@
+#include "crc16.hpp"
+
+constexpr uint16_t CRC16_POLY = 0x1021;
+
+struct CRC16Table {
+	//table[b] is the crc of the byte b
+	uint16_t table[256];
+	
+	CRC16Table() {
+		for (uint32_t b = 0; b < 256; b++) {
+			uint16_t crc = b << 8;
+			for (int bit = 0; bit < 8; bit++)
+				crc = (crc << 1) ^ (CRC16_POLY & (0 - (crc >> 15)));
+			table[b] = crc;
+		}
+	}
+};
+
+static const CRC16Table crc16_table;
+
+uint16_t crc16(const void *data, size_t len) {
+	const uint8_t *p = static_cast<const uint8_t *>(data);
+	uint16_t crc = 0;
+	
+	for (; len > 0; len--, p++)
+		crc = (crc << 8) ^ crc16_table.table[((crc >> 8) ^ *p) & 0xFF];
+	
+	return crc;
+}
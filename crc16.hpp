@@ -0,0 +1,13 @@
+#ifndef __CRC16_HPP__
+#define __CRC16_HPP__
+
+//c++
+#include <cstddef> //size_t
+#include <cstdint> //uint16_t
+
+/* CRC-16/XMODEM(polynomial 0x1021, no reflection, 0 at the start)
+ * computed by a 256-entry lookup table, a byte per iteration.
+ * It spreads keys evenly over the cluster hash slots */
+uint16_t crc16(const void *data, size_t len);
+
+#endif
@@ -0,0 +1,48 @@
+#include "crc32.hpp"
+
+//c++
+#include <cstring> //memcpy
+
+constexpr uint32_t CRC32_POLY = 0xEDB88320; //reflected 0x04C11DB7
+
+struct CRC32Tables {
+	//table[k][b] is the crc of the byte b followed by k zero bytes
+	uint32_t table[8][256];
+	
+	CRC32Tables() {
+		for (uint32_t b = 0; b < 256; b++) {
+			uint32_t crc = b;
+			for (int bit = 0; bit < 8; bit++)
+				crc = (crc >> 1) ^ (CRC32_POLY & (0 - (crc & 1)));
+			table[0][b] = crc;
+		}
+		
+		for (uint32_t b = 0; b < 256; b++) {
+			for (int k = 1; k < 8; k++)
+				table[k][b] = (table[k - 1][b] >> 8) ^ table[0][table[k - 1][b] & 0xFF];
+		}
+	}
+};
+
+static const CRC32Tables tables;
+
+uint32_t crc32(uint32_t crc, const void *data, size_t len) {
+	static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "slicing expects little-endian words");
+	const auto &t = tables.table;
+	const uint8_t *p = static_cast<const uint8_t *>(data);
+	crc = ~crc;
+	
+	for (; len >= 8; len -= 8, p += 8) {
+		uint32_t lo, hi;
+		memcpy(&lo, p, 4);
+		memcpy(&hi, p + 4, 4);
+		lo ^= crc;
+		crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24]
+			^ t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^ t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+	}
+	
+	for (; len > 0; len--, p++)
+		crc = (crc >> 8) ^ t[0][(crc ^ *p) & 0xFF];
+	
+	return ~crc;
+}
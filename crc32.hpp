@@ -0,0 +1,14 @@
+#ifndef __CRC32_HPP__
+#define __CRC32_HPP__
+
+//c++
+#include <cstddef> //size_t
+#include <cstdint> //uint32_t
+
+/* CRC-32(IEEE 802.3, the one of zlib/gzip) computed by slicing-by-8:
+ * 8 lookup tables let the loop consume 8 bytes per iteration
+ * instead of 1, so checksumming doesn't slow down writing a file.
+ * crc is the value of the data checksummed so far, 0 at the start */
+uint32_t crc32(uint32_t crc, const void *data, size_t len);
+
+#endif
@@ -1,83 +1,53 @@
 #ifndef __CUSTOM_HEAP_HPP__
 #define __CUSTOM_HEAP_HPP__
 
-#include <iostream>
-#include <memory> //std::shared_ptr
-#include <stdexcept>
-#include <string>
+/* =====================================================================
+ * TTLHeap is an indexed 4-ary min-heap of (deadline, entry) pairs.
+ * The pairs are stored by value in one flat array and every entry keeps
+ * its own position in the array(heap_idx), so an entry is found,
+ * moved or removed without any lookup or per-entry allocation.
+ * A node has 4 children instead of 2, which halves the height
+ * and keeps the children of a node in one cache line.
+ * //TTLHeap//
+ * Complexity: O(1) for the earliest deadline, O(logN) for the rest
+ * =====================================================================*/
+
+//c++
 #include <vector>
-#include <unordered_map>
 
-enum HeapStatus {
-	EXPIRED_H = -2,
-	NOTTL_H = -1,
-	FAILURE_H = 0,
-	OK_H = 1,
-};
+//custom
+#include "expiry_index.hpp"
 
-class HeapEntry {
-private:
-	std::shared_ptr<std::string> key;
-	int heap_idx = -1;
-	int expire_at = -1;
+constexpr size_t HEAP_ARITY = 4;
 
-public:
-	HeapEntry(std::shared_ptr<std::string> key, int ttl);
-	~HeapEntry() = default;
-	HeapEntry &operator=(const HeapEntry &other);
-	
-	bool operator==(const HeapEntry &other);
-	bool operator!=(const HeapEntry &other);
-	bool operator<(const HeapEntry &other);
-	bool operator>(const HeapEntry &other);
-	bool operator<=(const HeapEntry &other);
-	bool operator>=(const HeapEntry &other);
-	
-	std::shared_ptr<std::string> get_key() const;
-	int get_ttl();
-	int get_heap_idx() const;
-	int get_expire_at() const;
-	
-	void update_ttl(int new_ttl);
-	void update_entry_idx(int idx);
-};
-	
-class TTLHeap {
-private:	
-	//heap is used to maintain order of TTLs
-	std::vector<HeapEntry *> heap; 
-	//a map between keys and their heap indexes 
-	//to allow action such as remove and get_ttl for a random key
-	std::unordered_map<std::shared_ptr<std::string> , size_t> key2idx;
-	
-	void swap(HeapEntry *lhs, HeapEntry *rhs);
-	void sift_down(size_t i);
-	void sift_up(size_t i);
-	void heapify();
-	void update_in_map_idx(HeapEntry *entry);
-	void update_key(size_t i, int new_key);
+class TTLHeap : public ExpiryIndex {
+private:
+	struct HeapSlot {
+		//a copy of the entry's deadline, so sifting doesn't touch the entries
+		int64_t expire_at;
+		ExpiryEntry *entry;
+	};
+	
+	std::vector<HeapSlot> heap;
+	
+	//puts the slot at position i and lets its entry know about it
+	void _place(size_t i, const HeapSlot &slot);
+	void _sift_up(size_t i);
+	void _sift_down(size_t i);
+	void _remove_at(size_t i);
 
 public:
-	~TTLHeap();
-	void insert(std::shared_ptr<std::string> key, int ttl);
-	HeapStatus remove(std::shared_ptr<std::string> key);
-	int peek() const;
-	int get_ttl(std::shared_ptr<std::string>key);
-	std::shared_ptr<std::string> delete_min();
-	
-	size_t size() const;
-	bool empty() const;
-	
-	
-	friend std::ostream& operator<<(std::ostream& out, const TTLHeap &heap) {
-		for (HeapEntry *it : heap.heap) {
-			out << it->get_ttl() << " ";
-		}
-		
-		out << "\n";
-		
-		return out;
-	}
+	void schedule(ExpiryEntry *entry, int64_t expire_at) override;
+	void cancel(ExpiryEntry *entry) override;
+	//the entry is scheduled while it has a slot in the heap
+	bool is_scheduled(const ExpiryEntry *entry) const override;
+	ExpiryEntry *pop_expired(int64_t now) override;
+	int64_t next_deadline() const override;
+	size_t size() const override;
+	void clear() override;
+	
+	//returns the earliest deadline, throws underflow_error if the heap is empty
+	int64_t peek() const;
 };
 
 #endif
@@ -0,0 +1,108 @@
+#include "deferred_replies.hpp"
+
+//custom
+#include "io_shared_library.hpp" //TAG_*, HEADER_SIZE
+
+uint64_t DeferredReplies::reserve(Client &client, size_t parts) {
+	ClientState &state = clients[client.id];
+	state.fd = client.fd;
+	uint64_t seq = state.first_seq + state.slots.size();
+	state.slots.emplace_back();
+	state.slots.back().waiting = parts;
+	client.deferred++;
+
+	return seq;
+}
+
+void DeferredReplies::complete(uint64_t client, uint64_t seq, const std::string &reply) {
+	auto it = clients.find(client);
+	if (it == clients.end())
+		return; //the client has gone
+
+	ClientState &state = it->second;
+	size_t idx = seq - state.first_seq;
+	if (idx >= state.slots.size() || state.slots[idx].waiting == 0)
+		return;
+
+	//of the replies of a fan out, an error is the one the client gets
+	Slot &slot = state.slots[idx];
+	if (slot.reply.empty() || (!reply.empty() && reply[0] == TAG_ERR))
+		slot.reply = reply;
+
+	if (--slot.waiting == 0 && idx == 0)
+		ready.push_back(state.fd);
+}
+
+bool DeferredReplies::is_waiting(const Client &client) const {
+	auto it = clients.find(client.id);
+
+	return it != clients.end() && !it->second.slots.empty();
+}
+
+size_t DeferredReplies::take(Client &client, RingBuffer<uint8_t> &buffer) {
+	auto it = clients.find(client.id);
+	if (it == clients.end())
+		return 0;
+
+	ClientState &state = it->second;
+	size_t taken = 0;
+	while (!state.slots.empty() && state.slots.front().waiting == 0) {
+		const std::string &reply = state.slots.front().reply;
+		if (HEADER_SIZE + reply.size() > buffer.free_space())
+			break; //taken once the buffer is sent
+
+		uint32_t len = reply.size();
+		buffer.insert((const uint8_t *)&len, HEADER_SIZE);
+		buffer.insert((const uint8_t *)reply.data(), reply.size());
+		state.slots.pop_front();
+		state.first_seq++;
+		taken++;
+	}
+
+	return taken;
+}
+
+std::vector<int> DeferredReplies::take_ready() {
+	std::vector<int> fds;
+	fds.swap(ready);
+
+	return fds;
+}
+
+void DeferredReplies::forget(const Client &client) {
+	//the replies which are still to come are dropped by complete()
+	clients.erase(client.id);
+}
+
+size_t DeferredReplies::clients_num() const {
+	return clients.size();
+}
+
+std::string error_reply(int32_t code, const std::string &msg) {
+	std::string reply(1, (char)TAG_ERR);
+	uint32_t len = msg.size();
+	reply.append((const char *)&code, sizeof(code));
+	reply.append((const char *)&len, sizeof(len));
+	reply += msg;
+
+	return reply;
+}
+
+std::string str_reply(const std::string &val) {
+	std::string reply(1, (char)TAG_STR);
+	uint32_t len = val.size();
+	reply.append((const char *)&len, sizeof(len));
+	reply += val;
+
+	return reply;
+}
+
+std::string arr_reply(const std::vector<std::string> &vals) {
+	std::string reply(1, (char)TAG_ARR);
+	uint32_t n = vals.size();
+	reply.append((const char *)&n, sizeof(n));
+	for (const std::string &val : vals)
+		reply += str_reply(val);
+
+	return reply;
+}
@@ -0,0 +1,65 @@
+#ifndef __DEFERRED_REPLIES_HPP__
+#define __DEFERRED_REPLIES_HPP__
+
+//c++
+#include <cstddef> //size_t
+#include <cstdint> //uint64_t
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+//custom
+#include "buffer.hpp" //RingBuffer
+#include "request_handler.hpp" //Client
+
+/* DeferredReplies
+ * keeps the deferred replies of the connections of a RequestHandler
+ * in the order of their requests, whatever order they're ready in.
+ * A reply gets a slot(reserve()), which is filled later(complete()),
+ * possibly by several parts(e.g. a request fanned out to several servers),
+ * and the ready slots at the front are handed over to the connection(take()).
+ * The replies are kept without their length, as the handlers produce them */
+class DeferredReplies {
+private:
+	struct Slot {
+		std::string reply;
+		size_t waiting = 0; //the parts which haven't come yet
+	};
+
+	struct ClientState {
+		int fd = -1;
+		uint64_t first_seq = 0; //the request of slots.front()
+		std::deque<Slot> slots; //in the order of the requests
+	};
+
+	std::unordered_map<uint64_t, ClientState> clients; //by Client::id
+	std::vector<int> ready; //fds of the clients whose first reply has come
+
+public:
+	//reserves the slot of the next reply of the client, returns its number
+	uint64_t reserve(Client &client, size_t parts = 1);
+	//a part of the reply has come, of several parts an error is the one kept.
+	//Ignored if the client has gone
+	void complete(uint64_t client, uint64_t seq, const std::string &reply);
+	//the client waits for replies, so its next one has to be deferred as well
+	bool is_waiting(const Client &client) const;
+
+	//RequestHandler::take_replies()
+	size_t take(Client &client, RingBuffer<uint8_t> &buffer);
+	//RequestHandler::get_ready_clients()
+	std::vector<int> take_ready();
+	//RequestHandler::forget_client()
+	void forget(const Client &client);
+	//clients with replies still to come or to be taken
+	size_t clients_num() const;
+};
+
+//|TAG_ERR|code(4)|len(4)|msg|, the format of RingBuffer::append_err()
+std::string error_reply(int32_t code, const std::string &msg);
+//|TAG_STR|len(4)|str|
+std::string str_reply(const std::string &val);
+//|TAG_ARR|n(4)|str|str|...|
+std::string arr_reply(const std::vector<std::string> &vals);
+
+#endif
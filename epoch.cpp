@@ -0,0 +1,100 @@
+#include "epoch.hpp"
+
+//c++
+#include <stdexcept> //runtime_error
+#include <utility> //std::move
+
+std::atomic<uint64_t> Epoch::global{1};
+Epoch::ReaderSlot Epoch::slots[EPOCH_MAX_THREADS];
+std::atomic<bool> Epoch::enabled{false};
+thread_local Epoch::ThreadState Epoch::me;
+std::deque<std::pair<uint64_t, std::function<void()>>> Epoch::limbo;
+EpochStats Epoch::stats;
+
+Epoch::ThreadState::~ThreadState() {
+	if (slot)
+		slot->taken.store(false, std::memory_order_release);
+}
+
+void Epoch::_pin() {
+	if (me.depth++ > 0)
+		return; //the outer guard has pinned already
+
+	if (!me.slot) {
+		for (ReaderSlot &slot : slots) {
+			bool expected = false;
+			if (slot.taken.compare_exchange_strong(expected, true)) {
+				me.slot = &slot;
+				break;
+			}
+		}
+
+		if (!me.slot) {
+			me.depth--;
+			throw std::runtime_error("too many threads read the keyspace at once");
+		}
+	}
+
+	me.slot->epoch.store(global.load(std::memory_order_relaxed), std::memory_order_relaxed);
+	//the pin is visible to collect() before any pointer of the structure is loaded
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+void Epoch::_unpin() {
+	if (--me.depth > 0)
+		return;
+
+	//the loads of the reader are done before the slot is seen empty
+	me.slot->epoch.store(0, std::memory_order_release);
+}
+
+void Epoch::enable() {
+	enabled.store(true, std::memory_order_release);
+}
+
+void Epoch::retire(std::function<void()> free) {
+	if (!is_enabled()) {
+		free(); //nobody else reads, so there's nobody to wait for
+		return;
+	}
+
+	limbo.emplace_back(global.load(std::memory_order_relaxed), std::move(free));
+	stats.retired_objects++;
+}
+
+void Epoch::collect() {
+	if (limbo.empty())
+		return;
+
+	/* the objects were unlinked before the epoch is advanced, so a reader
+	 * which pins the new epoch or a later one can't reach them anymore,
+	 * an object is freed once every pinned reader is past its epoch.
+	 * A reader which has loaded the old epoch but hasn't published its pin yet
+	 * is ordered after this fence, so it sees the objects unlinked as well */
+	uint64_t oldest = global.fetch_add(1, std::memory_order_seq_cst) + 1;
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+
+	for (const ReaderSlot &slot : slots) {
+		uint64_t pinned = slot.epoch.load(std::memory_order_acquire);
+		if (pinned != 0 && pinned < oldest)
+			oldest = pinned;
+	}
+
+	while (!limbo.empty() && limbo.front().first < oldest) {
+		limbo.front().second();
+		limbo.pop_front();
+		stats.freed_objects++;
+	}
+}
+
+int Epoch::get_next_timeout() {
+	return limbo.empty() ? -1 : EPOCH_RETRY_MS;
+}
+
+EpochStats Epoch::get_stats() {
+	EpochStats res = stats;
+	res.pending_objects = limbo.size();
+	res.epoch = global.load(std::memory_order_relaxed);
+
+	return res;
+}
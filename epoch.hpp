@@ -0,0 +1,102 @@
+#ifndef __EPOCH_HPP__
+#define __EPOCH_HPP__
+
+/* =====================================================================
+ * Epoch-based reclamation lets other threads read a structure
+ * which the event loop keeps changing, without any lock.
+ *
+ * A reader pins the current epoch(Guard) for the duration of a lookup,
+ * the writer doesn't free what it unlinks, but retires it: the object
+ * is tagged with the epoch of the moment it was unlinked and kept aside.
+ * Every collect() advances the epoch and frees the objects retired before
+ * the oldest epoch still pinned, so a reader may hold a pointer to an unlinked
+ * node or a whole table as long as it's pinned, and nothing is freed under it.
+ *   - readers only store their epoch into a slot of their own, so pinning
+ *     is a couple of stores and a fence, readers never write shared lines
+ *   - there's a single writer(the event loop), which retires and collects,
+ *     so the retired objects are a plain queue in the order of their epochs
+ *   - until enable() is called there're no readers and retire() frees right away
+ * =====================================================================*/
+
+//c++
+#include <atomic>
+#include <cstddef> //size_t
+#include <cstdint> //uint64_t
+#include <deque>
+#include <functional> //std::function
+#include <utility> //std::pair
+
+constexpr size_t EPOCH_MAX_THREADS = 64; //threads which may pin at once
+constexpr size_t EPOCH_CACHE_LINE = 64;
+//the retired objects left by pinned readers are collected again after it
+constexpr int EPOCH_RETRY_MS = 10;
+
+struct EpochStats {
+	size_t retired_objects = 0;
+	size_t freed_objects = 0;
+	size_t pending_objects = 0; //retired, but not freed yet
+	uint64_t epoch = 0;
+};
+
+class Epoch {
+private:
+	//a slot per reader thread, on its own cache line so the readers don't share lines
+	struct alignas(EPOCH_CACHE_LINE) ReaderSlot {
+		std::atomic<uint64_t> epoch{0}; //the pinned epoch, 0 when not reading
+		std::atomic<bool> taken{false};
+	};
+
+	//the slot of a thread is taken on its first pin and given back when it exits
+	struct ThreadState {
+		ReaderSlot *slot = nullptr;
+		size_t depth = 0; //nested guards
+		~ThreadState();
+	};
+
+	static std::atomic<uint64_t> global; //starts at 1, so 0 means "not pinned"
+	static ReaderSlot slots[EPOCH_MAX_THREADS];
+	static std::atomic<bool> enabled;
+	static thread_local ThreadState me;
+
+	//the writer's state, no other thread touches it
+	static std::deque<std::pair<uint64_t, std::function<void()>>> limbo;
+	static EpochStats stats;
+
+	//throws runtime_error if more than EPOCH_MAX_THREADS threads read at once
+	static void _pin();
+	static void _unpin();
+
+public:
+	/* Guard pins the epoch while it's alive, so nothing the reader
+	 * can reach is freed, guards of the same thread may be nested */
+	class Guard {
+	public:
+		Guard() { _pin(); }
+		~Guard() { _unpin(); }
+		Guard(const Guard &) = delete;
+		Guard &operator=(const Guard &) = delete;
+	};
+
+	//there're readers from now on, called before the first one starts
+	static void enable();
+	//inline, since the keyspace checks it on every write
+	static bool is_enabled() {
+		return enabled.load(std::memory_order_acquire);
+	}
+
+	//the writer: frees the object once no reader may hold it
+	static void retire(std::function<void()> free);
+
+	template <typename T>
+	static void retire(T *ptr) {
+		retire([ptr] { delete ptr; });
+	}
+
+	//the writer: advances the epoch and frees the objects no reader may hold anymore
+	static void collect();
+	//returns ms till collect() is needed again, -1 if nothing is waiting
+	static int get_next_timeout();
+	static EpochStats get_stats();
+};
+
+#endif
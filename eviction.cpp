@@ -0,0 +1,122 @@
+#include "eviction.hpp"
+
+//c++
+#include <algorithm> //upper_bound
+#include <limits> //max()
+
+Evictor::Evictor(KeyMap &hmap, TTLManager &ttl_manager, LazyFree &lazy_free, AppendOnlyFile &aof,
+					Replication &replication, EvictionPolicy policy, size_t maxmemory, size_t samples)
+	: hmap(hmap), ttl_manager(ttl_manager), lazy_free(lazy_free), aof(aof), replication(replication), 
+	policy(policy), 
+	maxmemory(maxmemory), samples(samples), rng(std::random_device{}()) {
+	pool.reserve(EVICTION_POOL_SIZE);
+}
+
+bool Evictor::_idle(KeyMap::iterator it, uint64_t &idle) {
+	const KeyMeta &meta = it.meta();
+	switch (policy) {
+	case ALLKEYS_LRU:
+		idle = meta.idle_ms();
+		return true;
+	case ALLKEYS_LFU:
+		idle = LFU_MAX_VAL - meta.decayed_freq();
+		return true;
+	case VOLATILE_TTL:
+		if (!ttl_manager.has_ttl(it))
+			return false;
+		//the closer the deadline, the better
+		idle = std::numeric_limits<uint64_t>::max() - uint64_t(meta.expire_at);
+		return true;
+	default:
+		return false;
+	}
+}
+
+size_t Evictor::_populate_pool() {
+	hmap.sample(samples, rng(), sampled);
+	
+	size_t candidates = 0;
+	for (auto it : sampled) {
+		uint64_t idle;
+		if (!_idle(it, idle))
+			continue;
+		
+		candidates++;
+		const std::string &key = *it.first();
+		bool in_pool = false;
+		for (const auto &entry : pool) {
+			if (entry.key == key) {
+				in_pool = true;
+				break;
+			}
+		}
+		
+		if (in_pool)
+			continue;
+		
+		//a full pool only takes keys better than its worst one
+		if (pool.size() == EVICTION_POOL_SIZE) {
+			if (idle <= pool.front().idle)
+				continue;
+			pool.erase(pool.begin());
+		}
+		
+		auto pos = std::upper_bound(pool.begin(), pool.end(), idle,
+				[](uint64_t idle, const PoolEntry &entry) { return idle < entry.idle; });
+		pool.insert(pos, PoolEntry{idle, key});
+	}
+	
+	return candidates;
+}
+
+bool Evictor::_evict_one() {
+	for (size_t empty = 0; empty < EVICTION_MAX_EMPTY_SAMPLES; ) {
+		if (_populate_pool() == 0)
+			empty++;
+		
+		while (!pool.empty()) {
+			std::string key = std::move(pool.back().key);
+			pool.pop_back();
+			
+			//the key may have been deleted since it got into the pool
+			if (ttl_manager.erase(key, true)) {
+				//the replay and the replicas don't know the memory state, so the deletion is logged
+				aof.feed({"del", key});
+				replication.feed({"del", key});
+				stats.evicted_keys++;
+				return true;
+			}
+		}
+	}
+	
+	return false;
+}
+
+bool Evictor::free_memory() {
+	if (maxmemory == 0 || MemoryUsage::used() <= maxmemory)
+		return true;
+	
+	while (policy != NO_EVICTION && MemoryUsage::used() > maxmemory) {
+		if (!_evict_one())
+			break;
+		
+		//a big value is being freed in the background, so the memory
+		//will drop soon, evicting more keys meanwhile would be needless
+		if (lazy_free.get_stats().pending_objects > 0)
+			return true;
+	}
+	
+	if (MemoryUsage::used() <= maxmemory || lazy_free.get_stats().pending_objects > 0)
+		return true;
+	
+	stats.oom_rejections++;
+	return false;
+}
+
+size_t Evictor::get_maxmemory() const {
+	return maxmemory;
+}
+
+const EvictionStats &Evictor::get_stats() const {
+	return stats;
+}
@@ -0,0 +1,81 @@
+#ifndef __EVICTION_HPP__
+#define __EVICTION_HPP__
+
+/* =====================================================================
+ * Evictor keeps the used memory under maxmemory by deleting keys
+ * chosen by the eviction policy. There's no global LRU list or frequency
+ * heap to be maintained on every access: the access bits live in the
+ * keyspace nodes(KeyMeta), and candidates are found by sampling a few
+ * random buckets. The best ones of every sample are kept in a small pool
+ * sorted by their idle score, so the choice gets closer to the exact
+ * LRU/LFU with every eviction while each one costs O(samples).
+ *
+ * Ex. of the pool(idle score ascending, evicted from the end):
+ *   [ 120ms:"a" ][ 800ms:"k" ][ 5s:"x" ][ 40s:"b" ] <- "b" goes first
+ * =====================================================================*/
+
+//c++
+#include <cstdint> //uint64_t
+#include <random> //mt19937_64
+#include <string>
+#include <vector>
+
+//custom
+#include "aof.hpp"
+#include "keyspace.hpp"
+#include "lazy_free.hpp"
+#include "memory.hpp"
+#include "replication.hpp"
+#include "ttl_manager.hpp"
+
+constexpr size_t EVICTION_POOL_SIZE = 16;
+//samples without a candidate before giving up, e.g. when no key has a ttl
+constexpr size_t EVICTION_MAX_EMPTY_SAMPLES = 16;
+
+struct EvictionStats {
+	size_t evicted_keys = 0;
+	size_t oom_rejections = 0; //writes refused since nothing could be evicted
+};
+
+class Evictor {
+private:
+	struct PoolEntry {
+		uint64_t idle; //the higher, the better candidate
+		std::string key;
+	};
+	
+	KeyMap &hmap;
+	TTLManager &ttl_manager;
+	LazyFree &lazy_free;
+	AppendOnlyFile &aof;
+	Replication &replication;
+	EvictionPolicy policy;
+	size_t maxmemory;
+	size_t samples;
+	std::vector<PoolEntry> pool; //sorted by idle ascending
+	std::vector<KeyMap::iterator> sampled; //reused between samples
+	std::mt19937_64 rng;
+	EvictionStats stats;
+	
+	//returns false if the key isn't a candidate for the policy
+	bool _idle(KeyMap::iterator it, uint64_t &idle);
+	//adds the best keys of a new sample to the pool, returns the number of candidates seen
+	size_t _populate_pool();
+	//deletes the best candidate, returns false if none was found
+	bool _evict_one();
+	
+public:
+	Evictor(KeyMap &hmap, TTLManager &ttl_manager, LazyFree &lazy_free, AppendOnlyFile &aof,
+					Replication &replication, EvictionPolicy policy, size_t maxmemory, size_t samples);
+	Evictor(const Evictor &) = delete;
+	Evictor &operator=(const Evictor &) = delete;
+	
+	//evicts keys until the used memory is under the limit,
+	//returns false if it's impossible, so a write has to be refused
+	bool free_memory();
+	
+	size_t get_maxmemory() const;
+	const EvictionStats &get_stats() const;
+};
+
+#endif
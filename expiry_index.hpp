@@ -0,0 +1,62 @@
+#ifndef __EXPIRY_INDEX_HPP__
+#define __EXPIRY_INDEX_HPP__
+
+/* =====================================================================
+ * ExpiryIndex is an interface of the structure which orders the keys
+ * by their deadlines, so the expired ones are found without a full scan.
+ * The bookkeeping of a key(ExpiryEntry) is embedded into its keyspace node,
+ * so an index neither allocates per key nor looks keys up.
+ * Implemented by:
+ * //TTLHeap// - flat 4-ary min-heap of (deadline, entry), O(logN)
+ * //TimingWheel// - hierarchical timing wheel, O(1)
+ * =====================================================================*/
+
+//c++
+#include <cstddef> //size_t
+#include <cstdint> //int64_t
+
+constexpr size_t NO_HEAP_IDX = SIZE_MAX;
+
+/* the expiry bookkeeping to be embedded into a keyspace node */
+struct ExpiryEntry {
+	int64_t expire_at = -1; //ms, -1 while not scheduled
+	//TTLHeap: the entry's slot in the heap array
+	size_t heap_idx = NO_HEAP_IDX;
+	//TimingWheel: the next entry in the slot and the link pointing to this entry
+	ExpiryEntry *wheel_next = nullptr;
+	ExpiryEntry **wheel_pprev = nullptr;
+	
+	//the deadline may be read by other threads(HashMap::read()) while
+	//the index moves it, so it's written and read in one piece
+	int64_t load_deadline() const {
+		return __atomic_load_n(&expire_at, __ATOMIC_RELAXED);
+	}
+	
+	void store_deadline(int64_t deadline) {
+		__atomic_store_n(&expire_at, deadline, __ATOMIC_RELAXED);
+	}
+};
+
+class ExpiryIndex {
+public:
+	virtual ~ExpiryIndex() = default;
+	
+	//schedules the entry or moves it if it's already scheduled
+	virtual void schedule(ExpiryEntry *entry, int64_t expire_at) = 0;
+	virtual void cancel(ExpiryEntry *entry) = 0;
+	virtual bool is_scheduled(const ExpiryEntry *entry) const = 0;
+	//unschedules and returns an entry due by now, nullptr if there's none
+	virtual ExpiryEntry *pop_expired(int64_t now) = 0;
+	//returns the earliest time an entry may be due, -1 if there're no entries
+	virtual int64_t next_deadline() const = 0;
+	virtual size_t size() const = 0;
+	//forgets all the entries without touching them, e.g. when their nodes
+	//are about to be freed altogether
+	virtual void clear() = 0;
+	
+	bool empty() const {
+		return size() == 0;
+	}
+};
+
+#endif
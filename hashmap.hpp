@@ -6,6 +6,12 @@
 #include <memory> //unique_ptr, shared_ptr
 #include <new>
 #include <string>
+#include <type_traits> //std::conditional
+#include <utility> //std::swap
+#include <vector>
+
+//custom
+#include "epoch.hpp"
 
 constexpr size_t MAX_LOAD_FACTOR = 3;
 constexpr size_t MAX_NUM_ELEMENTS_TO_MOVE = 128;
@@ -21,12 +27,68 @@ constexpr int FNV_PRIME = 0x01000193;
  * 
  * HashTable is implemented as a dynamic array(array of buckets)
  * where a linked list of elements which hash function is equal to id
- * is stored at array[id] */
- 
-template <typename T, typename P>
+ * is stored at array[id] 
+ *
+ * Every node inherits Meta, which lets users embed their own bookkeeping
+ * (e.g. intrusive expiry links) into the node instead of a side table,
+ * by default it's empty and takes no space
+ *
+ * With ConcurrentReads other threads may look keys up(read()) while
+ * the owner thread keeps writing, without any lock. The mode is opt-in:
+ * it's on only once Epoch::enable() is called(there're readers), until then
+ * the map writes exactly as a map without ConcurrentReads does. Then:
+ *   - every link(bucket heads, next, the tables) is published by a release store,
+ *     so a reader which reaches a node sees it complete
+ *   - a value is never changed in place: the value a node is inserted with
+ *     stays inline, an update publishes a boxed new value and retires the old one
+ *   - erased nodes and dropped tables are retired(Epoch), not freed,
+ *     so a pinned reader may still walk them
+ *   - moving nodes between the tables during a rehash may hide a key from
+ *     a reader for a moment, so a miss is confirmed by a sequence counter
+ *     which the writer bumps around every batch of moves */
+
+struct NoMeta {};
+
+template <typename T, typename P, typename Meta = NoMeta, bool ConcurrentReads = false>
 class HashMap {
 private:
-	class HashNode {
+	//true once other threads may read the map
+	static bool _concurrent() {
+		if constexpr (ConcurrentReads)
+			return Epoch::is_enabled();
+		else
+			return false;
+	}
+	
+	//loads and stores the links which readers of other threads may follow
+	template <typename Ptr>
+	static Ptr _load(Ptr const &link) {
+		if constexpr (ConcurrentReads)
+			return __atomic_load_n(&link, __ATOMIC_ACQUIRE);
+		else
+			return link;
+	}
+	
+	template <typename Ptr>
+	static void _store(Ptr &link, Ptr val) {
+		if (_concurrent())
+			__atomic_store_n(&link, val, __ATOMIC_RELEASE);
+		else
+			link = val;
+	}
+	
+	//ConcurrentReads: the value which has replaced the inline one since
+	//there're readers, the inline one is never written after that
+	struct Replaced {
+		P *replaced = nullptr;
+	};
+	
+	//nothing for the maps without ConcurrentReads
+	struct NoReplaced {};
+	
+	//an empty base takes no space, unlike an empty member
+	class HashNode : public Meta, 
+					private std::conditional<ConcurrentReads, Replaced, NoReplaced>::type {
 	private:
 		/* we want to store ptr so that in case there're strings 
 		 * we could return string_view or shared_ptr 
@@ -39,6 +101,17 @@ private:
 		HashNode(const T &key, const P &value)
 			: key(std::make_shared<T>(key)), value(value), next(nullptr) {}
 		
+		HashNode(T &&key, P &&value)
+			: key(std::make_shared<T>(std::move(key))), value(std::move(value)), next(nullptr) {}
+		
+		~HashNode() {
+			if constexpr (ConcurrentReads)
+				delete this->replaced;
+		}
+		
+		HashNode(const HashNode &) = delete;
+		HashNode &operator=(const HashNode &) = delete;
+		
 		const T &get_key() const {
 			return *key;
 		}
@@ -48,10 +121,31 @@ private:
 		}
 				
 		const P &get_value() const{
-			return value;
+			if constexpr (ConcurrentReads) {
+				const P *replaced = _load(this->replaced);
+				return replaced ? *replaced : value;
+			}
+			else
+				return value;
 		}
 		
 		void set_value(const P &val) {
+			if constexpr (ConcurrentReads) {
+				if (_concurrent()) {
+					//a reader may be copying the old value right now
+					P *old = this->replaced;
+					_store(this->replaced, new P(val));
+					if (old)
+						Epoch::retire(old);
+					return;
+				}
+				
+				if (this->replaced) {
+					*this->replaced = val;
+					return;
+				}
+			}
+			
 			value = val;
 		}
 		
@@ -129,13 +223,26 @@ private:
 			//if there's a collision just append new node 
 			//to the front of the bucket's list
 			HashNode *next = table[bucket_id]; 
-			node->next = next;
-			table[bucket_id] = node;
+			_store(node->next, next);
+			_store(table[bucket_id], node);
 			size++;
 			
 			return node->get_key_ptr();
 		}
 		
+		//the same as insert(), but several threads may link nodes at once:
+		//the bucket's head is swapped atomically
+		void insert_atomic(HashNode *node) {
+			size_t bucket_id = hash_function(node->get_key());
+			HashNode *next = __atomic_load_n(&table[bucket_id], __ATOMIC_RELAXED);
+			do {
+				node->next = next;
+			} while (!__atomic_compare_exchange_n(&table[bucket_id], &next, node, true,
+											__ATOMIC_RELEASE, __ATOMIC_RELAXED));
+			
+			__atomic_fetch_add(&size, 1, __ATOMIC_RELAXED);
+		}
+		
 		HashNode **search(const T &key) {
 			size_t bucket_id = hash_function(key);
 			HashNode **cur = &table[bucket_id]; 
@@ -148,6 +255,17 @@ private:
 			return nullptr;
 		}
 		
+		//the lookup of a reader of another thread
+		HashNode *read(const T &key) {
+			size_t bucket_id = hash_function(key);
+			for (HashNode *it = _load(table[bucket_id]); it; it = _load(it->next)) {
+				if (it->get_key() == key)
+					return it;
+			}
+			
+			return nullptr;
+		}
+		
 		HashNode *erase(const T &key) {
 			/* we're using a singly-linked list remove:
 			 * remove nodes by assigning the next node to to_remove's ptr
@@ -156,7 +274,8 @@ private:
 			HashNode **to_remove;
 			if ((to_remove = this->search(key)) != nullptr) {
 				HashNode *node = *to_remove;
-				*to_remove = node->next;
+				//a reader standing on the node still gets to the rest of the bucket
+				_store(*to_remove, node->next);
 				size--;
 				
 				return node;
@@ -186,6 +305,30 @@ private:
 	HashTable *rehashing_backup;
 	//it's an idx till which the rehashing_backup was moved to the htab(which is larger)
 	size_t move_id;
+	//ConcurrentReads: odd while nodes move between the tables, so a reader's miss is retried
+	size_t rehash_seq = 0;
+	
+	void _seq_begin() {
+		if (_concurrent()) {
+			__atomic_store_n(&rehash_seq, rehash_seq + 1, __ATOMIC_RELAXED);
+			//the odd counter is visible before any link is changed
+			__atomic_thread_fence(__ATOMIC_RELEASE);
+		}
+	}
+	
+	void _seq_end() {
+		if (_concurrent())
+			__atomic_store_n(&rehash_seq, rehash_seq + 1, __ATOMIC_RELEASE);
+	}
+	
+	//frees what the map has dropped, or leaves it to the readers' epoch
+	template <typename X>
+	static void _free(X *ptr) {
+		if (_concurrent())
+			Epoch::retire(ptr);
+		else
+			delete ptr;
+	}
 	
 	//helper function that moves constant number of elements from backup to htab
 	void _move_elements() {
@@ -193,7 +336,8 @@ private:
 		
 		if (!rehashing_backup)
 			return; //no elements to move
-			
+		
+		_seq_begin();
 		while (moved < MAX_NUM_ELEMENTS_TO_MOVE && rehashing_backup->get_size() > 0) {
 			HashNode **node = &rehashing_backup->table[move_id];
 			if (!*node) { //empty bucket
@@ -206,10 +350,11 @@ private:
 		}
 		
 		if (rehashing_backup->get_size() == 0) {
-			delete rehashing_backup;
-			rehashing_backup = nullptr;
+			HashTable *empty = rehashing_backup;
+			_store(rehashing_backup, (HashTable *)nullptr);
+			_free(empty);
 		}
-			
+		_seq_end();
 	}
 	
 	//the function that updates "htab" and "rehashing_backup"
@@ -219,18 +364,56 @@ private:
 		if (rehashing_backup && rehashing_backup->get_size() != 0)
 			return;
 		
+		_seq_begin();
 		if (rehashing_backup) {
-			delete rehashing_backup; //destroy the old table
-			rehashing_backup = nullptr;
+			_free(rehashing_backup); //destroy the old table
+			_store(rehashing_backup, (HashTable *)nullptr);
 		}
 		
-		rehashing_backup = htab; //assign the current newer version to the old one
+		_store(rehashing_backup, htab); //assign the current newer version to the old one
 		size_t capacity = htab->get_capacity() * 2; //double the current size
-		htab = new HashTable(capacity); //create larger htable
+		_store(htab, new HashTable(capacity)); //create larger htable
 		move_id = 0; 
-		
+		_seq_end();
 	}
 	
+	//links a new node, growing the table the same way for every insert
+	HashNode *_link_new(HashNode *node) {
+		if (!rehashing_backup || rehashing_backup->get_size() == 0) {
+			size_t load_factor = htab->get_size() / htab->get_capacity();
+			if (load_factor >= MAX_LOAD_FACTOR) { 
+				_rehash();
+			}
+		}
+		
+		this->_move_elements();
+		htab->insert(node);
+
+		return node;
+	}
+
+	template <typename Visit>
+	static void _scan_bucket(HashTable *tab, size_t bucket_id, Visit &visit) {
+		for (HashNode *node = tab->table[bucket_id]; node; node = node->next)
+			visit(iterator(node));
+	}
+
+	//increments the bits of the cursor under the mask starting from the highest one
+	static size_t _next_cursor(size_t cursor, size_t mask) {
+		cursor |= ~mask;
+		cursor = _reverse_bits(cursor);
+		cursor++;
+		return _reverse_bits(cursor);
+	}
+
+	static size_t _reverse_bits(size_t v) {
+		size_t r = 0;
+		for (size_t i = 0; i < sizeof(v) * 8; i++, v >>= 1)
+			r = (r << 1) | (v & 1);
+
+		return r;
+	}
+
 public:	
 	class iterator {
 		private:
@@ -259,6 +442,10 @@ public:
 			cur->set_value(val);
 		}
 		
+		Meta &meta() {
+			return *cur;
+		}
+		
 		//prefix increment
 		iterator& operator++() {
 			cur = cur->next;
@@ -272,26 +459,29 @@ public:
 			return temp;
 		}
 		
+		//keys are unique, so the iterators are equal if they share the node,
+		//which also doesn't require the values to be comparable
 		bool operator!=(const iterator &right) const {
-			if (cur == nullptr || right.cur == nullptr)
-				return cur != right.cur;
-				
-			return ((cur->get_key() != right->get_key()) ||
-					(cur->get_value() != right->get_value()));
+			return cur != right.cur;
 		}
 		
 		bool operator==(const iterator &right) const {
-			if (cur == nullptr || right.cur == nullptr)
-				return cur == right.cur;
-				
-			return ((cur->get_key() == right->get_key()) &&
-					(cur->get_value() == right->get_value()));
+			return cur == right.cur;
 		}
 		
 	};
 	
 	HashMap(size_t n) : 
 		htab(new HashTable(n)), rehashing_backup(nullptr), move_id(0) {}
+	
+	//returns the number of buckets the map grows to while n keys are inserted
+	static size_t capacity_for(size_t n) {
+		size_t capacity = 1;
+		while (capacity * MAX_LOAD_FACTOR <= n)
+			capacity *= 2;
+		
+		return capacity;
+	}
 
 	~HashMap() {
 		//HashTables themselves and allocated for their data nodes are destroyed using ~HashTable()
@@ -310,6 +500,16 @@ public:
 		return iterator(nullptr);
 	}
 	
+	//returns the key of the node the meta is embedded into
+	static std::shared_ptr<T> key_of(Meta &meta) {
+		return static_cast<HashNode &>(meta).get_key_ptr();
+	}
+	
+	//returns the node the meta is embedded into
+	static iterator node_of(Meta &meta) {
+		return iterator(&static_cast<HashNode &>(meta));
+	}
+	
 	iterator search(const T &key) {
 		this->_move_elements();
 		
@@ -323,16 +523,35 @@ public:
 		return node ? iterator(*node) : iterator(nullptr);
 	}
 	
-	std::shared_ptr<T> insert(const T &key, const P &value) {
-		if (!rehashing_backup || rehashing_backup->get_size() == 0) {
-			size_t load_factor = htab->get_size() / htab->get_capacity();
-			if (load_factor >= MAX_LOAD_FACTOR) { 
-				_rehash();
-			}
+	/* ConcurrentReads: looks the key up from any thread while the owner thread
+	 * keeps writing. The caller holds an Epoch::Guard as long as it uses the node,
+	 * it may read only the key, the value(a snapshot of it) and what
+	 * Meta makes safe to read concurrently. Doesn't move any node */
+	iterator read(const T &key) {
+		static_assert(ConcurrentReads, "the map isn't built for concurrent readers");
+		
+		while (true) {
+			size_t seq = __atomic_load_n(&rehash_seq, __ATOMIC_ACQUIRE);
+			if (seq & 1)
+				continue; //the writer is moving nodes right now
+			
+			//a node found is the key's node, wherever it has been moved since
+			HashNode *node = _load(htab)->read(key);
+			if (node)
+				return iterator(node);
+			
+			HashTable *backup = _load(rehashing_backup);
+			if (backup && (node = backup->read(key)) != nullptr)
+				return iterator(node);
+			
+			//a miss counts only if no node has moved in the meantime
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if (__atomic_load_n(&rehash_seq, __ATOMIC_RELAXED) == seq)
+				return end();
 		}
-		
-		this->_move_elements();
-		
+	}
+	
+	std::shared_ptr<T> insert(const T &key, const P &value) {
 		auto it = search(key);
 		//if a key already exists just override its value with a new one
 		if (it != this->end()) { 
@@ -340,7 +559,48 @@ public:
 			return it.first();
 		}
 			
-		return htab->insert(new HashNode(key, value));;
+		return insert_new(key, value).first();
+	}
+	
+	//inserts a key which the caller has just searched for and not found,
+	//so the search isn't repeated
+	iterator insert_new(const T &key, const P &value) {
+		return iterator(_link_new(new HashNode(key, value)));
+	}
+	
+	iterator insert_new(T &&key, P &&value) {
+		return iterator(_link_new(new HashNode(std::move(key), std::move(value))));
+	}
+	
+	/* allocates the table for n keys at once, so that loading them
+	 * doesn't go through all the doublings and gradual rehashes,
+	 * does nothing unless the map is empty */
+	void reserve(size_t n) {
+		size_t capacity = capacity_for(n);
+		if (size() != 0 || capacity <= htab->get_capacity())
+			return;
+		
+		_seq_begin();
+		if (rehashing_backup) {
+			_free(rehashing_backup);
+			_store(rehashing_backup, (HashTable *)nullptr);
+		}
+		_free(htab);
+		_store(htab, new HashTable(capacity));
+		move_id = 0;
+		_seq_end();
+	}
+	
+	/* inserts a key which isn't in the map from one of several threads
+	 * loading the map at once, e.g. from a snapshot. The map has to be reserved
+	 * for all the keys and nothing else may access it until they're done */
+	iterator insert_concurrent(T &&key, P &&value) {
+		assert(!rehashing_backup);
+		
+		HashNode *node = new HashNode(std::move(key), std::move(value));
+		htab->insert_atomic(node);
+		
+		return iterator(node);
 	}
 	
 	std::unique_ptr<P> erase(const T &key) {
@@ -358,7 +618,7 @@ public:
 		
 		if (to_remove) {
 			std::unique_ptr<P> val = std::make_unique<P>(to_remove->get_value());
-			delete to_remove;
+			_free(to_remove);
 			to_remove = nullptr;
 			
 			return val;
@@ -367,8 +627,102 @@ public:
 		return nullptr;
 	}
 	
+	/* collects at most count nodes walking the buckets from a random one(seed),
+	 * it's a cheap approximation of picking nodes at random,
+	 * e.g. to find eviction candidates without any extra per-node links */
+	void sample(size_t count, size_t seed, std::vector<iterator> &out) {
+		out.clear();
+		
+		size_t steps = count * 10; //a sparse table mustn't be scanned fully
+		for (HashTable *tab : {htab, rehashing_backup}) {
+			if (!tab || tab->get_size() == 0)
+				continue;
+			
+			for (size_t i = 0; i < tab->capacity && steps > 0; i++, steps--) {
+				HashNode *node = tab->table[(seed + i) & tab->mask];
+				for (; node && out.size() < count; node = node->next)
+					out.push_back(iterator(node));
+				
+				if (out.size() == count)
+					return;
+			}
+		}
+	}
+	
+	/* visits every node of both tables without moving any of them,
+	 * so the map is walked as is even in the middle of a rehash
+	 * and a forked child doesn't write to the pages it shares with the parent */
+	template <typename Visit>
+	void for_each(Visit visit) {
+		for (HashTable *tab : {htab, rehashing_backup}) {
+			if (!tab || tab->get_size() == 0)
+				continue;
+			
+			for (size_t i = 0; i < tab->capacity; i++) {
+				for (HashNode *node = tab->table[i]; node; node = node->next)
+					visit(iterator(node));
+			}
+		}
+	}
+	
+	/* visits the nodes of the next bucket(s) of an incremental walk over the map
+	 * and returns the cursor of the following call, 0 once the walk is over.
+	 * The cursor is incremented from its highest bit(reverse binary), so
+	 * the buckets already visited stay visited when the table doubles,
+	 * and every node which is in the map from the first call to the last
+	 * is visited at least once, even if a rehash happens in between */
+	template <typename Visit>
+	size_t scan(size_t cursor, Visit visit) {
+		HashTable *small = htab, *large = rehashing_backup;
+		if (!large || large->get_size() == 0) {
+			_scan_bucket(small, cursor & small->mask, visit);
+			return _next_cursor(cursor, small->mask);
+		}
+
+		if (small->capacity > large->capacity)
+			std::swap(small, large);
+
+		//a bucket of the small table and the ones of the large table it's split into
+		_scan_bucket(small, cursor & small->mask, visit);
+		do {
+			_scan_bucket(large, cursor & large->mask, visit);
+			cursor = _next_cursor(cursor, large->mask);
+		} while (cursor & (small->mask ^ large->mask));
+
+		return cursor;
+	}
+
+	/* exchanges the content with another HashMap in O(1),
+	 * e.g. to detach all the nodes and free them elsewhere.
+	 * ConcurrentReads: readers may still walk the detached nodes,
+	 * so the other map has to be destroyed through Epoch::retire() */
+	void swap(HashMap &other) {
+		_seq_begin();
+		HashTable *tab = htab, *backup = rehashing_backup;
+		_store(htab, other.htab);
+		_store(rehashing_backup, other.rehashing_backup);
+		other.htab = tab;
+		other.rehashing_backup = backup;
+		std::swap(move_id, other.move_id);
+		_seq_end();
+	}
+	
 	//clear all the data from the HashMap
 	void clear() {
+		if (_concurrent()) {
+			//the tables are replaced, since readers may be walking them
+			_seq_begin();
+			HashTable *tab = htab, *backup = rehashing_backup;
+			_store(htab, new HashTable(tab->get_capacity()));
+			_store(rehashing_backup, (HashTable *)nullptr);
+			_free(tab);
+			if (backup)
+				_free(backup);
+			move_id = 0;
+			_seq_end();
+			return;
+		}
+		
 		if (htab)
 			htab->clear();
 		
@@ -1,16 +1,24 @@
 #ifndef __IO_SHARED_HPP_
 #define __IO_SHARED_HPP_
 
+//c++
+#include <string>
+
 //networking
 #include <sys/socket.h> //sockaddr
 #include <netinet/in.h> //sockaddr_in6
 
+//custom
+#include "crc16.hpp"
+
 /** This is a header to hold some shared 
  * between a server and a client definitions and functions **/
 
 constexpr const char *PORT = "1234";
 constexpr size_t HEADER_SIZE = sizeof(uint32_t);
 constexpr size_t MAX_MSG_LEN = 256;
+//a reply may be much longer than a request, e.g. info
+constexpr size_t MAX_RESP_LEN = 4096;
 
 enum Tag : uint8_t {
 	TAG_NIL = 0, //nill
@@ -28,8 +36,34 @@ enum ErrorCode : uint32_t {
 	RES_NOCMD, //command doesn't exist
 	RES_TOOLONG, //request/response/data is too long
 	RES_INVALID, //invalid input
+	RES_WRONGTYPE, //the key holds a value of another type
+	RES_OOM, //the memory limit is reached and nothing can be evicted
+	RES_IOERR, //failed to read or write a file, e.g. a snapshot
+	RES_BUSY, //a background job of the same kind is in progress
+	RES_READONLY, //a write sent to a replica
+	//cluster redirects, the message is "<slot> <host>:<port>"
+	RES_MOVED, //the slot is served by another node, which has to be asked from now on
+	RES_ASK, //the key is being migrated, only this command goes to the other node after "asking"
+	RES_TRYAGAIN, //the key is being migrated right now
+	RES_CLUSTERDOWN, //no node serves the slot
 };
 
+constexpr size_t CLUSTER_SLOTS = 16384;
+
+/* returns the cluster hash slot of a key: CRC16 of the key or of its hash tag,
+ * the part between the first '{' and the next '}' if it isn't empty,
+ * so related keys, e.g. "{user1}.name" and "{user1}.age", share a node */
+inline uint16_t key_hash_slot(const std::string &key) {
+	size_t open = key.find('{');
+	if (open != std::string::npos) {
+		size_t close = key.find('}', open + 1);
+		if (close != std::string::npos && close > open + 1)
+			return crc16(key.data() + open + 1, close - open - 1) % CLUSTER_SLOTS;
+	}
+	
+	return crc16(key.data(), key.size()) % CLUSTER_SLOTS;
+}
+
 /* returns pointer to struct in_addr or in6_addr
  * it's inline to ensure only one definition is used 
  * during compilation across all files */
@@ -0,0 +1,35 @@
+#include "keyspace.hpp"
+
+//c++
+#include <random> //minstd_rand, uniform_real_distribution
+
+void KeyMeta::touch(EvictionPolicy policy) {
+	if (policy == ALLKEYS_LRU) {
+		access_ms = uint32_t(Clock::now_ms());
+	}
+	else if (policy == ALLKEYS_LFU) {
+		uint8_t freq = decayed_freq();
+		if (freq < LFU_MAX_VAL) {
+			//the more accesses were counted, the less likely the next one is,
+			//so 8 bits are enough to tell hot keys from the rest
+			static thread_local std::minstd_rand rng(std::random_device{}());
+			std::uniform_real_distribution<double> chance(0, 1);
+			double base = freq > LFU_INIT_VAL ? freq - LFU_INIT_VAL : 0;
+			if (chance(rng) < 1.0 / (base * LFU_LOG_FACTOR + 1))
+				freq++;
+		}
+		
+		access_freq = freq;
+		access_minutes = uint16_t(Clock::now_ms() / LFU_DECAY_MS);
+	}
+}
+
+uint32_t KeyMeta::idle_ms() const {
+	//unsigned subtraction handles a wrapped clock
+	return uint32_t(Clock::now_ms()) - access_ms;
+}
+
+uint8_t KeyMeta::decayed_freq() const {
+	uint16_t elapsed = uint16_t(Clock::now_ms() / LFU_DECAY_MS) - access_minutes;
+	return elapsed >= access_freq ? 0 : access_freq - elapsed;
+}
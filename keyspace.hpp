@@ -0,0 +1,95 @@
+#ifndef __KEYSPACE_HPP__
+#define __KEYSPACE_HPP__
+
+/* =====================================================================
+ * The keyspace maps every key to a typed value: a string, a sorted set or a list.
+ * A node of the keyspace carries the value and the key's ExpiryEntry,
+ * so expiry is a property of the key whatever its type is,
+ * and deleting/overwriting the node drops the value together with the ttl.
+ * The node also keeps the access bits of the eviction policies(KeyMeta),
+ * so keys are ranked for eviction without any list of recently used keys.
+ * =====================================================================*/
+
+//c++
+#include <cstdint> //uint32_t
+#include <memory> //shared_ptr
+#include <stdexcept> //logic_error
+#include <string>
+#include <utility> //std::move
+
+//custom
+#include "clock.hpp"
+#include "expiry_index.hpp"
+#include "hashmap.hpp"
+#include "packed_list.hpp"
+#include "sortedset.hpp"
+
+enum KeyType {
+	STRING_KEY,
+	ZSET_KEY,
+	LIST_KEY,
+};
+
+/* KeyValue
+ * The HashMap copies values on writes, so a sorted set or a list is held
+ * by a pointer and a copy of the value never copies the collection itself */
+struct KeyValue {
+	KeyType type = STRING_KEY;
+	std::string str; //STRING_KEY
+	std::shared_ptr<SortSet> zset; //ZSET_KEY
+	std::shared_ptr<PackedList> list; //LIST_KEY
+
+	KeyValue(const std::string &str) : type(STRING_KEY), str(str) {}
+	KeyValue(std::shared_ptr<SortSet> zset) : type(ZSET_KEY), zset(std::move(zset)) {}
+	KeyValue(std::shared_ptr<PackedList> list) : type(LIST_KEY), list(std::move(list)) {}
+};
+
+//thrown when a command is applied to a key of another type
+class WrongTypeError : public std::logic_error {
+public:
+	WrongTypeError()
+		: std::logic_error("operation against a key holding the wrong kind of value") {}
+};
+
+//which keys are evicted once the memory limit is reached
+enum EvictionPolicy {
+	NO_EVICTION, //writes are refused instead
+	ALLKEYS_LRU, //the least recently used key
+	ALLKEYS_LFU, //the least frequently used key
+	VOLATILE_TTL, //the key with a ttl closest to its deadline
+};
+
+constexpr uint8_t LFU_INIT_VAL = 5; //new keys aren't the first to go
+constexpr uint8_t LFU_MAX_VAL = 255;
+constexpr double LFU_LOG_FACTOR = 10; //~1M accesses to saturate the counter
+constexpr int64_t LFU_DECAY_MS = 60 * 1000; //the counter drops by 1 per idle minute
+
+/* KeyMeta
+ * the bookkeeping embedded into every keyspace node: 
+ * the expiry entry and the access bits of LRU/LFU */
+struct KeyMeta : public ExpiryEntry {
+	//LRU: low 32 bits of the monotonic ms of the last access,
+	//the idle time wraps after ~49 days, which is fine for an approximation
+	uint32_t access_ms = uint32_t(Clock::now_ms());
+	//LFU: minutes of the last access, to decay the counter of idle keys
+	uint16_t access_minutes = uint16_t(Clock::now_ms() / LFU_DECAY_MS);
+	//LFU: logarithmic access counter, incremented with a decreasing probability
+	uint8_t access_freq = LFU_INIT_VAL;
+	
+	//records an access the way the policy needs it, nothing for the others
+	void touch(EvictionPolicy policy);
+	uint32_t idle_ms() const;
+	//the LFU counter after the decay for the idle minutes
+	uint8_t decayed_freq() const;
+};
+
+//the keyspace nodes carry their own deadline, expiry index links 
+//and access bits, so a TTL query is a single HashMap lookup.
+//The read threads look keys up concurrently(read()), they use only
+//the value and the deadline, the access bits are the event loop's.
+//Without read threads the map writes as a plain HashMap(see ConcurrentReads)
+typedef HashMap<std::string, KeyValue, KeyMeta, true> KeyMap;
+constexpr int hmap_base_capacity = 128;
+constexpr int zset_base_capacity = 16; //there may be many small sets
+
+#endif
@@ -0,0 +1,66 @@
+#include "lazy_free.hpp"
+
+//c++
+#include <utility> //std::move
+
+LazyFree::LazyFree() : worker(&LazyFree::_run, this) {}
+
+LazyFree::~LazyFree() {
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		stop = true;
+	}
+	
+	cv.notify_one();
+	worker.join();
+}
+
+void LazyFree::_run() {
+	std::unique_lock<std::mutex> lock(mtx);
+	while (true) {
+		cv.wait(lock, [this] { return stop || !jobs.empty(); });
+		if (jobs.empty())
+			return; //stopped and everything is freed
+		
+		std::shared_ptr<void> obj = std::move(jobs.front());
+		jobs.pop_front();
+		
+		//the object is freed without the lock, so the event loop isn't blocked
+		lock.unlock();
+		obj.reset();
+		pending.fetch_sub(1, std::memory_order_relaxed);
+		freed.fetch_add(1, std::memory_order_relaxed);
+		lock.lock();
+	}
+}
+
+std::shared_ptr<void> LazyFree::heavy_part(const KeyValue &val) {
+	if (val.type == ZSET_KEY && val.zset->size() > LAZYFREE_THRESHOLD)
+		return val.zset;
+	
+	if (val.type == LIST_KEY && val.list->size() > LAZYFREE_THRESHOLD)
+		return val.list;
+	
+	return nullptr;
+}
+
+void LazyFree::release(std::shared_ptr<void> obj) {
+	if (!obj)
+		return;
+	
+	pending.fetch_add(1, std::memory_order_relaxed);
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		jobs.push_back(std::move(obj));
+	}
+	
+	cv.notify_one();
+}
+
+LazyFreeStats LazyFree::get_stats() const {
+	LazyFreeStats stats;
+	stats.pending_objects = pending.load(std::memory_order_relaxed);
+	stats.freed_objects = freed.load(std::memory_order_relaxed);
+	
+	return stats;
+}
@@ -0,0 +1,63 @@
+#ifndef __LAZY_FREE_HPP__
+#define __LAZY_FREE_HPP__
+
+/* =====================================================================
+ * LazyFree frees big values on a background thread.
+ * Freeing a sorted set walks all of its nodes, so deleting a set of
+ * millions of keys on the event loop would block every client.
+ * Instead the value is detached from the keyspace in O(1) and its last
+ * reference is handed to the thread, so the destructor runs there.
+ * Values are held by shared_ptr<void>, which keeps the deleter
+ * of the real type, so any object(a set, a whole keyspace) can be queued.
+ * =====================================================================*/
+
+//c++
+#include <atomic>
+#include <condition_variable>
+#include <cstddef> //size_t
+#include <deque>
+#include <memory> //shared_ptr
+#include <mutex>
+#include <thread>
+
+//custom
+#include "keyspace.hpp"
+
+//values with fewer elements are cheaper to free right away than to queue
+constexpr size_t LAZYFREE_THRESHOLD = 64;
+
+struct LazyFreeStats {
+	size_t pending_objects = 0; //queued, but not freed yet
+	size_t freed_objects = 0; //freed by the thread
+};
+
+class LazyFree {
+private:
+	std::deque<std::shared_ptr<void>> jobs;
+	std::mutex mtx; //guards jobs and stop
+	std::condition_variable cv;
+	bool stop = false;
+	std::atomic<size_t> pending{0};
+	std::atomic<size_t> freed{0};
+	std::thread worker; //the last one, it starts when the rest is ready
+	
+	void _run();
+	
+public:
+	LazyFree();
+	//frees the queued objects and stops the thread
+	~LazyFree();
+	LazyFree(const LazyFree &) = delete;
+	LazyFree &operator=(const LazyFree &) = delete;
+	
+	/* returns a reference to the part of the value which is expensive to free,
+	 * nullptr if it's cheap. It has to be taken before the value is dropped
+	 * from the keyspace and then passed to release() */
+	static std::shared_ptr<void> heavy_part(const KeyValue &val);
+	//hands the object to the thread, nullptr is ignored
+	void release(std::shared_ptr<void> obj);
+	
+	LazyFreeStats get_stats() const;
+};
+
+#endif
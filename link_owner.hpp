@@ -0,0 +1,26 @@
+#ifndef __LINK_OWNER_HPP__
+#define __LINK_OWNER_HPP__
+
+//c++
+#include <cstddef> //size_t
+#include <vector>
+
+/* LinkOwner
+ * a module with sockets of its own, e.g. the replication links or
+ * the link of a slot migration. The event loop polls them together
+ * with the client connections and hands their events over to the owner */
+class LinkOwner {
+public:
+	virtual ~LinkOwner() {}
+
+	virtual std::vector<size_t> get_fds() const = 0;
+	virtual bool owns(int fd) const = 0;
+	virtual bool is_readable(int fd) const = 0;
+	virtual bool is_writable(int fd) const = 0;
+	virtual bool is_closing(int fd) const = 0;
+	virtual void handle_read(int fd) = 0;
+	virtual void handle_write(int fd) = 0;
+	virtual void close_link(int fd) = 0;
+};
+
+#endif
@@ -1,8 +1,25 @@
+#include "commands.hpp" //CommandExecutor
+#include "config.hpp"
 #include "server.hpp"
 
-int main() {
-	Server s;
-	s.run();
+int main(int argc, char **argv) {
+	Config config;
+	try {
+		config = Config::from_args(argc, argv);
+	}
+	catch (const std::exception &e) { //bad values, e.g. out of range numbers
+		std::cerr << e.what() << "\n" << Config::usage() << "\n";
+		return 1;
+	}
+	
+	try {
+		Server s(config.port, std::make_unique<CommandExecutor>(config));
+		s.run();
+	}
+	catch (const std::exception &e) { //e.g. a corrupted snapshot
+		std::cerr << e.what() << "\n";
+		return 1;
+	}
 	
 	return 0;
 }
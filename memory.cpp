@@ -0,0 +1,76 @@
+#include "memory.hpp"
+
+//c++
+#include <atomic>
+#include <cstdlib> //malloc(), free()
+#include <new> //bad_alloc, nothrow_t
+
+//c
+#include <malloc.h> //malloc_usable_size()
+
+//relaxed, since it's only a counter which nothing is synchronized with
+static std::atomic<size_t> used_bytes{0};
+
+static void *counted_malloc(size_t size) {
+	void *ptr = std::malloc(size ? size : 1);
+	if (ptr)
+		used_bytes.fetch_add(malloc_usable_size(ptr), std::memory_order_relaxed);
+	
+	return ptr;
+}
+
+static void counted_free(void *ptr) {
+	if (!ptr)
+		return;
+	
+	used_bytes.fetch_sub(malloc_usable_size(ptr), std::memory_order_relaxed);
+	std::free(ptr);
+}
+
+size_t MemoryUsage::used() {
+	return used_bytes.load(std::memory_order_relaxed);
+}
+
+void *operator new(size_t size) {
+	void *ptr = counted_malloc(size);
+	if (!ptr)
+		throw std::bad_alloc();
+	
+	return ptr;
+}
+
+void *operator new[](size_t size) {
+	return operator new(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+	return counted_malloc(size);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept {
+	return counted_malloc(size);
+}
+
+void operator delete(void *ptr) noexcept {
+	counted_free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept {
+	counted_free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+	counted_free(ptr);
+}
+
+void operator delete[](void *ptr, size_t) noexcept {
+	counted_free(ptr);
+}
+
+void operator delete(void *ptr, const std::nothrow_t &) noexcept {
+	counted_free(ptr);
+}
+
+void operator delete[](void *ptr, const std::nothrow_t &) noexcept {
+	counted_free(ptr);
+}
@@ -0,0 +1,19 @@
+#ifndef __MEMORY_HPP__
+#define __MEMORY_HPP__
+
+//c++
+#include <cstddef> //size_t
+
+/* MemoryUsage
+ * Every allocation of the server goes through the replaced global
+ * operator new/delete(memory.cpp), which add the real size of the block
+ * given by the allocator to a single counter. So the HashMap nodes,
+ * the sorted sets' indexes, the expiry heap and the buffers are all
+ * accounted without any changes to the structures themselves */
+class MemoryUsage {
+public:
+	//bytes currently allocated with new
+	static size_t used();
+};
+
+#endif
@@ -0,0 +1,108 @@
+#ifndef __ORDERED_INDEX_HPP__
+#define __ORDERED_INDEX_HPP__
+
+/* =====================================================================
+ * OrderedIndex is an interface of the ordered part of the Sorted Set.
+ * It stores pairs of (key, value), whereas the key(e.g. score) gives order
+ * but not necessarily unique and the value(e.g. name) is unique,
+ * so pairs with equal keys are ordered by their values using Compare
+ * (e.g. PointeeLess to order shared_ptr<string> names lexicographically).
+ * Implemented by:
+ * //SkipList// - pointer-per-node towers, O(logN) on average
+ * //BPTree// - cache-friendly B+tree with contiguous leaves, O(logN)
+ * =====================================================================*/
+
+#include <cmath> //isinf, NAN
+#include <cstddef> //size_t
+#include <functional> //std::less, std::function
+#include <utility> //std::pair
+#include <vector>
+
+//orders pointers by the objects they point to instead of by addresses
+template <typename P>
+struct PointeeLess {
+	bool operator()(const P &lhs, const P &rhs) const {
+		return *lhs < *rhs;
+	}
+};
+
+/* a sum of keys which counts the infinite keys apart from the finite ones,
+ * so a window is the difference of two prefix sums even if the prefixes
+ * hold an infinite key(inf - inf would make it NaN) */
+template <typename T>
+struct KeySum {
+	T finite = 0;
+	size_t plus_inf = 0; //number of +inf keys
+	size_t minus_inf = 0; //number of -inf keys
+	
+	KeySum &operator+=(const T &key) {
+		if (!std::isinf(key))
+			finite += key;
+		else if (key > 0)
+			plus_inf++;
+		else
+			minus_inf++;
+		
+		return *this;
+	}
+	
+	KeySum &operator+=(const KeySum &other) {
+		finite += other.finite;
+		plus_inf += other.plus_inf;
+		minus_inf += other.minus_inf;
+		
+		return *this;
+	}
+	
+	//the sum of the keys which are in this sum but not in the prefix
+	KeySum operator-(const KeySum &prefix) const {
+		return {finite - prefix.finite, plus_inf - prefix.plus_inf, minus_inf - prefix.minus_inf};
+	}
+	
+	//the sum itself: NaN if it holds both +inf and -inf
+	T value() const {
+		if (plus_inf > 0 && minus_inf > 0)
+			return NAN;
+		
+		if (plus_inf > 0)
+			return INFINITY;
+		
+		return minus_inf > 0 ? -INFINITY : finite;
+	}
+};
+
+template <typename T, typename P>
+class OrderedIndex {
+public:
+	virtual ~OrderedIndex() = default;
+
+	virtual void insert(const T &key, const P &value) = 0;
+	virtual void erase(const T &key, const P &value) = 0;
+	//moves (old_key, value) to new_key, returns false if it wasn't found
+	virtual bool update(const T &old_key, const P &value, const T &new_key) = 0;
+	//returns at most count values starting from the first key >= from
+	virtual std::vector<P> range(const T &from, size_t count) = 0;
+	//returns 0-based position of (key, value) or -1 if it wasn't found
+	virtual long rank(const T &key, const P &value) = 0;
+	//returns the number of pairs < (key, value), or <= (key, value) if inclusive,
+	//the value doesn't have to be stored in the index
+	virtual size_t count_before(const T &key, const P &value, bool inclusive) = 0;
+	//sets count and sum to the number and the sum of keys of the pairs < (key, value),
+	//or <= (key, value) if inclusive
+	virtual void aggregate_before(const T &key, const P &value, bool inclusive, 
+											size_t &count, KeySum<T> &sum) = 0;
+	//the sum of the keys of all the pairs
+	virtual KeySum<T> sum() = 0;
+	//returns at most count values starting from the 0-based position start,
+	//going to the lower positions if reverse
+	virtual std::vector<P> range_by_rank(size_t start, size_t count, bool reverse) = 0;
+	//replaces the content with the pairs in O(n), the pairs have to be
+	//sorted by (key, value) and have unique values
+	virtual void build(const std::vector<std::pair<T, P>> &pairs) = 0;
+	//visits all the pairs in order, e.g. to serialize them
+	virtual void for_each(const std::function<void(const T &, const P &)> &visit) = 0;
+	virtual void clear() = 0;
+	virtual size_t size() const = 0;
+};
+
+#endif
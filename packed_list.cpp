@@ -0,0 +1,184 @@
+#include "packed_list.hpp"
+
+//c++
+#include <cstdint> //uint8_t
+
+//the bytes of n in 7 bit groups
+static size_t varint_size(size_t n) {
+	size_t size = 1;
+	while (n >= 0x80) {
+		n >>= 7;
+		size++;
+	}
+
+	return size;
+}
+
+//|len|bytes|backlen| of a value of len bytes
+static size_t entry_size(size_t len) {
+	size_t entry = varint_size(len) + len;
+
+	return entry + varint_size(entry);
+}
+
+void PackedList::_pack(const std::string &val, std::string &out) {
+	size_t len = val.size();
+	while (len >= 0x80) {
+		out.push_back(char((len & 0x7F) | 0x80));
+		len >>= 7;
+	}
+	out.push_back(char(len));
+	size_t entry = varint_size(val.size()) + val.size();
+	out += val;
+
+	//the high groups first, so the low one is the last byte and is read first backwards
+	size_t groups = varint_size(entry);
+	for (size_t i = groups; i-- > 0;) {
+		uint8_t group = (entry >> (7 * i)) & 0x7F;
+		out.push_back(char(i + 1 < groups ? group | 0x80 : group));
+	}
+}
+
+size_t PackedList::_unpack(const std::string &data, size_t pos, std::string *val) {
+	size_t len = 0;
+	size_t shift = 0;
+	size_t start = pos;
+	uint8_t byte = 0;
+	do {
+		byte = uint8_t(data[pos++]);
+		len |= size_t(byte & 0x7F) << shift;
+		shift += 7;
+	} while (byte & 0x80);
+
+	if (val)
+		val->assign(data, pos, len);
+
+	return start + entry_size(len);
+}
+
+size_t PackedList::_entry_before(const std::string &data, size_t end) {
+	size_t pos = end - 1;
+	uint8_t byte = uint8_t(data[pos]);
+	size_t entry = byte & 0x7F;
+	size_t shift = 7;
+	while (byte & 0x80) {
+		byte = uint8_t(data[--pos]);
+		entry |= size_t(byte & 0x7F) << shift;
+		shift += 7;
+	}
+
+	return entry + (end - pos);
+}
+
+void PackedList::push_front(const std::string &val) {
+	std::string entry;
+	_pack(val, entry);
+	//a chunk holds one entry at least, however long
+	if (chunks.empty() || chunks.front().data.size() + entry.size() > LIST_CHUNK_BYTES)
+		chunks.emplace_front();
+
+	Chunk &chunk = chunks.front();
+	chunk.data.insert(0, entry);
+	chunk.count++;
+	length++;
+}
+
+void PackedList::push_back(const std::string &val) {
+	if (chunks.empty() || chunks.back().data.size() + entry_size(val.size()) > LIST_CHUNK_BYTES)
+		chunks.emplace_back();
+
+	Chunk &chunk = chunks.back();
+	_pack(val, chunk.data);
+	chunk.count++;
+	length++;
+}
+
+bool PackedList::pop_front(std::string &val) {
+	if (chunks.empty())
+		return false;
+
+	Chunk &chunk = chunks.front();
+	chunk.data.erase(0, _unpack(chunk.data, 0, &val));
+	if (--chunk.count == 0)
+		chunks.pop_front();
+	length--;
+
+	return true;
+}
+
+bool PackedList::pop_back(std::string &val) {
+	if (chunks.empty())
+		return false;
+
+	Chunk &chunk = chunks.back();
+	size_t start = chunk.data.size() - _entry_before(chunk.data, chunk.data.size());
+	_unpack(chunk.data, start, &val);
+	chunk.data.resize(start);
+	if (--chunk.count == 0)
+		chunks.pop_back();
+	length--;
+
+	return true;
+}
+
+std::vector<std::string> PackedList::range(long start, long stop) const {
+	long len = long(length);
+	if (start < 0)
+		start += len;
+	if (stop < 0)
+		stop += len;
+	if (start < 0)
+		start = 0;
+	if (stop >= len)
+		stop = len - 1;
+
+	std::vector<std::string> v;
+	if (start > stop)
+		return v;
+
+	//whole chunks are skipped by their counts
+	size_t skip = start;
+	size_t i = 0;
+	while (skip >= chunks[i].count)
+		skip -= chunks[i++].count;
+
+	v.reserve(stop - start + 1);
+	size_t pos = 0;
+	while (v.size() < size_t(stop - start + 1)) {
+		const Chunk &chunk = chunks[i];
+		if (pos == chunk.data.size()) {
+			i++;
+			pos = 0;
+			continue;
+		}
+
+		if (skip > 0) {
+			pos = _unpack(chunk.data, pos, nullptr);
+			skip--;
+			continue;
+		}
+
+		v.emplace_back();
+		pos = _unpack(chunk.data, pos, &v.back());
+	}
+
+	return v;
+}
+
+void PackedList::for_each(const std::function<void(const std::string &)> &visit) const {
+	std::string val;
+	for (const Chunk &chunk : chunks) {
+		for (size_t pos = 0; pos < chunk.data.size();) {
+			pos = _unpack(chunk.data, pos, &val);
+			visit(val);
+		}
+	}
+}
+
+size_t PackedList::size() const {
+	return length;
+}
+
+size_t PackedList::chunks_num() const {
+	return chunks.size();
+}
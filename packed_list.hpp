@@ -0,0 +1,63 @@
+#ifndef __PACKED_LIST_HPP__
+#define __PACKED_LIST_HPP__
+
+/* =====================================================================
+ * PackedList is the value of a list key: a deque of strings
+ * pushed and popped at both ends.
+ *
+ * The elements aren't allocated one by one, they're packed into chunks
+ * of up to LIST_CHUNK_BYTES, and the list is a deque of the chunks:
+ *   - an entry is |len varint|bytes|backlen|, where backlen is the size
+ *     of the first two parts written backwards, so a chunk is walked
+ *     from either end without any index
+ *   - a push appends to the end chunk or starts a new one, a pop cuts
+ *     the end entry off and drops the chunk once it's empty, so both
+ *     are O(1) apart from moving the bytes of one chunk at the front
+ *   - an element costs its bytes and 2-6 bytes of lengths instead of
+ *     a node with two pointers and a separate allocation
+ *   - a range skips whole chunks by their counts and then walks
+ *     the entries of a few chunks
+ * =====================================================================*/
+
+//c++
+#include <cstddef> //size_t
+#include <deque>
+#include <functional> //std::function
+#include <string>
+#include <vector>
+
+constexpr size_t LIST_CHUNK_BYTES = 4096;
+
+class PackedList {
+private:
+	struct Chunk {
+		std::string data; //the packed entries, head to tail
+		size_t count = 0;
+	};
+
+	std::deque<Chunk> chunks;
+	size_t length = 0;
+
+	//appends |len|bytes|backlen|
+	static void _pack(const std::string &val, std::string &out);
+	//the entry at pos: its value and the position of the next one
+	static size_t _unpack(const std::string &data, size_t pos, std::string *val);
+	//the size of the entry which ends at end
+	static size_t _entry_before(const std::string &data, size_t end);
+
+public:
+	void push_front(const std::string &val);
+	void push_back(const std::string &val);
+	//returns false if the list is empty
+	bool pop_front(std::string &val);
+	bool pop_back(std::string &val);
+	/* the elements from start to stop inclusive,
+	 * a negative index counts from the tail(-1 is the last element) */
+	std::vector<std::string> range(long start, long stop) const;
+	//visits the elements head to tail
+	void for_each(const std::function<void(const std::string &)> &visit) const;
+	size_t size() const;
+	size_t chunks_num() const;
+};
+
+#endif
@@ -0,0 +1,346 @@
+#include "persistence.hpp"
+
+//c
+#include <errno.h>
+#include <fcntl.h> //open()
+#include <signal.h> //kill()
+#include <string.h> //strerror()
+#include <sys/wait.h> //waitpid()
+#include <unistd.h> //fork(), pipe(), _exit(), fsync()
+
+//c++
+#include <algorithm> //max, min
+#include <climits> //INT_MAX
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <utility> //std::move
+
+//custom
+#include "clock.hpp"
+
+//returns the private dirty memory of the process: the pages it has written
+//since the fork, either itself or because the other process did
+static size_t private_dirty_bytes() {
+	std::ifstream smaps("/proc/self/smaps_rollup");
+	std::string line;
+	while (std::getline(smaps, line)) {
+		if (line.compare(0, 14, "Private_Dirty:") != 0)
+			continue;
+
+		size_t kb = 0;
+		std::istringstream(line.substr(14)) >> kb;
+		return kb * 1024;
+	}
+
+	return 0; //not supported by the kernel
+}
+
+Persistence::Persistence(KeyMap &hmap, TTLManager &ttl_manager, AppendOnlyFile &aof,
+				const std::string &path, std::vector<SavePoint> save_points,
+				size_t rewrite_percentage, size_t rewrite_min_size)
+		: hmap(hmap), ttl_manager(ttl_manager), aof(aof), path(path),
+		save_points(std::move(save_points)), rewrite_percentage(rewrite_percentage),
+		rewrite_min_size(rewrite_min_size), last_save_ms(Clock::now_ms()) {}
+
+Persistence::~Persistence() {
+	if (child <= 0)
+		return;
+
+	kill(child, SIGKILL);
+	waitpid(child, nullptr, 0);
+	close(report_fd);
+	if (child_kind == SNAPSHOT_CHILD)
+		unlink((path + ".tmp-" + std::to_string(child)).c_str());
+	else
+		aof.cancel_rewrite(child);
+}
+
+void Persistence::_fork(ChildKind kind) {
+	int fds[2];
+	if (pipe(fds) != 0)
+		throw SnapshotError(std::string("pipe(): ") + strerror(errno));
+
+	int64_t start = Clock::precise_us();
+	child_kind = kind;
+	pid_t pid = fork();
+	if (pid < 0) {
+		int err = errno;
+		close(fds[0]);
+		close(fds[1]);
+		throw SnapshotError(std::string("fork(): ") + strerror(err));
+	}
+
+	if (pid == 0) {
+		close(fds[0]);
+		_child_main(fds[1]);
+	}
+
+	//the page tables are copied, so it grows with the used memory
+	stats.last_fork_us = Clock::precise_us() - start;
+	close(fds[1]);
+	child = pid;
+	report_fd = fds[0];
+}
+
+void Persistence::_child_main(int pipe_fd) {
+	ChildReport report = {0, 0, 0};
+	int64_t start = Clock::precise_us();
+	int code = 0;
+	try {
+		if (child_kind == SNAPSHOT_CHILD)
+			report.bytes = Snapshot::save(hmap, ttl_manager, path);
+		else
+			report.bytes = _write_preamble();
+	}
+	catch (const SnapshotError &e) {
+		std::cerr << "background " << (child_kind == SNAPSHOT_CHILD ? "save" : "rewrite")
+			<< " failed: " << e.what() << "\n";
+		code = 1;
+	}
+
+	report.elapsed_us = Clock::precise_us() - start;
+	report.cow_bytes = private_dirty_bytes();
+
+	//less than PIPE_BUF, so it's written at once
+	if (write(pipe_fd, &report, sizeof(report)) != sizeof(report))
+		code = 1;
+
+	//no destructors and atexit handlers, they belong to the parent
+	_exit(code);
+}
+
+size_t Persistence::_write_preamble() {
+	//the parent appends the commands fed meanwhile to it
+	std::string new_path = aof.rewrite_path(getpid());
+	int fd = open(new_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		throw SnapshotError("open(" + new_path + "): " + strerror(errno));
+
+	size_t size = 0;
+	try {
+		size = Snapshot::write(fd, hmap, ttl_manager);
+		if (fsync(fd) != 0)
+			throw SnapshotError(std::string("fsync(): ") + strerror(errno));
+	}
+	catch (const SnapshotError &) {
+		close(fd);
+		unlink(new_path.c_str());
+		throw;
+	}
+
+	close(fd);
+	return size;
+}
+
+void Persistence::_finish_child(int status) {
+	ChildReport report;
+	ssize_t rv = read(report_fd, &report, sizeof(report));
+	close(report_fd);
+	report_fd = -1;
+	pid_t pid = child;
+	child = -1;
+
+	bool ok = WIFEXITED(status) && WEXITSTATUS(status) == 0 && rv == sizeof(report);
+	if (child_kind == SNAPSHOT_CHILD)
+		_finish_bgsave(ok, report);
+	else
+		_finish_rewrite(ok, report, pid);
+}
+
+void Persistence::_finish_bgsave(bool ok, const ChildReport &report) {
+	stats.last_bgsave_ok = ok;
+	if (!stats.last_bgsave_ok) {
+		std::cout << "background saving failed\n";
+		return;
+	}
+
+	//the writes made while the child was saving aren't in the file
+	stats.dirty -= dirty_at_fork;
+	last_save_ms = Clock::now_ms();
+	stats.last_save_time = Clock::to_unix_ms(last_save_ms);
+	stats.last_save_bytes = report.bytes;
+	stats.last_save_us = report.elapsed_us;
+	stats.last_cow_bytes = report.cow_bytes;
+
+	std::cout << "background saving finished: " << report.bytes << " bytes in "
+		<< report.elapsed_us / 1000 << " ms, " << report.cow_bytes / 1024
+		<< " kB of copy-on-write\n";
+}
+
+void Persistence::_finish_rewrite(bool ok, const ChildReport &report, pid_t pid) {
+	if (!ok) {
+		aof.cancel_rewrite(pid);
+		stats.last_rewrite_ok = false;
+		std::cout << "append only file rewrite failed\n";
+		return;
+	}
+
+	try {
+		aof.finish_rewrite(pid);
+	}
+	catch (const AppendOnlyError &e) {
+		stats.last_rewrite_ok = false;
+		std::cerr << "append only file rewrite failed: " << e.what() << "\n";
+		return;
+	}
+
+	stats.last_rewrite_ok = true;
+	stats.last_rewrite_us = report.elapsed_us;
+	stats.last_rewrite_cow_bytes = report.cow_bytes;
+
+	std::cout << "append only file rewrite finished: " << aof.get_stats().current_size 
+		<< " bytes, the preamble took " << report.elapsed_us / 1000 << " ms, "
+		<< report.cow_bytes / 1024 << " kB of copy-on-write\n";
+}
+
+int64_t Persistence::_next_save_point() const {
+	if (child > 0 || stats.dirty == 0)
+		return -1;
+
+	int64_t now = Clock::now_ms();
+	//a failed save isn't retried right away
+	int64_t ready = stats.last_bgsave_ok ? now : last_try_ms + BGSAVE_RETRY_DELAY_MS;
+
+	int64_t wait = -1;
+	for (const SavePoint &point : save_points) {
+		if (stats.dirty < point.changes)
+			continue;
+
+		int64_t at = std::max(last_save_ms + point.seconds * 1000, ready);
+		int64_t point_wait = std::max<int64_t>(at - now, 0);
+		if (wait < 0 || point_wait < wait)
+			wait = point_wait;
+	}
+
+	return wait;
+}
+
+int64_t Persistence::_next_rewrite() const {
+	if (child > 0 || !aof.is_enabled() || rewrite_percentage == 0)
+		return -1;
+
+	const AOFStats &aof_stats = aof.get_stats();
+	size_t growth = aof_stats.base_size * rewrite_percentage / 100;
+	if (aof_stats.current_size < rewrite_min_size 
+					|| aof_stats.current_size < aof_stats.base_size + growth)
+		return -1;
+
+	if (stats.last_rewrite_ok)
+		return 0;
+
+	//a failed rewrite isn't retried right away
+	return std::max<int64_t>(last_rewrite_try_ms + BGSAVE_RETRY_DELAY_MS - Clock::now_ms(), 0);
+}
+
+size_t Persistence::load(SortBackend backend) {
+	if (access(path.c_str(), F_OK) != 0)
+		return 0; //the first start
+
+	int64_t start = Clock::precise_us();
+	size_t keys = Snapshot::load(path, hmap, ttl_manager, backend);
+	std::cout << "loaded " << keys << " keys from " << path << " in "
+		<< (Clock::precise_us() - start) / 1000 << " ms\n";
+
+	return keys;
+}
+
+void Persistence::save() {
+	if (bgsave_in_progress())
+		throw SnapshotError("a background save is in progress");
+
+	int64_t start = Clock::precise_us();
+	stats.last_save_bytes = Snapshot::save(hmap, ttl_manager, path);
+	stats.last_save_us = Clock::precise_us() - start;
+	stats.last_cow_bytes = 0; //nothing is shared
+
+	stats.dirty = 0;
+	last_save_ms = Clock::now_ms();
+	stats.last_save_time = Clock::to_unix_ms(last_save_ms);
+}
+
+void Persistence::bgsave() {
+	if (child > 0)
+		throw SnapshotError("a background child is already running");
+
+	last_try_ms = Clock::now_ms();
+	try {
+		_fork(SNAPSHOT_CHILD);
+	}
+	catch (const SnapshotError &) {
+		stats.last_bgsave_ok = false;
+		throw;
+	}
+
+	dirty_at_fork = stats.dirty;
+	std::cout << "background saving started by pid " << child << "\n";
+}
+
+bool Persistence::bgsave_in_progress() const {
+	return child > 0 && child_kind == SNAPSHOT_CHILD;
+}
+
+void Persistence::bgrewriteaof() {
+	if (!aof.is_enabled())
+		throw SnapshotError("append only file is disabled");
+
+	if (child > 0)
+		throw SnapshotError("a background child is already running");
+
+	last_rewrite_try_ms = Clock::now_ms();
+	try {
+		_fork(REWRITE_CHILD);
+	}
+	catch (const SnapshotError &) {
+		stats.last_rewrite_ok = false;
+		throw;
+	}
+
+	//from now on the writes are missing from the child's snapshot
+	aof.start_rewrite();
+	std::cout << "append only file rewrite started by pid " << child << "\n";
+}
+
+bool Persistence::rewrite_in_progress() const {
+	return child > 0 && child_kind == REWRITE_CHILD;
+}
+
+void Persistence::add_dirty(size_t changes) {
+	stats.dirty += changes;
+}
+
+void Persistence::run_cron() {
+	if (child > 0) {
+		int status = 0;
+		if (waitpid(child, &status, WNOHANG) == child)
+			_finish_child(status);
+
+		return;
+	}
+
+	try {
+		if (_next_save_point() == 0)
+			bgsave();
+		else if (_next_rewrite() == 0)
+			bgrewriteaof();
+	}
+	catch (const SnapshotError &e) {
+		std::cerr << "background child failed: " << e.what() << "\n";
+	}
+}
+
+int Persistence::get_next_timeout() const {
+	if (child > 0)
+		return PERSISTENCE_CRON_MS;
+
+	int64_t wait = _next_save_point();
+	int64_t rewrite_wait = _next_rewrite();
+	if (wait < 0 || (rewrite_wait >= 0 && rewrite_wait < wait))
+		wait = rewrite_wait;
+
+	return wait < 0 ? -1 : int(std::min<int64_t>(wait, INT_MAX));
+}
+
+const PersistenceStats &Persistence::get_stats() const {
+	return stats;
+}
@@ -0,0 +1,138 @@
+#ifndef __PERSISTENCE_HPP__
+#define __PERSISTENCE_HPP__
+
+/* =====================================================================
+ * Persistence saves the keyspace to a snapshot file and loads it back
+ * on startup. A background save forks the server: the child gets
+ * a copy-on-write view of the memory frozen at the fork and writes it
+ * to the file, while the parent keeps serving. Only the pages the parent
+ * modifies meanwhile are copied, which is the memory cost of the save
+ * reported by the child(the private dirty memory of the child's mappings).
+ * The child writes a tiny report to a pipe and exits, the event loop
+ * reaps it without blocking.
+ *
+ * Saves are triggered either by save/bgsave or by the save points:
+ * "after S seconds if at least N writes were made", e.g. 900 1 300 10.
+ *
+ * The rewrite of the append only file is forked the same way, the child
+ * writes the snapshot preamble of the new log(see AppendOnlyFile).
+ * It's triggered by bgrewriteaof or once the log has grown by the given
+ * percentage since the last rewrite. Only one child runs at a time.
+ * =====================================================================*/
+
+//c
+#include <sys/types.h> //pid_t
+
+//c++
+#include <cstddef> //size_t
+#include <cstdint> //int64_t
+#include <string>
+#include <vector>
+
+//custom
+#include "aof.hpp"
+#include "keyspace.hpp"
+#include "snapshot.hpp" //SnapshotError
+#include "sortedset.hpp" //SortBackend
+#include "ttl_manager.hpp"
+
+constexpr int64_t BGSAVE_RETRY_DELAY_MS = 5 * 1000; //after a failed background save
+constexpr int PERSISTENCE_CRON_MS = 100; //how often a running child is checked
+
+//a background save is triggered once both thresholds are reached
+struct SavePoint {
+	int64_t seconds;
+	size_t changes;
+};
+
+struct PersistenceStats {
+	size_t dirty = 0; //writes since the last successful save
+	int64_t last_save_time = 0; //unix ms of the last successful save
+	bool last_bgsave_ok = true;
+	size_t last_save_bytes = 0;
+	int64_t last_save_us = 0; //time taken to write the file
+	int64_t last_fork_us = 0; //time the parent was blocked by fork()
+	size_t last_cow_bytes = 0; //memory copied while the child was writing
+	bool last_rewrite_ok = true;
+	int64_t last_rewrite_us = 0; //time taken by the child to write the preamble
+	size_t last_rewrite_cow_bytes = 0;
+};
+
+class Persistence {
+private:
+	enum ChildKind {
+		SNAPSHOT_CHILD,
+		REWRITE_CHILD,
+	};
+
+	//what the child reports to the parent
+	struct ChildReport {
+		size_t bytes;
+		int64_t elapsed_us;
+		size_t cow_bytes;
+	};
+
+	KeyMap &hmap;
+	TTLManager &ttl_manager;
+	AppendOnlyFile &aof;
+	std::string path;
+	std::vector<SavePoint> save_points;
+	size_t rewrite_percentage; //growth since the last rewrite, 0 - only bgrewriteaof
+	size_t rewrite_min_size; //a smaller log isn't rewritten automatically
+	pid_t child = -1; //the background save or rewrite in progress
+	ChildKind child_kind = SNAPSHOT_CHILD;
+	int report_fd = -1; //the parent's end of the child's pipe
+	size_t dirty_at_fork = 0; //writes which the running child saves
+	int64_t last_save_ms; //monotonic, the save points are counted from it
+	int64_t last_try_ms = 0; //monotonic, of the last background save
+	int64_t last_rewrite_try_ms = 0;
+	PersistenceStats stats;
+
+	//forks the child of the given kind, throws SnapshotError
+	void _fork(ChildKind kind);
+	//the body of the forked child, never returns
+	[[noreturn]] void _child_main(int pipe_fd);
+	//writes the snapshot preamble of the new append only file, returns its size
+	size_t _write_preamble();
+	//reads the child's report and updates the stats after it's exited
+	void _finish_child(int status);
+	void _finish_bgsave(bool ok, const ChildReport &report);
+	void _finish_rewrite(bool ok, const ChildReport &report, pid_t pid);
+	//returns ms till a save point is reached, 0 if it is, -1 if none will be
+	int64_t _next_save_point() const;
+	//the same for the automatic rewrite
+	int64_t _next_rewrite() const;
+
+public:
+	Persistence(KeyMap &hmap, TTLManager &ttl_manager, AppendOnlyFile &aof,
+					const std::string &path, std::vector<SavePoint> save_points,
+					size_t rewrite_percentage, size_t rewrite_min_size);
+	//kills a running child, its file is incomplete anyway
+	~Persistence();
+	Persistence(const Persistence &) = delete;
+	Persistence &operator=(const Persistence &) = delete;
+
+	//loads the snapshot into the empty keyspace if the file exists,
+	//returns the number of loaded keys, throws SnapshotError
+	size_t load(SortBackend backend);
+	//saves on the event loop, throws SnapshotError
+	void save();
+	//forks a child to save in the background, throws SnapshotError
+	void bgsave();
+	bool bgsave_in_progress() const;
+	//forks a child to rewrite the append only file, throws SnapshotError
+	void bgrewriteaof();
+	bool rewrite_in_progress() const;
+	//counts a write towards the save points
+	void add_dirty(size_t changes = 1);
+
+	//reaps the finished child and starts a save when a save point is reached
+	//or a rewrite when the append only file has grown enough
+	void run_cron();
+	//returns ms till run_cron() is needed again, -1 if it isn't
+	int get_next_timeout() const;
+
+	const PersistenceStats &get_stats() const;
+};
+
+#endif
@@ -63,3 +63,20 @@ RequestParser::ParseResult RequestParser::parse(const std::vector<uint8_t> &requ
 		
 	return {true, cmd, ""};
 }
+
+static void append_u32(std::string &out, uint32_t val) {
+	out.append(reinterpret_cast<const char *>(&val), HEADER_SIZE);
+}
+
+void encode_request(const std::vector<std::string> &cmd, std::string &out) {
+	size_t len = HEADER_SIZE;
+	for (const auto &arg : cmd)
+		len += HEADER_SIZE + arg.size();
+	
+	append_u32(out, len);
+	append_u32(out, cmd.size());
+	for (const auto &arg : cmd) {
+		append_u32(out, arg.size());
+		out.append(arg);
+	}
+}
@@ -44,4 +44,8 @@ public:
 	ParseResult parse(const std::vector<uint8_t> &request, size_t req_len);
 };
 
+//appends the command to out in the request format(len | nstr | len1 | str1 | ...),
+//which is also the format of the append only file and the replication stream
+void encode_request(const std::vector<std::string> &cmd, std::string &out);
+
 #endif
@@ -0,0 +1,438 @@
+#include "proxy.hpp"
+
+//c
+#include <errno.h>
+#include <fcntl.h> //fcntl()
+#include <netdb.h> //getaddrinfo()
+#include <netinet/in.h> //IPPROTO_TCP
+#include <netinet/tcp.h> //TCP_NODELAY
+#include <string.h> //strerror()
+#include <sys/socket.h> //send(), recv(), connect()
+#include <unistd.h> //close()
+
+//c++
+#include <algorithm> //min, max
+#include <climits> //INT_MAX
+#include <cstring> //memcpy
+#include <iostream>
+#include <stdexcept> //invalid_argument
+
+//custom
+#include "clock.hpp"
+#include "protocol.hpp" //encode_request()
+
+constexpr size_t MAX_POOL_SIZE = 64;
+
+//EAGAIN and EINTR only mean the socket isn't ready
+static bool would_block() {
+	return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+}
+
+//a port number is passed to getaddrinfo() as a string
+static bool is_port(const std::string &val) {
+	return !val.empty() && val.size() <= 5 && val.find_first_not_of("0123456789") == std::string::npos
+						&& std::stoul(val) > 0 && std::stoul(val) <= 65535;
+}
+
+//splits "<host>:<port>,<host>:<port>,...", throws invalid_argument
+static std::vector<std::string> parse_backends(const std::string &val) {
+	std::vector<std::string> backends;
+	size_t pos = 0;
+	while (pos <= val.size()) {
+		size_t end = std::min(val.find(',', pos), val.size());
+		std::string node = val.substr(pos, end - pos);
+		size_t colon = node.rfind(':');
+		if (colon == std::string::npos || colon == 0 || !is_port(node.substr(colon + 1)))
+			throw std::invalid_argument("a backend is <host>:<port>: " + node);
+
+		backends.push_back(node);
+		pos = end + 1;
+	}
+
+	return backends;
+}
+
+//the commands without a key, they go to the first backend
+static bool has_key(const std::vector<std::string> &cmd) {
+	static const char *keyless[] = {"info", "save", "bgsave", "bgrewriteaof", "cluster"};
+	if (cmd.size() < 2)
+		return false;
+
+	for (const char *name : keyless) {
+		if (cmd[0] == name)
+			return false;
+	}
+
+	return true;
+}
+
+/* the commands a shared link can't carry: the ones which change the connection
+ * itself(a subscribed link would push the messages to whichever client is next),
+ * and the blocking pops, which would park the link and stall
+ * the requests of all the other clients behind them */
+static bool is_refused(const std::string &name) {
+	static const char *refused[] = {"proxy", "psync", "replicaof", "asking",
+									"subscribe", "psubscribe", "unsubscribe", "punsubscribe",
+									"blpop", "brpop"};
+	if (name.empty())
+		return true;
+
+	for (const char *cmd : refused) {
+		if (name == cmd)
+			return true;
+	}
+
+	return false;
+}
+
+/* ProxyConfig */
+ProxyConfig ProxyConfig::from_args(int argc, char **argv) {
+	ProxyConfig config;
+	std::vector<std::string> args(argv + 1, argv + argc);
+
+	for (size_t i = 0; i < args.size(); i++) {
+		const std::string &opt = args[i];
+		if (i + 1 >= args.size())
+			throw std::invalid_argument("missing value for " + opt);
+
+		const std::string &val = args[++i];
+		if (opt == "--port") {
+			if (!is_port(val))
+				throw std::invalid_argument("bad port: " + val);
+
+			config.port = val;
+		}
+		else if (opt == "--backends") {
+			config.backends = parse_backends(val);
+		}
+		else if (opt == "--pool-size") {
+			config.pool_size = std::stoul(val);
+			if (config.pool_size == 0 || config.pool_size > MAX_POOL_SIZE)
+				throw std::invalid_argument("the pool size is 1.." + std::to_string(MAX_POOL_SIZE));
+		}
+		else {
+			throw std::invalid_argument("unknown option: " + opt);
+		}
+	}
+
+	if (config.backends.empty())
+		throw std::invalid_argument("no backends");
+
+	return config;
+}
+
+std::string ProxyConfig::usage() {
+	return "usage: ./proxy --backends <host>:<port>[,<host>:<port> ...] [--port <port>]\n"
+		   "               [--pool-size <links per backend>]";
+}
+
+/* Proxy */
+Proxy::Proxy(const ProxyConfig &config) : backends(config.backends), pool_size(config.pool_size) {
+	for (const std::string &node : backends) {
+		for (size_t i = 0; i < pool_size; i++) {
+			Link link;
+			link.node = node;
+			links.push_back(std::move(link));
+		}
+	}
+
+	for (Link &link : links)
+		_connect(link);
+}
+
+Proxy::~Proxy() {
+	for (Link &link : links) {
+		if (link.fd >= 0)
+			close(link.fd);
+	}
+}
+
+//private
+void Proxy::_connect(Link &link) {
+	link.last_try_ms = Clock::now_ms();
+
+	size_t colon = link.node.rfind(':');
+	std::string host = link.node.substr(0, colon);
+	std::string port = link.node.substr(colon + 1);
+
+	struct addrinfo hints{}, *res;
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	int err = getaddrinfo(host.c_str(), port.c_str(), &hints, &res);
+	if (err != 0) {
+		std::cerr << "can't resolve the backend " << host << ": " << gai_strerror(err) << "\n";
+		return;
+	}
+
+	int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+	if (fd < 0) {
+		perror("socket()");
+		freeaddrinfo(res);
+		return;
+	}
+
+	//the requests of an iteration are sent at once, they mustn't wait for the acks of the previous ones
+	int yes = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+	int rv = connect(fd, res->ai_addr, res->ai_addrlen);
+	freeaddrinfo(res);
+	if (rv != 0 && errno != EINPROGRESS) {
+		perror("connect() to the backend");
+		close(fd);
+		return;
+	}
+
+	//the event loop reports when it's connected
+	link.fd = fd;
+	link.state = LINK_CONNECTING;
+	fd2link[fd] = &link - links.data();
+}
+
+void Proxy::_link_down(Link &link) {
+	std::cerr << "the link to the backend " << link.node << " is lost\n";
+	bool was_idle = link.state == LINK_UP && link.sent.empty();
+	if (link.fd >= 0) {
+		fd2link.erase(link.fd);
+		close(link.fd);
+		link.fd = -1;
+	}
+
+	link.state = LINK_DOWN;
+	link.last_try_ms = Clock::now_ms();
+	link.output.clear();
+	link.input.clear();
+	stats.link_errors++;
+
+	//whether they've been executed is unknown
+	std::deque<Request> sent;
+	sent.swap(link.sent);
+	std::string reply = error_reply(RES_IOERR, "the link to the backend " + link.node + " is lost");
+	for (const Request &request : sent)
+		replies.complete(request.client, request.seq, reply);
+	
+	//e.g. closed by the idle timeout of the backend, nothing has failed
+	if (was_idle)
+		_connect(link);
+}
+
+void Proxy::_forward(Link &link, const std::vector<std::string> &cmd, uint64_t client, uint64_t seq) {
+	if (link.state == LINK_DOWN) {
+		stats.refused++;
+		replies.complete(client, seq, error_reply(RES_IOERR, "the backend " + link.node + " is down"));
+		return;
+	}
+
+	//sent by before_reply() with the other requests of the iteration
+	encode_request(cmd, link.output);
+	link.sent.push_back({client, seq});
+	stats.forwarded++;
+}
+
+void Proxy::_read_replies(Link &link) {
+	std::string &input = link.input;
+	size_t pos = 0;
+	while (input.size() - pos >= HEADER_SIZE) {
+		uint32_t len = 0;
+		std::memcpy(&len, input.data() + pos, HEADER_SIZE);
+		if (len > MAX_RESP_LEN || link.sent.empty()) {
+			_link_down(link); //not the protocol of the server, or a reply nobody has asked for
+			return;
+		}
+
+		if (input.size() - pos - HEADER_SIZE < len)
+			break; //the rest hasn't come yet
+
+		Request request = link.sent.front();
+		link.sent.pop_front();
+		replies.complete(request.client, request.seq, input.substr(pos + HEADER_SIZE, len));
+		pos += HEADER_SIZE + len;
+	}
+
+	input.erase(0, pos);
+}
+
+void Proxy::_flush(Link &link) {
+	ssize_t rv = send(link.fd, link.output.data(), link.output.size(), MSG_NOSIGNAL);
+	stats.sends++;
+	if (rv < 0) {
+		if (!would_block())
+			_link_down(link);
+		return;
+	}
+
+	link.output.erase(0, rv);
+}
+
+//public
+void Proxy::do_query(const std::vector<std::string> &cmd,
+								RingBuffer<uint8_t> &, Client &client) {
+	const std::string name = cmd.empty() ? "" : cmd[0];
+	//a client uses one link of a backend, so its requests are executed in order
+	size_t link = client.id % pool_size;
+	if (name == "flushall") {
+		uint64_t seq = replies.reserve(client, backends.size());
+		for (size_t backend = 0; backend < backends.size(); backend++)
+			_forward(links[backend * pool_size + link], cmd, client.id, seq);
+
+		return;
+	}
+
+	uint64_t seq = replies.reserve(client);
+	if (name == "proxy" && cmd.size() == 2 && cmd[1] == "info") {
+		size_t up = std::count_if(links.begin(), links.end(),
+								[](const Link &link) { return link.state == LINK_UP; });
+		std::vector<std::string> lines = {
+			"proxy_clients:" + std::to_string(replies.clients_num()),
+			"proxy_backends:" + std::to_string(backends.size()),
+			"proxy_links:" + std::to_string(links.size()),
+			"proxy_links_up:" + std::to_string(up),
+			"proxy_forwarded:" + std::to_string(stats.forwarded),
+			"proxy_sends:" + std::to_string(stats.sends),
+			"proxy_refused:" + std::to_string(stats.refused),
+			"proxy_link_errors:" + std::to_string(stats.link_errors),
+		};
+
+		replies.complete(client.id, seq, arr_reply(lines));
+		return;
+	}
+
+	//the connection to the client isn't the connection to a server
+	if (is_refused(name)) {
+		stats.refused++;
+		replies.complete(client.id, seq, error_reply(RES_NOCMD, "not supported by the proxy: " + name));
+		return;
+	}
+
+	size_t backend = has_key(cmd) ? key_hash_slot(cmd[1]) * backends.size() / CLUSTER_SLOTS : 0;
+	_forward(links[backend * pool_size + link], cmd, client.id, seq);
+}
+
+size_t Proxy::take_replies(Client &client, RingBuffer<uint8_t> &buffer) {
+	return replies.take(client, buffer);
+}
+
+std::vector<int> Proxy::get_ready_clients() {
+	return replies.take_ready();
+}
+
+void Proxy::forget_client(const Client &client) {
+	replies.forget(client);
+}
+
+void Proxy::adopt_link(int fd, const std::vector<uint8_t> &) {
+	close(fd);
+}
+
+std::vector<LinkOwner *> Proxy::get_link_owners() {
+	return {this};
+}
+
+void Proxy::run_cron() {
+	int64_t now_ms = Clock::now_ms();
+	for (Link &link : links) {
+		if (link.state == LINK_DOWN && now_ms - link.last_try_ms >= PROXY_RETRY_MS)
+			_connect(link);
+	}
+}
+
+int Proxy::get_next_timeout() {
+	int64_t wait = -1;
+	int64_t now_ms = Clock::now_ms();
+	for (const Link &link : links) {
+		if (link.state != LINK_DOWN)
+			continue;
+
+		int64_t link_wait = std::max<int64_t>(link.last_try_ms + PROXY_RETRY_MS - now_ms, 0);
+		wait = wait < 0 ? link_wait : std::min(wait, link_wait);
+	}
+
+	return int(std::min<int64_t>(wait, INT_MAX));
+}
+
+void Proxy::before_reply() {
+	//the rest of an output which doesn't fit into the socket is sent when it's writable
+	for (Link &link : links) {
+		if (link.state == LINK_UP && !link.output.empty())
+			_flush(link);
+	}
+}
+
+std::vector<size_t> Proxy::get_fds() const {
+	std::vector<size_t> fds;
+	for (const auto &pair : fd2link)
+		fds.push_back(pair.first);
+
+	return fds;
+}
+
+bool Proxy::owns(int fd) const {
+	return fd2link.count(fd) > 0;
+}
+
+bool Proxy::is_readable(int fd) const {
+	auto it = fd2link.find(fd);
+	return it != fd2link.end() && links[it->second].state == LINK_UP;
+}
+
+bool Proxy::is_writable(int fd) const {
+	auto it = fd2link.find(fd);
+	if (it == fd2link.end())
+		return false;
+
+	const Link &link = links[it->second];
+	return link.state == LINK_CONNECTING || !link.output.empty();
+}
+
+bool Proxy::is_closing(int) const {
+	return false; //a link is closed right away
+}
+
+void Proxy::handle_read(int fd) {
+	auto it = fd2link.find(fd);
+	if (it == fd2link.end())
+		return;
+
+	Link &link = links[it->second];
+	std::vector<char> chunk(PROXY_READ_CHUNK);
+	ssize_t rv = recv(fd, chunk.data(), chunk.size(), 0);
+	if (rv < 0 && would_block())
+		return;
+
+	if (rv <= 0) {
+		_link_down(link);
+		return;
+	}
+
+	link.input.append(chunk.data(), rv);
+	_read_replies(link);
+}
+
+void Proxy::handle_write(int fd) {
+	auto it = fd2link.find(fd);
+	if (it == fd2link.end())
+		return;
+
+	Link &link = links[it->second];
+	if (link.state == LINK_CONNECTING) {
+		int err = 0;
+		socklen_t len = sizeof(err);
+		if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0 || err != 0) {
+			std::cerr << "can't connect to the backend " << link.node << ": " << strerror(err) << "\n";
+			_link_down(link);
+			return;
+		}
+
+		std::cout << "proxy: connected to the backend " << link.node << "\n";
+		link.state = LINK_UP;
+	}
+
+	if (!link.output.empty())
+		_flush(link);
+}
+
+void Proxy::close_link(int fd) {
+	auto it = fd2link.find(fd);
+	if (it != fd2link.end())
+		_link_down(links[it->second]);
+}
@@ -0,0 +1,139 @@
+#ifndef __PROXY_HPP__
+#define __PROXY_HPP__
+
+/* =====================================================================
+ * The proxy(./proxy) takes the connections of many clients off the servers.
+ *
+ * It runs on the same Server/ConnectionManager event loop as the server,
+ * but its requests are forwarded instead of executed: every backend server
+ * gets a small pool of long-lived links, and the requests of all the clients
+ * are pipelined over them, so a backend sees a few connections whatever
+ * the number of clients and their churn.
+ *   - a request goes to the backend of its key: the slot of the key
+ *     (CRC16 with {hash tags}, as in the cluster mode) picks a backend,
+ *     so the slots are split into as many ranges as there are backends
+ *   - a client always uses the same link of a backend, so its requests
+ *     to that backend are executed in the order it has sent them
+ *   - the requests of an event loop iteration go to a link in one send()
+ *   - a link matches its replies to the requests in the order it has sent
+ *     them, and every client gets its replies in the order of its requests,
+ *     even if they come from different backends
+ *   - keyless commands(info, save, ...) go to the first backend, flushall to all
+ *     of them, the commands which change the connection itself(psync, replicaof,
+ *     asking, subscribe, psubscribe, unsubscribe, punsubscribe) are refused,
+ *     and so are the blocking pops(blpop, brpop),
+ *     since a parked pop would stall every other client of the link
+ * A lost link fails the requests which are waiting for their replies, then
+ * it's reconnected after PROXY_RETRY_MS, the requests meanwhile are refused.
+ * An idle link closed by the backend(its connection timeout) is reconnected right away.
+ * =====================================================================*/
+
+//c++
+#include <cstddef> //size_t
+#include <cstdint> //uint64_t
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+//custom
+#include "buffer.hpp" //RingBuffer
+#include "deferred_replies.hpp"
+#include "io_shared_library.hpp" //PORT, key_hash_slot()
+#include "link_owner.hpp"
+#include "request_handler.hpp"
+
+constexpr int64_t PROXY_RETRY_MS = 1000; //a lost link to a backend is reconnected after it
+constexpr size_t PROXY_READ_CHUNK = 64 * 1024;
+
+/* ProxyConfig holds the proxy settings from the command line, e.g.:
+ * ./proxy --port 1300 --backends 127.0.0.1:1234,127.0.0.1:1235 --pool-size 2 */
+struct ProxyConfig {
+	std::string port = PORT;
+	std::vector<std::string> backends; //host:port
+	size_t pool_size = 2; //links per backend
+
+	//throws invalid_argument upon an unknown option or a bad value
+	static ProxyConfig from_args(int argc, char **argv);
+	static std::string usage();
+};
+
+struct ProxyStats {
+	size_t forwarded = 0; //requests sent to the backends
+	size_t sends = 0; //send() calls on the links
+	size_t refused = 0; //requests refused by the proxy itself
+	size_t link_errors = 0;
+};
+
+class Proxy : public RequestHandler, public LinkOwner {
+private:
+	//a request sent over a link, waiting for its reply
+	struct Request {
+		uint64_t client; //Client::id
+		uint64_t seq; //the number of the request of the client
+	};
+
+	enum LinkState {
+		LINK_DOWN, //waits to reconnect
+		LINK_CONNECTING,
+		LINK_UP,
+	};
+
+	struct Link {
+		std::string node; //host:port of the backend
+		LinkState state = LINK_DOWN;
+		int fd = -1;
+		int64_t last_try_ms = 0;
+		std::string output;
+		std::string input;
+		std::deque<Request> sent; //in the order of their replies
+	};
+
+	std::vector<std::string> backends;
+	size_t pool_size;
+	std::vector<Link> links; //pool_size links of every backend, one backend after another
+	std::unordered_map<int, size_t> fd2link;
+	DeferredReplies replies; //of the clients, in the order of their requests
+	ProxyStats stats;
+
+	void _connect(Link &link);
+	//fails the requests waiting for replies, the link is reconnected after PROXY_RETRY_MS
+	//or right away if it was idle
+	void _link_down(Link &link);
+	//sends the request to the backend, or refuses it if the link is down
+	void _forward(Link &link, const std::vector<std::string> &cmd, uint64_t client, uint64_t seq);
+	void _read_replies(Link &link);
+	void _flush(Link &link);
+
+public:
+	Proxy(const ProxyConfig &config);
+	~Proxy();
+	Proxy(const Proxy &) = delete;
+	Proxy &operator=(const Proxy &) = delete;
+
+	//every reply is deferred
+	void do_query(const std::vector<std::string> &cmd,
+										RingBuffer<uint8_t> &buffer, Client &client) override;
+	size_t take_replies(Client &client, RingBuffer<uint8_t> &buffer) override;
+	std::vector<int> get_ready_clients() override;
+	void forget_client(const Client &client) override;
+	//the proxy refuses psync, so a connection never turns into a link
+	void adopt_link(int fd, const std::vector<uint8_t> &pending) override;
+	std::vector<LinkOwner *> get_link_owners() override;
+	//reconnects the links which are down
+	void run_cron() override;
+	int get_next_timeout() override;
+	//sends the requests of the iteration, one send() per link
+	void before_reply() override;
+
+	std::vector<size_t> get_fds() const override;
+	bool owns(int fd) const override;
+	bool is_readable(int fd) const override;
+	bool is_writable(int fd) const override;
+	bool is_closing(int fd) const override;
+	void handle_read(int fd) override;
+	void handle_write(int fd) override;
+	void close_link(int fd) override;
+};
+
+#endif
@@ -0,0 +1,24 @@
+#include "proxy.hpp"
+#include "server.hpp"
+
+int main(int argc, char **argv) {
+	ProxyConfig config;
+	try {
+		config = ProxyConfig::from_args(argc, argv);
+	}
+	catch (const std::exception &e) { //bad values, e.g. out of range numbers
+		std::cerr << e.what() << "\n" << ProxyConfig::usage() << "\n";
+		return 1;
+	}
+	
+	try {
+		Server s(config.port, std::make_unique<Proxy>(config));
+		s.run();
+	}
+	catch (const std::exception &e) {
+		std::cerr << e.what() << "\n";
+		return 1;
+	}
+	
+	return 0;
+}
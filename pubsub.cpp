@@ -0,0 +1,243 @@
+#include "pubsub.hpp"
+
+//c++
+#include <iostream>
+#include <utility> //std::swap
+
+//custom
+#include "deferred_replies.hpp" //arr_reply()
+#include "io_shared_library.hpp" //HEADER_SIZE
+
+//|len(4)|TAG_ARR|n(4)|str|str|..., the frame of a reply
+static std::shared_ptr<const std::string> encode_message(const std::vector<std::string> &vals) {
+	std::string reply = arr_reply(vals);
+	uint32_t len = reply.size();
+	auto payload = std::make_shared<std::string>();
+	payload->reserve(HEADER_SIZE + reply.size());
+	payload->append((const char *)&len, HEADER_SIZE);
+	payload->append(reply);
+
+	return payload;
+}
+
+bool PubSub::_push(Client &client, const std::shared_ptr<const std::string> &payload) {
+	if (output_limit > 0 && client.pushed_bytes + payload->size() > output_limit)
+		return false;
+
+	//the connection takes the whole queue at once
+	if (client.pushed.empty())
+		ready.push_back(client.fd);
+
+	client.pushed.push_back(payload);
+	client.pushed_bytes += payload->size();
+
+	return true;
+}
+
+void PubSub::_cut_off(Client &client) {
+	if (!subscribers.count(client.id))
+		return; //has been cut off by another subscription of the same message
+
+	std::cout << "client " << client.fd << " is cut off, its messages are over the output limit\n";
+	stats.output_limit_drops++;
+	_unsubscribe_all(client.id);
+	client.subscriptions = 0;
+	client.pushed.clear();
+	client.cut_off = true;
+	ready.push_back(client.fd);
+}
+
+void PubSub::_unsubscribe_all(uint64_t client) {
+	auto it = subscribers.find(client);
+	if (it == subscribers.end())
+		return;
+
+	for (const std::string &channel : it->second.channels) {
+		auto receivers = channels.find(channel);
+		receivers->second.erase(client);
+		if (receivers->second.empty())
+			channels.erase(receivers);
+	}
+
+	for (const std::string &pattern : it->second.patterns) {
+		auto receivers = patterns.find(pattern);
+		receivers->second.erase(client);
+		if (receivers->second.empty())
+			patterns.erase(receivers);
+	}
+
+	subscribers.erase(it);
+}
+
+size_t PubSub::subscribe(Client &client, const std::string &name, bool pattern) {
+	Subscriber &subscriber = subscribers[client.id];
+	auto &names = pattern ? subscriber.patterns : subscriber.channels;
+	if (names.insert(name).second)
+		(pattern ? patterns : channels)[name][client.id] = &client;
+
+	client.subscriptions = subscriber.channels.size() + subscriber.patterns.size();
+	return client.subscriptions;
+}
+
+size_t PubSub::unsubscribe(Client &client, const std::string &name, bool pattern) {
+	auto it = subscribers.find(client.id);
+	if (it == subscribers.end())
+		return 0;
+
+	Subscriber &subscriber = it->second;
+	auto &names = pattern ? subscriber.patterns : subscriber.channels;
+	if (names.erase(name)) {
+		auto &all = pattern ? patterns : channels;
+		auto receivers = all.find(name);
+		receivers->second.erase(client.id);
+		if (receivers->second.empty())
+			all.erase(receivers);
+	}
+
+	client.subscriptions = subscriber.channels.size() + subscriber.patterns.size();
+	if (client.subscriptions == 0)
+		subscribers.erase(it);
+
+	return client.subscriptions;
+}
+
+std::vector<std::string> PubSub::get_subscriptions(const Client &client, bool pattern) const {
+	auto it = subscribers.find(client.id);
+	if (it == subscribers.end())
+		return {};
+
+	const auto &names = pattern ? it->second.patterns : it->second.channels;
+	return std::vector<std::string>(names.begin(), names.end());
+}
+
+size_t PubSub::publish(const std::string &channel, const std::string &message) {
+	stats.messages++;
+	size_t receivers = 0;
+	std::vector<Client *> over_limit;
+	auto deliver = [&](const Receivers &to, const std::shared_ptr<const std::string> &payload) {
+		for (const auto &pair : to) {
+			if (_push(*pair.second, payload))
+				receivers++;
+			else
+				over_limit.push_back(pair.second);
+		}
+	};
+
+	//one payload for the channel and one per matching pattern, whatever the number of receivers
+	auto it = channels.find(channel);
+	if (it != channels.end())
+		deliver(it->second, encode_message({"message", channel, message}));
+
+	for (const auto &pair : patterns) {
+		if (glob_match(pair.first, channel))
+			deliver(pair.second, encode_message({"pmessage", pair.first, channel, message}));
+	}
+
+	//after the walk, since it drops the subscriptions being walked
+	for (Client *client : over_limit)
+		_cut_off(*client);
+
+	return receivers;
+}
+
+std::vector<int> PubSub::take_ready() {
+	std::vector<int> fds;
+	fds.swap(ready);
+
+	return fds;
+}
+
+void PubSub::forget(const Client &client) {
+	_unsubscribe_all(client.id);
+}
+
+size_t PubSub::channels_num() const {
+	return channels.size();
+}
+
+size_t PubSub::patterns_num() const {
+	return patterns.size();
+}
+
+const PubSubStats &PubSub::get_stats() const {
+	return stats;
+}
+
+//matches c against the class which starts at pattern[p] == '[', moves p past the class
+static bool class_match(const std::string &pattern, size_t &p, char c) {
+	p++;
+	bool negate = p < pattern.size() && pattern[p] == '^';
+	if (negate)
+		p++;
+
+	bool match = false;
+	while (p < pattern.size() && pattern[p] != ']') {
+		if (pattern[p] == '\\' && p + 1 < pattern.size())
+			p++;
+
+		char low = pattern[p];
+		char high = low;
+		if (p + 2 < pattern.size() && pattern[p + 1] == '-' && pattern[p + 2] != ']') {
+			high = pattern[p + 2];
+			p += 2;
+		}
+
+		if (low > high)
+			std::swap(low, high);
+
+		if (low <= c && c <= high)
+			match = true;
+
+		p++;
+	}
+
+	if (p < pattern.size())
+		p++; //']'
+
+	return match != negate;
+}
+
+bool glob_match(const std::string &pattern, const std::string &str) {
+	size_t p = 0, s = 0;
+	//the last * and the part of str it has taken, widened by one char upon a mismatch
+	size_t star = std::string::npos, star_end = 0;
+	while (s < str.size()) {
+		if (p < pattern.size() && pattern[p] == '*') {
+			star = p++;
+			star_end = s;
+			continue;
+		}
+
+		if (p < pattern.size()) {
+			size_t next = p + 1;
+			bool match = true;
+			if (pattern[p] == '[') {
+				next = p;
+				match = class_match(pattern, next, str[s]);
+			}
+			else if (pattern[p] == '\\' && p + 1 < pattern.size()) {
+				match = pattern[p + 1] == str[s];
+				next = p + 2;
+			}
+			else if (pattern[p] != '?')
+				match = pattern[p] == str[s];
+
+			if (match) {
+				p = next;
+				s++;
+				continue;
+			}
+		}
+
+		if (star == std::string::npos)
+			return false;
+
+		p = star + 1;
+		s = ++star_end;
+	}
+
+	while (p < pattern.size() && pattern[p] == '*')
+		p++;
+
+	return p == pattern.size();
+}
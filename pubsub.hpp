@@ -0,0 +1,90 @@
+#ifndef __PUBSUB_HPP__
+#define __PUBSUB_HPP__
+
+/* =====================================================================
+ * PubSub delivers the messages published to a channel to the clients
+ * subscribed to the channel or to a pattern matching it(a glob: *, ?, [a-z], \x).
+ *
+ * A message is encoded once, framed with its length, into a payload
+ * shared by all its receivers:
+ *   - a receiver queues a reference to the payload(Client::pushed),
+ *     and its connection sends the payload right from there, so a message
+ *     to N subscribers costs N references instead of N copies in the
+ *     outgoing buffers of the connections
+ *   - the payload is freed once the slowest receiver has sent it
+ *   - a subscriber whose unsent messages exceed the output limit is
+ *     cut off: it's unsubscribed, its queue is dropped and its connection
+ *     is closed, so a slow client can't make the server hoard messages
+ * A subscribed connection runs only the (un)subscribe commands, so the
+ * messages are never mistaken for the replies to its requests.
+ * =====================================================================*/
+
+//c++
+#include <cstddef> //size_t
+#include <cstdint> //uint64_t
+#include <memory> //shared_ptr
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+//custom
+#include "request_handler.hpp" //Client
+
+constexpr size_t PUBSUB_OUTPUT_LIMIT = 32 << 20; //the default of --pubsub-output-limit
+
+struct PubSubStats {
+	size_t messages = 0; //published since the start
+	size_t output_limit_drops = 0; //subscribers cut off for their unsent messages
+};
+
+class PubSub {
+private:
+	//by client id, a client is valid till the handler forgets it
+	typedef std::unordered_map<uint64_t, Client *> Receivers;
+
+	struct Subscriber {
+		std::unordered_set<std::string> channels;
+		std::unordered_set<std::string> patterns;
+	};
+
+	std::unordered_map<uint64_t, Subscriber> subscribers; //by client id
+	std::unordered_map<std::string, Receivers> channels;
+	std::unordered_map<std::string, Receivers> patterns;
+	size_t output_limit; //bytes of unsent messages per subscriber, 0 - no limit
+	std::vector<int> ready; //fds of the clients whose queues have got messages
+	PubSubStats stats;
+
+	//queues the payload to the client, false if it would exceed the limit
+	bool _push(Client &client, const std::shared_ptr<const std::string> &payload);
+	//unsubscribes the client from everything and has its connection closed
+	void _cut_off(Client &client);
+	void _unsubscribe_all(uint64_t client);
+
+public:
+	PubSub(size_t output_limit) : output_limit(output_limit) {}
+
+	//pattern - name is a pattern instead of a channel,
+	//both return the number of the subscriptions of the client afterwards
+	size_t subscribe(Client &client, const std::string &name, bool pattern);
+	size_t unsubscribe(Client &client, const std::string &name, bool pattern);
+	//the channels or the patterns of the client, which unsubscribe without arguments drops
+	std::vector<std::string> get_subscriptions(const Client &client, bool pattern) const;
+
+	//returns the number of the clients the message is queued to
+	size_t publish(const std::string &channel, const std::string &message);
+
+	//RequestHandler::get_ready_clients()
+	std::vector<int> take_ready();
+	//RequestHandler::forget_client()
+	void forget(const Client &client);
+
+	size_t channels_num() const;
+	size_t patterns_num() const;
+	const PubSubStats &get_stats() const;
+};
+
+//a glob match of the whole str: * - any run, ? - any char, [a-z]/[^abc] - a class, \x - x itself
+bool glob_match(const std::string &pattern, const std::string &str);
+
+#endif
@@ -0,0 +1,117 @@
+#include "read_threads.hpp"
+
+//c++
+#include <memory> //unique_ptr
+#include <thread>
+#include <utility> //std::move
+
+//custom
+#include "clock.hpp"
+#include "epoch.hpp"
+#include "io_shared_library.hpp" //RES_*
+#include "server.hpp"
+#include "ttl_manager.hpp" //EXPIRED, NOTTL
+
+/* KeyReader */
+KeyReader::KeyReader(KeyMap &hmap) : hmap(hmap) {}
+
+void KeyReader::do_query(const std::vector<std::string> &cmd,
+									RingBuffer<uint8_t> &buffer, Client &) {
+	if (cmd.empty()) {
+		buffer.append_err(RES_NOCMD, "no input");
+		return;
+	}
+
+	bool get = (cmd[0] == "get");
+	bool in_ms = (cmd[0] == "pttl");
+	if (!get && !in_ms && cmd[0] != "ttl") {
+		buffer.append_err(RES_NOCMD, "the read port serves only get, ttl and pttl");
+		return;
+	}
+
+	if (cmd.size() < 2) {
+		buffer.append_err(RES_NOCMD, "usage: " + cmd[0] + " <key>");
+		return;
+	}
+
+	lookups.fetch_add(1, std::memory_order_relaxed);
+
+	//the node and its value stay allocated till the reply is built
+	Epoch::Guard guard;
+	auto it = hmap.read(cmd[1]);
+	int64_t deadline = (it != hmap.end()) ? it.meta().load_deadline() : -1;
+
+	//a due key counts as a missing one, as on the event loop
+	if (it == hmap.end() || (deadline >= 0 && deadline <= Clock::now_ms())) {
+		if (get)
+			buffer.append_nil();
+		else
+			buffer.append_int(EXPIRED);
+
+		return;
+	}
+
+	if (get) {
+		const KeyValue &val = it.second();
+		if (val.type != STRING_KEY)
+			buffer.append_err(RES_WRONGTYPE, WrongTypeError().what());
+		else
+			buffer.append_str(val.str);
+
+		return;
+	}
+
+	int64_t rc = (deadline < 0) ? int64_t(NOTTL) : deadline - Clock::now_ms();
+	if (rc > 0 && !in_ms)
+		rc = (rc + 500) / 1000; //rounded to the closest second
+	buffer.append_int(rc);
+}
+
+void KeyReader::adopt_link(int, const std::vector<uint8_t> &) {}
+
+std::vector<LinkOwner *> KeyReader::get_link_owners() {
+	return {};
+}
+
+void KeyReader::run_cron() {}
+
+int KeyReader::get_next_timeout() {
+	return -1;
+}
+
+void KeyReader::before_reply() {}
+
+size_t KeyReader::get_lookups() const {
+	return lookups.load(std::memory_order_relaxed);
+}
+
+/* ReadThreads */
+void ReadThreads::start(size_t threads, const std::string &port, KeyMap &hmap) {
+	if (threads == 0)
+		return;
+
+	//from now on the event loop retires what it drops from the keyspace
+	Epoch::enable();
+
+	for (size_t i = 0; i < threads; i++) {
+		auto reader = std::make_unique<KeyReader>(hmap);
+		readers.push_back(reader.get());
+
+		std::thread([port, reader = std::move(reader)]() mutable {
+			Server server(port, std::move(reader), true);
+			server.run();
+		}).detach();
+	}
+}
+
+size_t ReadThreads::size() const {
+	return readers.size();
+}
+
+size_t ReadThreads::get_lookups() const {
+	size_t sum = 0;
+	for (const KeyReader *reader : readers)
+		sum += reader->get_lookups();
+
+	return sum;
+}
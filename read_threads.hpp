@@ -0,0 +1,76 @@
+#ifndef __READ_THREADS_HPP__
+#define __READ_THREADS_HPP__
+
+/* =====================================================================
+ * The read threads serve get, ttl and pttl on a port of their own(--read-port),
+ * so the reads of a read-mostly load are spread over the cores
+ * instead of queueing behind the writes on the event loop.
+ *
+ * Every thread runs a Server/ConnectionManager event loop of its own,
+ * the threads listen on the same port(SO_REUSEPORT) and the kernel
+ * spreads the connections between them. A lookup doesn't take any lock:
+ *   - the keyspace is read with KeyMap::read() under an Epoch::Guard,
+ *     the nodes, values and tables the event loop drops meanwhile
+ *     are freed only once every reader has left them
+ *   - a key past its deadline is missing, the event loop expires it later
+ *   - a read doesn't update the access bits of the eviction policies
+ * Writes stay on the event loop(the main port), a value is published
+ * before its write is replied to, so a client which reads after its write
+ * sees it on the read port as well.
+ * The threads run until the process exits.
+ * =====================================================================*/
+
+//c++
+#include <atomic>
+#include <cstddef> //size_t
+#include <string>
+#include <vector>
+
+//custom
+#include "buffer.hpp" //RingBuffer
+#include "keyspace.hpp" //KeyMap
+#include "request_handler.hpp"
+
+constexpr size_t READ_MAX_THREADS = 32;
+
+//serves the requests of the connections of a read thread
+class KeyReader : public RequestHandler {
+private:
+	KeyMap &hmap;
+	std::atomic<size_t> lookups{0}; //written by its thread, read by info
+
+public:
+	KeyReader(KeyMap &hmap);
+	KeyReader(const KeyReader &) = delete;
+	KeyReader &operator=(const KeyReader &) = delete;
+
+	//refuses every command but get, ttl and pttl
+	void do_query(const std::vector<std::string> &cmd,
+										RingBuffer<uint8_t> &buffer, Client &client) override;
+	//psync isn't served, so a connection never turns into a link
+	void adopt_link(int fd, const std::vector<uint8_t> &pending) override;
+	std::vector<LinkOwner *> get_link_owners() override;
+	void run_cron() override;
+	int get_next_timeout() override;
+	void before_reply() override;
+
+	size_t get_lookups() const;
+};
+
+class ReadThreads {
+private:
+	std::vector<KeyReader *> readers; //owned by the servers of the threads
+
+public:
+	ReadThreads() = default;
+	ReadThreads(const ReadThreads &) = delete;
+	ReadThreads &operator=(const ReadThreads &) = delete;
+
+	//starts the threads on the port, the keyspace is read concurrently from now on
+	void start(size_t threads, const std::string &port, KeyMap &hmap);
+	size_t size() const;
+	//the lookups of all the threads
+	size_t get_lookups() const;
+};
+
+#endif
@@ -0,0 +1,865 @@
+#include "replication.hpp"
+
+//c
+#include <errno.h>
+#include <fcntl.h> //open(), fcntl()
+#include <netdb.h> //getaddrinfo()
+#include <netinet/in.h> //IPPROTO_TCP
+#include <netinet/tcp.h> //TCP_NODELAY
+#include <stdio.h> //rename()
+#include <string.h> //strerror()
+#include <sys/sendfile.h> //sendfile()
+#include <sys/socket.h> //send(), recv(), connect()
+#include <sys/stat.h> //fstat()
+#include <unistd.h> //close(), write(), unlink()
+
+//c++
+#include <algorithm> //min, max
+#include <climits> //INT_MAX
+#include <cstring> //memcpy
+#include <iostream>
+#include <random>
+#include <stdexcept> //invalid_argument
+
+//custom
+#include "clock.hpp"
+#include "io_shared_library.hpp" //HEADER_SIZE, Tag
+
+//EAGAIN and EINTR only mean the socket isn't ready
+static bool would_block() {
+	return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+}
+
+//writes all of data, returns false upon an error
+static bool write_all(int fd, const char *data, size_t len) {
+	while (len > 0) {
+		ssize_t rv = ::write(fd, data, len);
+		if (rv < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+
+		data += rv;
+		len -= rv;
+	}
+
+	return true;
+}
+
+/* ReplicationBacklog */
+bool ReplicationBacklog::is_active() const {
+	return !buf.empty();
+}
+
+void ReplicationBacklog::reset(uint64_t offset) {
+	if (buf.empty())
+		buf.resize(capacity);
+
+	next = 0;
+	histlen = 0;
+	end = offset;
+}
+
+void ReplicationBacklog::append(const char *data, size_t len) {
+	end += len;
+
+	//only the last capacity bytes are kept
+	if (len > capacity) {
+		data += len - capacity;
+		len = capacity;
+	}
+
+	histlen = std::min(histlen + len, capacity);
+	while (len > 0) {
+		size_t n = std::min(len, capacity - next);
+		std::memcpy(&buf[next], data, n);
+		next = (next + n) % capacity;
+		data += n;
+		len -= n;
+	}
+}
+
+bool ReplicationBacklog::contains(uint64_t offset) const {
+	return is_active() && offset <= end && end - offset <= histlen;
+}
+
+void ReplicationBacklog::copy_from(uint64_t offset, std::string &out) const {
+	size_t len = end - offset;
+	size_t start = (next + capacity - len) % capacity;
+	size_t first = std::min(len, capacity - start);
+
+	out.append(&buf[start], first);
+	out.append(&buf[0], len - first); //wrapped around
+}
+
+size_t ReplicationBacklog::size() const {
+	return histlen;
+}
+
+size_t ReplicationBacklog::get_capacity() const {
+	return capacity;
+}
+
+/* Replication */
+Replication::Replication(Persistence &persistence, const std::string &snapshot_path, size_t backlog_size,
+			std::function<void(const std::vector<std::string> &)> apply, std::function<void()> load)
+		: persistence(persistence), snapshot_path(snapshot_path), apply(std::move(apply)),
+		load(std::move(load)), replid(_new_replid()), backlog(backlog_size) {}
+
+Replication::~Replication() {
+	for (auto &pair : replicas)
+		_close_replica(pair.first, pair.second);
+
+	_master_down();
+}
+
+std::string Replication::_new_replid() {
+	static const char digits[] = "0123456789abcdef";
+	std::random_device rd;
+	std::string id(REPL_ID_LEN, '0');
+	for (char &c : id)
+		c = digits[rd() % 16];
+
+	return id;
+}
+
+void Replication::replicaof(const std::string &host, const std::string &port) {
+	_master_down();
+
+	//the history of a former primary is kept, so it may continue with the new one
+	master.state = LINK_DOWN;
+	master.host = host;
+	master.port = port;
+	master.last_try_ms = Clock::now_ms() - REPL_RETRY_MS; //right away
+	std::cout << "replicating " << host << ":" << port << "\n";
+}
+
+void Replication::promote() {
+	if (master.state == LINK_NONE)
+		return;
+
+	_master_down();
+	master.state = LINK_NONE;
+	master.host.clear();
+	master.port.clear();
+
+	//the replicas of the old primary have its history up to this offset
+	replid2 = replid;
+	second_offset = offset;
+	replid = _new_replid();
+	if (!backlog.is_active())
+		backlog.reset(offset);
+
+	std::cout << "promoted to a primary, the new history " << replid
+		<< " starts at offset " << offset << "\n";
+}
+
+bool Replication::is_replica() const {
+	return master.state != LINK_NONE;
+}
+
+bool Replication::link_is_up() const {
+	return master.state == LINK_UP;
+}
+
+std::string Replication::add_replica(int fd, const std::string &id, const std::string &from) {
+	if (is_replica() && !link_is_up())
+		throw std::invalid_argument("the replica isn't synced with its primary yet");
+
+	//"?" or a negative offset - the replica has no history
+	int64_t req_offset = -1;
+	if (id != "?") {
+		try {
+			req_offset = std::stoll(from);
+		}
+		catch (const std::exception &) {
+			throw std::invalid_argument("offset isn't a number");
+		}
+	}
+
+	//the history is kept from the first replica on
+	if (!backlog.is_active())
+		backlog.reset(offset);
+
+	ReplicaLink link;
+	link.last_ack_ms = Clock::now_ms();
+
+	bool known = id == replid || (id == replid2 && req_offset >= 0 && uint64_t(req_offset) <= second_offset);
+	if (known && req_offset >= 0 && backlog.contains(req_offset)) {
+		link.state = REPLICA_ONLINE;
+		link.ack_offset = req_offset;
+		backlog.copy_from(req_offset, link.output);
+		replicas[fd] = std::move(link);
+		stats.sync_partial_ok++;
+		std::cout << "partial resync of replica " << fd << " from offset " << req_offset << "\n";
+
+		return "continue " + replid;
+	}
+
+	if (id != "?")
+		stats.sync_partial_err++;
+
+	//its snapshot is saved by the next bgsave
+	link.state = REPLICA_WAIT_BGSAVE;
+	replicas[fd] = std::move(link);
+	stats.sync_full++;
+	std::cout << "full resync of replica " << fd << "\n";
+
+	return "fullresync " + replid;
+}
+
+void Replication::adopt(int fd, const std::vector<uint8_t> &pending) {
+	auto it = replicas.find(fd);
+	if (it == replicas.end())
+		return;
+
+	it->second.head.insert(it->second.head.begin(), pending.begin(), pending.end());
+}
+
+void Replication::feed(const std::vector<std::string> &cmd) {
+	//nobody has ever asked for the stream
+	if (!backlog.is_active())
+		return;
+
+	encoded.clear();
+	encode_request(cmd, encoded);
+	_feed_raw(encoded.data(), encoded.size());
+}
+
+void Replication::_feed_raw(const char *data, size_t len) {
+	offset += len;
+	backlog.append(data, len);
+
+	for (auto &pair : replicas) {
+		ReplicaLink &link = pair.second;
+		//the snapshot will have the write
+		if (link.state == REPLICA_WAIT_BGSAVE || link.closing)
+			continue;
+
+		link.output.append(data, len);
+		if (link.output.size() > REPL_OUTPUT_LIMIT) {
+			std::cout << "replica " << pair.first << " is dropped, its output is over the limit\n";
+			stats.output_limit_drops++;
+			link.closing = true;
+		}
+	}
+}
+
+void Replication::flush() {
+	for (auto it = replicas.begin(); it != replicas.end(); ) {
+		if (!it->second.closing)
+			_send_replica(it->first, it->second);
+
+		if (it->second.closing) {
+			_close_replica(it->first, it->second);
+			it = replicas.erase(it);
+		}
+		else
+			++it;
+	}
+
+	if (master.state >= LINK_HANDSHAKE && !master.output.empty())
+		_send_master();
+}
+
+void Replication::_send_replica(int fd, ReplicaLink &link) {
+	if (!link.head.empty()) {
+		ssize_t rv = send(fd, link.head.data(), link.head.size(), MSG_NOSIGNAL);
+		if (rv < 0) {
+			if (!would_block())
+				link.closing = true;
+			return;
+		}
+
+		link.head.erase(0, rv);
+		if (!link.head.empty())
+			return;
+	}
+
+	if (link.snapshot_fd >= 0) {
+		//straight from the page cache to the socket
+		while (link.snapshot_left > 0) {
+			ssize_t rv = sendfile(fd, link.snapshot_fd, &link.snapshot_pos, link.snapshot_left);
+			if (rv < 0 && would_block())
+				return;
+
+			if (rv <= 0) { //an error or the file got shorter
+				link.closing = true;
+				return;
+			}
+
+			link.snapshot_left -= rv;
+		}
+
+		close(link.snapshot_fd);
+		link.snapshot_fd = -1;
+		std::cout << "the snapshot is sent to replica " << fd << "\n";
+	}
+
+	if (link.state != REPLICA_ONLINE || link.output.empty())
+		return;
+
+	ssize_t rv = send(fd, link.output.data(), link.output.size(), MSG_NOSIGNAL);
+	if (rv < 0) {
+		if (!would_block())
+			link.closing = true;
+		return;
+	}
+
+	link.output.erase(0, rv);
+}
+
+void Replication::_close_replica(int fd, ReplicaLink &link) {
+	if (link.snapshot_fd >= 0)
+		close(link.snapshot_fd);
+
+	close(fd);
+	std::cout << "replica " << fd << " is disconnected\n";
+}
+
+void Replication::_read_acks(ReplicaLink &link) {
+	size_t pos = 0;
+	while (link.input.size() - pos >= HEADER_SIZE) {
+		uint32_t len = 0;
+		std::memcpy(&len, link.input.data() + pos, HEADER_SIZE);
+		if (len > MAX_MSG_LEN) {
+			link.closing = true;
+			return;
+		}
+
+		if (link.input.size() - pos - HEADER_SIZE < len)
+			break;
+
+		std::vector<uint8_t> payload(link.input.begin() + pos + HEADER_SIZE,
+									link.input.begin() + pos + HEADER_SIZE + len);
+		pos += HEADER_SIZE + len;
+
+		auto result = parser.parse(payload, len);
+		if (!result.success || result.cmd.size() != 3
+						|| result.cmd[0] != "replconf" || result.cmd[1] != "ack")
+			continue; //nothing else is expected from a replica
+
+		try {
+			link.ack_offset = std::stoull(result.cmd[2]);
+			link.last_ack_ms = Clock::now_ms();
+		}
+		catch (const std::exception &) {}
+	}
+
+	link.input.erase(0, pos);
+}
+
+void Replication::_start_sync() {
+	bool waiting = false;
+	for (const auto &pair : replicas)
+		waiting |= pair.second.state == REPLICA_WAIT_BGSAVE && !pair.second.closing;
+
+	if (!waiting)
+		return;
+
+	try {
+		persistence.bgsave();
+	}
+	catch (const SnapshotError &) {
+		return; //another child is running, it's retried by the cron
+	}
+
+	//the snapshot has every write up to now, the stream goes on from here
+	sync_bgsave = true;
+	sync_offset = offset;
+	for (auto &pair : replicas) {
+		if (pair.second.state == REPLICA_WAIT_BGSAVE)
+			pair.second.state = REPLICA_SYNCING;
+	}
+}
+
+void Replication::_finish_sync() {
+	sync_bgsave = false;
+	bool ok = persistence.get_stats().last_bgsave_ok;
+
+	for (auto &pair : replicas) {
+		ReplicaLink &link = pair.second;
+		if (link.state != REPLICA_SYNCING || link.closing)
+			continue;
+
+		//the replica reconnects and asks again
+		struct stat st;
+		int fd = ok ? open(snapshot_path.c_str(), O_RDONLY) : -1;
+		if (fd < 0 || fstat(fd, &st) != 0) {
+			if (fd >= 0)
+				close(fd);
+			link.closing = true;
+			continue;
+		}
+
+		uint64_t size = st.st_size;
+		link.head.append(reinterpret_cast<const char *>(&sync_offset), sizeof(sync_offset));
+		link.head.append(reinterpret_cast<const char *>(&size), sizeof(size));
+		link.snapshot_fd = fd;
+		link.snapshot_pos = 0;
+		link.snapshot_left = size;
+		link.state = REPLICA_ONLINE;
+	}
+}
+
+void Replication::_connect() {
+	master.last_try_ms = Clock::now_ms();
+
+	struct addrinfo hints{}, *res;
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	int err = getaddrinfo(master.host.c_str(), master.port.c_str(), &hints, &res);
+	if (err != 0) {
+		std::cerr << "can't resolve the primary " << master.host << ": " << gai_strerror(err) << "\n";
+		return;
+	}
+
+	int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+	if (fd < 0) {
+		perror("socket()");
+		freeaddrinfo(res);
+		return;
+	}
+
+	//the stream is sent once per iteration, it mustn't wait for acks
+	int yes = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+	int rv = connect(fd, res->ai_addr, res->ai_addrlen);
+	freeaddrinfo(res);
+	if (rv != 0 && errno != EINPROGRESS) {
+		perror("connect() to the primary");
+		close(fd);
+		return;
+	}
+
+	//the event loop reports when it's connected
+	master.fd = fd;
+	master.state = LINK_CONNECTING;
+}
+
+void Replication::_master_down() {
+	if (master.fd >= 0) {
+		close(master.fd);
+		master.fd = -1;
+		std::cout << "the link to the primary is down\n";
+	}
+
+	if (master.transfer_fd >= 0) {
+		close(master.transfer_fd);
+		unlink(_transfer_path().c_str());
+		master.transfer_fd = -1;
+	}
+
+	master.input.clear();
+	master.output.clear();
+	master.transfer_header = false;
+	master.last_try_ms = Clock::now_ms();
+	if (master.state != LINK_NONE)
+		master.state = LINK_DOWN;
+}
+
+void Replication::_send_master() {
+	ssize_t rv = send(master.fd, master.output.data(), master.output.size(), MSG_NOSIGNAL);
+	if (rv < 0) {
+		if (!would_block())
+			_master_down();
+		return;
+	}
+
+	master.output.erase(0, rv);
+}
+
+bool Replication::_process_master_input() {
+	size_t pos = 0;
+	while (true) {
+		size_t start = pos;
+		LinkState state = master.state;
+
+		bool ok = true;
+		if (state == LINK_HANDSHAKE)
+			ok = _read_handshake(pos);
+		else if (state == LINK_TRANSFER)
+			ok = _read_transfer(pos);
+		else if (state == LINK_UP)
+			_read_stream(pos);
+
+		if (!ok)
+			return false;
+
+		if (pos == start && master.state == state)
+			break; //the rest hasn't arrived yet
+	}
+
+	master.input.erase(0, pos);
+	return true;
+}
+
+bool Replication::_read_handshake(size_t &pos) {
+	const std::string &in = master.input;
+	if (in.size() - pos < HEADER_SIZE)
+		return true;
+
+	uint32_t len = 0;
+	std::memcpy(&len, in.data() + pos, HEADER_SIZE);
+	if (in.size() - pos - HEADER_SIZE < len)
+		return true;
+
+	//a str or an err reply
+	const char *data = in.data() + pos + HEADER_SIZE;
+	pos += HEADER_SIZE + len;
+
+	uint32_t str_len = 0;
+	size_t str_at = len > 0 && data[0] == TAG_ERR ? 1 + sizeof(int32_t) : 1;
+	if (len < str_at + HEADER_SIZE)
+		return false;
+
+	std::memcpy(&str_len, data + str_at, HEADER_SIZE);
+	if (len != str_at + HEADER_SIZE + str_len)
+		return false;
+
+	std::string reply(data + str_at + HEADER_SIZE, str_len);
+	if (data[0] != TAG_STR) {
+		std::cerr << "the primary refused to sync: " << reply << "\n";
+		return false;
+	}
+
+	size_t space = reply.find(' ');
+	std::string kind = reply.substr(0, space);
+	std::string id = space == std::string::npos ? "" : reply.substr(space + 1);
+	if (id.size() != REPL_ID_LEN) {
+		std::cerr << "bad reply of the primary to psync: " << reply << "\n";
+		return false;
+	}
+
+	if (kind == "fullresync") {
+		master.transfer_id = id;
+		master.state = LINK_TRANSFER;
+		return true;
+	}
+
+	if (kind != "continue") {
+		std::cerr << "bad reply of the primary to psync: " << reply << "\n";
+		return false;
+	}
+
+	//the primary was promoted and continues our history with a new one
+	if (id != replid) {
+		replid2 = replid;
+		second_offset = offset;
+		replid = id;
+	}
+
+	master.state = LINK_UP;
+	master.last_ack_ms = 0; //the primary learns the offset right away
+	stats.partial_syncs_done++;
+	std::cout << "partial resync with the primary from offset " << offset << "\n";
+
+	return true;
+}
+
+bool Replication::_read_transfer(size_t &pos) {
+	const std::string &in = master.input;
+	if (!master.transfer_header) {
+		if (in.size() - pos < REPL_TRANSFER_HEADER)
+			return true;
+
+		uint64_t size = 0;
+		std::memcpy(&master.transfer_offset, in.data() + pos, sizeof(uint64_t));
+		std::memcpy(&size, in.data() + pos + sizeof(uint64_t), sizeof(uint64_t));
+		pos += REPL_TRANSFER_HEADER;
+
+		master.transfer_fd = open(_transfer_path().c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (master.transfer_fd < 0) {
+			perror("open() of the snapshot of the primary");
+			return false;
+		}
+
+		master.transfer_header = true;
+		master.transfer_left = size;
+		std::cout << "receiving a snapshot of " << size << " bytes from the primary\n";
+	}
+
+	size_t n = std::min(in.size() - pos, master.transfer_left);
+	if (n > 0) {
+		if (!write_all(master.transfer_fd, in.data() + pos, n)) {
+			perror("write() of the snapshot of the primary");
+			return false;
+		}
+
+		pos += n;
+		master.transfer_left -= n;
+	}
+
+	return master.transfer_left > 0 || _finish_transfer();
+}
+
+bool Replication::_finish_transfer() {
+	int64_t start = Clock::precise_us();
+	int fd = master.transfer_fd;
+	master.transfer_fd = -1;
+	master.transfer_header = false;
+
+	if (close(fd) != 0 || rename(_transfer_path().c_str(), snapshot_path.c_str()) != 0) {
+		perror("the snapshot of the primary");
+		unlink(_transfer_path().c_str());
+		return false;
+	}
+
+	//the keyspace is replaced, it doesn't continue any history until it's loaded,
+	//and the replicas of this server have to sync with the new one
+	replid = _new_replid();
+	replid2.clear();
+	for (auto &pair : replicas)
+		pair.second.closing = true;
+
+	try {
+		load();
+	}
+	catch (const SnapshotError &e) {
+		std::cerr << "failed to load the snapshot of the primary: " << e.what() << "\n";
+		return false;
+	}
+
+	replid = master.transfer_id;
+	offset = master.transfer_offset;
+	backlog.reset(offset);
+	master.state = LINK_UP;
+	master.last_ack_ms = 0;
+	stats.full_syncs_done++;
+	std::cout << "full resync with the primary is done in " << (Clock::precise_us() - start) / 1000
+		<< " ms, at offset " << offset << "\n";
+
+	return true;
+}
+
+void Replication::_read_stream(size_t &pos) {
+	const std::string &in = master.input;
+	while (in.size() - pos >= HEADER_SIZE) {
+		uint32_t len = 0;
+		std::memcpy(&len, in.data() + pos, HEADER_SIZE);
+		if (in.size() - pos - HEADER_SIZE < len)
+			break;
+
+		std::vector<uint8_t> payload(in.begin() + pos + HEADER_SIZE,
+									in.begin() + pos + HEADER_SIZE + len);
+		auto result = parser.parse(payload, len);
+		if (result.success)
+			apply(result.cmd);
+		else
+			std::cerr << "bad command from the primary: " << result.error_msg << "\n";
+
+		//passed on as it came, so the offsets of the chained replicas match
+		_feed_raw(in.data() + pos, HEADER_SIZE + len);
+		pos += HEADER_SIZE + len;
+	}
+}
+
+std::string Replication::_transfer_path() const {
+	return snapshot_path + ".sync";
+}
+
+std::vector<size_t> Replication::get_fds() const {
+	std::vector<size_t> fds;
+	if (master.fd >= 0)
+		fds.push_back(master.fd);
+
+	for (const auto &pair : replicas)
+		fds.push_back(pair.first);
+
+	return fds;
+}
+
+bool Replication::owns(int fd) const {
+	return fd == master.fd || replicas.count(fd);
+}
+
+bool Replication::is_readable(int fd) const {
+	if (fd == master.fd)
+		return master.state >= LINK_HANDSHAKE;
+
+	auto it = replicas.find(fd);
+	return it != replicas.end() && !it->second.closing;
+}
+
+bool Replication::is_writable(int fd) const {
+	if (fd == master.fd)
+		return master.state == LINK_CONNECTING || !master.output.empty();
+
+	auto it = replicas.find(fd);
+	if (it == replicas.end())
+		return false;
+
+	const ReplicaLink &link = it->second;
+	return !link.head.empty() || link.snapshot_fd >= 0
+			|| (link.state == REPLICA_ONLINE && !link.output.empty());
+}
+
+bool Replication::is_closing(int fd) const {
+	auto it = replicas.find(fd);
+	return it != replicas.end() && it->second.closing;
+}
+
+void Replication::handle_read(int fd) {
+	std::vector<char> chunk(REPL_READ_CHUNK);
+	ssize_t rv = recv(fd, chunk.data(), chunk.size(), 0);
+	if (rv < 0 && would_block())
+		return;
+
+	if (fd == master.fd) {
+		if (rv <= 0) {
+			_master_down();
+			return;
+		}
+
+		master.input.append(chunk.data(), rv);
+		if (!_process_master_input())
+			_master_down();
+		return;
+	}
+
+	auto it = replicas.find(fd);
+	if (it == replicas.end())
+		return;
+
+	if (rv <= 0) {
+		it->second.closing = true;
+		return;
+	}
+
+	it->second.input.append(chunk.data(), rv);
+	_read_acks(it->second);
+}
+
+void Replication::handle_write(int fd) {
+	if (fd == master.fd) {
+		if (master.state == LINK_CONNECTING) {
+			int err = 0;
+			socklen_t len = sizeof(err);
+			if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0 || err != 0) {
+				std::cerr << "can't connect to the primary: " << strerror(err) << "\n";
+				_master_down();
+				return;
+			}
+
+			//asks for the rest of the history, the one without any gets a full resync
+			std::string id = backlog.is_active() ? replid : "?";
+			encode_request({"psync", id, std::to_string(offset)}, master.output);
+			master.state = LINK_HANDSHAKE;
+			std::cout << "connected to the primary " << master.host << ":" << master.port << "\n";
+		}
+
+		_send_master();
+		return;
+	}
+
+	auto it = replicas.find(fd);
+	if (it != replicas.end() && !it->second.closing)
+		_send_replica(fd, it->second);
+}
+
+void Replication::close_link(int fd) {
+	if (fd == master.fd) {
+		_master_down();
+		return;
+	}
+
+	auto it = replicas.find(fd);
+	if (it == replicas.end())
+		return;
+
+	_close_replica(fd, it->second);
+	replicas.erase(it);
+}
+
+void Replication::run_cron() {
+	int64_t now = Clock::now_ms();
+	if (master.state == LINK_DOWN && now - master.last_try_ms >= REPL_RETRY_MS)
+		_connect();
+
+	if (master.state == LINK_UP && now - master.last_ack_ms >= REPL_ACK_PERIOD_MS) {
+		encode_request({"replconf", "ack", std::to_string(offset)}, master.output);
+		master.last_ack_ms = now;
+	}
+
+	//the bgsave is reaped by the persistence cron, which runs first
+	if (sync_bgsave && !persistence.bgsave_in_progress())
+		_finish_sync();
+
+	if (!sync_bgsave)
+		_start_sync();
+}
+
+//-1 means there's nothing to wait for
+static int64_t min_wait(int64_t left, int64_t right) {
+	if (left < 0)
+		return right;
+
+	if (right < 0)
+		return left;
+
+	return std::min(left, right);
+}
+
+int Replication::get_next_timeout() const {
+	int64_t now = Clock::now_ms();
+	int64_t wait = -1;
+	if (master.state == LINK_DOWN)
+		wait = std::max<int64_t>(master.last_try_ms + REPL_RETRY_MS - now, 0);
+	else if (master.state == LINK_UP)
+		wait = std::max<int64_t>(master.last_ack_ms + REPL_ACK_PERIOD_MS - now, 0);
+
+	for (const auto &pair : replicas) {
+		if (pair.second.state != REPLICA_ONLINE)
+			wait = min_wait(wait, REPL_CRON_MS);
+	}
+
+	return wait < 0 ? -1 : int(std::min<int64_t>(wait, INT_MAX));
+}
+
+const std::string &Replication::get_replid() const {
+	return replid;
+}
+
+uint64_t Replication::get_offset() const {
+	return offset;
+}
+
+size_t Replication::online_replicas() const {
+	size_t online = 0;
+	for (const auto &pair : replicas)
+		online += pair.second.state == REPLICA_ONLINE && pair.second.snapshot_fd < 0;
+
+	return online;
+}
+
+uint64_t Replication::min_ack_offset() const {
+	uint64_t min = offset;
+	for (const auto &pair : replicas) {
+		if (pair.second.state == REPLICA_ONLINE)
+			min = std::min(min, pair.second.ack_offset);
+	}
+
+	return min;
+}
+
+const std::string &Replication::get_master_host() const {
+	return master.host;
+}
+
+const std::string &Replication::get_master_port() const {
+	return master.port;
+}
+
+bool Replication::sync_in_progress() const {
+	return master.state == LINK_TRANSFER;
+}
+
+const ReplicationBacklog &Replication::get_backlog() const {
+	return backlog;
+}
+
+const ReplicationStats &Replication::get_stats() const {
+	return stats;
+}
@@ -0,0 +1,241 @@
+#ifndef __REPLICATION_HPP__
+#define __REPLICATION_HPP__
+
+/* =====================================================================
+ * Replication keeps replicas as read-only copies of a primary.
+ *
+ * A replica connects to its primary and sends "psync <replid> <offset>":
+ * the id of the history it has and how many bytes of it it has applied.
+ * The primary continues from that offset if the rest of the history is
+ * still in its backlog(a partial resync), or else starts a full resync:
+ * it saves a snapshot in the background(bgsave), buffers the writes made
+ * since the fork for the replica and sends the file and then the buffer.
+ * The replica replaces its keyspace with the snapshot and follows the stream.
+ *
+ * The stream is the write commands in the form of the append only file
+ * (absolute deadlines, evictions as del), so the replica gets the same
+ * keyspace at any later time. A command is encoded once and appended
+ * to the backlog and to the output of every replica, which is sent
+ * once per event loop iteration, so a write costs the primary two appends.
+ *
+ * Backlog: a fixed-size circular buffer of the latest bytes of the stream.
+ * Offsets count the bytes of the stream since the history started, so
+ * a replica which lost the link for a while asks for the bytes after its
+ * offset and gets them from the backlog instead of a new snapshot.
+ *
+ * Failover: a replica promoted by "replicaof no one" starts a new history,
+ * but remembers the old one up to its offset, so the other replicas
+ * of the old primary switch to it with a partial resync as well.
+ * Replicas keep a backlog of the stream they apply, so they may be chained.
+ *
+ * the link, primary -> replica:
+ *   the reply to psync: "fullresync <replid>" or "continue <replid>"
+ *   full resync:        offset u64 | size u64 | snapshot(size bytes)
+ *   stream:             command...(length | nstr | len1 | str1 | ...)
+ * replica -> primary:   "replconf ack <offset>" once a second
+ * =====================================================================*/
+
+//c
+#include <sys/types.h> //off_t
+
+//c++
+#include <cstddef> //size_t
+#include <cstdint> //uint64_t, int64_t
+#include <functional> //std::function
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+//custom
+#include "link_owner.hpp"
+#include "persistence.hpp"
+#include "protocol.hpp" //RequestParser
+
+constexpr size_t REPL_ID_LEN = 40; //hex digits of a history id
+constexpr int64_t REPL_RETRY_MS = 1000; //a lost primary is reconnected after it
+constexpr int64_t REPL_ACK_PERIOD_MS = 1000;
+constexpr int REPL_CRON_MS = 100; //how often a full resync waiting for a bgsave is checked
+//a replica this far behind is dropped, it resyncs once it reconnects
+constexpr size_t REPL_OUTPUT_LIMIT = 256 << 20;
+constexpr size_t REPL_READ_CHUNK = 64 * 1024;
+//offset and size of the snapshot of a full resync
+constexpr size_t REPL_TRANSFER_HEADER = 8 + 8;
+
+/* ReplicationBacklog
+ * the latest bytes of the stream in a circular buffer, allocated once
+ * the first replica attaches, ends at the current offset */
+class ReplicationBacklog {
+private:
+	std::vector<char> buf;
+	size_t capacity;
+	size_t next = 0; //where the next byte is written
+	size_t histlen = 0; //bytes held, up to capacity
+	uint64_t end = 0; //the offset after the last byte
+
+public:
+	ReplicationBacklog(size_t capacity) : capacity(capacity) {}
+
+	bool is_active() const;
+	//drops the history, the next byte is at offset
+	void reset(uint64_t offset);
+	void append(const char *data, size_t len);
+	//the bytes from offset to the end are held
+	bool contains(uint64_t offset) const;
+	//appends the bytes from offset to the end to out
+	void copy_from(uint64_t offset, std::string &out) const;
+	size_t size() const;
+	size_t get_capacity() const;
+};
+
+struct ReplicationStats {
+	size_t sync_full = 0; //full resyncs served
+	size_t sync_partial_ok = 0; //partial resyncs served
+	size_t sync_partial_err = 0; //asked for, but the history wasn't in the backlog
+	size_t output_limit_drops = 0; //replicas dropped since they fell too far behind
+	size_t full_syncs_done = 0; //as a replica
+	size_t partial_syncs_done = 0;
+};
+
+class Replication : public LinkOwner {
+private:
+	enum ReplicaState {
+		REPLICA_WAIT_BGSAVE, //a full resync waits for a bgsave to start
+		REPLICA_SYNCING, //the bgsave of its snapshot is running, the stream is buffered
+		REPLICA_ONLINE, //the snapshot is sent(if any) and the stream follows it
+	};
+
+	//a replica of this server, the link is owned once it's sent psync
+	struct ReplicaLink {
+		ReplicaState state;
+		std::string head; //sent before the snapshot: the psync reply, the transfer header
+		int snapshot_fd = -1;
+		off_t snapshot_pos = 0;
+		size_t snapshot_left = 0;
+		std::string output; //the stream, sent after the snapshot
+		std::string input; //acks
+		uint64_t ack_offset = 0;
+		int64_t last_ack_ms = 0;
+		bool closing = false;
+	};
+
+	enum LinkState {
+		LINK_NONE, //not a replica
+		LINK_DOWN, //waits to reconnect
+		LINK_CONNECTING,
+		LINK_HANDSHAKE, //psync is sent, waits for the reply
+		LINK_TRANSFER, //receives the snapshot
+		LINK_UP, //follows the stream
+	};
+
+	//the link to the primary of this server
+	struct MasterLink {
+		LinkState state = LINK_NONE;
+		std::string host;
+		std::string port;
+		int fd = -1;
+		std::string input;
+		std::string output; //psync and acks
+		int64_t last_try_ms = 0;
+		int64_t last_ack_ms = 0;
+		//the snapshot of a full resync
+		std::string transfer_id; //the history it starts
+		int transfer_fd = -1;
+		bool transfer_header = false; //the offset and size are read
+		uint64_t transfer_offset = 0;
+		size_t transfer_left = 0;
+	};
+
+	Persistence &persistence;
+	std::string snapshot_path; //written by bgsave, replaced by a full resync
+	std::function<void(const std::vector<std::string> &)> apply;
+	std::function<void()> load;
+
+	std::string replid;
+	std::string replid2; //the previous history, valid up to second_offset
+	uint64_t offset = 0; //of the stream fed or applied so far
+	uint64_t second_offset = 0;
+	ReplicationBacklog backlog;
+	std::unordered_map<int, ReplicaLink> replicas;
+	bool sync_bgsave = false; //the running bgsave is for the waiting replicas
+	uint64_t sync_offset = 0; //the offset of its snapshot
+	MasterLink master;
+	RequestParser parser;
+	std::string encoded; //reused by feed()
+	ReplicationStats stats;
+
+	static std::string _new_replid();
+	//appends raw bytes of the stream to the backlog and to the replicas
+	void _feed_raw(const char *data, size_t len);
+	//sends as much of the link's pending data as the socket takes
+	void _send_replica(int fd, ReplicaLink &link);
+	void _close_replica(int fd, ReplicaLink &link);
+	void _read_acks(ReplicaLink &link);
+	//starts a bgsave for the replicas waiting for it
+	void _start_sync();
+	//the bgsave is done, the replicas get the file next
+	void _finish_sync();
+
+	void _connect();
+	void _master_down();
+	void _send_master();
+	//consumes what the primary has sent, returns false if the link is lost
+	bool _process_master_input();
+	bool _read_handshake(size_t &pos);
+	bool _read_transfer(size_t &pos);
+	bool _finish_transfer();
+	void _read_stream(size_t &pos);
+	std::string _transfer_path() const;
+
+public:
+	Replication(Persistence &persistence, const std::string &snapshot_path, size_t backlog_size,
+			std::function<void(const std::vector<std::string> &)> apply, std::function<void()> load);
+	~Replication();
+	Replication(const Replication &) = delete;
+	Replication &operator=(const Replication &) = delete;
+
+	//follows the given primary from now on, the keyspace is kept till it's synced
+	void replicaof(const std::string &host, const std::string &port);
+	//stops following the primary and starts a new history
+	void promote();
+	bool is_replica() const;
+	bool link_is_up() const;
+
+	/* handles "psync <replid> <offset>" of the connection fd, replid "?" asks
+	 * for a full resync. Returns the reply, the connection has to be
+	 * handed over by adopt() right after it. Throws invalid_argument */
+	std::string add_replica(int fd, const std::string &replid, const std::string &offset);
+	//takes over the socket of a replica, with the bytes its connection hasn't sent yet
+	void adopt(int fd, const std::vector<uint8_t> &pending);
+	//appends a write command to the stream
+	void feed(const std::vector<std::string> &cmd);
+	//sends the stream of the iteration, once per event loop iteration
+	void flush();
+
+	//the sockets of the links, polled by the event loop with the connections
+	std::vector<size_t> get_fds() const override;
+	bool owns(int fd) const override;
+	bool is_readable(int fd) const override;
+	bool is_writable(int fd) const override;
+	bool is_closing(int fd) const override;
+	void handle_read(int fd) override;
+	void handle_write(int fd) override;
+	void close_link(int fd) override;
+
+	//reconnects to the primary, sends acks and runs the full resyncs
+	void run_cron();
+	//returns ms till run_cron() is needed again, -1 if it isn't
+	int get_next_timeout() const;
+
+	const std::string &get_replid() const;
+	uint64_t get_offset() const;
+	size_t online_replicas() const;
+	//the lowest offset acknowledged by the online replicas
+	uint64_t min_ack_offset() const;
+	const std::string &get_master_host() const;
+	const std::string &get_master_port() const;
+	bool sync_in_progress() const;
+	const ReplicationBacklog &get_backlog() const;
+	const ReplicationStats &get_stats() const;
+};
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef __REQUEST_HANDLER_HPP__
+#define __REQUEST_HANDLER_HPP__
+
+//c++
+#include <cstddef> //size_t
+#include <cstdint> //uint64_t
+#include <deque>
+#include <memory> //shared_ptr
+#include <string>
+#include <vector>
+
+//custom
+#include "buffer.hpp" //RingBuffer
+#include "link_owner.hpp"
+
+//the connection a command comes from
+struct Client {
+	uint64_t id = 0; //unlike the fd, it isn't reused by the next connection
+	int fd = -1; //-1 for the commands replayed from the append only file
+	bool replica = false; //psync turned the connection into a replication link
+	bool master = false; //the stream of the primary, which a replica applies
+	bool asking = false; //the next command may use a slot being imported
+	size_t deferred = 0; //requests whose replies the handler hands over later
+	bool blocked = false; //waits for a blocking command, the next requests wait for it
+	size_t subscriptions = 0; //pub/sub channels and patterns
+	//pub/sub messages framed with their lengths, the payloads are shared by their receivers
+	//and sent by the connection as they are
+	std::deque<std::shared_ptr<const std::string>> pushed;
+	size_t pushed_bytes = 0; //of the messages which haven't been sent yet
+	bool cut_off = false; //the messages have exceeded the output limit, the connection is closed
+};
+
+/* RequestHandler
+ * runs the requests of the connections: the commands of the server(CommandExecutor)
+ * or the forwarding of the proxy(Proxy). A reply is either appended to the buffer
+ * by do_query() or deferred: the handler counts it in client.deferred and hands it
+ * over by take_replies() once it's ready. A handler which defers a reply defers
+ * the following ones of the connection as well, so the replies keep their order */
+class RequestHandler {
+public:
+	virtual ~RequestHandler() {}
+
+	virtual void do_query(const std::vector<std::string> &cmd,
+										RingBuffer<uint8_t> &buffer, Client &client) = 0;
+	//moves the ready deferred replies of the client into the buffer in order
+	//while they fit, returns their number
+	virtual size_t take_replies(Client &, RingBuffer<uint8_t> &) { return 0; }
+	//the fds of the connections which have got deferred replies since the last call
+	virtual std::vector<int> get_ready_clients() { return {}; }
+	//the connection is closed, its deferred replies are dropped
+	virtual void forget_client(const Client &) {}
+	//the connection has turned into a link(client.replica), the handler owns it from now on,
+	//pending - the replies which haven't been sent yet
+	virtual void adopt_link(int fd, const std::vector<uint8_t> &pending) = 0;
+
+	//the modules with links of their own, polled by the event loop
+	virtual std::vector<LinkOwner *> get_link_owners() = 0;
+	//background work of the event loop, e.g. active expiry
+	virtual void run_cron() = 0;
+	//returns ms till run_cron() is needed again, -1 if it isn't
+	virtual int get_next_timeout() = 0;
+	//the last work of an event loop iteration before its replies are sent
+	virtual void before_reply() = 0;
+};
+
+#endif
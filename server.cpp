@@ -1,5 +1,8 @@
 #include "server.hpp"
 
+Server::Server(const std::string &port, std::unique_ptr<RequestHandler> handler, bool reuse_port) 
+								: port(port), reuse_port(reuse_port), cm(std::move(handler)) {}
+
 //private:
 void Server::fd_set_nb(int fd) {
 	//get the file access mode and the file status flags
@@ -24,7 +27,7 @@ void Server::setup_listen_fd() {
 	hints.ai_socktype = SOCK_STREAM; //TCP
 	hints.ai_flags = AI_PASSIVE; //use the IP of the host
 	
-	if ((err = getaddrinfo(NULL, PORT, &hints, &res)) != 0) {
+	if ((err = getaddrinfo(NULL, port.c_str(), &hints, &res)) != 0) {
 		//since getaddrinfo() in case of error produces error code 
 		//and not necessary sets errno we need to use here gai_strerror() 
 		//which translates the error code instead of die()  
@@ -47,6 +50,8 @@ void Server::setup_listen_fd() {
 	*/
 	int yes = 1;
 	setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+	if (reuse_port)
+		setsockopt(listen_fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes));
 	
 	if ((bind(listen_fd, res->ai_addr, res->ai_addrlen)) != 0) {
 		die("bind()");
@@ -130,6 +135,9 @@ void Server::process_poll_results(int rv) {
 void Server::run() {
 	setup_listen_fd();
 	
+	//a peer which has gone away is an error of send(), not a signal killing the server
+	signal(SIGPIPE, SIG_IGN);
+	
 	//the event loop
 	while (true) {
 		prepare_poll_args();
@@ -137,6 +145,7 @@ void Server::run() {
 		int timeout_ms = cm.get_next_timer();
 		//poll every connection fds + listening socket to get those which are ready
 		//set timeout to the closest timer value to give a last chance to it's connection
+		//or to the next key deadline to expire it on time
 		int rv = poll(poll_args.data(), (nfds_t)poll_args.size(), timeout_ms);
 						
 		if (rv < 0) {
@@ -150,9 +159,18 @@ void Server::run() {
 			die("poll()");
 		}
 		
+		//a single clock sample serves the whole iteration
+		Clock::update();
+		
 		process_poll_results(rv);
 		
 		//check if anything has timeouted
 		cm.check_timers();
+		
+		//background jobs with a time budget, e.g. active expiry
+		cm.run_cron();
+		
+		//the replies go out after the writes are logged
+		cm.send_replies();
 	}
 }
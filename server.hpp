@@ -3,6 +3,8 @@
 
 //c++
 #include <errno.h>
+#include <memory> //unique_ptr
+#include <string>
 #include <vector>
 
 
@@ -10,17 +12,24 @@
 #include <fcntl.h> //fcntl
 #include <netdb.h> //getaddrinfo, freeaddrinfo
 #include <poll.h> //poll()
+#include <signal.h> //signal()
 #include <sys/types.h> //getaddrinfo
 
 //custom
 #include "conn_manager.hpp"
-#include "io_shared_library.hpp" //PORT
+#include "io_shared_library.hpp"
 
 class Server {
 public:
+	//the handler runs the requests: the commands of the server or the forwarding of the proxy,
+	//reuse_port: several servers(of the read threads) listen on the port and the kernel
+	//spreads the connections between them
+	Server(const std::string &port, std::unique_ptr<RequestHandler> handler, bool reuse_port = false);
 	void run();
 	
 private:
+	std::string port;
+	bool reuse_port;
 	int listen_fd = -1;
 	//vector of fds to be examined by poll in event loop
 	std::vector <struct pollfd> poll_args;
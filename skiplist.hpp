@@ -4,7 +4,8 @@
 /* =====================================================================
  * This is SkipList data structure which stores paires of (key, value),
  * whereas the key(e.g. int/float) gives order but not necessarily unique 
- * and the value(e.g. strings) is unique. Pairs are sorted by keys.
+ * and the value(e.g. strings) is unique. Pairs are sorted by keys
+ * and pairs with equal keys are sorted by values using Compare.
  * Skiplist is a probabilistic data structure which is implemented 
  * as a double linked list of double linked lists, 
  * where nodes on each level is sorted and connected from above and below
@@ -15,6 +16,11 @@
  * //SkipList//
  * Main goal: range queries. It stores data in ordered way based on its key 
  * Complexity: O(logN) for every action on average
+ * Every node keeps the width of its link, i.e. the number of the lowest level
+ * nodes it skips to reach the next node, and the sum of their keys,
+ * so ranks and sums of key ranges are found in O(logN) as well.
+ * A link's sum is recomputed from the links below it on every change
+ * instead of being adjusted by the difference, so it never drifts.
  * 
  * Ex. of SkipList:
  * 
@@ -40,23 +46,31 @@
 #include <limits> //infinity()
 #include <cstdlib> //rand(), srand()
 #include <random> //mt19937
+#include <vector>
+
+//custom
+#include "ordered_index.hpp"
 
 #define INFTY std::numeric_limits<T>::infinity()
 
-template <typename T, typename P>
-class SkipList {
+template <typename T, typename P, typename Compare = std::less<P>>
+class SkipList : public OrderedIndex<T, P> {
 private:
 	class SkipNode {
 		private:
 		T key;
 		size_t level;
+		//number of the lowest level nodes between this node and the next one,
+		//the next one included
+		size_t width;
+		KeySum<T> sum; //sum of the keys of the same lowest level nodes
 		SkipNode *next, *prev, *down, *up;
 		
 		public:
 		SkipNode(const T &key, size_t level = 0, 
 			SkipNode *next = nullptr, SkipNode *prev = nullptr,
 			SkipNode *down = nullptr, SkipNode *up = nullptr): 
-											key(key), level(level), 
+											key(key), level(level), width(1), sum(),
 											next(next), prev(prev), 
 											down(down), up(up) {}
 											
@@ -250,6 +264,7 @@ private:
 	std::mt19937 rng;
 	std::bernoulli_distribution dist;
 	SkipNode *top;
+	size_t length; //number of nodes on the lowest level
 	
 	SkipNode *_add_after(const T &key, const P &value, size_t level, SkipNode *node) {
 		DataSkipNode *to_add = new DataSkipNode(key, value, level, node->next);
@@ -266,39 +281,82 @@ private:
 		return dist(rng);
 	}
 	
-	SkipNode *_insert_rec(const T &key, const P &value, SkipNode *node) {
-		SkipNode *deeper, *new_node;
-		//find the first node bigger than the key in the list
-		while (node->next && node->next->key <= key) {
-			if (node->get_key() == key || node->next->get_key() == key) {
-				DataSkipNode *dnode;
-				if ((dnode = dynamic_cast<DataSkipNode *>(node->next)) != nullptr) {
-					if (dnode->get_value() >= value)
-						break;
-				}
-			}
-			node = node->next;
-		}
+	//returns true if the node goes strictly before the (key, value) pair
+	//or if the node holds an equal pair and inclusive is set
+	bool _before(SkipNode *node, const T &key, const P &value, bool inclusive = false) const {
+		if (!node->prev)
+			return true; //-INFTY head
+		
+		if (!node->next)
+			return false; //INFTY tail
 		
-		if (!node->down)
-			return _add_after(key, value, 0, node); //the lowest level was reached
+		if (node->key != key)
+			return node->key < key;
 		
-		//try to insert one level lower
-		deeper = _insert_rec(key, value, node->down);
+		const P &node_value = static_cast<DataSkipNode *>(node)->value;
+		if (inclusive)
+			return !Compare()(value, node_value);
 		
-		/* try to insert on this level:
-		 * if deeper is null the node wasn't inserted on the previous level 
-		 * so nothing to insert here
-		 * if it was, toss a coin to decide whether to insert on this level as well */
-		if (!deeper || _toss())
-			return nullptr; 
+		return Compare()(node_value, value);
+	}
+	
+	//returns the node at the 1-based position on the lowest level
+	SkipNode *_at(size_t pos) {
+		SkipNode *node = top;
+		size_t rank = 0;
+		while (1) {
+			for (; node->next->next && rank + node->width <= pos; node = node->next)
+				rank += node->width;
+			
+			if (!node->down) 
+				break; //final level
+			
+			node = node->down;
+		}
 		
-		//insert on this level if the previous conditions are met
-		new_node = _add_after(key, value, deeper->level + 1, node);
-		new_node->down = deeper;
-		deeper->up = new_node;
+		return node;
+	}
+	
+	//returns true if the node holds the (key, value) pair
+	bool _matches(SkipNode *node, const T &key, const P &value) const {
+		return node->prev && node->next && node->key == key 
+				&& static_cast<DataSkipNode *>(node)->value == value;
+	}
+	
+	/* fills preds with the last node before (key, value) on every level 
+	 * from the top to the lowest one, 
+	 * ranks with the positions of these nodes on the lowest level,
+	 * where the head is at 0 */
+	void _find_preds(const T &key, const P &value, std::vector<SkipNode *> &preds, 
+						std::vector<size_t> &ranks) {
+		SkipNode *node = top;
+		size_t rank = 0;
+		while (node) {
+			for (; _before(node->next, key, value); node = node->next)
+				rank += node->width;
+			
+			preds.push_back(node);
+			ranks.push_back(rank);
+			node = node->down;
+		}
+	}
 	
-		return new_node;		
+	/* recomputes the sum of the node's link from the links below it
+	 * (on the lowest level it's the key of the next node), so the lower levels
+	 * have to be recomputed first. A link skips 2 links below on average */
+	void _recount(SkipNode *node) {
+		node->sum = KeySum<T>();
+		if (!node->down) {
+			if (node->next->next)
+				node->sum += node->next->key; //the tail has no key to add
+			
+			return;
+		}
+		
+		//the tails aren't linked to the levels below
+		SkipNode *end = node->next->down;
+		for (SkipNode *below = node->down; below != end && below->next; below = below->next)
+			node->sum += below->sum;
 	}
 	
 	//removes the node from all levels
@@ -328,8 +386,8 @@ private:
 		SkipNode *node = top;
 		SkipNode *level = nullptr;
 		while (1) {
-			//return the last node <= key in the list
-			for (; node->next && node->next->key <= key; node = node->next);
+			//return the last node <= key in the list, the tail has no next
+			for (; node->next->next && node->next->key <= key; node = node->next);
 
 			if (!node->down) 
 				break; //final level
@@ -351,9 +409,10 @@ private:
 		 * or if not found then the closest(from below) to it from the lowest level */
 		SkipNode *node = top;
 		while (1) {
-			//return the last node <= key in the list
-			for (; node->next && node->next->key <= key; node = node->next);
-			if (node->key == key)
+			//return the last node <= key in the list,
+			//the head and the tail are told by their links since a score may be infinite
+			for (; node->next->next && node->next->key <= key; node = node->next);
+			if (node->prev && node->key == key)
 				return node;
 				
 			if (!node->down) 
@@ -365,42 +424,11 @@ private:
 		return node;
 	}
 	
-	SkipNode *_lookup(const T &key, const P &value) {
-		/*return a node with a given key from the upper level
-		 * or if not found then the closest to it from the lowest level */
-		SkipNode *node = top;
-		while (1) {
-			//return the last node < key in the list
-			for (; node->next && node->next->key < key; node = node->next);
-			while (node->next && node->next->key == key) {
-				node = node->next;
-				if (node->get_key() == key) {
-					DataSkipNode *dnode = dynamic_cast<DataSkipNode *>(node);
-					if (dnode) {
-						if (dnode->get_value() == value) {
-							return node;
-						}
-						if (dnode->get_value() > value) {
-							node = node->prev;
-							break;
-						}
-					}
-				}
-			}
-			
-			if (!node->down) 
-				break; //final level
-			
-			node = node->down;
-		}
-		
-		return nullptr;
-	}
-	
 	void _remove_empty_levels() {
 		SkipNode *level_node = top;
 		while (level_node) {
-			if (level_node->next->key == INFTY && level_node->level > 0) {
+			//only the tail has no next
+			if (!level_node->next->next && level_node->level > 0) {
 				SkipNode *tmp = level_node->down;
 				_remove(level_node->next);
 				_remove(level_node);
@@ -415,7 +443,7 @@ private:
 public:	
 	SkipList()
 		: rng(std::random_device{}()), 
-								dist(0.5), top(new SkipNode(-INFTY)) {
+						dist(0.5), top(new SkipNode(-INFTY)), length(0) {
 		/* generate a seed for future random sequences.
 		 * we have to generate it once and before the first _toss()
 		 * so rand() will return different numbers 
@@ -441,7 +469,7 @@ public:
 		return citerator(nullptr, nullptr);
 	}
 	
-	void clear() {
+	void clear() override {
 		iterator it = begin();
 		while (it != end()) {
 			SkipNode *tmp = it.get_current();
@@ -451,10 +479,11 @@ public:
 			 //as well, if we want just clear the skiplist and not destroy it
 			 //we need to save the top level INFTY dummy node
 			 //and this way preserve the upper level
-			 //to become  a reset skiplist
-			if (tmp->get_key() != -INFTY) {
-				if (tmp->get_key() == INFTY &&
-								tmp->get_level() == top->get_level()) {
+			 //to become  a reset skiplist.
+			 //The dummies are told by their links, not by their keys,
+			 //since a pair may have an infinite key as well
+			if (tmp->prev) {
+				if (!tmp->next && tmp->get_level() == top->get_level()) {
 					tmp->prev = top;
 					top->next = tmp;
 				}
@@ -475,18 +504,21 @@ public:
 		}
 		
 		top->level = 0;
+		top->width = 1;
+		top->sum = KeySum<T>();
 		top->down = nullptr;
 		top->next->level = 0;
+		length = 0;
 	}
 	
-	~SkipList() {
+	~SkipList() override {
 		iterator it = begin();
 		while (it != end()) {
 			SkipNode *tmp = it.get_current();
 			it++;
-			 //we'll delete all the -infty nodes separately
+			 //we'll delete all the -infty nodes(no prev) separately
 			 //since they used as between-levels navigation
-			if (tmp->get_key() != -INFTY)
+			if (tmp->prev)
 				delete tmp;
 		}
 		
@@ -504,47 +536,278 @@ public:
 		return node->key;
 	}
 	
-	void insert(const T &key, const P &value) {
-		SkipNode *node = top;
-		SkipNode *deeper;
-		deeper = _insert_rec(key, value, node);
+	void insert(const T &key, const P &value) override {
+		std::vector<SkipNode *> preds;
+		std::vector<size_t> ranks;
+		_find_preds(key, value, preds, ranks);
+		
+		//the new node's position on the lowest level
+		size_t pos = ranks.back() + 1;
+		
+		/* go up through the levels:
+		 * while the coin says so the node is inserted on the level
+		 * and its predecessor's link is split between the two nodes,
+		 * above that the predecessors' links just skip one more node.
+		 * The sums are recomputed bottom-up from the updated levels */
+		SkipNode *deeper = nullptr;
+		bool growing = true;
+		for (size_t i = preds.size(); i-- > 0;) {
+			SkipNode *pred = preds[i];
+			if (growing && (!deeper || !_toss())) {
+				SkipNode *new_node = _add_after(key, value, deeper ? deeper->level + 1 : 0, pred);
+				new_node->width = ranks[i] + pred->width + 1 - pos;
+				pred->width = pos - ranks[i];
+				new_node->down = deeper;
+				if (deeper)
+					deeper->up = new_node;
+				_recount(new_node);
+				deeper = new_node;
+			}
+			else {
+				growing = false;
+				pred->width++;
+			}
+			
+			_recount(pred);
+		}
 		
-		if (!deeper || _toss())
+		length++;
+		
+		//the node reached the top level, toss whether to add a new empty one
+		if (!growing || _toss())
 			return;
 		
 		SkipNode *dummy = new SkipNode(INFTY, deeper->level + 1);
 		top = new SkipNode(-INFTY, deeper->level + 1, dummy, nullptr, top);
+		top->width = length + 1;
+		_recount(top);
 		dummy->prev = top;
 	}
 	
+	/* bulk loading: the pairs are chained on the lowest level,
+	 * then every second node of a level is promoted to the level above
+	 * until a level stays empty, which gives perfectly balanced towers
+	 * without tossing a coin or searching for predecessors */
+	void build(const std::vector<std::pair<T, P>> &pairs) override {
+		clear();
+		
+		SkipNode *last = top;
+		for (const auto &pair : pairs) {
+			last = _add_after(pair.first, pair.second, 0, last);
+			last->prev->sum += pair.first;
+		}
+		length = pairs.size();
+		
+		for (bool promoted = length > 0; promoted;) {
+			SkipNode *dummy = new SkipNode(INFTY, top->level + 1);
+			SkipNode *head = new SkipNode(-INFTY, top->level + 1, dummy, nullptr, top);
+			dummy->prev = head;
+			head->width = 0;
+			
+			//the link of a promoted node goes to its copy above,
+			//the link of any other node is skipped by the last copy before it,
+			//the sums are added up in the same order as _recount() does
+			SkipNode *upper = head;
+			size_t count = 0;
+			promoted = false;
+			for (SkipNode *node = top; node->next; node = node->next) {
+				if (node->prev && ++count % 2 == 0) {
+					SkipNode *copy = _add_after(node->key, 
+									static_cast<DataSkipNode *>(node)->value, head->level, upper);
+					copy->width = 0;
+					copy->down = node;
+					node->up = copy;
+					upper = copy;
+					promoted = true;
+				}
+				
+				upper->width += node->width;
+				upper->sum += node->sum;
+			}
+			
+			top = head;
+		}
+	}
+	
 	void erase(const T &key) {
 		SkipNode *node = _lookup(key);
-		if (node->key != key)
+		if (node->key != key || !node->prev || !node->next)
+			return;
+		
+		erase(key, static_cast<DataSkipNode *>(node)->value);
+	}
+	
+	void erase(const T &key, const P &value) override {
+		std::vector<SkipNode *> preds;
+		std::vector<size_t> ranks;
+		_find_preds(key, value, preds, ranks);
+		
+		if (!_matches(preds.back()->next, key, value))
 			return;
 			
-		//the node was found
-		while (node) {
-			SkipNode *tmp = node->down;
-			_remove(node);
-			node = tmp;
+		//the node was found, remove it from every level it's on
+		//and shorten the links which skipped it by one
+		for (SkipNode *pred : preds) {
+			if (_matches(pred->next, key, value)) {
+				pred->width += pred->next->width - 1;
+				_remove(pred->next);
+			}
+			else
+				pred->width--;
 		}
 		
+		for (size_t i = preds.size(); i-- > 0;)
+			_recount(preds[i]);
+		
+		length--;
 		_remove_empty_levels();
 	}
 	
-	void erase(const T &key, const P &value) {
-		SkipNode *node = _lookup(key, value);
-		if (!node)
-			return;
+	/* moves the (old_key, value) pair to new_key.
+	 * if the node keeps its place between its neighbours on the lowest level
+	 * the keys of its whole tower are rewritten in place,
+	 * otherwise the node is relinked by removing and inserting it again.
+	 * returns false if (old_key, value) wasn't found */
+	bool update(const T &old_key, const P &value, const T &new_key) override {
+		std::vector<SkipNode *> preds;
+		std::vector<size_t> ranks;
+		_find_preds(old_key, value, preds, ranks);
+		
+		SkipNode *bottom = preds.back()->next;
+		if (!_matches(bottom, old_key, value))
+			return false;
+		
+		if (old_key == new_key)
+			return true;
+		
+		//the -INFTY head has no prev and the INFTY tail has no next,
+		//equal keys are ordered by value so they always go through relinking
+		bool after_prev = !bottom->prev->prev || bottom->prev->key < new_key;
+		bool before_next = !bottom->next->next || new_key < bottom->next->key;
+		
+		if (after_prev && before_next) {
+			for (SkipNode *pred : preds) {
+				if (_matches(pred->next, old_key, value))
+					pred->next->key = new_key;
+			}
+			
+			//every predecessor's link skips the node, whether it's its tower or not
+			for (size_t i = preds.size(); i-- > 0;)
+				_recount(preds[i]);
+			
+			return true;
+		}
+		
+		erase(old_key, value);
+		insert(new_key, value);
+		
+		return true;
+	}
+	
+	//returns at most count values starting from the first key >= from
+	std::vector<P> range(const T &from, size_t count) override {
+		std::vector<P> v;
+		SkipNode *node = top;
+		while (1) {
+			//stop at the last node < from in the list
+			for (; node->next->next && node->next->key < from; node = node->next);
+			
+			if (!node->down) 
+				break; //final level
+			
+			node = node->down;
+		}
+		
+		for (node = node->next; node->next && v.size() < count; node = node->next)
+			v.push_back(static_cast<DataSkipNode *>(node)->value);
+		
+		return v;
+	}
+	
+	//returns 0-based position of (key, value) or -1 if it wasn't found
+	long rank(const T &key, const P &value) override {
+		SkipNode *node = top;
+		size_t rank = 0;
+		while (node) {
+			for (; _before(node->next, key, value); node = node->next)
+				rank += node->width;
 			
-		//the node was found
+			if (_matches(node->next, key, value))
+				return rank + node->width - 1;
+			
+			node = node->down;
+		}
+		
+		return -1;
+	}
+	
+	//returns the number of pairs < (key, value), or <= (key, value) if inclusive
+	size_t count_before(const T &key, const P &value, bool inclusive) override {
+		SkipNode *node = top;
+		size_t rank = 0;
 		while (node) {
-			SkipNode *tmp = node->down;
-			_remove(node);
-			node = tmp;
+			for (; _before(node->next, key, value, inclusive); node = node->next)
+				rank += node->width;
+			
+			node = node->down;
 		}
 		
-		_remove_empty_levels();
+		return rank;
+	}
+	
+	//sets count and sum to the number and the sum of keys of the pairs < (key, value),
+	//or <= (key, value) if inclusive
+	void aggregate_before(const T &key, const P &value, bool inclusive, 
+								size_t &count, KeySum<T> &sum) override {
+		SkipNode *node = top;
+		count = 0;
+		sum = KeySum<T>();
+		while (node) {
+			for (; _before(node->next, key, value, inclusive); node = node->next) {
+				count += node->width;
+				sum += node->sum;
+			}
+			
+			node = node->down;
+		}
+	}
+	
+	//returns at most count values starting from the 0-based position start,
+	//going to the lower positions if reverse
+	std::vector<P> range_by_rank(size_t start, size_t count, bool reverse) override {
+		std::vector<P> v;
+		if (start >= length)
+			return v;
+		
+		//both the head and the tail have no prev or next accordingly
+		SkipNode *node = _at(start + 1);
+		for (; node->prev && node->next && v.size() < count; 
+								node = reverse ? node->prev : node->next)
+			v.push_back(static_cast<DataSkipNode *>(node)->value);
+		
+		return v;
+	}
+	
+	void for_each(const std::function<void(const T &, const P &)> &visit) override {
+		if (length == 0)
+			return;
+		
+		//level 0 links all the pairs, the INFTY tail has no next
+		for (SkipNode *node = _at(1); node->next; node = node->next)
+			visit(node->key, static_cast<DataSkipNode *>(node)->value);
+	}
+	
+	//the links of the top level skip all the pairs
+	KeySum<T> sum() override {
+		KeySum<T> sum;
+		for (SkipNode *node = top; node->next; node = node->next)
+			sum += node->sum;
+		
+		return sum;
+	}
+	
+	size_t size() const override {
+		return length;
 	}
 	
 	citerator search_range(const T &key) {
@@ -552,7 +815,7 @@ public:
 		return it;
 	}
 	
-	friend std::ostream& operator<<(std::ostream& out, const SkipList<T, P> &sl) {
+	friend std::ostream& operator<<(std::ostream& out, const SkipList<T, P, Compare> &sl) {
 		for (citerator it = sl.cbegin(); it != sl.cend(); it++) {
 			out << it << " ";
 			if (*it == INFTY)
@@ -0,0 +1,454 @@
+#include "snapshot.hpp"
+
+//c
+#include <errno.h>
+#include <fcntl.h> //open()
+#include <string.h> //strerror()
+#include <sys/mman.h> //mmap()
+#include <sys/stat.h> //fstat()
+#include <unistd.h> //write(), read(), fsync()
+
+//c++
+#include <algorithm> //min, max
+#include <atomic>
+#include <cstdio> //rename()
+#include <cstring> //memcpy
+#include <exception> //exception_ptr
+#include <functional> //std::ref
+#include <memory> //make_shared
+#include <thread>
+#include <utility> //std::pair
+#include <vector>
+
+//custom
+#include "clock.hpp"
+#include "crc32.hpp"
+
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "the fields are copied as is");
+
+static SnapshotError io_error(const std::string &what) {
+	return SnapshotError(what + ": " + strerror(errno));
+}
+
+/* SnapshotWriter */
+SnapshotWriter::SnapshotWriter(int fd) : fd(fd) {
+	section.reserve(SNAPSHOT_SECTION_SIZE);
+}
+
+void SnapshotWriter::_write(const void *data, size_t n) {
+	const uint8_t *p = static_cast<const uint8_t *>(data);
+	size_t done = 0;
+	while (done < n) {
+		ssize_t rv = ::write(fd, p + done, n - done);
+		if (rv < 0) {
+			if (errno == EINTR)
+				continue;
+			throw io_error("write()");
+		}
+		done += rv;
+	}
+
+	written += n;
+}
+
+void SnapshotWriter::_write_meta(const void *data, size_t n) {
+	crc = crc32(crc, data, n);
+	_write(data, n);
+}
+
+void SnapshotWriter::_flush_section() {
+	uint8_t header[SNAPSHOT_SECTION_HEADER];
+	uint8_t *p = header;
+	auto pack = [&p](const auto &field) {
+		memcpy(p, &field, sizeof(field));
+		p += sizeof(field);
+	};
+	pack(uint8_t(SNAPSHOT_SECTION));
+	pack(uint64_t(section_keys));
+	pack(uint64_t(section.size()));
+	pack(crc32(0, section.data(), section.size()));
+
+	_write_meta(header, sizeof(header));
+	_write(section.data(), section.size());
+	section.clear();
+	section_keys = 0;
+}
+
+void SnapshotWriter::_put(const void *data, size_t n) {
+	const uint8_t *p = static_cast<const uint8_t *>(data);
+	section.insert(section.end(), p, p + n);
+}
+
+void SnapshotWriter::_str(const std::string &str) {
+	_field<uint32_t>(str.size());
+	_put(str.data(), str.size());
+}
+
+void SnapshotWriter::write_header(size_t keys) {
+	uint8_t header[sizeof(SNAPSHOT_MAGIC) + sizeof(uint32_t) + sizeof(uint64_t)];
+	uint32_t version = SNAPSHOT_VERSION;
+	uint64_t count = keys;
+	memcpy(header, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+	memcpy(header + sizeof(SNAPSHOT_MAGIC), &version, sizeof(version));
+	memcpy(header + sizeof(SNAPSHOT_MAGIC) + sizeof(version), &count, sizeof(count));
+	_write_meta(header, sizeof(header));
+}
+
+void SnapshotWriter::write_key(const std::string &key, const KeyValue &val, int64_t deadline) {
+	if (val.type == ZSET_KEY)
+		_field<uint8_t>(SNAPSHOT_ZSET);
+	else
+		_field<uint8_t>(val.type == LIST_KEY ? SNAPSHOT_LIST : SNAPSHOT_STRING);
+	_field<int64_t>(deadline);
+	_str(key);
+
+	if (val.type == STRING_KEY)
+		_str(val.str);
+	else if (val.type == LIST_KEY) {
+		_field<uint64_t>(val.list->size());
+		val.list->for_each([this](const std::string &elem) { _str(elem); });
+	}
+	else {
+		_field<uint64_t>(val.zset->size());
+		val.zset->for_each([this](const std::string &name, double score) {
+			_str(name);
+			_field<double>(score);
+		});
+	}
+
+	section_keys++;
+	if (section.size() >= SNAPSHOT_SECTION_SIZE)
+		_flush_section();
+}
+
+void SnapshotWriter::finish() {
+	if (section_keys > 0)
+		_flush_section();
+
+	uint8_t eof = SNAPSHOT_EOF;
+	_write_meta(&eof, sizeof(eof));
+
+	uint32_t expected = crc;
+	_write(&expected, sizeof(expected));
+}
+
+size_t SnapshotWriter::size() const {
+	return written;
+}
+
+/* SnapshotReader */
+void SnapshotReader::_get(void *dst, size_t n) {
+	if (n > size - pos)
+		throw SnapshotError("unexpected end of the snapshot");
+
+	memcpy(dst, data + pos, n);
+	pos += n;
+}
+
+std::string SnapshotReader::_str() {
+	uint32_t n = _field<uint32_t>();
+	if (n > size - pos)
+		throw SnapshotError("unexpected end of the snapshot");
+
+	std::string str(reinterpret_cast<const char *>(data + pos), n);
+	pos += n;
+	return str;
+}
+
+void SnapshotReader::_checksum(size_t start) {
+	crc = crc32(crc, data + start, pos - start);
+}
+
+size_t SnapshotReader::read_header() {
+	char magic[sizeof(SNAPSHOT_MAGIC)];
+	_get(magic, sizeof(magic));
+	if (memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) != 0)
+		throw SnapshotError("not a snapshot file");
+
+	uint32_t version = _field<uint32_t>();
+	if (version != SNAPSHOT_VERSION)
+		throw SnapshotError("unsupported snapshot version " + std::to_string(version));
+
+	//the keyspace is allocated for all the keys, so the count must be sane
+	uint64_t keys = _field<uint64_t>();
+	if (keys > size / SNAPSHOT_MIN_RECORD)
+		throw SnapshotError("invalid number of keys");
+
+	_checksum(0);
+	return keys;
+}
+
+bool SnapshotReader::read_section(SnapshotSection &section) {
+	size_t start = pos;
+	uint8_t type = _field<uint8_t>();
+	if (type == SNAPSHOT_EOF) {
+		_checksum(start);
+		if (_field<uint32_t>() != crc)
+			throw SnapshotError("snapshot checksum mismatch");
+
+		return false;
+	}
+
+	if (type != SNAPSHOT_SECTION)
+		throw SnapshotError("unknown snapshot record " + std::to_string(type));
+
+	section.keys = _field<uint64_t>();
+	section.bytes = _field<uint64_t>();
+	section.crc = _field<uint32_t>();
+	_checksum(start);
+
+	if (section.bytes > size - pos || section.keys > section.bytes / SNAPSHOT_MIN_RECORD)
+		throw SnapshotError("invalid snapshot section");
+
+	//the records are decoded later, maybe by another thread
+	section.data = data + pos;
+	pos += section.bytes;
+	return true;
+}
+
+bool SnapshotReader::read_key(std::string &key, KeyValue &val,
+							int64_t &deadline, SortBackend backend) {
+	if (pos == size)
+		return false;
+
+	uint8_t type = _field<uint8_t>();
+	deadline = _field<int64_t>();
+	key = _str();
+
+	if (type == SNAPSHOT_STRING) {
+		val = KeyValue(_str());
+		return true;
+	}
+
+	if (type == SNAPSHOT_LIST) {
+		//every element takes at least a length
+		uint64_t elements = _field<uint64_t>();
+		if (elements == 0 || elements > (size - pos) / sizeof(uint32_t))
+			throw SnapshotError("invalid list size");
+
+		auto list = std::make_shared<PackedList>();
+		for (uint64_t i = 0; i < elements; i++)
+			list->push_back(_str());
+
+		val = KeyValue(std::move(list));
+		return true;
+	}
+
+	if (type != SNAPSHOT_ZSET)
+		throw SnapshotError("unknown snapshot record " + std::to_string(type));
+
+	//every member takes at least a length and a score
+	uint64_t members = _field<uint64_t>();
+	if (members == 0 || members > (size - pos) / (sizeof(uint32_t) + sizeof(double)))
+		throw SnapshotError("invalid sorted set size");
+
+	std::vector<std::pair<std::string, double>> items;
+	items.reserve(members);
+	for (uint64_t i = 0; i < members; i++) {
+		std::string name = _str();
+		double score = _field<double>();
+		//the index is built from the stored order, which has to be right
+		if (i > 0 && !(items.back().second < score 
+					|| (items.back().second == score && items.back().first < name)))
+			throw SnapshotError("sorted set members are out of order");
+
+		items.emplace_back(std::move(name), score);
+	}
+
+	auto zset = std::make_shared<SortSet>(zset_base_capacity, backend);
+	zset->build_sorted(std::move(items));
+	val = KeyValue(std::move(zset));
+
+	return true;
+}
+
+size_t SnapshotReader::consumed() const {
+	return pos;
+}
+
+/* Snapshot */
+size_t Snapshot::write(int fd, KeyMap &hmap, const TTLManager &ttl_manager) {
+	SnapshotWriter writer(fd);
+	writer.write_header(hmap.size());
+
+	hmap.for_each([&](KeyMap::iterator it) {
+		int64_t deadline = -1;
+		if (ttl_manager.has_ttl(it))
+			deadline = Clock::to_unix_ms(it.meta().expire_at);
+
+		//a reference to the key, copying its shared_ptr would write to the node
+		writer.write_key(it->get_key(), it.second(), deadline);
+	});
+
+	writer.finish();
+	return writer.size();
+}
+
+//what a loader thread gives back to the event loop thread
+struct LoadShard {
+	size_t loaded = 0;
+	//the expiry index isn't thread-safe, so the ttls are set after the threads are done
+	std::vector<std::pair<KeyMap::iterator, int64_t>> deadlines;
+	std::exception_ptr error;
+};
+
+static void load_section(const SnapshotSection &section, KeyMap &hmap, 
+									SortBackend backend, LoadShard &shard) {
+	if (crc32(0, section.data, section.bytes) != section.crc)
+		throw SnapshotError("snapshot section checksum mismatch");
+
+	SnapshotReader reader(section.data, section.bytes);
+	std::string key;
+	KeyValue val{std::string()};
+	int64_t deadline;
+	size_t keys = 0;
+	while (reader.read_key(key, val, deadline, backend)) {
+		keys++;
+		int64_t expire_at = Clock::from_unix_ms(deadline);
+		if (deadline >= 0 && expire_at <= Clock::now_ms())
+			continue; //expired while the server was down
+
+		//the keys of a snapshot are unique, the keyspace isn't searched
+		auto it = hmap.insert_concurrent(std::move(key), std::move(val));
+		if (deadline >= 0)
+			shard.deadlines.emplace_back(it, expire_at);
+
+		shard.loaded++;
+	}
+
+	if (keys != section.keys)
+		throw SnapshotError("invalid snapshot section");
+}
+
+static void load_sections(const std::vector<SnapshotSection> &sections, KeyMap &hmap,
+				TTLManager &ttl_manager, SortBackend backend, size_t &loaded) {
+	size_t threads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+	threads = std::max<size_t>(std::min(threads, sections.size()), 1);
+
+	std::atomic<size_t> next{0};
+	std::vector<LoadShard> shards(threads);
+	auto work = [&](LoadShard &shard) {
+		try {
+			size_t i;
+			while ((i = next.fetch_add(1, std::memory_order_relaxed)) < sections.size())
+				load_section(sections[i], hmap, backend, shard);
+		}
+		catch (...) {
+			shard.error = std::current_exception();
+			next = sections.size(); //the others stop too
+		}
+	};
+
+	//the calling thread is one of the loaders
+	std::vector<std::thread> workers;
+	for (size_t i = 1; i < threads; i++)
+		workers.emplace_back(work, std::ref(shards[i]));
+	work(shards[0]);
+	for (auto &worker : workers)
+		worker.join();
+
+	for (auto &shard : shards) {
+		if (shard.error)
+			std::rethrow_exception(shard.error);
+	}
+
+	for (auto &shard : shards) {
+		for (const auto &entry : shard.deadlines)
+			ttl_manager.set(entry.first, entry.second);
+		loaded += shard.loaded;
+	}
+}
+
+size_t Snapshot::read(int fd, size_t size, KeyMap &hmap, TTLManager &ttl_manager, 
+									SortBackend backend, size_t &loaded) {
+	if (size == 0)
+		throw SnapshotError("unexpected end of the snapshot");
+
+	void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (mapped == MAP_FAILED)
+		throw io_error("mmap()");
+
+	//every page is read, the kernel may read ahead as much as it wants
+	madvise(mapped, size, MADV_WILLNEED);
+
+	size_t consumed = 0;
+	try {
+		SnapshotReader reader(static_cast<const uint8_t *>(mapped), size);
+		size_t keys = reader.read_header();
+
+		std::vector<SnapshotSection> sections;
+		SnapshotSection section;
+		size_t section_keys = 0;
+		while (reader.read_section(section)) {
+			sections.push_back(section);
+			section_keys += section.keys;
+		}
+
+		if (section_keys != keys)
+			throw SnapshotError("invalid number of keys");
+
+		//no rehash while loading and the threads never move a node
+		hmap.reserve(keys);
+		load_sections(sections, hmap, ttl_manager, backend, loaded);
+		consumed = reader.consumed();
+	}
+	catch (...) {
+		munmap(mapped, size);
+		throw;
+	}
+
+	munmap(mapped, size);
+	return consumed;
+}
+
+size_t Snapshot::save(KeyMap &hmap, const TTLManager &ttl_manager, const std::string &path) {
+	std::string tmp_path = path + ".tmp-" + std::to_string(getpid());
+	int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		throw io_error("open(" + tmp_path + ")");
+
+	size_t size = 0;
+	try {
+		size = write(fd, hmap, ttl_manager);
+		if (fsync(fd) != 0)
+			throw io_error("fsync()");
+	}
+	catch (const SnapshotError &e) {
+		close(fd);
+		unlink(tmp_path.c_str());
+		throw;
+	}
+
+	close(fd);
+	if (rename(tmp_path.c_str(), path.c_str()) != 0) {
+		SnapshotError err = io_error("rename(" + path + ")");
+		unlink(tmp_path.c_str());
+		throw err;
+	}
+
+	return size;
+}
+
+size_t Snapshot::load(const std::string &path, KeyMap &hmap,
+						TTLManager &ttl_manager, SortBackend backend) {
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		throw io_error("open(" + path + ")");
+
+	size_t loaded = 0;
+	try {
+		struct stat st;
+		if (fstat(fd, &st) != 0)
+			throw io_error("fstat()");
+
+		if (read(fd, st.st_size, hmap, ttl_manager, backend, loaded) != size_t(st.st_size))
+			throw SnapshotError("unexpected data after the end of the snapshot");
+	}
+	catch (const SnapshotError &e) {
+		close(fd);
+		throw;
+	}
+
+	close(fd);
+	return loaded;
+}
@@ -0,0 +1,161 @@
+#ifndef __SNAPSHOT_HPP__
+#define __SNAPSHOT_HPP__
+
+/* =====================================================================
+ * A snapshot is a point-in-time copy of the keyspace in a compact
+ * binary file. Every field is little-endian and every string is
+ * prefixed by its length, so a file is read in one pass without any parsing.
+ *
+ * file:    "RDSH" | version u32 | keys u64 | section... | EOF u8 | crc32 u32
+ * section: SECTION u8 | keys u64 | bytes u64 | crc32 u32 | record...
+ * record:  type u8 | deadline i64 | key
+ *          STRING: value
+ *          ZSET:   members u64 | (name, score f64)... ordered by (score, name)
+ *          LIST:   elements u64 | element... head to tail
+ * string:  length u32 | bytes
+ *
+ * The deadline is a unix time in ms(-1 - no ttl), since the monotonic
+ * clock of the server starts over on restart.
+ *
+ * Records are grouped into sections of ~SNAPSHOT_SECTION_SIZE bytes, so
+ * the loader finds every section by skipping over them and decodes them
+ * on all the cores at once. Each section has the checksum of its records,
+ * and the last checksum covers the rest of the file(the header and the
+ * section headers), so a torn or corrupted file is never loaded.
+ * =====================================================================*/
+
+//c++
+#include <cstddef> //size_t
+#include <cstdint> //uint32_t, int64_t
+#include <stdexcept> //runtime_error
+#include <string>
+#include <vector>
+
+//custom
+#include "keyspace.hpp"
+#include "sortedset.hpp" //SortBackend
+#include "ttl_manager.hpp"
+
+constexpr char SNAPSHOT_MAGIC[4] = {'R', 'D', 'S', 'H'};
+constexpr uint32_t SNAPSHOT_VERSION = 2;
+constexpr size_t SNAPSHOT_SECTION_SIZE = 1 << 20;
+//type, keys, bytes and crc
+constexpr size_t SNAPSHOT_SECTION_HEADER = 1 + 8 + 8 + 4;
+//type, deadline and the lengths of the key and the value
+constexpr size_t SNAPSHOT_MIN_RECORD = 1 + 8 + 4 + 4;
+
+enum SnapshotRecord : uint8_t {
+	SNAPSHOT_STRING = 0,
+	SNAPSHOT_ZSET = 1,
+	SNAPSHOT_LIST = 2,
+	SNAPSHOT_SECTION = 0xFE,
+	SNAPSHOT_EOF = 0xFF,
+};
+
+//an I/O error or a malformed file
+class SnapshotError : public std::runtime_error {
+public:
+	SnapshotError(const std::string &msg) : std::runtime_error(msg) {}
+};
+
+/* SnapshotWriter
+ * encodes the records of a section in memory and writes the section
+ * with its header once it's SNAPSHOT_SECTION_SIZE long */
+class SnapshotWriter {
+private:
+	int fd;
+	std::vector<uint8_t> section; //the records of the current section
+	size_t section_keys = 0;
+	size_t written = 0;
+	uint32_t crc = 0; //of the header and the section headers
+
+	void _write(const void *data, size_t n);
+	//writes a part of the file structure, covered by the last checksum
+	void _write_meta(const void *data, size_t n);
+	void _flush_section();
+	void _put(const void *data, size_t n);
+	//the fields are written with their exact sizes
+	template <typename Field>
+	void _field(Field val) { _put(&val, sizeof(val)); }
+	void _str(const std::string &str);
+
+public:
+	SnapshotWriter(int fd);
+	SnapshotWriter(const SnapshotWriter &) = delete;
+	SnapshotWriter &operator=(const SnapshotWriter &) = delete;
+
+	void write_header(size_t keys);
+	void write_key(const std::string &key, const KeyValue &val, int64_t deadline);
+	//writes the last section, EOF and the checksum
+	void finish();
+	size_t size() const; //bytes written so far
+};
+
+//the records of a section, found without decoding them
+struct SnapshotSection {
+	const uint8_t *data;
+	size_t bytes;
+	size_t keys;
+	uint32_t crc;
+};
+
+/* SnapshotReader
+ * the reverse of SnapshotWriter over a file mapped into memory:
+ * either the whole file(header and sections) or the records of a section.
+ * Every length is checked against the rest of the data before anything
+ * is allocated for it */
+class SnapshotReader {
+private:
+	const uint8_t *data;
+	size_t size;
+	size_t pos = 0;
+	uint32_t crc = 0; //of the header and the section headers read so far
+
+	void _get(void *dst, size_t n);
+	template <typename Field>
+	Field _field() {
+		Field val;
+		_get(&val, sizeof(val));
+		return val;
+	}
+	std::string _str();
+	//adds the bytes read since start to the checksum of the file structure
+	void _checksum(size_t start);
+
+public:
+	SnapshotReader(const uint8_t *data, size_t size) : data(data), size(size) {}
+	SnapshotReader(const SnapshotReader &) = delete;
+	SnapshotReader &operator=(const SnapshotReader &) = delete;
+
+	//returns the number of keys
+	size_t read_header();
+	//skips over the next section, returns false at EOF, when the checksum has been verified
+	bool read_section(SnapshotSection &section);
+	//decodes the next record of a section, returns false at the end of the section
+	bool read_key(std::string &key, KeyValue &val, int64_t &deadline, SortBackend backend);
+	//bytes up to the end of what was read, the file may go on after the snapshot
+	size_t consumed() const;
+};
+
+class Snapshot {
+public:
+	//writes the keyspace to an open file without syncing it, returns the number of bytes
+	static size_t write(int fd, KeyMap &hmap, const TTLManager &ttl_manager);
+	/* reads a snapshot from the start of an open file of size bytes into
+	 * an empty keyspace and adds the number of loaded keys to loaded,
+	 * returns the number of bytes of the snapshot, since other data may follow it.
+	 * The file is mapped into memory, the keyspace is allocated for all the keys
+	 * at once and the sections are decoded by one thread per core */
+	static size_t read(int fd, size_t size, KeyMap &hmap, TTLManager &ttl_manager,
+								SortBackend backend, size_t &loaded);
+	//writes the keyspace to a temporary file which replaces path once it's synced,
+	//so the previous snapshot stays intact until the new one is complete,
+	//returns the size of the file, throws SnapshotError
+	static size_t save(KeyMap &hmap, const TTLManager &ttl_manager, const std::string &path);
+	//loads the keys of the file into an empty keyspace, the ones past their deadline are dropped,
+	//returns the number of loaded keys, throws SnapshotError
+	static size_t load(const std::string &path, KeyMap &hmap,
+							TTLManager &ttl_manager, SortBackend backend);
+};
+
+#endif
@@ -1,14 +1,25 @@
 #include "sortedset.hpp"
 
-SortSet::SortSet(size_t hashmap_size) 
-			: map(new HashMap<std::string, double>(hashmap_size)), 
-			skiplist(new SkipList<double, shared_ptr<std::string>>()) {}
+//c++
+#include <algorithm> //std::min, std::sort
+#include <cmath> //isnan, nextafter
+#include <stdexcept> //domain_error, invalid_argument
+
+SortSet::SortSet(size_t hashmap_size, SortBackend backend) 
+			: map(new HashMap<std::string, double>(hashmap_size)), index(nullptr) {
+	if (backend == BPTREE_BACKEND)
+		index = new BPTree<double, shared_ptr<std::string>, 
+								PointeeLess<shared_ptr<std::string>>>();
+	else
+		index = new SkipList<double, shared_ptr<std::string>, 
+								PointeeLess<shared_ptr<std::string>>>();
+}
 
 SortSet::~SortSet() {
 	delete map;
 	map = nullptr;
-	delete skiplist;
-	skiplist = nullptr;
+	delete index;
+	index = nullptr;
 }
 
 //if we search by key then it's HashMap query
@@ -24,31 +35,105 @@ double SortSet::search(const std::string &name) {
 //returns 1: if a new key was added
 //returns 0: if an already existing key was updated
 int SortSet::insert(const std::string &name, double score) {
-	int rc = 1;
 	//if a node with a given key already exists, change its score
 	auto it = map->search(name);
 	if (it != map->end()) {
-		skiplist->erase(it.second(), it.first());
+		//the index node is moved in place if the order allows it
+		index->update(it.second(), it.first(), score);
 		it.set_second(score); //update the score for the hashmap node
-		rc = 0; //the key already exists and was updated
+		return 0; //the key already exists and was updated
 	}
 	
-	//insert to hashmap only new keys to prevent unnecessary searches
-	if (rc) { 
-		//want to insert the direct reference to the allocated string in Hashmap
-		skiplist->insert(score, map->insert(name, score));
+	//want to insert the direct reference to the allocated string in Hashmap
+	index->insert(score, map->insert(name, score));
+	
+	return 1;
+}
+
+size_t SortSet::insert_many(const std::vector<std::pair<std::string, double>> &items) {
+	size_t added = 0;
+	
+	//a rebuild costs O(set + batch), so a small batch, or a batch into a bigger set,
+	//is cheaper to insert one by one
+	if (items.size() < BULK_MIN_BATCH || items.size() < index->size()) {
+		for (const auto &item : items)
+			added += insert(item.first, item.second);
+		
+		return added;
 	}
-	else
-		skiplist->insert(score, it.first());
 	
-	return rc;
+	//the map is updated first, so every name is listed once with its final score
+	std::vector<shared_ptr<std::string>> names = index->range_by_rank(0, index->size(), false);
+	for (const auto &item : items) {
+		auto it = map->search(item.first);
+		if (it != map->end())
+			it.set_second(item.second);
+		else {
+			names.push_back(map->insert(item.first, item.second));
+			added++;
+		}
+	}
+	
+	std::vector<std::pair<double, shared_ptr<std::string>>> pairs;
+	pairs.reserve(names.size());
+	for (const auto &name : names)
+		pairs.emplace_back(map->search(*name).second(), name);
+	
+	auto less = [](const std::pair<double, shared_ptr<std::string>> &lhs, 
+					const std::pair<double, shared_ptr<std::string>> &rhs) {
+		if (lhs.first != rhs.first)
+			return lhs.first < rhs.first;
+		
+		return *lhs.second < *rhs.second;
+	};
+	if (!std::is_sorted(pairs.begin(), pairs.end(), less))
+		std::sort(pairs.begin(), pairs.end(), less);
+	
+	index->build(pairs);
+	
+	return added;
+}
+
+void SortSet::build_sorted(std::vector<std::pair<std::string, double>> &&items) {
+	map->reserve(items.size());
+	
+	std::vector<std::pair<double, shared_ptr<std::string>>> pairs;
+	pairs.reserve(items.size());
+	for (auto &item : items) {
+		double score = item.second;
+		pairs.emplace_back(score, map->insert_new(std::move(item.first), std::move(score)).first());
+	}
+	
+	index->build(pairs);
+}
+
+//returns the new score of the key,
+//a missing key is added as if its previous score was 0
+double SortSet::incrby(const std::string &name, double increment) {
+	if (std::isnan(increment))
+		throw std::domain_error("increment is not a number");
+		
+	auto it = map->search(name);
+	if (it == map->end()) {
+		index->insert(increment, map->insert(name, increment));
+		return increment;
+	}
+	
+	double score = it.second() + increment;
+	if (std::isnan(score)) //e.g. inf + (-inf)
+		throw std::domain_error("resulting score is not a number");
+	
+	index->update(it.second(), it.first(), score);
+	it.set_second(score);
+	
+	return score;
 }
 
 int SortSet::erase(const std::string &name) {
 	int rc = 0;
 	auto it = map->search(name);
 	if (it != map->end()) {
-		skiplist->erase(it.second(), it.first());
+		index->erase(it.second(), it.first());
 		map->erase(name);
 		rc = 1;
 	}
@@ -57,23 +142,179 @@ int SortSet::erase(const std::string &name) {
 }
 
 std::vector<std::string> SortSet::range(double score, size_t offset) {
-	auto it = skiplist->search_range(score);
 	std::vector<std::string> v;
-	for (size_t i = 0; i < offset && it != skiplist->cend(); i++) {
-		try {
-			const std::string &val = *it.get_value();
-			v.push_back(val);
-			std::cout << it;
-		}
-		catch(...) {}
-		it++;
-	}
-	std::cout << "\n";
+	for (const auto &name : index->range(score, offset))
+		v.push_back(*name);
 	
 	return v;
 }	
 
+long SortSet::rank(const std::string &name) {
+	auto it = map->search(name);
+	if (it == map->end())
+		return -1;
+	
+	return index->rank(it.second(), it.first());
+}
+
+/* LexBound */
+LexBound LexBound::parse(const std::string &bound) {
+	if (bound == "-")
+		return {MIN, ""};
+	
+	if (bound == "+")
+		return {MAX, ""};
+	
+	if (!bound.empty() && bound[0] == '[')
+		return {INCLUSIVE, bound.substr(1)};
+	
+	if (!bound.empty() && bound[0] == '(')
+		return {EXCLUSIVE, bound.substr(1)};
+	
+	throw std::invalid_argument("lex bound must start with '[' or '(' or be '-' or '+'");
+}
+
+size_t SortSet::_count_before(double score, const LexBound &bound, bool is_max) {
+	//"" is the lowest possible name, so everything from the next score is above "+"
+	static const auto lowest = std::make_shared<std::string>();
+	
+	switch (bound.type) {
+	case LexBound::MIN:
+		return index->count_before(score, lowest, false);
+	case LexBound::MAX:
+		//nothing goes after +inf, and nextafter() can't step over it
+		if (score == INFINITY)
+			return index->size();
+		
+		return index->count_before(std::nextafter(score, INFINITY), lowest, false);
+	default:
+		break;
+	}
+	
+	auto name = std::make_shared<std::string>(bound.name);
+	//the lower bound excludes the names before it(and itself if exclusive)
+	//the upper bound includes the names before it(and itself if inclusive)
+	bool inclusive = (bound.type == LexBound::INCLUSIVE) == is_max;
+	
+	return index->count_before(score, name, inclusive);
+}
+
+std::vector<std::string> SortSet::range_by_lex(const LexBound &min, const LexBound &max,
+									size_t offset, size_t count, bool reverse) {
+	double score = 0;
+	if (!lex_score(score))
+		return {};
+	
+	return range_by_lex(score, min, max, offset, count, reverse);
+}
+
+bool SortSet::lex_score(double &score) {
+	auto first = index->range_by_rank(0, 1, false);
+	if (first.empty())
+		return false;
+	
+	score = map->search(*first[0]).second();
+	return true;
+}
+
+std::vector<std::string> SortSet::range_by_lex(double score, const LexBound &min, 
+						const LexBound &max, size_t offset, size_t count, bool reverse) {
+	std::vector<std::string> v;
+	size_t lo = _count_before(score, min, false);
+	size_t hi = _count_before(score, max, true);
+	if (hi <= lo || hi - lo <= offset)
+		return v;
+	
+	count = std::min(count, hi - lo - offset);
+	size_t start = reverse ? hi - 1 - offset : lo + offset;
+	for (const auto &name : index->range_by_rank(start, count, reverse))
+		v.push_back(*name);
+	
+	return v;
+}
+
+size_t SortSet::lex_count(const LexBound &min, const LexBound &max) {
+	double score = 0;
+	if (!lex_score(score))
+		return 0;
+	
+	size_t lo = _count_before(score, min, false);
+	size_t hi = _count_before(score, max, true);
+	
+	return (hi > lo) ? hi - lo : 0;
+}
+
+double parse_score(const std::string &score) {
+	size_t pos = 0;
+	double value = std::stod(score, &pos); //accepts "-inf" and "+inf" as well
+	if (pos != score.size() || std::isnan(value))
+		throw std::invalid_argument("invalid score");
+	
+	return value;
+}
+
+/* ScoreBound */
+ScoreBound ScoreBound::parse(const std::string &bound) {
+	bool exclusive = !bound.empty() && bound[0] == '(';
+	try {
+		return {parse_score(exclusive ? bound.substr(1) : bound), exclusive};
+	}
+	catch(const std::invalid_argument &e) { //stod's own message is just "stod"
+		throw std::invalid_argument("invalid score bound");
+	}
+}
+
+void SortSet::_aggregate_before(const ScoreBound &bound, bool is_max, 
+										size_t &count, KeySum<double> &sum) {
+	//(score, "") goes before all the names with the score,
+	//so the pairs before it are exactly the ones with lower scores
+	static const auto lowest = std::make_shared<std::string>();
+	
+	//the lower bound excludes the scores below it(and itself if exclusive)
+	//the upper bound includes the scores below it(and itself if inclusive)
+	double score = bound.score;
+	if (is_max != bound.exclusive) {
+		//nothing goes after +inf, and nextafter() can't step over it
+		if (score == INFINITY) {
+			count = index->size();
+			sum = index->sum();
+			return;
+		}
+		
+		score = std::nextafter(score, INFINITY);
+	}
+	
+	index->aggregate_before(score, lowest, false, count, sum);
+}
+
+ScoreAggregate SortSet::aggregate(const ScoreBound &min, const ScoreBound &max) {
+	size_t lo_count = 0, hi_count = 0;
+	KeySum<double> lo_sum, hi_sum;
+	_aggregate_before(min, false, lo_count, lo_sum);
+	_aggregate_before(max, true, hi_count, hi_sum);
+	
+	if (hi_count <= lo_count)
+		return {0, 0, 0, 0};
+	
+	//the scores are ordered, so the extremes are the ends of the range
+	double min_score = map->search(*index->range_by_rank(lo_count, 1, false)[0]).second();
+	double max_score = map->search(*index->range_by_rank(hi_count - 1, 1, false)[0]).second();
+	
+	//the infinite scores are counted apart, so a -inf below the range doesn't make it NaN
+	return {hi_count - lo_count, (hi_sum - lo_sum).value(), min_score, max_score};
+}
+
+size_t SortSet::size() {
+	return index->size();
+}
+
 void SortSet::clear() {
 	map->clear();
-	skiplist->clear();
+	index->clear();
+}
+
+void SortSet::for_each(const std::function<void(const std::string &, double)> &visit) {
+	index->for_each([&visit](const double &score, const shared_ptr<std::string> &name) {
+		visit(*name, score);
+	});
 }
@@ -9,37 +9,88 @@
  * //HashMap://
  * Main goal: point queries. Uses name as key.
  * Complexity: O(1) for every action on average
- * //SkipList//
+ * //SkipList// or //BPTree// (chosen by SortBackend)
  * Main goal: range queries. It stores data in ordered way based on its score 
  * Complexity: O(logN) for every action on average
  * =====================================================================*/
 
+#include <functional> //std::function
 #include <limits> //infinity()
 #include <memory> //shared_ptr
 #include <string>
+#include <utility> //std::pair
 #include <vector> 
 
 //custom
+#include "bptree.hpp"
 #include "hashmap.hpp"
+#include "ordered_index.hpp"
 #include "skiplist.hpp"
 
 using std::shared_ptr;
 
 constexpr double MINUS_INFTY = -std::numeric_limits<double>::infinity();
+//insert_many rebuilds the index only for a batch at least this big and
+//at least as big as the set, below that single inserts are cheaper(bench_sset cutover)
+constexpr size_t BULK_MIN_BATCH = 64;
+
+//the ordered index which stores (score, name) pairs
+enum SortBackend {
+	SKIPLIST_BACKEND, //the default one
+	BPTREE_BACKEND, //better for big sets and long ranges
+};
+
+/* the whole string has to be a number, e.g. "1.5", "1e3" or "-inf",
+ * throws invalid_argument upon anything else or NaN(it can't be ordered)
+ * and out_of_range if it doesn't fit into a double */
+double parse_score(const std::string &score);
+
+/* a bound of a lexicographic range over names with equal scores:
+ * "[name" - inclusive, "(name" - exclusive, "-" - the lowest, "+" - the highest */
+struct LexBound {
+	enum Type {MIN, MAX, INCLUSIVE, EXCLUSIVE} type;
+	std::string name;
+	
+	//throws invalid_argument upon a malformed bound
+	static LexBound parse(const std::string &bound);
+};
+
+/* a bound of a score range:
+ * "1.5" - inclusive, "(1.5" - exclusive, "-inf" and "+inf" are allowed */
+struct ScoreBound {
+	double score;
+	bool exclusive;
+	
+	//throws invalid_argument upon a malformed bound
+	static ScoreBound parse(const std::string &bound);
+};
+
+//aggregates of the scores in a score range
+struct ScoreAggregate {
+	size_t count;
+	double sum;
+	double min; //defined only if count > 0
+	double max; //defined only if count > 0
+};
 
 /* TODO:
  * RANGE (w+w\t scores) +
  * RANGEGETBYSCORE
  * REMRANGEBYSCORE
- * RANK
+ * RANK +
  * */
 class SortSet {
 	private:
 	HashMap<std::string, double> *map; //to store as (key=name, value=score)
-	SkipList<double, shared_ptr<std::string>> *skiplist; //to store as (key=score, value=name)
+	OrderedIndex<double, shared_ptr<std::string>> *index; //to store as (key=score, value=name)
+	
+	//returns the number of names going before the bound among the ones with the score
+	size_t _count_before(double score, const LexBound &bound, bool is_max);
+	//sets count and sum of the scores going before the bound
+	void _aggregate_before(const ScoreBound &bound, bool is_max, size_t &count, KeySum<double> &sum);
 	
 	public:
-	SortSet(size_t hashmap_size);
+	SortSet(size_t hashmap_size, SortBackend backend = SKIPLIST_BACKEND);
 	
 	~SortSet();
 	//if we search by key then it's HashMap query
@@ -47,8 +98,39 @@ class SortSet {
 	//returns 1: if a new key was added
 	//returns 0: if an already existing key was updated
 	int insert(const std::string &name, double score);
+	/* inserts many (name, score) pairs at once, a repeated name gets its last score,
+	 * returns the number of added keys. A big batch(see BULK_MIN_BATCH) rebuilds
+	 * the index bottom-up in O(n), skipping the sort for sorted input */
+	size_t insert_many(const std::vector<std::pair<std::string, double>> &items);
+	/* fills an empty set with unique names ordered by (score, name), e.g. from
+	 * a snapshot: the map is allocated at its final size, nothing is searched
+	 * or sorted and the index is built bottom-up in O(n) */
+	void build_sorted(std::vector<std::pair<std::string, double>> &&items);
+	//returns the new score of the key, throws domain_error if it is NaN
+	double incrby(const std::string &name, double increment);
 	int erase(const std::string &name);
 	std::vector<std::string> range(double score, size_t offset);
+	//returns 0-based position of the name in the set or -1 if it doesn't exist
+	long rank(const std::string &name);
+	/* lexicographic range queries, the names are expected to share 
+	 * the same score(e.g. 0) like in an autocomplete index,
+	 * otherwise only the names with the lowest score are queried */
+	std::vector<std::string> range_by_lex(const LexBound &min, const LexBound &max,
+								size_t offset, size_t count, bool reverse = false);
+	//the score the lexicographic queries use: the lowest one, false if the set is empty
+	bool lex_score(double &score);
+	/* the same query at a known lex_score(), it reads only the index,
+	 * as range() does, so it can run on another thread while the set isn't written
+	 * (unlike the map, the index isn't rehashed by the lookups of other readers) */
+	std::vector<std::string> range_by_lex(double score, const LexBound &min, const LexBound &max,
+								size_t offset, size_t count, bool reverse = false);
+	size_t lex_count(const LexBound &min, const LexBound &max);
+	//count and sum come from the index's link/subtree aggregates in O(logN),
+	//without visiting the names in the range
+	ScoreAggregate aggregate(const ScoreBound &min, const ScoreBound &max);
+	//visits all the (name, score) pairs ordered by score
+	void for_each(const std::function<void(const std::string &, double)> &visit);
+	size_t size();
 	void clear();
 };
 
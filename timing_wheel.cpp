@@ -0,0 +1,216 @@
+#include "timing_wheel.hpp"
+
+//c++
+#include <algorithm> //fill
+#include <functional> //std::less
+#include <iterator> //begin, end
+#include <limits> //max()
+
+constexpr int64_t WHEEL_L0_MASK = WHEEL_L0_SLOTS - 1;
+constexpr int64_t WHEEL_LN_MASK = WHEEL_LN_SLOTS - 1;
+constexpr size_t WHEEL_SPAN_BITS = WHEEL_L0_BITS + (WHEEL_LEVELS - 1) * WHEEL_LN_BITS;
+
+TimingWheel::TimingWheel(int64_t now) : current(now) {}
+
+size_t TimingWheel::_slot(size_t level, size_t idx) {
+	if (level == 0)
+		return idx;
+
+	return WHEEL_L0_SLOTS + (level - 1) * WHEEL_LN_SLOTS + idx;
+}
+
+long TimingWheel::_slot_of(ExpiryEntry **head) const {
+	//std::less gives a total order even for pointers outside the array
+	std::less<ExpiryEntry * const *> less;
+	if (less(head, slots) || !less(head, slots + WHEEL_SLOTS))
+		return -1;
+
+	return head - slots;
+}
+
+void TimingWheel::_link(ExpiryEntry **head, ExpiryEntry *entry) {
+	entry->wheel_next = *head;
+	if (*head)
+		(*head)->wheel_pprev = &entry->wheel_next;
+
+	*head = entry;
+	entry->wheel_pprev = head;
+
+	long slot = _slot_of(head);
+	if (slot >= 0)
+		occupied[slot / 64] |= uint64_t(1) << (slot % 64);
+}
+
+void TimingWheel::_unlink(ExpiryEntry *entry) {
+	ExpiryEntry **pprev = entry->wheel_pprev;
+	*pprev = entry->wheel_next;
+	if (entry->wheel_next)
+		entry->wheel_next->wheel_pprev = pprev;
+
+	entry->wheel_next = nullptr;
+	entry->wheel_pprev = nullptr;
+
+	//the entry was the last one in its slot
+	long slot;
+	if (!*pprev && (slot = _slot_of(pprev)) >= 0)
+		occupied[slot / 64] &= ~(uint64_t(1) << (slot % 64));
+}
+
+void TimingWheel::_place(ExpiryEntry *entry) {
+	int64_t expire_at = entry->expire_at;
+	if (expire_at <= current) {
+		//already due, goes to the slot being processed
+		_link(&slots[current & WHEEL_L0_MASK], entry);
+		return;
+	}
+
+	/* the entry goes to the level of the highest digit
+	 * in which its deadline differs from current,
+	 * so it's cascaded exactly when current reaches that digit */
+	uint64_t diff = expire_at ^ current;
+	if (diff < WHEEL_L0_SLOTS) {
+		_link(&slots[expire_at & WHEEL_L0_MASK], entry);
+		return;
+	}
+
+	size_t shift = WHEEL_L0_BITS;
+	for (size_t level = 1; level < WHEEL_LEVELS; level++, shift += WHEEL_LN_BITS) {
+		if ((diff >> (shift + WHEEL_LN_BITS)) == 0) {
+			_link(&slots[_slot(level, (expire_at >> shift) & WHEEL_LN_MASK)], entry);
+			return;
+		}
+	}
+
+	_link(&overflow, entry);
+}
+
+void TimingWheel::_cascade() {
+	size_t shift = WHEEL_L0_BITS;
+	for (size_t level = 1; level <= WHEEL_LEVELS; level++, shift += WHEEL_LN_BITS) {
+		size_t idx = (current >> shift) & WHEEL_LN_MASK;
+		//the overflow list is cascaded once all the levels have wrapped
+		ExpiryEntry **head = &overflow;
+		if (level < WHEEL_LEVELS) {
+			size_t slot = _slot(level, idx);
+			head = &slots[slot];
+			occupied[slot / 64] &= ~(uint64_t(1) << (slot % 64));
+		}
+
+		//detach the whole list first, since far entries may return to overflow
+		ExpiryEntry *list = *head;
+		*head = nullptr;
+		while (list) {
+			ExpiryEntry *entry = list;
+			list = entry->wheel_next;
+			entry->wheel_next = nullptr;
+			entry->wheel_pprev = nullptr;
+			_place(entry);
+		}
+
+		if (level == WHEEL_LEVELS || idx != 0)
+			break; //the levels above haven't reached a new slot yet
+	}
+}
+
+int64_t TimingWheel::_next_event() const {
+	/* entries of every level are placed after current's digit of the level,
+	 * and an occupied slot of a lower level is always reached 
+	 * before any slot of a higher one, so the first one found is the closest */
+	size_t pos = (current & WHEEL_L0_MASK) + 1;
+	for (size_t word = pos / 64; word < WHEEL_L0_SLOTS / 64; word++) {
+		uint64_t bits = occupied[word];
+		if (word == pos / 64)
+			bits &= ~uint64_t(0) << (pos % 64);
+
+		if (bits)
+			return (current & ~WHEEL_L0_MASK) + word * 64 + __builtin_ctzll(bits);
+	}
+
+	size_t shift = WHEEL_L0_BITS;
+	for (size_t level = 1; level < WHEEL_LEVELS; level++, shift += WHEEL_LN_BITS) {
+		static_assert(WHEEL_LN_SLOTS == 64, "a level has to fit a bitmap word");
+		uint64_t bits = occupied[_slot(level, 0) / 64];
+		size_t digit = (current >> shift) & WHEEL_LN_MASK;
+		bits = digit + 1 < 64 ? bits & (~uint64_t(0) << (digit + 1)) : 0;
+
+		if (bits) {
+			int64_t period = (current >> (shift + WHEEL_LN_BITS)) << (shift + WHEEL_LN_BITS);
+			return period + (int64_t(__builtin_ctzll(bits)) << shift);
+		}
+	}
+
+	if (overflow)
+		return ((current >> WHEEL_SPAN_BITS) + 1) << WHEEL_SPAN_BITS;
+
+	return std::numeric_limits<int64_t>::max();
+}
+
+void TimingWheel::schedule(ExpiryEntry *entry, int64_t expire_at) {
+	if (is_scheduled(entry)) {
+		_unlink(entry);
+		count--;
+	}
+
+	entry->store_deadline(expire_at);
+	_place(entry);
+	count++;
+}
+
+void TimingWheel::cancel(ExpiryEntry *entry) {
+	if (!is_scheduled(entry))
+		return;
+
+	_unlink(entry);
+	count--;
+	entry->store_deadline(-1);
+}
+
+bool TimingWheel::is_scheduled(const ExpiryEntry *entry) const {
+	return entry->wheel_pprev != nullptr;
+}
+
+ExpiryEntry *TimingWheel::pop_expired(int64_t now) {
+	while (true) {
+		ExpiryEntry *head = slots[current & WHEEL_L0_MASK];
+		if (head) {
+			_unlink(head);
+			count--;
+			return head;
+		}
+
+		if (current >= now)
+			return nullptr;
+
+		//skip the empty slots, the ones up to now can't get entries anymore
+		int64_t next = count ? _next_event() : now;
+		if (next > now) {
+			current = now;
+			return nullptr;
+		}
+
+		current = next;
+		if ((current & WHEEL_L0_MASK) == 0)
+			_cascade();
+	}
+}
+
+int64_t TimingWheel::next_deadline() const {
+	if (count == 0)
+		return -1;
+	
+	if (slots[current & WHEEL_L0_MASK])
+		return current;
+	
+	return _next_event();
+}
+
+size_t TimingWheel::size() const {
+	return count;
+}
+
+void TimingWheel::clear() {
+	std::fill(std::begin(slots), std::end(slots), nullptr);
+	std::fill(std::begin(occupied), std::end(occupied), 0);
+	overflow = nullptr;
+	count = 0;
+}
@@ -0,0 +1,83 @@
+#ifndef __TIMING_WHEEL_HPP__
+#define __TIMING_WHEEL_HPP__
+
+/* =====================================================================
+ * TimingWheel is a hierarchical timing wheel of millisecond resolution.
+ * Level 0 has a slot per millisecond for the next WHEEL_L0_SLOTS ms,
+ * every higher level has WHEEL_LN_SLOTS slots, each one covering
+ * the whole span of the level below. An entry is put on the lowest level
+ * whose slot holds its deadline and is moved(cascaded) one level down
+ * when the wheel reaches that slot, so it reaches level 0
+ * right before it's due. Deadlines further than the highest level wait
+ * in an overflow list which is cascaded once per wheel turn.
+ * Occupied slots are marked in a bitmap, so the wheel jumps straight
+ * to the next occupied slot instead of ticking through empty milliseconds.
+ *
+ * Entries are intrusive: the links are embedded into the entry itself
+ * (e.g. into a HashMap node), so schedule/cancel/reschedule are O(1)
+ * without any allocation or lookup.
+ *
+ * Ex. of TimingWheel(level 0 of 8 slots, level 1 of 4 slots):
+ *
+ *  level 1:  [ 0-7 ][ 8-15 ][ 16-23 ][ 24-31 ]
+ *                      |
+ *                     (12)->(9)            cascaded when current reaches 8
+ *  level 0:  [0][1][2][3][4][5][6][7]
+ *                     ^  |
+ *               current (5)->(5)           due when current reaches 5
+ * =====================================================================*/
+
+//c++
+#include <cstddef> //size_t
+#include <cstdint> //int64_t, uint64_t
+
+//custom
+#include "expiry_index.hpp"
+
+constexpr size_t WHEEL_L0_BITS = 8;
+constexpr size_t WHEEL_LN_BITS = 6;
+constexpr size_t WHEEL_LEVELS = 5; //8 + 4 * 6 = 32 bits of ms, ~49 days
+constexpr size_t WHEEL_L0_SLOTS = 1 << WHEEL_L0_BITS;
+constexpr size_t WHEEL_LN_SLOTS = 1 << WHEEL_LN_BITS;
+constexpr size_t WHEEL_SLOTS = WHEEL_L0_SLOTS + (WHEEL_LEVELS - 1) * WHEEL_LN_SLOTS;
+
+class TimingWheel : public ExpiryIndex {
+private:
+	//level 0 takes the first WHEEL_L0_SLOTS slots, 
+	//every next level takes WHEEL_LN_SLOTS slots after it
+	ExpiryEntry *slots[WHEEL_SLOTS] = {};
+	uint64_t occupied[WHEEL_SLOTS / 64] = {}; //a bit per non-empty slot
+	ExpiryEntry *overflow = nullptr; //beyond the highest level
+	int64_t current; //every slot before it was already processed
+	size_t count = 0;
+
+	static size_t _slot(size_t level, size_t idx);
+	//returns the slot index if head is a slot and not a link of another entry
+	long _slot_of(ExpiryEntry **head) const;
+	void _link(ExpiryEntry **head, ExpiryEntry *entry);
+	void _unlink(ExpiryEntry *entry);
+
+	//puts the entry into the slot of its deadline relative to current
+	void _place(ExpiryEntry *entry);
+	//moves the entries of the higher levels' slots reached by current down
+	void _cascade();
+	//returns the closest time after current when an occupied slot is reached
+	int64_t _next_event() const;
+
+public:
+	TimingWheel(int64_t now);
+	TimingWheel(const TimingWheel &) = delete;
+	TimingWheel &operator=(const TimingWheel &) = delete;
+
+	void schedule(ExpiryEntry *entry, int64_t expire_at) override;
+	void cancel(ExpiryEntry *entry) override;
+	//the entry is scheduled while it's linked into a slot
+	bool is_scheduled(const ExpiryEntry *entry) const override;
+	ExpiryEntry *pop_expired(int64_t now) override;
+	//may be earlier than the actual deadline, e.g. the time of a cascade
+	int64_t next_deadline() const override;
+	size_t size() const override;
+	void clear() override;
+};
+
+#endif
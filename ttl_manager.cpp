@@ -1,49 +1,173 @@
 #include "ttl_manager.hpp"
 
-//c
-#include <time.h> //clock_gettime() for better performance and poll() compatibility
+//c++
+#include <climits> //INT_MAX
 
+//custom
+#include "epoch.hpp"
 
-static int get_monotonic_ms() {
-	struct timespec tv = {0, 0};
-	clock_gettime(CLOCK_MONOTONIC, &tv);
-	return int(tv.tv_sec) * 1000 + tv.tv_nsec / 1000000;
+TTLManager::TTLManager(KeyMap &hmap, LazyFree &lazy_free, 
+						ExpiryBackend backend, EvictionPolicy access_policy) 
+				: hmap(hmap), lazy_free(lazy_free), access_policy(access_policy) {
+	if (backend == WHEEL_EXPIRY)
+		index = std::make_unique<TimingWheel>(Clock::now_ms());
+	else
+		index = std::make_unique<TTLHeap>();
 }
 
-TTLManager::TTLManager(HashMap<std::string, std::string> &hmap) : hmap(hmap) {}
+//removes the key of an entry which has already left the index
+void TTLManager::_expire(ExpiryEntry *entry) {
+	//every entry of the index is embedded into a keyspace node
+	auto it = KeyMap::node_of(static_cast<KeyMeta &>(*entry));
+	std::shared_ptr<void> heavy = LazyFree::heavy_part(it.second());
+	hmap.erase(*it.first());
+	lazy_free.release(std::move(heavy));
+	stats.expired_keys++;
+}
 
-TTLStatus TTLManager::set(const std::string &key, int ttl_ms) {
+KeyMap::iterator TTLManager::lookup(const std::string &key) {
 	auto it = hmap.search(key);
+	if (it == hmap.end())
+		return it;
+	
+	KeyMeta &entry = it.meta();
+	if (index->is_scheduled(&entry) && entry.expire_at <= Clock::now_ms()) {
+		//the active cycle hasn't got to it yet
+		index->cancel(&entry);
+		_expire(&entry);
+		return hmap.end();
+	}
+	
+	entry.touch(access_policy);
+	return it;
+}
+
+bool TTLManager::erase(const std::string &key, bool lazy) {
+	auto it = lookup(key);
+	if (it == hmap.end())
+		return false;
+	
+	//the index mustn't keep a link to the freed node
+	index->cancel(&it.meta());
+	
+	//the value's last reference is taken before the node is freed
+	std::shared_ptr<void> heavy = lazy ? LazyFree::heavy_part(it.second()) : nullptr;
+	bool rc = (hmap.erase(key) != nullptr);
+	lazy_free.release(std::move(heavy));
+	
+	return rc;
+}
+
+void TTLManager::clear(bool lazy) {
+	//the entries are freed together with the nodes
+	index->clear();
+	backlog = false;
+	
+	if (!lazy) {
+		hmap.clear();
+		return;
+	}
+	
+	//the nodes are detached in O(1) and the whole old table is freed in the background
+	//once the read threads can't reach it anymore
+	auto old = std::make_shared<KeyMap>(hmap_base_capacity);
+	hmap.swap(*old);
+	Epoch::retire([this, old] { lazy_free.release(old); });
+}
+
+TTLStatus TTLManager::set(const std::string &key, int64_t expire_at) {
+	auto it = lookup(key);
 	if (it == hmap.end()) 
 		return EXPIRED; //the key has expired or doesn't exist
-		
-	ttl_heap.insert(it.first(), ttl_ms);
+	
+	return set(it, expire_at);
+}
+
+TTLStatus TTLManager::set(KeyMap::iterator it, int64_t expire_at) {
+	if (expire_at <= Clock::now_ms()) {
+		//a deadline in the past deletes the key right away
+		index->cancel(&it.meta());
+		_expire(&it.meta());
+		return OK;
+	}
+	
+	index->schedule(&it.meta(), expire_at);
+	
 	return OK;		
 }
 
 TTLStatus TTLManager::remove(const std::string &key) {
-	auto it = hmap.search(key);
-	if (it != hmap.end()) {
-		HeapStatus rc;
-		if ((rc = ttl_heap.remove(it.first())) == OK_H)
-			return OK;
+	return remove(lookup(key));
+}
+
+TTLStatus TTLManager::remove(KeyMap::iterator it) {
+	if (it != hmap.end() && index->is_scheduled(&it.meta())) {
+		index->cancel(&it.meta());
+		return OK;
 	}
 	
 	return EXPIRED; //the key has expired or doesn't exist
 }
 
-int TTLManager::get_ttl(const std::string &key) {
-	auto it = hmap.search(key);
+bool TTLManager::has_ttl(KeyMap::iterator it) const {
+	return index->is_scheduled(&it.meta());
+}
+
+int64_t TTLManager::get_ttl(const std::string &key) {
+	auto it = lookup(key);
 	if (it == hmap.end())
 		return EXPIRED; //the key has expired or doesn't exist
 	
-	return ttl_heap.get_ttl(it.first());
+	//the deadline is read right from the node, no second lookup is needed
+	const ExpiryEntry &entry = it.meta();
+	if (!index->is_scheduled(&entry))
+		return NOTTL;
+	
+	return entry.expire_at - Clock::now_ms();
 }
 
-void TTLManager::process_expired() {
-	int now = get_monotonic_ms();
-	while (!ttl_heap.empty() && ttl_heap.peek() <= now) {
-		const std::string &key = *ttl_heap.delete_min();
-		hmap.erase(key);
+void TTLManager::active_expire_cycle(int64_t budget_us) {
+	int64_t start = Clock::precise_us();
+	int64_t now = Clock::now_ms();
+	size_t removed = 0;
+	
+	stats.active_cycles++;
+	backlog = false;
+	
+	ExpiryEntry *entry;
+	while ((entry = index->pop_expired(now)) != nullptr) {
+		_expire(entry);
+		
+		//the clock is checked once in a while, since it isn't free either
+		if (++removed % ACTIVE_EXPIRE_CLOCK_CHECK == 0 
+						&& Clock::precise_us() - start >= budget_us) {
+			//let the clients be served and come back at the next iteration
+			backlog = true;
+			stats.timed_out_cycles++;
+			break;
+		}
 	}
 }
+
+int TTLManager::get_next_timeout() {
+	if (backlog)
+		return 0;
+	
+	int64_t deadline = index->next_deadline();
+	if (deadline < 0)
+		return -1; //no key has a ttl, nothing to wake up for
+	
+	int64_t timeout = deadline - Clock::now_ms();
+	if (timeout <= 0)
+		return 0;
+	
+	return timeout > INT_MAX ? INT_MAX : int(timeout);
+}
+
+const ExpiryStats &TTLManager::get_stats() const {
+	return stats;
+}
+
+size_t TTLManager::size() const {
+	return index->size();
+}
@@ -6,8 +6,12 @@
 #include <string>
 
 //custom
+#include "clock.hpp"
 #include "custom_heap.hpp"
-#include "hashmap.hpp"
+#include "expiry_index.hpp"
+#include "keyspace.hpp" //KeyMap
+#include "lazy_free.hpp"
+#include "timing_wheel.hpp"
 
 typedef enum : int {
 	EXPIRED = -2,
@@ -16,20 +20,70 @@ typedef enum : int {
 	OK = 1,
 } TTLStatus;
 
+//which structure orders the keys by their deadlines
+enum ExpiryBackend {
+	HEAP_EXPIRY, //TTLHeap, O(logN)
+	WHEEL_EXPIRY, //TimingWheel, O(1)
+};
+
+constexpr int64_t ACTIVE_EXPIRE_BUDGET_US = 1000; //time budget of one active expiry cycle
+constexpr size_t ACTIVE_EXPIRE_CLOCK_CHECK = 16; //keys removed between clock checks
+
+struct ExpiryStats {
+	size_t expired_keys = 0; //removed either by the active cycle or on access
+	size_t active_cycles = 0;
+	size_t timed_out_cycles = 0; //stopped by the budget with due keys left
+};
+
+/* TTLManager
+ * Keys are expired in two ways(expired big values are freed by LazyFree):
+ * - actively: the event loop runs a cycle which removes due keys
+ *   for at most ACTIVE_EXPIRE_BUDGET_US and is woken up by the next deadline,
+ *   or right at the next loop iteration if due keys were left behind
+ * - lazily: a due key which wasn't removed yet is removed when it's accessed */
 class TTLManager {
 private:
-	HashMap<std::string, std::string> &hmap;
-	TTLHeap ttl_heap;
+	KeyMap &hmap;
+	LazyFree &lazy_free;
+	std::unique_ptr<ExpiryIndex> index;
+	ExpiryStats stats;
+	bool backlog = false; //the last active cycle ran out of its budget
+	EvictionPolicy access_policy; //how lookups record accesses
+	
+	void _expire(ExpiryEntry *entry);
 	
 public:
-	TTLManager(HashMap<std::string, std::string> &hmap);
+	TTLManager(KeyMap &hmap, LazyFree &lazy_free, ExpiryBackend backend = HEAP_EXPIRY, 
+							EvictionPolicy access_policy = NO_EVICTION);
 	TTLManager(const TTLManager &) = delete;
 	TTLManager &operator=(const TTLManager &) = delete;
 
-	TTLStatus set(const std::string &key, int ttl_ms);
+	//returns the key's node or end() if it doesn't exist or has just expired,
+	//the access is recorded for the eviction policy
+	KeyMap::iterator lookup(const std::string &key);
+	//deletes the key together with its expiry entry, a big value is freed
+	//in the background if lazy, returns false if it doesn't exist or has just expired
+	bool erase(const std::string &key, bool lazy = false);
+	//deletes all the keys, in O(1) if lazy
+	void clear(bool lazy = false);
+	//expire_at is an absolute deadline in the Clock's monotonic ms
+	TTLStatus set(const std::string &key, int64_t expire_at);
 	TTLStatus remove(const std::string &key);
-	int get_ttl(const std::string &key);
-	void process_expired();
+	//the same for a node the caller has already looked up,
+	//set() with a past deadline deletes the node and invalidates it
+	TTLStatus set(KeyMap::iterator it, int64_t expire_at);
+	TTLStatus remove(KeyMap::iterator it);
+	bool has_ttl(KeyMap::iterator it) const;
+	//returns the remaining ms, or EXPIRED/NOTTL
+	int64_t get_ttl(const std::string &key);
+	
+	//removes due keys until there're no more of them or the budget runs out
+	void active_expire_cycle(int64_t budget_us = ACTIVE_EXPIRE_BUDGET_US);
+	//returns ms till the next cycle is needed, -1 if no key has a ttl
+	int get_next_timeout();
+	
+	const ExpiryStats &get_stats() const;
+	size_t size() const; //number of keys with a ttl
 };
 
 #endif
@@ -0,0 +1,131 @@
+#include "worker_pool.hpp"
+
+//c
+#include <errno.h>
+#include <string.h> //strerror()
+#include <sys/eventfd.h>
+#include <unistd.h> //read(), write(), close()
+
+//c++
+#include <cstdint> //uint64_t
+#include <stdexcept> //runtime_error
+#include <utility> //std::move
+
+WorkerPool::~WorkerPool() {
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		stop = true;
+	}
+	
+	cv.notify_all();
+	for (std::thread &worker : workers)
+		worker.join();
+	
+	if (wake_fd >= 0)
+		close(wake_fd);
+}
+
+void WorkerPool::_run() {
+	std::unique_lock<std::mutex> lock(mtx);
+	while (true) {
+		cv.wait(lock, [this] { return stop || !jobs.empty(); });
+		if (stop)
+			return;
+		
+		Job job = std::move(jobs.front());
+		jobs.pop_front();
+		
+		lock.unlock();
+		job.result = job.work();
+		lock.lock();
+		
+		//one wake up for the jobs which finish before the event loop gets to them
+		bool wake = finished.empty();
+		finished.push_back(std::move(job));
+		if (wake) {
+			uint64_t one = 1;
+			while (write(wake_fd, &one, sizeof(one)) < 0 && errno == EINTR);
+		}
+	}
+}
+
+void WorkerPool::start(size_t threads) {
+	if (threads == 0)
+		return;
+	
+	wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (wake_fd < 0)
+		throw std::runtime_error(std::string("can't create the eventfd of the workers: ") + strerror(errno));
+	
+	for (size_t i = 0; i < threads; i++)
+		workers.emplace_back(&WorkerPool::_run, this);
+}
+
+bool WorkerPool::is_enabled() const {
+	return !workers.empty();
+}
+
+void WorkerPool::submit(std::function<std::string()> work, 
+							std::function<void(const std::string &)> done) {
+	submitted++;
+	pending++;
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		jobs.push_back({std::move(work), std::move(done), ""});
+	}
+	
+	cv.notify_one();
+}
+
+WorkerStats WorkerPool::get_stats() const {
+	WorkerStats stats;
+	stats.threads = workers.size();
+	stats.jobs = submitted;
+	stats.pending_jobs = pending;
+	
+	return stats;
+}
+
+std::vector<size_t> WorkerPool::get_fds() const {
+	if (wake_fd < 0)
+		return {};
+	
+	return {size_t(wake_fd)};
+}
+
+bool WorkerPool::owns(int fd) const {
+	return wake_fd >= 0 && fd == wake_fd;
+}
+
+bool WorkerPool::is_readable(int) const {
+	return true;
+}
+
+bool WorkerPool::is_writable(int) const {
+	return false;
+}
+
+bool WorkerPool::is_closing(int) const {
+	return false;
+}
+
+void WorkerPool::handle_read(int) {
+	uint64_t count = 0;
+	while (read(wake_fd, &count, sizeof(count)) < 0 && errno == EINTR);
+	
+	std::deque<Job> ready;
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		ready.swap(finished);
+	}
+	
+	//the jobs, and what their work has captured, are destroyed here, on the event loop
+	for (Job &job : ready) {
+		pending--;
+		job.done(job.result);
+	}
+}
+
+void WorkerPool::handle_write(int) {}
+
+void WorkerPool::close_link(int) {}
@@ -0,0 +1,85 @@
+#ifndef __WORKER_POOL_HPP__
+#define __WORKER_POOL_HPP__
+
+/* =====================================================================
+ * WorkerPool runs the expensive part of commands(e.g. a long range
+ * of a big sorted set) off the event loop, so the other clients
+ * keep being served meanwhile.
+ *
+ * A job is a pair of functions:
+ *   - work() runs on a worker thread and returns the result(a reply).
+ *     It has to work on what it has captured, e.g. a snapshot of its input,
+ *     and never touch the keyspace, which the event loop keeps changing
+ *   - done(result) runs back on the event loop, e.g. to hand the reply
+ *     over to the connection
+ * The workers wake the event loop through an eventfd, which is polled
+ * with the connections(LinkOwner). A finished job is destroyed on the
+ * event loop as well, so whatever work() has captured is released there.
+ * =====================================================================*/
+
+//c++
+#include <condition_variable>
+#include <cstddef> //size_t
+#include <deque>
+#include <functional> //std::function
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//custom
+#include "link_owner.hpp"
+
+constexpr size_t WORKER_MAX_THREADS = 32;
+
+struct WorkerStats {
+	size_t threads = 0;
+	size_t jobs = 0; //submitted since the start
+	size_t pending_jobs = 0; //queued or running
+};
+
+class WorkerPool : public LinkOwner {
+private:
+	struct Job {
+		std::function<std::string()> work;
+		std::function<void(const std::string &)> done;
+		std::string result;
+	};
+
+	std::deque<Job> jobs; //waiting for a worker
+	std::deque<Job> finished; //waiting for the event loop
+	std::mutex mtx; //guards jobs, finished and stop
+	std::condition_variable cv;
+	bool stop = false;
+	int wake_fd = -1; //eventfd, readable once a job is finished
+	size_t submitted = 0;
+	size_t pending = 0;
+	std::vector<std::thread> workers;
+
+	void _run();
+
+public:
+	WorkerPool() = default;
+	//drops the jobs which haven't started, waits for the running ones
+	~WorkerPool();
+	WorkerPool(const WorkerPool &) = delete;
+	WorkerPool &operator=(const WorkerPool &) = delete;
+
+	//throws runtime_error if the eventfd can't be created
+	void start(size_t threads);
+	bool is_enabled() const;
+	void submit(std::function<std::string()> work, std::function<void(const std::string &)> done);
+	WorkerStats get_stats() const;
+
+	std::vector<size_t> get_fds() const override;
+	bool owns(int fd) const override;
+	bool is_readable(int fd) const override;
+	bool is_writable(int fd) const override;
+	bool is_closing(int fd) const override;
+	//runs done() of the finished jobs
+	void handle_read(int fd) override;
+	void handle_write(int fd) override;
+	void close_link(int fd) override;
+};
+
+#endif